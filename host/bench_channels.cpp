@@ -0,0 +1,80 @@
+#include "host_commands.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "LittleFS.h"
+#include "fake_btstack.h"
+#include "host_stream.h"
+#include "audio/audio_pipeline.h"
+#include "audio/wav_source.h"
+
+// モノラルのWAVを STEREO / JOINT_STEREO / MONO でエンコードして比べます。
+//  - 読み込み・変換・エンコードにかかる1フレームあたりの時間
+//  - ペイロード(kbit/s)とパケット数
+// MONO ではエンコーダに1チャンネルだけを渡し、ビットプールは SBC_MONO_MAX_BITPOOL までにします。
+
+typedef struct
+{
+    const char *name;
+    btstack_sbc_channel_mode_t channel_mode;
+    uint32_t wav_rate;
+} bench_channel_case_t;
+
+static double bench_encode_us(int num_frames)
+{
+    static uint8_t sbc_frame[SBC_STORAGE_SIZE];
+    uint64_t start_ns = host_time_ns();
+    for (int i = 0; i < num_frames; i++)
+    {
+        wav_source_service();
+        audio_pipeline_encode_frame(sbc_frame, sizeof(sbc_frame));
+    }
+    return (host_time_ns() - start_ns) / 1000.0 / num_frames;
+}
+
+int bench_channels_main(int argc, char **argv)
+{
+    int seconds = 10;
+    if (argc > 1)
+        seconds = atoi(argv[1]);
+    static const bench_channel_case_t cases[] = {
+        {"stereo", SBC_CHANNEL_MODE_STEREO, 48000},
+        {"joint stereo", SBC_CHANNEL_MODE_JOINT_STEREO, 48000},
+        {"mono", SBC_CHANNEL_MODE_MONO, 48000},
+        {"mono, 44.1 kHz input", SBC_CHANNEL_MODE_MONO, 44100},
+    };
+    LittleFS.setRoot("");
+    static a2dp_media_sending_context_t context;
+    double stereo_us = 0, stereo_bytes = 0;
+    int result = 0;
+    printf("mono 8-bit WAV, SBC 48 kHz, 16 blocks, 8 subbands, negotiated max bitpool 53 (%d s):\n", seconds);
+    for (const bench_channel_case_t &c : cases)
+    {
+        const char *path = "channels_input.wav";
+        if (host_write_test_wav(path, c.wav_rate, seconds) != 0 || wav_source_open(LittleFS, path, true) != 0)
+            return 1;
+        media_codec_configuration_sbc_t configuration = {
+            0, c.channel_mode == SBC_CHANNEL_MODE_MONO ? 1 : 2, 48000, 16, 8, 2, 53, c.channel_mode, SBC_ALLOCATION_METHOD_SNR};
+        audio_pipeline_set_mode(AUDIO_PIPELINE_SINGLE_CORE);
+        audio_pipeline_init_encoder(&configuration);
+        double encode_us = bench_encode_us(seconds * 48000 / 128);
+
+        audio_pipeline_init_encoder(&configuration);
+        host_stream_run(&context, seconds, audio_pipeline_loop);
+        bitpool_control_stats_t stats;
+        audio_pipeline_get_bitpool_stats(&stats);
+        double bytes = (double)fake_a2dp_sink.payload_bytes / seconds;
+        if (c.channel_mode == SBC_CHANNEL_MODE_STEREO)
+        {
+            stereo_us = encode_us;
+            stereo_bytes = bytes;
+        }
+        printf("  %-22s bitpool %2u, read + convert + encode %7.3f us/frame (%5.1f%%), payload %6.1f kbit/s (%5.1f%%), %5.1f packets/s, frame errors %u\n",
+               c.name, stats.max_bitpool, encode_us, 100.0 * encode_us / stereo_us, bytes * 8 / 1000, 100.0 * bytes / stereo_bytes,
+               (double)fake_a2dp_sink.packets / seconds, fake_a2dp_sink.frame_errors);
+        result |= fake_a2dp_sink.frame_errors == 0 && fake_a2dp_sink.sbc_frames > 0 ? 0 : 1;
+        wav_source_close();
+    }
+    return result;
+}
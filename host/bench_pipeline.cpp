@@ -0,0 +1,260 @@
+#include "host_commands.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "LittleFS.h"
+#include "fake_btstack.h"
+#include "host_stream.h"
+#include "audio/audio_pipeline.h"
+#include "audio/pcm_convert.h"
+#include "audio/wav_source.h"
+
+// オーディオパイプラインのベンチマークです。
+//  1. ステージ別: 読み込み / 16bitステレオへの変換 / SBCエンコード / sbc_storage への詰め込み を1フレームずつ計測
+//  2. パケット単位のエンコード: audio_pipeline_encode_frames() で sbc_storage に直接書く場合と、エンコーダのバッファからコピーする場合
+//  3. 音量: 変換のカーネルとゲイン付きのカーネル(音量を変えている途中のブロック)の1サンプルあたりの時間
+//  4. 通し: 仮想時間で a2dp_demo_audio_timeout_handler を回し、CAN_SEND_NOW で a2dp_demo_send_media_packet を呼ぶ
+
+static const char *BENCH_WAV_FILE_NAME = "bench_input.wav";
+
+// 現在の main.cpp の構成(48kHz ステレオ, 16ブロック, 8サブバンド, SNR, ビットプール53)
+static const media_codec_configuration_sbc_t bench_configuration = {
+    0, 2, 48000, 16, 8, 2, 53, SBC_CHANNEL_MODE_STEREO, SBC_ALLOCATION_METHOD_SNR};
+
+typedef struct
+{
+    const char *name;
+    uint64_t total_ns;
+} bench_stage_t;
+
+static void bench_stages(int seconds)
+{
+    enum
+    {
+        STAGE_READ,
+        STAGE_CONVERT,
+        STAGE_ENCODE,
+        STAGE_PACK,
+        NUM_STAGES
+    };
+    bench_stage_t stages[NUM_STAGES] = {{"read", 0}, {"convert", 0}, {"encode", 0}, {"pack", 0}};
+
+    static uint8_t wav_data[256 * 6] __attribute__((aligned(4)));
+    static int16_t pcm_frame[256 * NUM_CHANNELS] __attribute__((aligned(4)));
+    const wav_format_t *format = wav_source_format();
+    pcm_convert_func_t convert = pcm_convert_select(format, NUM_CHANNELS);
+    static uint8_t sbc_storage[SBC_STORAGE_SIZE];
+    int sbc_storage_count = 0;
+
+    int num_samples = btstack_sbc_encoder_num_audio_frames();
+    int num_frames = seconds * current_sample_rate / num_samples;
+    uint64_t sbc_bytes = 0;
+    for (int i = 0; i < num_frames; i++)
+    {
+        wav_source_service();
+        uint64_t t0 = host_time_ns();
+        // 16bitステレオは produce_audio() と同じく直接読み込む(変換は0)
+        wav_source_read(convert ? wav_data : (uint8_t *)pcm_frame, num_samples * format->block_align);
+        uint64_t t1 = host_time_ns();
+        if (convert)
+            convert(wav_data, pcm_frame, num_samples);
+        uint64_t t2 = host_time_ns();
+        btstack_sbc_encoder_process_data(pcm_frame);
+        uint64_t t3 = host_time_ns();
+        int sbc_frame_size = btstack_sbc_encoder_sbc_buffer_length();
+        if (sbc_storage_count + sbc_frame_size > SBC_STORAGE_SIZE - 1)
+            sbc_storage_count = 0;
+        memcpy(&sbc_storage[1 + sbc_storage_count], btstack_sbc_encoder_sbc_buffer(), sbc_frame_size);
+        sbc_storage_count += sbc_frame_size;
+        uint64_t t4 = host_time_ns();
+
+        stages[STAGE_READ].total_ns += t1 - t0;
+        stages[STAGE_CONVERT].total_ns += t2 - t1;
+        stages[STAGE_ENCODE].total_ns += t3 - t2;
+        stages[STAGE_PACK].total_ns += t4 - t3;
+        sbc_bytes += sbc_frame_size;
+    }
+
+    uint64_t total_ns = 0;
+    printf("stage breakdown (%d frames of %d samples):\n", num_frames, num_samples);
+    for (int i = 0; i < NUM_STAGES; i++)
+    {
+        total_ns += stages[i].total_ns;
+        printf("  %-8s %8.3f us/frame\n", stages[i].name, stages[i].total_ns / 1000.0 / num_frames);
+    }
+    printf("  %-8s %8.3f us/frame\n", "total", total_ns / 1000.0 / num_frames);
+    printf("  throughput: %.0f SBC frames/s, %.0f SBC bytes/s (realtime needs %d frames/s)\n",
+           num_frames * 1e9 / total_ns, sbc_bytes * 1e9 / total_ns, current_sample_rate / num_samples);
+}
+
+typedef struct
+{
+    uint64_t elapsed_ns;
+    uint64_t sbc_bytes;
+    uint32_t frames;
+    uint32_t calls;
+    uint32_t hash;
+} bench_encode_result_t;
+
+// 1パケット分(frames_per_packet フレーム)ずつ sbc_storage にエンコードする。ファイルの先頭とエンコーダの初期状態から始める。
+static bench_encode_result_t bench_encode_packets(const char *path, int seconds, int frames_per_packet, bool zero_copy)
+{
+    bench_encode_result_t result = {};
+    static uint8_t sbc_storage[SBC_STORAGE_SIZE];
+    wav_source_close();
+    wav_source_open(LittleFS, path, true);
+    audio_pipeline_set_zero_copy(zero_copy);
+    audio_pipeline_init_encoder(&bench_configuration);
+    int num_samples = btstack_sbc_encoder_num_audio_frames();
+    int num_packets = seconds * current_sample_rate / num_samples / frames_per_packet;
+    result.hash = 2166136261u;
+    for (int i = 0; i < num_packets; i++)
+    {
+        wav_source_service();
+        int encoded_frames;
+        uint64_t t0 = host_time_ns();
+        int length = audio_pipeline_encode_frames(&sbc_storage[1], SBC_STORAGE_SIZE - 1, frames_per_packet, &encoded_frames);
+        result.elapsed_ns += host_time_ns() - t0;
+        result.calls++;
+        result.frames += encoded_frames;
+        result.sbc_bytes += length;
+        for (int j = 1; j <= length; j++)
+            result.hash = (result.hash ^ sbc_storage[j]) * 16777619u;
+    }
+    audio_pipeline_set_zero_copy(true);
+    return result;
+}
+
+static void bench_zero_copy(const char *path, int seconds)
+{
+    int frame_length = btstack_sbc_encoder_sbc_buffer_length();
+    payload_plan_t plan;
+    payload_planner_plan(&plan, PAYLOAD_PLANNER_2M, 1011, frame_length);
+    bench_encode_result_t copy = bench_encode_packets(path, seconds, plan.frames_per_packet, false);
+    bench_encode_result_t direct = bench_encode_packets(path, seconds, plan.frames_per_packet, true);
+    double copy_us = copy.elapsed_ns / 1000.0 / copy.frames;
+    double direct_us = direct.elapsed_ns / 1000.0 / direct.frames;
+    printf("read + convert + encode into the payload (%u frames per packet, one call per packet):\n", plan.frames_per_packet);
+    printf("  copy from encoder buffer %8.3f us/frame, %u bytes copied (%.0f bytes/s of audio)\n", copy_us,
+           (unsigned)copy.sbc_bytes, (double)copy.sbc_bytes / seconds);
+    printf("  encode into payload      %8.3f us/frame, 0 bytes copied, saved %.3f us/frame (%.1f%%)\n", direct_us,
+           copy_us - direct_us, (copy_us - direct_us) * 100 / copy_us);
+    printf("  encoder calls: %u per second instead of %u, output %s (hash %08x)\n", (unsigned)(direct.calls / seconds),
+           (unsigned)(direct.frames / seconds), copy.hash == direct.hash && copy.frames == direct.frames ? "identical" : "DIFFERENT",
+           (unsigned)direct.hash);
+}
+
+typedef struct
+{
+    const char *name;
+    pcm_convert_func_t convert; // NULL は変換しない(produce_audio() はエンコーダのバッファに直接読み込む)
+    pcm_convert_gain_func_t convert_gain;
+    int block_align;
+    int output_channels;
+} bench_volume_kernel_t;
+
+static const bench_volume_kernel_t bench_volume_kernels[] = {
+    {"u8 mono", pcm_convert_u8_mono, pcm_convert_gain_u8_mono, 1, 2},
+    {"u8 stereo", pcm_convert_u8_stereo, pcm_convert_gain_u8_stereo, 2, 2},
+    {"s16 mono", pcm_convert_s16_mono, pcm_convert_gain_s16_mono, 2, 2},
+    {"s16 stereo", NULL, pcm_convert_gain_s16_stereo, 4, 2},
+    {"s24 mono", pcm_convert_s24_mono, pcm_convert_gain_s24_mono, 3, 2},
+    {"s24 stereo", pcm_convert_s24_stereo, pcm_convert_gain_s24_stereo, 6, 2},
+    {"u8 mono -> mono", pcm_convert_mono_u8_mono, pcm_convert_gain_mono_u8_mono, 1, 1},
+    {"u8 stereo -> mono", pcm_convert_mono_u8_stereo, pcm_convert_gain_mono_u8_stereo, 2, 1},
+    {"s16 mono -> mono", NULL, pcm_convert_gain_mono_s16_mono, 2, 1},
+    {"s16 stereo -> mono", pcm_convert_mono_s16_stereo, pcm_convert_gain_mono_s16_stereo, 4, 1},
+    {"s24 mono -> mono", pcm_convert_mono_s24_mono, pcm_convert_gain_mono_s24_mono, 3, 1},
+    {"s24 stereo -> mono", pcm_convert_mono_s24_stereo, pcm_convert_gain_mono_s24_stereo, 6, 1},
+};
+
+// 1ブロック(1フレーム分のサンプル)の変換の時間(ns/sample)。ゲイン付きは毎回 1 倍から半分まで変える。
+static double bench_volume_kernel(const bench_volume_kernel_t *kernel, int num_samples, bool gain)
+{
+    static uint8_t src[256 * 6] __attribute__((aligned(4)));
+    static int16_t dst[256 * NUM_CHANNELS] __attribute__((aligned(4)));
+    for (size_t i = 0; i < sizeof(src); i++)
+        src[i] = (uint8_t)(i * 37);
+    const int iterations = 200000;
+    uint32_t level = PCM_GAIN_LEVEL(PCM_GAIN_UNITY);
+    int32_t step = pcm_gain_step(level, PCM_GAIN_UNITY / 2, num_samples);
+    uint64_t start_ns = host_time_ns();
+    for (int i = 0; i < iterations; i++)
+    {
+        if (gain)
+            kernel->convert_gain(src, dst, num_samples, level, step);
+        else if (kernel->convert)
+            kernel->convert(src, dst, num_samples);
+        // 最適化でループが消えないようにする
+        __asm__ volatile("" : : "r"(dst) : "memory");
+    }
+    return (double)(host_time_ns() - start_ns) / iterations / num_samples;
+}
+
+static void bench_volume(void)
+{
+    int num_samples = btstack_sbc_encoder_num_audio_frames();
+    printf("volume fused into the conversion kernel (%d samples per call, ramping):\n", num_samples);
+    printf("  %-20s %10s %10s %10s\n", "kernel", "plain", "with gain", "gain cost");
+    for (const bench_volume_kernel_t &kernel : bench_volume_kernels)
+    {
+        double plain = bench_volume_kernel(&kernel, num_samples, false);
+        double gain = bench_volume_kernel(&kernel, num_samples, true);
+        printf("  %-20s %7.3f ns %7.3f ns %+7.3f ns/sample%s\n", kernel.name, plain, gain, gain - plain,
+               kernel.convert ? "" : " (plain reads into the encoder buffer)");
+    }
+}
+
+static void bench_end_to_end(int seconds)
+{
+    static a2dp_media_sending_context_t context;
+    wav_source_reset_stats();
+    // loop() の代わりに先読みリングを補充する
+    uint64_t elapsed_ns = host_stream_run(&context, seconds, audio_pipeline_loop);
+    wav_source_stats_t stats;
+    wav_source_get_stats(&stats);
+
+    printf("end to end (%d s of virtual time):\n", seconds);
+    printf("  packets: %u (%.1f packets/s), SBC frames: %u (%.1f frames/s)\n",
+           fake_a2dp_sink.packets, (double)fake_a2dp_sink.packets / seconds,
+           fake_a2dp_sink.sbc_frames, (double)fake_a2dp_sink.sbc_frames / seconds);
+    printf("  payload: %.0f bytes/s (%.1f kbit/s)\n",
+           (double)fake_a2dp_sink.payload_bytes / seconds, fake_a2dp_sink.payload_bytes * 8.0 / 1000.0 / seconds);
+    printf("  rtp timestamp span: %u samples\n", fake_a2dp_sink.last_timestamp - fake_a2dp_sink.first_timestamp);
+    printf("  timer + send: %.3f ms per second of audio (%.0f SBC frames/s possible)\n",
+           elapsed_ns / 1e6 / seconds, fake_a2dp_sink.sbc_frames * 1e9 / elapsed_ns);
+    printf("  prefetch: min level %u/%u bytes, %u refills, worst refill %u us, underrun %u bytes\n",
+           stats.min_level, stats.capacity, stats.refills, stats.worst_refill_us, stats.underrun_bytes);
+}
+
+int bench_pipeline_main(int argc, char **argv)
+{
+    const char *path = BENCH_WAV_FILE_NAME;
+    int seconds = 10;
+    if (argc > 1)
+        path = argv[1];
+    if (argc > 2)
+        seconds = atoi(argv[2]);
+    if (argc <= 1 && host_write_test_wav(path, current_sample_rate, seconds) != 0)
+    {
+        printf("failed to write %s\n", path);
+        return 1;
+    }
+    LittleFS.setRoot("");
+    if (wav_source_open(LittleFS, path, true) != 0)
+        return 1;
+    audio_pipeline_init_encoder(&bench_configuration);
+    printf("SBC: %d Hz, %d blocks, %d subbands, bitpool %d, %d bytes/frame\n",
+           bench_configuration.sampling_frequency, bench_configuration.block_length,
+           bench_configuration.subbands, bench_configuration.max_bitpool_value,
+           btstack_sbc_encoder_sbc_buffer_length());
+
+    bench_stages(seconds);
+    bench_zero_copy(path, seconds);
+    bench_volume();
+    bench_end_to_end(seconds);
+    wav_source_close();
+    return 0;
+}
@@ -0,0 +1,138 @@
+#include "host_commands.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "audio/resampler.h"
+
+// サンプリングレート変換の確認とベンチマークです。
+//  1. 1kHz のサイン波を変換し、出力の周波数でのサイン波に当てはめた残差から SNR を求める
+//  2. 出力1サンプルあたりの時間(x86 ではサイクル数も)を計測する
+// M0+ での目安として、出力1サンプルあたりの積和の回数も表示します。
+
+static resampler_t bench_resampler;
+static uint32_t bench_input_rate;
+static uint64_t bench_input_samples;
+static double bench_frequency;
+
+static int bench_sine_source(int16_t *pcm_buffer, int num_samples)
+{
+    for (int i = 0; i < num_samples; i++)
+    {
+        double v = 0.5 * sin(2 * M_PI * bench_frequency * bench_input_samples / bench_input_rate);
+        int16_t s = (int16_t)lrint(32767 * v);
+        pcm_buffer[i * 2] = s;
+        pcm_buffer[i * 2 + 1] = (int16_t)-s;
+        bench_input_samples++;
+    }
+    return 0;
+}
+
+static int bench_zero_source(int16_t *pcm_buffer, int num_samples)
+{
+    memset(pcm_buffer, 0x11, num_samples * 2 * sizeof(int16_t));
+    return 0;
+}
+
+static inline uint64_t bench_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// 出力を a*sin + b*cos に最小二乗で当てはめ、残差との比を dB で返す。
+static double bench_snr(const int16_t *pcm, int num_samples, uint32_t output_rate, int channel)
+{
+    double ss = 0, sc = 0, cc = 0, ys = 0, yc = 0;
+    for (int n = 0; n < num_samples; n++)
+    {
+        double w = 2 * M_PI * bench_frequency * n / output_rate;
+        double s = sin(w), c = cos(w), y = pcm[n * 2 + channel];
+        ss += s * s;
+        sc += s * c;
+        cc += c * c;
+        ys += y * s;
+        yc += y * c;
+    }
+    double det = ss * cc - sc * sc;
+    double a = (ys * cc - yc * sc) / det;
+    double b = (yc * ss - ys * sc) / det;
+    double signal = 0, noise = 0;
+    for (int n = 0; n < num_samples; n++)
+    {
+        double w = 2 * M_PI * bench_frequency * n / output_rate;
+        double fit = a * sin(w) + b * cos(w);
+        double e = pcm[n * 2 + channel] - fit;
+        signal += fit * fit;
+        noise += e * e;
+    }
+    return 10 * log10(signal / (noise > 0 ? noise : 1e-9));
+}
+
+static int bench_ratio(uint32_t input_rate, uint32_t output_rate)
+{
+    static int16_t pcm[48000 * 2] __attribute__((aligned(4)));
+    if (resampler_configure(&bench_resampler, input_rate, output_rate, 2) != 0)
+    {
+        printf("  %u -> %u: not supported\n", input_rate, output_rate);
+        return 1;
+    }
+
+    // 品質: 始めのフィルタの立ち上がりを捨てて1秒分を見る。
+    bench_input_rate = input_rate;
+    bench_input_samples = 0;
+    bench_frequency = 1000;
+    resampler_process(&bench_resampler, pcm, 128, bench_sine_source);
+    resampler_process(&bench_resampler, pcm, output_rate, bench_sine_source);
+    double snr_left = bench_snr(pcm, output_rate, output_rate, 0);
+    double snr_right = bench_snr(pcm, output_rate, output_rate, 1);
+    // 出力 128 + output_rate サンプルに対して読み込んだ入力の数(ブロック単位で先読みする分だけ多い)
+    double consumed = (double)bench_input_samples / (128 + output_rate) * output_rate;
+
+    // 速さ: 入力を作る時間を除くため、中身を作らない入力で回す。
+    resampler_reset(&bench_resampler);
+    const int num_frames = 20000;
+    uint64_t start_ns = host_time_ns();
+    uint64_t start_cycles = bench_cycles();
+    for (int i = 0; i < num_frames; i++)
+    {
+        resampler_process(&bench_resampler, pcm, 128, bench_zero_source);
+        __asm__ volatile("" : : "r"(pcm) : "memory");
+    }
+    uint64_t elapsed_cycles = bench_cycles() - start_cycles;
+    uint64_t elapsed_ns = host_time_ns() - start_ns;
+    double samples = (double)num_frames * 128;
+
+    printf("  %5u -> %5u (%u/%u): SNR L %.1f dB R %.1f dB, input %.0f samples per %u output\n",
+           input_rate, output_rate, bench_resampler.up, bench_resampler.down, snr_left, snr_right, consumed, output_rate);
+    printf("    %.2f ns/sample", elapsed_ns / samples);
+    if (elapsed_cycles)
+        printf(", %.1f host cycles/sample", elapsed_cycles / samples);
+    printf(", %.2f%% of one host core in realtime\n", elapsed_ns / samples * output_rate / 1e7);
+    // M0+ の目安: 1回の積和が ldrsh x2 + muls + adds で約5サイクル、1サンプルのループの外側が約40サイクル
+    int m0_cycles = RESAMPLER_TAPS * 2 * 5 + 40;
+    printf("    M0+ estimate ~%d cycles/sample, %.1f%% of a 133 MHz core\n", m0_cycles, m0_cycles * (double)output_rate / 133e6 * 100);
+    return snr_left > 60 && snr_right > 60 ? 0 : 1;
+}
+
+int bench_resampler_main(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+    printf("resampler: %d taps x 2 channels = %d multiply-accumulates per output sample, %u bytes of coefficients\n",
+           RESAMPLER_TAPS, RESAMPLER_TAPS * 2, (unsigned)sizeof(bench_resampler.coefficients));
+    int result = 0;
+    result |= bench_ratio(44100, 48000);
+    result |= bench_ratio(48000, 44100);
+    result |= bench_ratio(32000, 48000);
+    result |= bench_ratio(22050, 44100);
+    return result;
+}
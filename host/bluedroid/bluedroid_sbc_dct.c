@@ -0,0 +1,2 @@
+// bluedroid SBC エンコーダ本体をホストでビルドします(ファームウェアでは arduino-pico のライブラリに含まれています)。
+#include "sbc_dct.c"
@@ -0,0 +1,2 @@
+// btstack_min() などのユーティリティをホストでビルドします。
+#include "btstack_util.c"
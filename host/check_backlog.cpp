@@ -0,0 +1,183 @@
+#include "host_commands.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <thread>
+
+#include "LittleFS.h"
+#include "fake_btstack.h"
+#include "host_stream.h"
+#include "audio/audio_pipeline.h"
+#include "audio/sbc_frame_queue.h"
+#include "audio/wav_source.h"
+
+// 溜まったサンプルの上限(audio_pipeline_set_backlog_policy)を確かめます。
+// CAN_SEND_NOW が CHECK_STALL_MS の間来ない(電波が途切れた)リンクでストリーミングし、
+//  - 上限なし: 途切れた分をまとめて送り返すので、送ったパケットのRTPタイムスタンプが実時間から大きく遅れる
+//  - 上限あり: 遅れは上限 + 1パケット程度に収まり、超えた分は捨てたフレームとして数えられる
+// ことと、どの場合もRTPタイムスタンプ + 組み立て中のパケット + 溜まったサンプルが実時間のサンプル数と一致することを確認します。
+// デュアルコアモードでは、コア1を止めてキューが空になったときのアンダーランも数えます。
+
+static const uint32_t CHECK_STALL_START_MS = 3000;
+static const uint32_t CHECK_STALL_MS = 2000;
+static const uint32_t CHECK_PRODUCER_STALL_START_MS = 7000;
+static const uint32_t CHECK_PRODUCER_STALL_MS = 200;
+static const int CHECK_SECONDS = 10;
+
+static a2dp_media_sending_context_t check_context;
+static std::atomic<bool> check_core1_running;
+static std::atomic<bool> check_producer_paused;
+static bool check_pause_producer;
+
+typedef struct
+{
+    uint32_t max_lag_ms;      // 送ったパケットのRTPタイムスタンプの、実時間からの遅れの最大値
+    uint32_t recovery_ms;     // 途切れが終わってから、溜まったサンプルが 1 パケット分以下に戻るまで
+    uint32_t max_burst;       // 途切れの後、10ms の間に送ったパケット数の最大値
+    uint32_t mismatches;      // サンプル数の勘定が合わなかった回数
+    uint32_t frame_errors;
+    audio_backlog_stats_t stats;
+} check_result_t;
+
+static check_result_t check_result;
+static uint32_t check_packets;
+static uint32_t check_window_packets;
+
+static void check_each_ms(void)
+{
+    uint32_t now = fake_btstack_time_ms() - 1;
+    bool stalled = now >= CHECK_STALL_START_MS && now < CHECK_STALL_START_MS + CHECK_STALL_MS;
+    fake_btstack_set_can_send_now_delay_ms(stalled ? CHECK_STALL_MS * 2 : 2);
+
+    const media_clock_t *clock = &check_context.clock;
+    uint32_t samples_per_frame = 128;
+    if (fake_a2dp_sink.packets != check_packets)
+    {
+        // 最後に送ったパケットの最初のサンプルの、実時間からの遅れ
+        uint32_t lag = (uint32_t)clock->samples_due - fake_a2dp_sink.last_timestamp;
+        uint32_t lag_ms = (uint32_t)((uint64_t)lag * 1000 / current_sample_rate);
+        if (lag_ms > check_result.max_lag_ms)
+            check_result.max_lag_ms = lag_ms;
+        check_window_packets += fake_a2dp_sink.packets - check_packets;
+        check_packets = fake_a2dp_sink.packets;
+    }
+    if (now % 10 == 0)
+    {
+        if (now > CHECK_STALL_START_MS + CHECK_STALL_MS && check_window_packets > check_result.max_burst)
+            check_result.max_burst = check_window_packets;
+        check_window_packets = 0;
+    }
+    uint32_t accounted = check_context.rtp_timestamp + check_context.sbc_storage_frames * samples_per_frame + check_context.samples_ready;
+    if (accounted != (uint32_t)clock->samples_due)
+        check_result.mismatches++;
+    if (now > CHECK_STALL_START_MS + CHECK_STALL_MS && check_result.recovery_ms == 0 &&
+        check_context.samples_ready <= 8 * samples_per_frame)
+        check_result.recovery_ms = now - (CHECK_STALL_START_MS + CHECK_STALL_MS);
+
+    if (audio_pipeline_get_mode() == AUDIO_PIPELINE_SINGLE_CORE)
+    {
+        audio_pipeline_loop();
+        return;
+    }
+    bool paused = check_pause_producer && now >= CHECK_PRODUCER_STALL_START_MS &&
+                  now < CHECK_PRODUCER_STALL_START_MS + CHECK_PRODUCER_STALL_MS;
+    check_producer_paused = paused;
+    if (paused)
+        return;
+    uint32_t level, max_level, underruns;
+    do
+    {
+        audio_pipeline_get_queue_stats(&level, &max_level, &underruns);
+    } while (level < SBC_FRAME_QUEUE_SLOTS / 2);
+}
+
+static check_result_t check_run(const char *path, audio_pipeline_mode_t mode, audio_backlog_policy_t policy, uint32_t max_ms)
+{
+    static const media_codec_configuration_sbc_t configuration = {
+        0, 2, 48000, 16, 8, 2, 53, SBC_CHANNEL_MODE_JOINT_STEREO, SBC_ALLOCATION_METHOD_LOUDNESS};
+    check_result = {};
+    check_packets = 0;
+    check_window_packets = 0;
+    check_pause_producer = mode == AUDIO_PIPELINE_DUAL_CORE;
+    audio_pipeline_set_mode(mode);
+    audio_pipeline_set_backlog_policy(policy, max_ms);
+    // ビットプールの制御で溜まり方が変わらないように固定する。
+    audio_pipeline_set_adaptive_bitpool(false);
+    if (wav_source_open(LittleFS, path, true) != 0)
+        return check_result;
+    audio_pipeline_init_encoder(&configuration);
+    std::thread core1;
+    if (mode == AUDIO_PIPELINE_DUAL_CORE)
+    {
+        check_core1_running = true;
+        check_producer_paused = false;
+        core1 = std::thread([]() {
+            while (check_core1_running)
+            {
+                if (!check_producer_paused)
+                    audio_pipeline_loop1();
+            }
+        });
+    }
+    host_stream_run(&check_context, CHECK_SECONDS, check_each_ms);
+    if (mode == AUDIO_PIPELINE_DUAL_CORE)
+    {
+        check_core1_running = false;
+        core1.join();
+    }
+    check_result.frame_errors = fake_a2dp_sink.frame_errors;
+    audio_pipeline_get_backlog_stats(&check_context, &check_result.stats);
+    fake_btstack_set_can_send_now_delay_ms(0);
+    audio_pipeline_set_mode(AUDIO_PIPELINE_SINGLE_CORE);
+    audio_pipeline_set_backlog_policy(AUDIO_BACKLOG_DROP_AUDIO, AUDIO_BACKLOG_MAX_MS);
+    audio_pipeline_set_adaptive_bitpool(true);
+    wav_source_close();
+    return check_result;
+}
+
+static void check_print(const char *name, const check_result_t *result)
+{
+    printf("  %-26s max backlog %5u ms, max rtp lag %5u ms, recovery %5u ms, max burst %u packets/10 ms, "
+           "dropped %4u frames, overruns %u, underruns %u, mismatches %u, frame errors %u\n",
+           name, (unsigned)((uint64_t)result->stats.max_backlog_samples * 1000 / current_sample_rate),
+           (unsigned)result->max_lag_ms, (unsigned)result->recovery_ms, (unsigned)result->max_burst,
+           (unsigned)result->stats.dropped_frames, (unsigned)result->stats.overruns, (unsigned)result->stats.underruns,
+           (unsigned)result->mismatches, (unsigned)result->frame_errors);
+}
+
+int check_backlog_main(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+    const char *path = "backlog_input.wav";
+    if (host_write_test_wav(path, 48000, 5) != 0)
+        return 1;
+    LittleFS.setRoot("");
+
+    printf("link stalls for %u ms at %u ms; dual core producer stalls for %u ms at %u ms (%d s)\n", (unsigned)CHECK_STALL_MS,
+           (unsigned)CHECK_STALL_START_MS, (unsigned)CHECK_PRODUCER_STALL_MS, (unsigned)CHECK_PRODUCER_STALL_START_MS, CHECK_SECONDS);
+    check_result_t unlimited = check_run(path, AUDIO_PIPELINE_SINGLE_CORE, AUDIO_BACKLOG_DROP_AUDIO, 0);
+    check_result_t drop_audio = check_run(path, AUDIO_PIPELINE_SINGLE_CORE, AUDIO_BACKLOG_DROP_AUDIO, AUDIO_BACKLOG_MAX_MS);
+    check_result_t drop_time = check_run(path, AUDIO_PIPELINE_SINGLE_CORE, AUDIO_BACKLOG_DROP_TIME, AUDIO_BACKLOG_MAX_MS);
+    check_result_t dual = check_run(path, AUDIO_PIPELINE_DUAL_CORE, AUDIO_BACKLOG_DROP_AUDIO, AUDIO_BACKLOG_MAX_MS);
+    check_print("no limit", &unlimited);
+    check_print("drop audio, single core", &drop_audio);
+    check_print("drop time, single core", &drop_time);
+    check_print("drop audio, dual core", &dual);
+
+    int result = 0;
+    const check_result_t *limited[] = {&drop_audio, &drop_time, &dual};
+    // 上限 + 1パケット(最大15フレーム) + タイマー1周期
+    uint32_t max_lag_ms = AUDIO_BACKLOG_MAX_MS + 15 * 128 * 1000 / 48000 + AUDIO_TIMEOUT_MS;
+    for (const check_result_t *r : limited)
+    {
+        bool ok = r->mismatches == 0 && r->frame_errors == 0 && r->max_lag_ms <= max_lag_ms && r->stats.overruns > 0 &&
+                  r->stats.dropped_frames > 0 && r->recovery_ms < unlimited.recovery_ms;
+        result |= ok ? 0 : 1;
+    }
+    result |= unlimited.mismatches == 0 && unlimited.stats.dropped_frames == 0 && unlimited.max_lag_ms > CHECK_STALL_MS / 2 ? 0 : 1;
+    result |= dual.stats.underruns > 0 ? 0 : 1;
+    printf("%s\n", result == 0 ? "OK" : "NG");
+    return result;
+}
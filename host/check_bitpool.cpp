@@ -0,0 +1,162 @@
+#include "host_commands.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <thread>
+
+#include "LittleFS.h"
+#include "fake_btstack.h"
+#include "host_stream.h"
+#include "audio/audio_pipeline.h"
+#include "audio/sbc_frame_queue.h"
+#include "audio/wav_source.h"
+
+// 送信の詰まり具合によるビットプールの制御(bitpool_control)を確かめます。
+// CAN_SEND_NOW が来るまでの時間を、空いたリンク -> 混んだリンク -> 空いたリンク と変えてストリーミングし、
+//  - 制御なし(ビットプール固定)では溜まったサンプルが増え続けること
+//  - 制御ありでは混んでいる間ビットプールが下がって溜まりが抑えられ、空いたら最大値に戻ること
+//  - ビットプールが変わってもパケットのフレーム数と長さが合っていること(シングルコア/デュアルコア)
+// を確認し、1秒ごとのビットプールと溜まったサンプルを表示します。
+
+typedef struct
+{
+    uint32_t start_ms;
+    uint32_t delay_ms;
+} check_link_phase_t;
+
+static const check_link_phase_t check_link_phases[] = {{0, 2}, {3000, 25}, {9000, 2}};
+static const int CHECK_SECONDS = 20;
+
+static a2dp_media_sending_context_t check_context;
+static bool check_trace;
+static uint32_t check_max_backlog_ms;
+static std::atomic<bool> check_core1_running;
+
+static uint32_t check_backlog_ms(void)
+{
+    return (uint32_t)((uint64_t)check_context.samples_ready * 1000 / current_sample_rate);
+}
+
+// loop() の代わりに毎ms呼ばれる。リンクの混み具合を変え、1秒ごとに状態を表示する。
+static void check_each_ms(void)
+{
+    uint32_t now = fake_btstack_time_ms() - 1;
+    uint32_t delay_ms = 0;
+    for (const check_link_phase_t &phase : check_link_phases)
+    {
+        if (now >= phase.start_ms)
+            delay_ms = phase.delay_ms;
+    }
+    fake_btstack_set_can_send_now_delay_ms(delay_ms);
+    uint32_t backlog_ms = check_backlog_ms();
+    if (backlog_ms > check_max_backlog_ms)
+        check_max_backlog_ms = backlog_ms;
+    if (check_trace && now % 1000 == 999)
+        printf("    %2u s: can_send_now delay %2u ms, bitpool %2u, backlog %4u ms\n",
+               (unsigned)(now / 1000 + 1), (unsigned)delay_ms, fake_a2dp_sink.last_bitpool, (unsigned)backlog_ms);
+    if (audio_pipeline_get_mode() == AUDIO_PIPELINE_SINGLE_CORE)
+    {
+        audio_pipeline_loop();
+        return;
+    }
+    // 実機ではコア1の方がリアルタイムより十分速いので、仮想時間を進める前にキューを半分以上埋めさせる。
+    uint32_t level, max_level, underruns;
+    do
+    {
+        audio_pipeline_get_queue_stats(&level, &max_level, &underruns);
+    } while (level < SBC_FRAME_QUEUE_SLOTS / 2);
+}
+
+typedef struct
+{
+    uint32_t max_backlog_ms;
+    uint32_t final_backlog_ms;
+    uint32_t frame_errors;
+    uint32_t packets;
+    uint8_t final_bitpool;
+    bitpool_control_stats_t stats;
+} check_result_t;
+
+static check_result_t check_run(const char *path, audio_pipeline_mode_t mode, bool adaptive, bool trace)
+{
+    static const media_codec_configuration_sbc_t configuration = {
+        0, 2, 48000, 16, 8, 2, 53, SBC_CHANNEL_MODE_STEREO, SBC_ALLOCATION_METHOD_SNR};
+    check_result_t result = {};
+    audio_pipeline_set_mode(mode);
+    audio_pipeline_set_adaptive_bitpool(adaptive);
+    if (wav_source_open(LittleFS, path, true) != 0)
+        return result;
+    audio_pipeline_init_encoder(&configuration);
+    check_trace = trace;
+    check_max_backlog_ms = 0;
+    std::thread core1;
+    if (mode == AUDIO_PIPELINE_DUAL_CORE)
+    {
+        check_core1_running = true;
+        core1 = std::thread([]() {
+            while (check_core1_running)
+                audio_pipeline_loop1();
+        });
+    }
+    host_stream_run(&check_context, CHECK_SECONDS, check_each_ms);
+    if (mode == AUDIO_PIPELINE_DUAL_CORE)
+    {
+        check_core1_running = false;
+        core1.join();
+    }
+    result.max_backlog_ms = check_max_backlog_ms;
+    result.final_backlog_ms = check_backlog_ms();
+    result.frame_errors = fake_a2dp_sink.frame_errors;
+    result.packets = fake_a2dp_sink.packets;
+    result.final_bitpool = fake_a2dp_sink.last_bitpool;
+    audio_pipeline_get_bitpool_stats(&result.stats);
+    fake_btstack_set_can_send_now_delay_ms(0);
+    audio_pipeline_set_mode(AUDIO_PIPELINE_SINGLE_CORE);
+    audio_pipeline_set_adaptive_bitpool(true);
+    wav_source_close();
+    return result;
+}
+
+static void check_print(const char *name, const check_result_t *result)
+{
+    printf("  %-22s packets %5u, max backlog %5u ms, backlog at end %4u ms, bitpool at end %2u, switches %3u, send latency max %u ms, frame errors %u\n",
+           name, (unsigned)result->packets, (unsigned)result->max_backlog_ms, (unsigned)result->final_backlog_ms,
+           result->final_bitpool, (unsigned)result->stats.switches, (unsigned)result->stats.max_latency_ms,
+           (unsigned)result->frame_errors);
+}
+
+int check_bitpool_main(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+    const char *path = "bitpool_input.wav";
+    if (host_write_test_wav(path, 48000, 5) != 0)
+        return 1;
+    LittleFS.setRoot("");
+    // 制御なしで溜まり続けることを見るので、溜まったサンプルの上限は外す。
+    audio_pipeline_set_backlog_policy(AUDIO_BACKLOG_DROP_AUDIO, 0);
+
+    printf("link: can_send_now delay 2 ms, 25 ms from 3 s, 2 ms from 9 s (%d s)\n", CHECK_SECONDS);
+    check_result_t fixed = check_run(path, AUDIO_PIPELINE_SINGLE_CORE, false, false);
+    printf("  adaptive, single core:\n");
+    check_result_t single = check_run(path, AUDIO_PIPELINE_SINGLE_CORE, true, true);
+    check_result_t dual = check_run(path, AUDIO_PIPELINE_DUAL_CORE, true, false);
+    check_print("fixed bitpool", &fixed);
+    check_print("adaptive, single core", &single);
+    check_print("adaptive, dual core", &dual);
+
+    int result = 0;
+    const check_result_t *adaptive[] = {&single, &dual};
+    for (const check_result_t *r : adaptive)
+    {
+        bool ok = r->frame_errors == 0 && r->final_bitpool == r->stats.max_bitpool &&
+                  r->stats.switches > 0 && r->max_backlog_ms < fixed.max_backlog_ms &&
+                  r->final_backlog_ms <= BITPOOL_CONTROL_BACKLOG_HIGH_MS;
+        result |= ok ? 0 : 1;
+    }
+    result |= fixed.frame_errors == 0 ? 0 : 1;
+    audio_pipeline_set_backlog_policy(AUDIO_BACKLOG_DROP_AUDIO, AUDIO_BACKLOG_MAX_MS);
+    printf("%s\n", result == 0 ? "OK" : "NG");
+    return result;
+}
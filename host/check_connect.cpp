@@ -0,0 +1,193 @@
+#include "host_commands.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "audio/connect_planner.h"
+
+// 知っているスピーカーへの直接の接続(connect_planner)を確かめます。
+// BTstack の代わりに、ページング・インクワイアリ・接続からストリーミングまでの時間を仮想時間で進める簡単なモデルで、
+//  - 設定したアドレスのスピーカーが電源オン: インクワイアリをせずに接続する
+//  - 設定したアドレスはオフ、ペアリングした別のスピーカーがオン: 1回のページタイムアウトの後にそちらに接続する
+//  - どれもオフで新しいスピーカーだけ: MAX_PAGE_TIMEOUTS 回の後にインクワイアリに切り替える
+//  - 設定したアドレスのスピーカーが接続を断る(認証の失敗など): ページタイムアウトには数えずに次の候補に接続する
+//  - どのスピーカーも断る: 候補を1回ずつ試してインクワイアリに切り替える
+//  - 候補が無い: すぐにインクワイアリ
+//  - 切断後: 最後に接続したスピーカーに直接接続し直す
+// を確認し、起動(切断)から最初のメディアパケットまでの時間を経路ごとに表示します。
+
+static const uint8_t CHECK_MAX_PAGE_TIMEOUTS = 3;
+// モデルの時間(ms)
+static const uint32_t CHECK_BOOT_MS = 600;        // 起動から HCI_STATE_WORKING まで
+static const uint32_t CHECK_PAGE_MS = 700;        // ページングして ACL がつながるまで
+static const uint32_t CHECK_PAGE_TIMEOUT_MS = 2560; // PAGE_TIMEOUT_SLOTS 0x1000
+static const uint32_t CHECK_INQUIRY_MS = 1280;    // 1回のインクワイアリ(見つかるのは1回目の終わり)
+static const uint32_t CHECK_STREAM_MS = 900;      // 接続から SDP・AVDTP の設定を経て最初のパケットまで
+
+typedef struct
+{
+    const uint8_t *powered[3]; // 電源が入っているスピーカー(NULL で終わり)
+    const uint8_t *nearby;     // インクワイアリで見つかるスピーカー
+    const uint8_t *refusing[2]; // 電源は入っているが接続を断るスピーカー
+} check_world_t;
+
+static const uint8_t CHECK_REFUSED_STATUS = 0x05; // ERROR_CODE_AUTHENTICATION_FAILURE
+
+static const uint8_t check_configured[6] = {0xFD, 0x94, 0x0B, 0xD6, 0x4D, 0x34};
+static const uint8_t check_paired[6] = {0x41, 0x42, 0x2B, 0x84, 0x12, 0x8D};
+static const uint8_t check_new[6] = {0x00, 0x1A, 0x7D, 0xDA, 0x71, 0x13};
+
+static bool check_is_in(const uint8_t *const *list, int count, const uint8_t *address)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (list[i] != NULL && memcmp(list[i], address, 6) == 0)
+            return true;
+    }
+    return false;
+}
+
+static bool check_is_powered(const check_world_t *world, const uint8_t *address)
+{
+    return check_is_in(world->powered, 3, address);
+}
+
+// 最初のパケットを送るまで進め、その時刻を返す。connected に接続したスピーカーを入れる。
+static uint32_t check_run(connect_planner_t *planner, const check_world_t *world, connect_planner_action_t action,
+                          uint8_t *address, uint32_t now_ms, const uint8_t **connected, uint32_t *pages, uint32_t *inquiries,
+                          uint32_t *timeouts)
+{
+    for (int attempt = 0; attempt < 20; attempt++)
+    {
+        if (action == CONNECT_PLANNER_INQUIRY)
+        {
+            (*inquiries)++;
+            now_ms += CHECK_INQUIRY_MS;
+            if (world->nearby == NULL)
+                continue;
+            memcpy(address, world->nearby, 6);
+        }
+        else
+        {
+            (*pages)++;
+            if (!check_is_powered(world, address))
+            {
+                (*timeouts)++;
+                now_ms += CHECK_PAGE_TIMEOUT_MS;
+                action = connect_planner_failed(planner, CONNECT_PLANNER_PAGE_TIMEOUT, address);
+                continue;
+            }
+            if (check_is_in(world->refusing, 2, address))
+            {
+                now_ms += CHECK_PAGE_MS;
+                action = connect_planner_failed(planner, CHECK_REFUSED_STATUS, address);
+                continue;
+            }
+        }
+        now_ms += CHECK_PAGE_MS;
+        connect_planner_connected(planner, address);
+        *connected = world->nearby != NULL && memcmp(address, world->nearby, 6) == 0 ? world->nearby
+                     : memcmp(address, check_configured, 6) == 0                      ? check_configured
+                                                                                      : check_paired;
+        now_ms += CHECK_STREAM_MS;
+        connect_planner_first_packet(planner, now_ms);
+        return now_ms;
+    }
+    *connected = NULL;
+    return now_ms;
+}
+
+typedef struct
+{
+    const char *name;
+    bool configured;
+    bool paired;
+    check_world_t world;
+    connect_path_t expected_path;
+    uint32_t expected_pages;
+    const uint8_t *expected_speaker;
+} check_case_t;
+
+static int check_case(const check_case_t *c)
+{
+    connect_planner_t planner;
+    connect_planner_init(&planner, CHECK_MAX_PAGE_TIMEOUTS);
+    if (c->configured)
+        connect_planner_add_candidate(&planner, check_configured);
+    if (c->paired)
+        connect_planner_add_candidate(&planner, check_paired);
+    uint8_t address[6];
+    const uint8_t *connected = NULL;
+    uint32_t pages = 0, inquiries = 0, timeouts = 0;
+    connect_planner_action_t action = connect_planner_start(&planner, 0, address);
+    uint32_t first_packet_ms = check_run(&planner, &c->world, action, address, CHECK_BOOT_MS, &connected, &pages, &inquiries, &timeouts);
+    connect_planner_stats_t stats;
+    connect_planner_get_stats(&planner, &stats);
+    // ページタイムアウトだけを数え、断られた分はほかの失敗として数える。
+    uint32_t refused = c->expected_path == CONNECT_PATH_INQUIRY ? pages - timeouts : pages - timeouts - 1;
+    bool ok = connected == c->expected_speaker && pages == c->expected_pages && stats.paths[c->expected_path].connections == 1 &&
+              stats.paths[c->expected_path].last_ms == first_packet_ms && stats.page_timeouts == timeouts && stats.failures == refused;
+    printf("  %-34s %-7s pages %u (%u timeouts, %u refused), inquiries %u, first packet %5u ms after boot -> %s\n", c->name,
+           connect_planner_path_name(c->expected_path), (unsigned)pages, (unsigned)stats.page_timeouts, (unsigned)stats.failures,
+           (unsigned)inquiries, (unsigned)first_packet_ms, ok ? "OK" : "NG");
+    if (!ok || connected == NULL)
+        return ok ? 0 : 1;
+
+    // 切断: 接続していたスピーカーに直接つなぎ直す(インクワイアリで見つけたものも候補の先頭に入っている)
+    uint32_t disconnect_ms = first_packet_ms + 60000;
+    pages = inquiries = 0;
+    action = connect_planner_disconnected(&planner, disconnect_ms, address);
+    bool first_is_last = action == CONNECT_PLANNER_PAGE && memcmp(address, connected, 6) == 0;
+    check_world_t world = c->world;
+    world.powered[0] = connected;
+    const uint8_t *reconnected = NULL;
+    uint32_t again_ms = check_run(&planner, &world, action, address, disconnect_ms, &reconnected, &pages, &inquiries, &timeouts);
+    bool reconnect_ok = first_is_last && reconnected == connected && pages == 1 && inquiries == 0;
+    printf("  %-34s %-7s pages %u, inquiries %u, first packet %5u ms after disconnect -> %s\n", "  reconnect after disconnect",
+           "direct", (unsigned)pages, (unsigned)inquiries, (unsigned)(again_ms - disconnect_ms), reconnect_ok ? "OK" : "NG");
+    return reconnect_ok ? 0 : 1;
+}
+
+int check_connect_main(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+    static const check_case_t cases[] = {
+        {"configured speaker on", true, true, {{check_configured, check_paired, NULL}, check_new, {NULL, NULL}}, CONNECT_PATH_DIRECT, 1, check_configured},
+        {"configured off, paired speaker on", true, true, {{check_paired, NULL, NULL}, check_new, {NULL, NULL}}, CONNECT_PATH_DIRECT, 2, check_paired},
+        {"known speakers off, new speaker", true, true, {{check_new, NULL, NULL}, check_new, {NULL, NULL}}, CONNECT_PATH_INQUIRY, CHECK_MAX_PAGE_TIMEOUTS, check_new},
+        {"no known speakers", false, false, {{check_new, NULL, NULL}, check_new, {NULL, NULL}}, CONNECT_PATH_INQUIRY, 0, check_new},
+        {"configured refuses, paired on", true, true, {{check_configured, check_paired, NULL}, check_new, {check_configured, NULL}},
+         CONNECT_PATH_DIRECT, 2, check_paired},
+        {"known speakers refuse, new speaker", true, true, {{check_configured, check_paired, check_new}, check_new, {check_configured, check_paired}},
+         CONNECT_PATH_INQUIRY, 2, check_new},
+    };
+    printf("connect (page %u ms, page timeout %u ms, inquiry %u ms, up to %u page timeouts):\n", (unsigned)CHECK_PAGE_MS,
+           (unsigned)CHECK_PAGE_TIMEOUT_MS, (unsigned)CHECK_INQUIRY_MS, (unsigned)CHECK_MAX_PAGE_TIMEOUTS);
+    int result = 0;
+    for (const check_case_t &c : cases)
+        result |= check_case(&c);
+
+    // 候補の扱い: 0 のアドレスと重複は入れない。いっぱいのときに接続したものは先頭に入り、一番後ろが落ちる。
+    connect_planner_t planner;
+    connect_planner_init(&planner, CHECK_MAX_PAGE_TIMEOUTS);
+    static const uint8_t zero[6] = {0};
+    uint8_t many[CONNECT_PLANNER_MAX_CANDIDATES + 1][6];
+    bool added = !connect_planner_add_candidate(&planner, zero);
+    for (int i = 0; i <= CONNECT_PLANNER_MAX_CANDIDATES; i++)
+    {
+        memset(many[i], 0x10 + i, 6);
+        added &= connect_planner_add_candidate(&planner, many[i]) == (i < CONNECT_PLANNER_MAX_CANDIDATES);
+    }
+    added &= !connect_planner_add_candidate(&planner, many[0]);
+    connect_planner_connected(&planner, many[CONNECT_PLANNER_MAX_CANDIDATES]);
+    added &= planner.num_candidates == CONNECT_PLANNER_MAX_CANDIDATES &&
+             memcmp(planner.candidates[0], many[CONNECT_PLANNER_MAX_CANDIDATES], 6) == 0 &&
+             memcmp(planner.candidates[1], many[0], 6) == 0 &&
+             memcmp(planner.candidates[CONNECT_PLANNER_MAX_CANDIDATES - 1], many[CONNECT_PLANNER_MAX_CANDIDATES - 2], 6) == 0;
+    printf("  candidates: zero/duplicate/full rejected, last connected moved to the front -> %s\n", added ? "OK" : "NG");
+    result |= added ? 0 : 1;
+
+    printf("%s\n", result == 0 ? "OK" : "NG");
+    return result;
+}
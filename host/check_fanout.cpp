@@ -0,0 +1,277 @@
+#include "host_commands.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <thread>
+
+#include "LittleFS.h"
+#include "fake_btstack.h"
+#include "host_stream.h"
+#include "audio/audio_pipeline.h"
+#include "audio/sbc_frame_queue.h"
+#include "audio/stage_profile.h"
+#include "audio/wav_source.h"
+
+// 2つのシンクへの同時のストリーミング(共有のリング sbc_fanout)を確かめます。
+//  - 2つのシンクに送ったフレームのバイト列が、1つのシンクに送ったときと同じであること(1回だけエンコードして同じフレームを送っている)
+//  - 片方のシンクの CAN_SEND_NOW が遅くても、もう片方は影響を受けず、遅いシンクのリングの深さだけが増えること
+//  - 片方のシンクが途切れてリング1周より遅れたら、読めなかったフレームを捨てて RTPタイムスタンプを実時間に合わせること
+//    (RTPタイムスタンプ + 組み立て中のパケット + 溜まったサンプルが実時間のサンプル数と一致する)
+//  - ビットプールの範囲を2台のスピーカーの範囲の共通部分に狭められ、重ならなければ受け付けないこと
+// と、シンクごとのリングの深さを表示し、1つのシンクを2回(シンクごとにエンコード)ストリーミングしたときと処理時間を比べます。
+// 比べやすいように、ビットプールは固定します。
+
+static const int CHECK_SECONDS = 5;
+static const uint32_t CHECK_STALL_START_MS = 2000;
+static const uint32_t CHECK_STALL_MS = 1000;
+
+typedef enum
+{
+    CHECK_LINK_SAME = 0, // どちらのシンクも CAN_SEND_NOW はすぐに来る
+    CHECK_LINK_SLOW,     // 2つ目のシンクの CAN_SEND_NOW が毎回 CHECK_SLOW_DELAY_MS 遅れる
+    CHECK_LINK_STALL,    // 2つ目のシンクの CAN_SEND_NOW が CHECK_STALL_MS の間来ない
+} check_link_t;
+
+static const uint32_t CHECK_SLOW_DELAY_MS = 12;
+
+typedef struct
+{
+    uint32_t max_level;    // リングの中の、まだ読んでいないフレーム数の最大
+    uint32_t lost;         // 上書きされて読めなかったフレーム数
+    uint32_t dropped;      // 捨てたフレーム数(読めなかった分と、溜まったサンプルの上限で捨てた分)
+    uint32_t mismatches;   // サンプル数の勘定が合わなかった回数
+    uint32_t sbc_frames;
+    uint32_t frame_errors;
+    uint32_t last_timestamp;
+    FILE *dump;
+} check_sink_result_t;
+
+typedef struct
+{
+    check_sink_result_t sinks[SBC_FANOUT_MAX_READERS];
+    uint32_t encoded_frames; // エンコーダを呼んだ回数
+    uint64_t busy_ns;
+    uint64_t encode_ns;
+} check_result_t;
+
+static a2dp_media_sending_context_t check_contexts[SBC_FANOUT_MAX_READERS];
+static int check_num_sinks;
+static check_link_t check_link;
+static check_result_t check_result;
+static std::atomic<bool> check_core1_running;
+
+static void check_each_ms(void)
+{
+    uint32_t now = fake_btstack_time_ms() - 1;
+    if (check_link == CHECK_LINK_STALL)
+    {
+        bool stalled = now >= CHECK_STALL_START_MS && now < CHECK_STALL_START_MS + CHECK_STALL_MS;
+        fake_btstack_set_sink_can_send_now_delay_ms(2, stalled ? CHECK_STALL_MS * 2 : 0);
+    }
+    for (int i = 0; i < check_num_sinks; i++)
+    {
+        const a2dp_media_sending_context_t *context = &check_contexts[i];
+        check_sink_result_t *sink = &check_result.sinks[i];
+        audio_fanout_stats_t stats;
+        audio_pipeline_get_fanout_stats(context, &stats);
+        if (stats.max_level > sink->max_level)
+            sink->max_level = stats.max_level;
+        sink->lost = stats.lost;
+        uint32_t accounted = context->rtp_timestamp + context->sbc_storage_frames * 128 + context->samples_ready;
+        if (context->fragment_offset == 0 && accounted != (uint32_t)context->clock.samples_due)
+            sink->mismatches++;
+    }
+
+    if (audio_pipeline_get_mode() == AUDIO_PIPELINE_SINGLE_CORE)
+    {
+        audio_pipeline_loop();
+        return;
+    }
+    // 結果が毎回同じになるように、コア1がキューを半分まで埋めるのを待つ。
+    uint32_t level, max_level, underruns;
+    do
+    {
+        audio_pipeline_get_queue_stats(&level, &max_level, &underruns);
+    } while (level < SBC_FRAME_QUEUE_SLOTS / 2);
+}
+
+static check_result_t check_run(const char *path, audio_pipeline_mode_t mode, int num_sinks, check_link_t link)
+{
+    static const media_codec_configuration_sbc_t configuration = {
+        0, 2, 48000, 16, 8, 2, 53, SBC_CHANNEL_MODE_JOINT_STEREO, SBC_ALLOCATION_METHOD_LOUDNESS};
+    check_result = {};
+    check_num_sinks = num_sinks;
+    check_link = link;
+    audio_pipeline_set_mode(mode);
+    if (wav_source_open(LittleFS, path, true) != 0)
+        return check_result;
+    audio_pipeline_init_encoder(&configuration);
+    fake_btstack_set_can_send_now_delay_ms(0);
+    if (link == CHECK_LINK_SLOW)
+        fake_btstack_set_sink_can_send_now_delay_ms(2, CHECK_SLOW_DELAY_MS);
+    for (int i = 0; i < num_sinks; i++)
+    {
+        check_result.sinks[i].dump = tmpfile();
+        fake_a2dp_sinks[i].dump = check_result.sinks[i].dump;
+    }
+    std::thread core1;
+    if (mode == AUDIO_PIPELINE_DUAL_CORE)
+    {
+        check_core1_running = true;
+        core1 = std::thread([]() {
+            while (check_core1_running)
+                audio_pipeline_loop1();
+        });
+    }
+    stage_profile_reset();
+    check_result.busy_ns = host_stream_run_sinks(check_contexts, num_sinks, CHECK_SECONDS, check_each_ms);
+    if (mode == AUDIO_PIPELINE_DUAL_CORE)
+    {
+        check_core1_running = false;
+        core1.join();
+    }
+    const stage_profile_stage_stats_t *encode = stage_profile_get(STAGE_PROFILE_ENCODE);
+    check_result.encoded_frames = encode->count;
+    check_result.encode_ns = encode->total_cycles;
+    for (int i = 0; i < num_sinks; i++)
+    {
+        check_sink_result_t *sink = &check_result.sinks[i];
+        sink->dropped = check_contexts[i].backlog.dropped_frames;
+        sink->sbc_frames = fake_a2dp_sinks[i].sbc_frames;
+        sink->frame_errors = fake_a2dp_sinks[i].frame_errors;
+        sink->last_timestamp = fake_a2dp_sinks[i].last_timestamp;
+        fake_a2dp_sinks[i].dump = NULL;
+    }
+    fake_btstack_set_can_send_now_delay_ms(0);
+    audio_pipeline_set_mode(AUDIO_PIPELINE_SINGLE_CORE);
+    wav_source_close();
+    return check_result;
+}
+
+static void check_close(check_result_t *result)
+{
+    for (check_sink_result_t &sink : result->sinks)
+    {
+        if (sink.dump)
+            fclose(sink.dump);
+    }
+}
+
+// 2つの書き出しの短い方の長さまでが一致するか
+static bool check_same_frames(FILE *a, FILE *b)
+{
+    long length_a = ftell(a);
+    long length_b = ftell(b);
+    long length = length_a < length_b ? length_a : length_b;
+    rewind(a);
+    rewind(b);
+    for (long i = 0; i < length; i++)
+    {
+        if (fgetc(a) != fgetc(b))
+            return false;
+    }
+    fseek(a, length_a, SEEK_SET);
+    fseek(b, length_b, SEEK_SET);
+    return length > 0;
+}
+
+static void check_print(const char *name, const check_result_t *result, int num_sinks)
+{
+    printf("  %s: encoded %u frames, busy %.1f ms\n", name, (unsigned)result->encoded_frames, result->busy_ns / 1e6);
+    for (int i = 0; i < num_sinks; i++)
+    {
+        const check_sink_result_t *sink = &result->sinks[i];
+        printf("    sink %d: frames %5u, queue max %2u frames (%2u ms), lost %3u, dropped %3u, mismatches %u, frame errors %u\n", i + 1,
+               (unsigned)sink->sbc_frames, (unsigned)sink->max_level, (unsigned)(sink->max_level * 128 * 1000 / 48000),
+               (unsigned)sink->lost, (unsigned)sink->dropped, (unsigned)sink->mismatches, (unsigned)sink->frame_errors);
+    }
+}
+
+// 送ったフレームは実時間分(組み立て中と送信中のパケットの分だけ少ないことがある)で、勘定が合い、フレームの誤りが無い。
+static bool check_sink_ok(const check_sink_result_t *sink)
+{
+    uint32_t expected_frames = 48000 * CHECK_SECONDS / 128;
+    return sink->frame_errors == 0 && sink->mismatches == 0 && sink->sbc_frames + sink->dropped <= expected_frames &&
+           sink->sbc_frames + sink->dropped + 2 * SBC_MAX_FRAMES_PER_PACKET >= expected_frames;
+}
+
+int check_fanout_main(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+    const char *path = "fanout_input.wav";
+    if (host_write_test_wav(path, 48000, CHECK_SECONDS) != 0)
+        return 1;
+    LittleFS.setRoot("");
+    audio_pipeline_set_adaptive_bitpool(false);
+
+    printf("streaming 48k joint bitpool 53 to one and two sinks (%d s):\n", CHECK_SECONDS);
+    check_result_t single = check_run(path, AUDIO_PIPELINE_SINGLE_CORE, 1, CHECK_LINK_SAME);
+    check_result_t twice = check_run(path, AUDIO_PIPELINE_SINGLE_CORE, 1, CHECK_LINK_SAME);
+    check_result_t fanout = check_run(path, AUDIO_PIPELINE_SINGLE_CORE, 2, CHECK_LINK_SAME);
+    check_result_t slow = check_run(path, AUDIO_PIPELINE_SINGLE_CORE, 2, CHECK_LINK_SLOW);
+    check_result_t stall = check_run(path, AUDIO_PIPELINE_SINGLE_CORE, 2, CHECK_LINK_STALL);
+    check_result_t dual = check_run(path, AUDIO_PIPELINE_DUAL_CORE, 2, CHECK_LINK_SLOW);
+    // 2台目のスピーカーの範囲(20..35)との共通部分に狭め、重ならない範囲は受け付けず、2台目が切断されたら 2..53 に戻す。
+    bitpool_control_stats_t narrowed, restored;
+    bool range_ok = audio_pipeline_set_bitpool_range(20, 35);
+    audio_pipeline_get_bitpool_stats(&narrowed);
+    range_ok = range_ok && !audio_pipeline_set_bitpool_range(40, 35);
+    range_ok = range_ok && audio_pipeline_set_bitpool_range(2, 53);
+    audio_pipeline_get_bitpool_stats(&restored);
+    range_ok = range_ok && narrowed.bitpool == 35 && narrowed.max_bitpool == 35 && narrowed.min_bitpool == 20 &&
+               restored.bitpool == 53 && restored.max_bitpool == 53;
+    audio_pipeline_set_adaptive_bitpool(true);
+    check_print("one sink", &single, 1);
+    check_print("two sinks", &fanout, 2);
+    char name[64];
+    snprintf(name, sizeof(name), "two sinks, sink 2 waits %u ms for CAN_SEND_NOW", (unsigned)CHECK_SLOW_DELAY_MS);
+    check_print(name, &slow, 2);
+    snprintf(name, sizeof(name), "two sinks, sink 2 stalls for %u ms", (unsigned)CHECK_STALL_MS);
+    check_print(name, &stall, 2);
+    check_print("two sinks, dual core, sink 2 slow", &dual, 2);
+
+    int result = 0;
+    const check_result_t *runs[] = {&fanout, &slow, &stall, &dual};
+    for (const check_result_t *r : runs)
+    {
+        for (int i = 0; i < 2; i++)
+            result |= check_sink_ok(&r->sinks[i]) ? 0 : 1;
+    }
+    result |= check_sink_ok(&single.sinks[0]) ? 0 : 1;
+    // 途切れなければ、どちらのシンクにも1つのシンクと同じフレームを送り、読めないフレームは無い。
+    bool same = true;
+    const check_result_t *clean[] = {&fanout, &slow, &dual};
+    for (const check_result_t *r : clean)
+    {
+        for (int i = 0; i < 2; i++)
+            same = same && check_same_frames(single.sinks[0].dump, r->sinks[i].dump) && r->sinks[i].lost == 0;
+    }
+    // 途切れたシンクはリング1周より遅れて読めなかったフレームがあり、もう片方は1つのシンクと同じ。
+    same = same && check_same_frames(single.sinks[0].dump, stall.sinks[0].dump) && stall.sinks[0].lost == 0;
+    bool stall_lost = stall.sinks[1].lost > 0 && stall.sinks[1].max_level >= SBC_FANOUT_SLOTS - 1;
+    printf("  frames identical to one sink: %s, stalled sink lost frames: %s\n", same ? "yes" : "NO", stall_lost ? "yes" : "NO");
+    result |= same && stall_lost ? 0 : 1;
+    printf("  bitpool range narrowed to both sinks: %u..%u (bitpool %u), restored: %u..%u (bitpool %u): %s\n",
+           narrowed.min_bitpool, narrowed.max_bitpool, narrowed.bitpool, restored.min_bitpool, restored.max_bitpool, restored.bitpool,
+           range_ok ? "yes" : "NO");
+    result |= range_ok ? 0 : 1;
+    // 遅いシンクのリングの深さは、CAN_SEND_NOW の遅れの分くらい増える。
+    result |= slow.sinks[1].max_level > slow.sinks[0].max_level ? 0 : 1;
+
+    // 1回だけエンコードする: 2つのシンクでもエンコードは1つのシンクと同じ回数
+    uint64_t twice_ns = single.busy_ns + twice.busy_ns;
+    printf("CPU for two sinks (timer callbacks and sends, %d s of audio):\n", CHECK_SECONDS);
+    printf("  encode twice (one pipeline per sink): %u frames encoded, busy %.1f ms (encode %.1f ms)\n",
+           (unsigned)(single.encoded_frames + twice.encoded_frames), twice_ns / 1e6, (single.encode_ns + twice.encode_ns) / 1e6);
+    printf("  encode once (shared ring):            %u frames encoded, busy %.1f ms (encode %.1f ms), %.0f%% of encoding twice\n",
+           (unsigned)fanout.encoded_frames, fanout.busy_ns / 1e6, fanout.encode_ns / 1e6, fanout.busy_ns * 100.0 / twice_ns);
+    result |= fanout.encoded_frames <= single.encoded_frames + 1 && fanout.busy_ns < twice_ns ? 0 : 1;
+
+    check_result_t *all[] = {&single, &twice, &fanout, &slow, &stall, &dual};
+    for (check_result_t *r : all)
+        check_close(r);
+    printf("%s\n", result == 0 ? "OK" : "NG");
+    return result;
+}
@@ -0,0 +1,147 @@
+#include "host_commands.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+
+#include "LittleFS.h"
+#include "fake_btstack.h"
+#include "host_stream.h"
+#include "audio/audio_pipeline.h"
+#include "audio/sbc_frame_queue.h"
+#include "audio/wav_source.h"
+
+// sbc_frame_queue をホストの2スレッドで確かめます。
+//  1. キュー単体: 書き込みスレッドが長さと中身の違うフレームを積み、読み出しスレッドが順番と中身を確かめる
+//  2. パイプライン: コア1の代わりのスレッドで audio_pipeline_loop1() を回し、
+//     シングルコアモードと同じSBCフレーム列が送られること、コア0側の処理時間を比べる
+
+static sbc_frame_queue_t check_queue;
+
+static uint8_t check_frame_byte(uint32_t sequence, int index)
+{
+    return (uint8_t)(sequence * 31u + index * 7u);
+}
+
+static int check_queue_threads(uint32_t num_frames)
+{
+    sbc_frame_queue_init(&check_queue);
+    uint32_t errors = 0;
+    uint64_t start_ns = host_time_ns();
+
+    std::thread producer([num_frames]() {
+        for (uint32_t sequence = 0; sequence < num_frames; sequence++)
+        {
+            sbc_frame_slot_t *slot;
+            while ((slot = sbc_frame_queue_acquire(&check_queue)) == NULL)
+                std::this_thread::yield();
+            slot->length = 20 + sequence % (SBC_FRAME_MAX_SIZE - 20);
+            slot->generation = (uint16_t)sequence;
+            for (int i = 0; i < slot->length; i++)
+                slot->data[i] = check_frame_byte(sequence, i);
+            sbc_frame_queue_push(&check_queue);
+        }
+    });
+
+    for (uint32_t sequence = 0; sequence < num_frames; sequence++)
+    {
+        const sbc_frame_slot_t *slot;
+        while ((slot = sbc_frame_queue_front(&check_queue)) == NULL)
+            std::this_thread::yield();
+        if (slot->generation != (uint16_t)sequence || slot->length != 20 + sequence % (SBC_FRAME_MAX_SIZE - 20))
+        {
+            errors++;
+        }
+        else
+        {
+            for (int i = 0; i < slot->length; i++)
+            {
+                if (slot->data[i] != check_frame_byte(sequence, i))
+                {
+                    errors++;
+                    break;
+                }
+            }
+        }
+        sbc_frame_queue_pop(&check_queue);
+    }
+    producer.join();
+    uint64_t elapsed_ns = host_time_ns() - start_ns;
+
+    printf("queue: %u frames in %.1f ms (%.0f frames/s), max depth %u, empty polls %u, errors %u\n",
+           num_frames, elapsed_ns / 1e6, num_frames * 1e9 / elapsed_ns,
+           check_queue.max_level, check_queue.underruns, errors);
+    return errors == 0 ? 0 : 1;
+}
+
+static std::atomic<bool> check_core1_running;
+
+// 仮想時間を進める前に、コア1(スレッド)がキューを半分以上埋めるのを待つ。
+// 実機ではコア1の方がリアルタイムより十分速いので、それと同じ状況にする。
+static void check_wait_for_core1(void)
+{
+    uint32_t level, max_level, underruns;
+    do
+    {
+        audio_pipeline_get_queue_stats(&level, &max_level, &underruns);
+    } while (level < SBC_FRAME_QUEUE_SLOTS / 2);
+}
+
+static int check_pipeline(const char *path, int seconds)
+{
+    static const media_codec_configuration_sbc_t configuration = {
+        0, 2, 48000, 16, 8, 2, 53, SBC_CHANNEL_MODE_STEREO, SBC_ALLOCATION_METHOD_SNR};
+    static a2dp_media_sending_context_t context;
+
+    // シングルコア
+    audio_pipeline_set_mode(AUDIO_PIPELINE_SINGLE_CORE);
+    if (wav_source_open(LittleFS, path, true) != 0)
+        return 1;
+    audio_pipeline_init_encoder(&configuration);
+    uint64_t single_ns = host_stream_run(&context, seconds, audio_pipeline_loop);
+    fake_a2dp_sink_t single = fake_a2dp_sink;
+
+    // デュアルコア
+    audio_pipeline_set_mode(AUDIO_PIPELINE_DUAL_CORE);
+    if (wav_source_open(LittleFS, path, true) != 0)
+        return 1;
+    audio_pipeline_init_encoder(&configuration);
+    check_core1_running = true;
+    std::thread core1([]() {
+        while (check_core1_running)
+            audio_pipeline_loop1();
+    });
+    uint64_t dual_ns = host_stream_run(&context, seconds, check_wait_for_core1);
+    check_core1_running = false;
+    core1.join();
+    fake_a2dp_sink_t dual = fake_a2dp_sink;
+    uint32_t level, max_level, underruns;
+    audio_pipeline_get_queue_stats(&level, &max_level, &underruns);
+    audio_pipeline_set_mode(AUDIO_PIPELINE_SINGLE_CORE);
+    wav_source_close();
+
+    bool same = single.sbc_frames == dual.sbc_frames && single.frame_hash == dual.frame_hash;
+    printf("pipeline (%d s): single core %u frames hash %08x, dual core %u frames hash %08x -> %s\n",
+           seconds, single.sbc_frames, single.frame_hash, dual.sbc_frames, dual.frame_hash, same ? "same" : "DIFFERENT");
+    printf("  core 0 (BTstack context) time per second of audio: single %.3f ms, dual %.3f ms\n",
+           single_ns / 1e6 / seconds, dual_ns / 1e6 / seconds);
+    printf("  queue max depth %u/%u\n", max_level, SBC_FRAME_QUEUE_SLOTS);
+    return same ? 0 : 1;
+}
+
+int check_frame_queue_main(int argc, char **argv)
+{
+    const char *path = "queue_input.wav";
+    int seconds = 5;
+    if (argc > 1)
+        seconds = atoi(argv[1]);
+    if (host_write_test_wav(path, 48000, seconds) != 0)
+        return 1;
+    LittleFS.setRoot("");
+
+    int result = check_queue_threads(1000000);
+    result |= check_pipeline(path, seconds);
+    return result;
+}
@@ -0,0 +1,314 @@
+#include "host_commands.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "LittleFS.h"
+#include "audio/ima_adpcm.h"
+#include "audio/pcm_convert.h"
+#include "audio/wav_source.h"
+
+// IMA-ADPCM の WAV(ima_adpcm と wav_source)を確かめます。
+//  - ヘッダの解析(samples_per_block、wav_source_format() が 16bit PCM を返すこと)
+//  - ima_adpcm_decode_block() が、エンコーダが1サンプルずつ進めた予測値と1サンプルも違わないこと、元の PCM との SNR
+//  - wav_source から少しずつ読んだものと、ブロックの途中・境目へのシーク、wav_source_skip()、同じ曲を続けて予約したときの曲間
+//  - 1サンプルあたりの時間: ブロックのデコードと u8 の変換カーネル、wav_source からの読み出しと変換まで(u8 モノラルの WAV と比べる)
+// を確認します。
+
+static const uint32_t CHECK_SAMPLE_RATE = 48000;
+static const uint32_t CHECK_NUM_SAMPLES = 48000 * 3 + 123; // 最後のブロックは半端になる
+static const uint32_t CHECK_READ_SAMPLES = 100;
+
+typedef struct
+{
+    const char *name;
+    const char *path;
+    int num_channels;
+    uint32_t block_align;
+} check_case_t;
+
+static const check_case_t check_cases[] = {
+    {"mono 1024", "ima_mono_1024.wav", 1, 1024},
+    {"stereo 1024", "ima_stereo_1024.wav", 2, 1024},
+    {"mono 256", "ima_mono_256.wav", 1, 256},
+};
+
+// 正弦波のスイープと小さい雑音。チャンネルごとに位相を変える。
+static void check_make_pcm(std::vector<int16_t> *pcm, int num_channels)
+{
+    pcm->resize((size_t)CHECK_NUM_SAMPLES * num_channels);
+    uint32_t noise = 12345;
+    double phase[2] = {0, 1};
+    for (uint32_t n = 0; n < CHECK_NUM_SAMPLES; n++)
+    {
+        double frequency = 100 + 2000.0 * n / CHECK_NUM_SAMPLES;
+        for (int c = 0; c < num_channels; c++)
+        {
+            noise = noise * 1103515245u + 12345u;
+            phase[c] += 2 * M_PI * frequency * (c + 1) / CHECK_SAMPLE_RATE;
+            (*pcm)[(size_t)n * num_channels + c] = (int16_t)(20000 * sin(phase[c]) + (int)((noise >> 16) & 255) - 128);
+        }
+    }
+}
+
+// 新しい位置の最初のサンプルを読むまで読み出し、そこからの CHECK_READ_SAMPLES サンプルが expected と同じか
+static bool check_landing(const int16_t *expected, int num_channels)
+{
+    int16_t data[CHECK_READ_SAMPLES * 2];
+    uint32_t sample;
+    bool requested;
+    uint32_t before = wav_source_landings(&sample, &requested);
+    for (int reads = 0; reads < 100; reads++)
+    {
+        wav_source_service();
+        wav_source_read((uint8_t *)data, CHECK_READ_SAMPLES * num_channels * 2);
+        if (wav_source_landings(&sample, &requested) == before)
+            continue;
+        // 新しい位置の前は無音。この読み出しの後ろから新しい位置のサンプルが並ぶ。
+        for (uint32_t first = 0; first < CHECK_READ_SAMPLES; first++)
+        {
+            uint32_t count = CHECK_READ_SAMPLES - first;
+            if (memcmp(&data[first * num_channels], expected, count * num_channels * 2) != 0)
+                continue;
+            for (uint32_t i = 0; i < first * num_channels; i++)
+            {
+                if (data[i] != 0)
+                    return false;
+            }
+            return requested;
+        }
+        return false;
+    }
+    return false;
+}
+
+static const char *check_queue_path;
+static uint32_t check_queued;
+
+static void check_queue_again(void)
+{
+    if (check_queued < 2 && wav_source_queue(LittleFS, check_queue_path, check_queued + 1) == 0)
+        check_queued++;
+}
+
+static bool check_case(const check_case_t *c)
+{
+    std::vector<int16_t> pcm;
+    check_make_pcm(&pcm, c->num_channels);
+    uint32_t samples_per_block = host_adpcm_samples_per_block(c->block_align, c->num_channels);
+    uint32_t num_blocks = (CHECK_NUM_SAMPLES + samples_per_block - 1) / samples_per_block;
+    std::vector<int16_t> reference((size_t)num_blocks * samples_per_block * c->num_channels);
+    if (host_write_adpcm_wav(c->path, pcm.data(), CHECK_NUM_SAMPLES, c->num_channels, CHECK_SAMPLE_RATE, c->block_align,
+                             reference.data()) != 0)
+        return false;
+
+    // ヘッダ
+    File file = LittleFS.open(c->path, "r");
+    wav_format_t format;
+    bool parse_ok = file && wav_format_parse(file, &format) == WAV_FORMAT_OK && format.format_tag == WAV_FORMAT_IMA_ADPCM &&
+                    format.samples_per_block == samples_per_block && format.block_align == c->block_align &&
+                    format.data_size == num_blocks * c->block_align &&
+                    wav_format_num_samples(&format) == num_blocks * samples_per_block;
+    if (!parse_ok)
+    {
+        printf("  %-12s header NG\n", c->name);
+        return false;
+    }
+
+    // ブロックのデコード
+    std::vector<uint8_t> blocks(format.data_size);
+    file.seek(format.data_offset);
+    file.read(blocks.data(), blocks.size());
+    file.close();
+    std::vector<int16_t> decoded(reference.size());
+    bool decode_ok = true;
+    for (uint32_t b = 0; b < num_blocks; b++)
+    {
+        uint32_t n = ima_adpcm_decode_block(&blocks[(size_t)b * c->block_align], c->block_align, c->num_channels,
+                                            &decoded[(size_t)b * samples_per_block * c->num_channels]);
+        decode_ok &= n == samples_per_block;
+    }
+    decode_ok &= decoded == reference;
+    double signal = 0, noise = 0;
+    for (size_t i = 0; i < pcm.size(); i++)
+    {
+        signal += (double)pcm[i] * pcm[i];
+        noise += (double)(pcm[i] - decoded[i]) * (pcm[i] - decoded[i]);
+    }
+    double snr = 10 * log10(signal / noise);
+
+    // wav_source から少しずつ読む
+    bool read_ok = wav_source_open(LittleFS, c->path, false) == 0;
+    const wav_format_t *output = wav_source_format();
+    read_ok &= output->format_tag == WAV_FORMAT_PCM && output->bits_per_sample == 16 &&
+               output->num_channels == c->num_channels && output->block_align == 2 * c->num_channels;
+    uint32_t total = num_blocks * samples_per_block;
+    std::vector<int16_t> streamed((size_t)(total + CHECK_READ_SAMPLES) * c->num_channels);
+    for (uint32_t n = 0; read_ok && n < total; n += CHECK_READ_SAMPLES)
+    {
+        wav_source_service();
+        wav_source_read((uint8_t *)&streamed[(size_t)n * c->num_channels], CHECK_READ_SAMPLES * c->num_channels * 2);
+    }
+    wav_source_stats_t stats;
+    wav_source_get_stats(&stats);
+    read_ok &= memcmp(streamed.data(), reference.data(), reference.size() * 2) == 0 && stats.underrun_bytes == 0;
+
+    // ブロックの途中・ブロックの境目・最初のブロックの途中へのシーク
+    bool seek_ok = read_ok;
+    for (uint32_t sample : {samples_per_block * 7 + 333 % samples_per_block, samples_per_block * 3, 5u, samples_per_block * 2 - 1})
+    {
+        if (sample + CHECK_READ_SAMPLES > total)
+            continue;
+        wav_source_request_seek(sample);
+        seek_ok &= check_landing(&reference[(size_t)sample * c->num_channels], c->num_channels);
+    }
+
+    // wav_source_skip(): デコードしてある分の中と、ブロックをまたぐ分
+    bool skip_ok = seek_ok;
+    wav_source_request_seek(0);
+    skip_ok &= check_landing(&reference[0], c->num_channels);
+    uint32_t position = CHECK_READ_SAMPLES;
+    int16_t data[CHECK_READ_SAMPLES * 2];
+    for (uint32_t skip : {10u, samples_per_block * 2 + 17, samples_per_block - 1})
+    {
+        wav_source_skip(skip);
+        position += skip;
+        wav_source_service();
+        wav_source_read((uint8_t *)data, CHECK_READ_SAMPLES * c->num_channels * 2);
+        skip_ok &= memcmp(data, &reference[(size_t)position * c->num_channels], CHECK_READ_SAMPLES * c->num_channels * 2) == 0;
+        position += CHECK_READ_SAMPLES;
+    }
+    wav_source_close();
+
+    // 同じ曲を続けて予約して、曲の境目でサンプルが欠けず無音も入らないこと
+    bool gapless_ok = skip_ok;
+    check_queue_path = c->path;
+    check_queued = 0;
+    wav_source_set_queue_callback(check_queue_again);
+    gapless_ok &= wav_source_open(LittleFS, c->path, false) == 0;
+    std::vector<int16_t> played((size_t)(3 * total + CHECK_READ_SAMPLES) * c->num_channels);
+    for (uint32_t n = 0; gapless_ok && n < 3 * total; n += CHECK_READ_SAMPLES)
+    {
+        wav_source_service();
+        wav_source_read((uint8_t *)&played[(size_t)n * c->num_channels], CHECK_READ_SAMPLES * c->num_channels * 2);
+    }
+    wav_source_track_stats_t track;
+    wav_source_get_track_stats(&track);
+    for (int round = 0; gapless_ok && round < 3; round++)
+        gapless_ok &= memcmp(&played[(size_t)round * total * c->num_channels], reference.data(), reference.size() * 2) == 0;
+    gapless_ok &= track.changes == 2 && track.max_gap_samples == 0;
+    wav_source_close();
+    wav_source_set_queue_callback(NULL);
+
+    printf("  %-12s %4u samples/block, %5.2f bits/sample, SNR %5.1f dB, decode %s, read %s, seek %s, skip %s, gapless %s\n",
+           c->name, (unsigned)samples_per_block, 8.0 * c->block_align / samples_per_block / c->num_channels, snr,
+           decode_ok ? "ok" : "NG", read_ok ? "ok" : "NG", seek_ok ? "ok" : "NG", skip_ok ? "ok" : "NG",
+           gapless_ok ? "ok" : "NG");
+    return decode_ok && read_ok && seek_ok && skip_ok && gapless_ok && snr > 30;
+}
+
+static void bench_decode(const char *name, const char *path)
+{
+    File file = LittleFS.open(path, "r");
+    wav_format_t format;
+    if (!file || wav_format_parse(file, &format) != WAV_FORMAT_OK)
+        return;
+    std::vector<uint8_t> block(format.block_align);
+    file.seek(format.data_offset);
+    file.read(block.data(), block.size());
+    file.close();
+    static int16_t pcm[(WAV_FORMAT_MAX_ADPCM_BLOCK_ALIGN - 4) * 2 + 1];
+    const int iterations = 20000;
+    uint64_t start_ns = host_time_ns();
+    for (int i = 0; i < iterations; i++)
+    {
+        ima_adpcm_decode_block(block.data(), format.block_align, format.num_channels, pcm);
+        __asm__ volatile("" : : "r"(pcm) : "memory");
+    }
+    uint64_t elapsed_ns = host_time_ns() - start_ns;
+    printf("  %-34s %6.3f ns/sample\n", name, (double)elapsed_ns / iterations / format.samples_per_block);
+}
+
+static void bench_u8(void)
+{
+    static uint8_t src[1017];
+    static int16_t dst[1017 * 2];
+    for (size_t i = 0; i < sizeof(src); i++)
+        src[i] = (uint8_t)(i * 7);
+    const int iterations = 20000;
+    uint64_t start_ns = host_time_ns();
+    for (int i = 0; i < iterations; i++)
+    {
+        pcm_convert_u8_mono(src, dst, 1016);
+        __asm__ volatile("" : : "r"(dst) : "memory");
+    }
+    uint64_t elapsed_ns = host_time_ns() - start_ns;
+    printf("  %-34s %6.3f ns/sample\n", "u8 mono -> stereo (pcm_convert)", (double)elapsed_ns / iterations / 1016);
+}
+
+// wav_source から読み出してエンコーダに渡す 16bit ステレオにするまで。1回の読み出しは1フレーム(128サンプル)分。
+static void bench_source(const char *name, const char *path, uint32_t seconds)
+{
+    if (wav_source_open(LittleFS, path, true) != 0)
+        return;
+    const wav_format_t *format = wav_source_format();
+    pcm_convert_func_t convert = pcm_convert_select(format, 2);
+    static uint8_t data[128 * 4];
+    static int16_t pcm[128 * 2];
+    uint32_t reads = seconds * CHECK_SAMPLE_RATE / 128;
+    uint64_t busy_ns = 0;
+    for (uint32_t i = 0; i < reads; i++)
+    {
+        wav_source_service();
+        uint64_t start_ns = host_time_ns();
+        wav_source_read(data, 128 * format->block_align);
+        if (convert)
+            convert(data, pcm, 128);
+        busy_ns += host_time_ns() - start_ns;
+    }
+    wav_source_stats_t stats;
+    wav_source_get_stats(&stats);
+    wav_source_close();
+    File file = LittleFS.open(path, "r");
+    wav_format_t file_format;
+    wav_format_parse(file, &file_format);
+    file.close();
+    printf("  %-34s %6.3f ns/sample, file %6u bytes/s, underrun %u bytes\n", name, (double)busy_ns / reads / 128,
+           (unsigned)((uint64_t)file_format.data_size * CHECK_SAMPLE_RATE / wav_format_num_samples(&file_format)),
+           (unsigned)stats.underrun_bytes);
+}
+
+int check_ima_adpcm_main(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+    LittleFS.setRoot("");
+    int result = 0;
+    printf("IMA-ADPCM files (%u samples at %u Hz):\n", (unsigned)CHECK_NUM_SAMPLES, (unsigned)CHECK_SAMPLE_RATE);
+    for (const check_case_t &c : check_cases)
+        result |= check_case(&c) ? 0 : 1;
+
+    // 16bit の WAV と u8 の WAV からの変換(transcode_adpcm)
+    host_test_wav_t wav = {CHECK_SAMPLE_RATE, CHECK_SAMPLE_RATE * 2, 2, 16, false, true};
+    const char *u8_path = "ima_input_u8.wav";
+    bool transcode_ok = host_write_test_wav_ex("ima_input_s16.wav", &wav) == 0 && host_write_test_wav(u8_path, CHECK_SAMPLE_RATE, 5) == 0 &&
+                        host_transcode_adpcm("ima_input_s16.wav", "ima_from_s16.wav", 1024) == 0 &&
+                        host_transcode_adpcm(u8_path, "ima_from_u8.wav", 1024) == 0;
+    transcode_ok &= wav_source_open(LittleFS, "ima_from_s16.wav", false) == 0 && wav_source_format()->num_channels == 2;
+    wav_source_close();
+    printf("  transcode s16 stereo / u8 mono: %s\n", transcode_ok ? "ok" : "NG");
+    result |= transcode_ok ? 0 : 1;
+
+    printf("time per sample:\n");
+    bench_decode("decode mono (block 1024)", "ima_mono_1024.wav");
+    bench_decode("decode stereo (block 1024)", "ima_stereo_1024.wav");
+    bench_decode("decode mono (block 256)", "ima_mono_256.wav");
+    bench_u8();
+    bench_source("wav_source u8 mono", u8_path, 5);
+    bench_source("wav_source IMA-ADPCM mono", "ima_from_u8.wav", 5);
+    printf("%s\n", result == 0 ? "OK" : "NG");
+    return result;
+}
@@ -0,0 +1,356 @@
+#include "host_commands.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "audio/inquiry_ranker.h"
+
+// インクワイアリの結果の順位付け(inquiry_ranker)を確かめます。
+//  1. Class of Device の判定、許可リスト(アドレスと名前)、同じデバイスの結果の合わせ方、候補がいっぱいのときの入れ替え
+//  2. スマートフォン・PC・他人のヘッドホンなどが多い混んだ環境を乱数で作り、最初に見つかったものに接続する以前のやり方と
+//     収集の窓の後に点数順に試すやり方(許可リストなし / あり)で、スピーカーにつながるまでの時間と無駄な接続の割合を比べる
+
+static const uint32_t CHECK_WINDOW_MS = 3 * 1280;      // A2DP_SOURCE_DEMO_INQUIRY_DURATION_1280MS = 3
+static const uint32_t CHECK_CONNECT_MS = 700 + 900;    // ページング + A2DP の設定から最初のパケットまで
+static const uint32_t CHECK_PAGE_TIMEOUT_MS = 2560;    // 応答しない(他の機器につながっている、遠い)
+static const uint32_t CHECK_A2DP_TIMEOUT_MS = 5000;    // ACL はつながるが A2DP のシンクが無い(スマートフォン、PC)
+static const int CHECK_TRIALS = 500;
+
+typedef enum
+{
+    CHECK_PHONE,
+    CHECK_LAPTOP,
+    CHECK_WATCH,
+    CHECK_TV,
+    CHECK_BUSY_HEADPHONES, // 他人のスマートフォンにつながっているヘッドホン
+    CHECK_FAR_SPEAKER,     // 隣の部屋のスピーカー(つながることもある)
+    CHECK_OUR_SPEAKER,
+} check_kind_t;
+
+typedef struct
+{
+    check_kind_t kind;
+    uint32_t cod;
+    int rssi;
+    const char *name;
+} check_kind_info_t;
+
+static const check_kind_info_t check_kinds[] = {
+    {CHECK_PHONE, 0x5a020c, -60, "Pixel"},
+    {CHECK_LAPTOP, 0x3c010c, -65, "ThinkPad"},
+    {CHECK_WATCH, 0x000704, -70, NULL},
+    {CHECK_TV, 0x240438, -75, "BRAVIA"},
+    {CHECK_BUSY_HEADPHONES, 0x240418, -58, "WH-1000XM4"},
+    {CHECK_FAR_SPEAKER, 0x240414, -86, "SRS-XB13"},
+    {CHECK_OUR_SPEAKER, 0x240414, -62, "LBS"},
+};
+
+// 混んだ環境: スマートフォン 8、PC 4、時計 3、テレビ 2、他人のヘッドホン 4、遠いスピーカー 1、こちらのスピーカー 1
+static const int check_population[] = {8, 4, 3, 2, 4, 1, 1};
+
+typedef struct
+{
+    uint8_t address[6];
+    check_kind_t kind;
+    uint32_t cod;
+    int rssi;
+    const char *name;
+} check_device_t;
+
+#define CHECK_MAX_DEVICES 32
+
+static uint32_t check_random_state;
+
+static uint32_t check_random(void)
+{
+    check_random_state = check_random_state * 1664525u + 1013904223u;
+    return check_random_state >> 8;
+}
+
+static int check_make_devices(check_device_t *devices)
+{
+    int num_devices = 0;
+    for (size_t kind = 0; kind < sizeof(check_kinds) / sizeof(check_kinds[0]); kind++)
+    {
+        for (int i = 0; i < check_population[kind]; i++)
+        {
+            check_device_t *device = &devices[num_devices];
+            device->address[0] = (uint8_t)kind;
+            device->address[1] = (uint8_t)i;
+            for (int j = 2; j < 6; j++)
+                device->address[j] = (uint8_t)check_random();
+            device->kind = check_kinds[kind].kind;
+            device->cod = check_kinds[kind].cod;
+            device->rssi = check_kinds[kind].rssi;
+            device->name = check_kinds[kind].name;
+            num_devices++;
+        }
+    }
+    return num_devices;
+}
+
+// 1回のインクワイアリで device が最初に応答する時刻(ms)。RSSI は ±6 dB ゆらぐ。
+static void check_responses(const check_device_t *devices, int num_devices, uint32_t *time_ms, int *rssi)
+{
+    for (int i = 0; i < num_devices; i++)
+    {
+        time_ms[i] = check_random() % CHECK_WINDOW_MS;
+        rssi[i] = devices[i].rssi + (int)(check_random() % 13) - 6;
+    }
+}
+
+// 接続を試した結果(かかった時間)。成功なら true。
+static bool check_attempt(const check_device_t *device, int rssi, uint32_t *cost_ms)
+{
+    switch (device->kind)
+    {
+    case CHECK_OUR_SPEAKER:
+        *cost_ms = CHECK_CONNECT_MS;
+        return true;
+    case CHECK_FAR_SPEAKER:
+        // 遠いほど失敗しやすい
+        if ((int)(check_random() % 30) < rssi + 95)
+        {
+            *cost_ms = CHECK_CONNECT_MS;
+            return true;
+        }
+        *cost_ms = CHECK_PAGE_TIMEOUT_MS;
+        return false;
+    case CHECK_BUSY_HEADPHONES:
+        *cost_ms = CHECK_PAGE_TIMEOUT_MS;
+        return false;
+    default:
+        *cost_ms = CHECK_A2DP_TIMEOUT_MS;
+        return false;
+    }
+}
+
+typedef struct
+{
+    uint64_t total_ms;
+    uint32_t times_ms[CHECK_TRIALS];
+    uint32_t attempts;
+    uint32_t wasted;
+    uint32_t our_speaker;
+    uint32_t far_speaker;
+} check_policy_result_t;
+
+static void check_record(check_policy_result_t *result, int trial, uint32_t now_ms, const check_device_t *connected)
+{
+    result->times_ms[trial] = now_ms;
+    result->total_ms += now_ms;
+    if (connected->kind == CHECK_OUR_SPEAKER)
+        result->our_speaker++;
+    else
+        result->far_speaker++;
+}
+
+// 以前のやり方: 最初に応答したデバイスに接続し、失敗したらインクワイアリからやり直す。
+static void check_first_hit(const check_device_t *devices, int num_devices, int trial, check_policy_result_t *result)
+{
+    uint32_t now_ms = 0;
+    uint32_t time_ms[CHECK_MAX_DEVICES];
+    int rssi[CHECK_MAX_DEVICES];
+    for (;;)
+    {
+        check_responses(devices, num_devices, time_ms, rssi);
+        int first = 0;
+        for (int i = 1; i < num_devices; i++)
+        {
+            if (time_ms[i] < time_ms[first])
+                first = i;
+        }
+        now_ms += time_ms[first];
+        uint32_t cost_ms;
+        result->attempts++;
+        bool ok = check_attempt(&devices[first], rssi[first], &cost_ms);
+        now_ms += cost_ms;
+        if (ok)
+        {
+            check_record(result, trial, now_ms, &devices[first]);
+            return;
+        }
+        result->wasted++;
+    }
+}
+
+// 収集の窓の間に結果を inquiry_ranker に渡し、窓が終わったら(許可リストのものが見つかったらそのとき)点数順に試す。
+static void check_ranked(const check_device_t *devices, int num_devices, int trial, const char *const *allowlist,
+                         int allowlist_size, check_policy_result_t *result)
+{
+    inquiry_ranker_t ranker;
+    inquiry_ranker_init(&ranker, allowlist, allowlist_size);
+    uint32_t now_ms = 0;
+    uint32_t time_ms[CHECK_MAX_DEVICES];
+    int rssi[CHECK_MAX_DEVICES];
+    for (;;)
+    {
+        inquiry_ranker_reset(&ranker);
+        check_responses(devices, num_devices, time_ms, rssi);
+        // 応答の順に渡す
+        uint32_t window_end_ms = CHECK_WINDOW_MS;
+        bool done[CHECK_MAX_DEVICES] = {};
+        for (int n = 0; n < num_devices; n++)
+        {
+            int next = -1;
+            for (int i = 0; i < num_devices; i++)
+            {
+                if (!done[i] && (next < 0 || time_ms[i] < time_ms[next]))
+                    next = i;
+            }
+            done[next] = true;
+            const char *name = devices[next].name;
+            inquiry_ranker_add(&ranker, devices[next].address, devices[next].cod, rssi[next], name, name ? (int)strlen(name) : 0);
+            if (inquiry_ranker_has_allowlisted(&ranker))
+            {
+                window_end_ms = time_ms[next];
+                break;
+            }
+        }
+        now_ms += window_end_ms;
+        uint8_t address[6];
+        while (inquiry_ranker_next(&ranker, address, NULL))
+        {
+            const check_device_t *device = NULL;
+            int index = 0;
+            for (int i = 0; i < num_devices; i++)
+            {
+                if (memcmp(devices[i].address, address, 6) == 0)
+                {
+                    device = &devices[i];
+                    index = i;
+                }
+            }
+            uint32_t cost_ms;
+            bool ok = check_attempt(device, rssi[index], &cost_ms);
+            now_ms += cost_ms;
+            if (ok)
+            {
+                inquiry_ranker_connected(&ranker);
+                check_record(result, trial, now_ms, device);
+                inquiry_ranker_stats_t stats;
+                inquiry_ranker_get_stats(&ranker, &stats);
+                result->attempts += stats.attempts;
+                result->wasted += stats.wasted;
+                return;
+            }
+        }
+    }
+}
+
+static int check_compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static void check_print(const char *name, check_policy_result_t *result)
+{
+    qsort(result->times_ms, CHECK_TRIALS, sizeof(uint32_t), check_compare_u32);
+    printf("  %-26s time to stream avg %6.0f ms, p50 %5u ms, p90 %6u ms | attempts %5u, wasted %5u (%4.1f%%) | our speaker %3u/%d\n",
+           name, (double)result->total_ms / CHECK_TRIALS, (unsigned)result->times_ms[CHECK_TRIALS / 2],
+           (unsigned)result->times_ms[CHECK_TRIALS * 9 / 10], (unsigned)result->attempts, (unsigned)result->wasted,
+           result->attempts ? result->wasted * 100.0 / result->attempts : 0.0, (unsigned)result->our_speaker, CHECK_TRIALS);
+}
+
+static int check_ranker_rules(void)
+{
+    static const char *const allowlist[] = {"AA:BB:CC:DD:EE:FF", "LBS"};
+    inquiry_ranker_t ranker;
+    inquiry_ranker_init(&ranker, allowlist, 2);
+    static const uint8_t phone[6] = {1, 0, 0, 0, 0, 1};
+    static const uint8_t speaker[6] = {1, 0, 0, 0, 0, 2};
+    static const uint8_t headphones[6] = {1, 0, 0, 0, 0, 3};
+    static const uint8_t odd_cod[6] = {0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF};
+    static const uint8_t named[6] = {1, 0, 0, 0, 0, 5};
+    bool ok = !inquiry_ranker_is_audio_sink(0x5a020c) && !inquiry_ranker_is_audio_sink(0x240438) &&
+              !inquiry_ranker_is_audio_sink(0x240410) && inquiry_ranker_is_audio_sink(0x240414) &&
+              inquiry_ranker_is_audio_sink(0x240418) && inquiry_ranker_is_audio_sink(0x200404);
+    ok &= inquiry_ranker_add(&ranker, phone, 0x5a020c, -40, "phone", 5) < 0;
+    ok &= inquiry_ranker_add(&ranker, speaker, 0x240414, -70, NULL, 0) == -70 + INQUIRY_RANKER_SPEAKER_BONUS;
+    // 同じデバイス: 強い方の RSSI と、後から来た名前
+    ok &= inquiry_ranker_add(&ranker, speaker, 0x240414, -80, "Speaker", 7) ==
+          -70 + INQUIRY_RANKER_NAME_BONUS + INQUIRY_RANKER_SPEAKER_BONUS;
+    ok &= inquiry_ranker_add(&ranker, headphones, 0x240418, -60, NULL, 0) == -60;
+    ok &= !inquiry_ranker_has_allowlisted(&ranker);
+    // 許可リスト: クラスが違ってもアドレスで入る / 名前の先頭
+    ok &= inquiry_ranker_add(&ranker, odd_cod, 0x000000, -90, NULL, 0) == -90 + INQUIRY_RANKER_ALLOWLIST_SCORE;
+    ok &= inquiry_ranker_add(&ranker, named, 0x5a020c, -95, "LBS-2024", 8) ==
+          -95 + INQUIRY_RANKER_NAME_BONUS + INQUIRY_RANKER_ALLOWLIST_SCORE;
+    ok &= inquiry_ranker_has_allowlisted(&ranker);
+    // 試す順: 許可リスト(-84 > -89)、スピーカー(-54)、ヘッドホン(-60)
+    const uint8_t *order[] = {named, odd_cod, speaker, headphones};
+    uint8_t address[6];
+    for (const uint8_t *expected : order)
+        ok &= inquiry_ranker_next(&ranker, address, NULL) && memcmp(address, expected, 6) == 0;
+    ok &= !inquiry_ranker_next(&ranker, address, NULL);
+    inquiry_ranker_stats_t stats;
+    inquiry_ranker_get_stats(&ranker, &stats);
+    ok &= stats.results == 6 && stats.ignored == 1 && stats.attempts == 4 && stats.wasted == 4;
+
+    // いっぱいのときは、一番低いものより強ければ入れ替える
+    inquiry_ranker_reset(&ranker);
+    uint8_t many[INQUIRY_RANKER_MAX_DEVICES + 1][6];
+    for (int i = 0; i < INQUIRY_RANKER_MAX_DEVICES; i++)
+    {
+        memset(many[i], 0x20 + i, 6);
+        inquiry_ranker_add(&ranker, many[i], 0x240414, -80 + i, NULL, 0);
+    }
+    memset(many[INQUIRY_RANKER_MAX_DEVICES], 0x7f, 6);
+    inquiry_ranker_add(&ranker, many[INQUIRY_RANKER_MAX_DEVICES], 0x240414, -30, NULL, 0);
+    ok &= inquiry_ranker_next(&ranker, address, NULL) && memcmp(address, many[INQUIRY_RANKER_MAX_DEVICES], 6) == 0;
+    int remaining = 0;
+    bool dropped_weakest = true;
+    while (inquiry_ranker_next(&ranker, address, NULL))
+    {
+        remaining++;
+        dropped_weakest &= memcmp(address, many[0], 6) != 0;
+    }
+    ok &= remaining == INQUIRY_RANKER_MAX_DEVICES - 1 && dropped_weakest;
+    printf("  class of device filter, allowlist, duplicates, order, replacement when full -> %s\n", ok ? "OK" : "NG");
+    return ok ? 0 : 1;
+}
+
+int check_inquiry_main(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+    int result = 0;
+    printf("ranker rules:\n");
+    result |= check_ranker_rules();
+
+    static check_policy_result_t first_hit, ranked, allowlisted;
+    static const char *const allowlist[] = {"LBS"};
+    for (int trial = 0; trial < CHECK_TRIALS; trial++)
+    {
+        check_random_state = 12345u + trial * 7919u;
+        check_device_t devices[CHECK_MAX_DEVICES];
+        int num_devices = check_make_devices(devices);
+        uint32_t seed = check_random_state;
+        check_first_hit(devices, num_devices, trial, &first_hit);
+        check_random_state = seed;
+        check_ranked(devices, num_devices, trial, NULL, 0, &ranked);
+        check_random_state = seed;
+        check_ranked(devices, num_devices, trial, allowlist, 1, &allowlisted);
+    }
+    int num_devices = 0;
+    for (int count : check_population)
+        num_devices += count;
+    printf("crowded room (%d devices, 1 of them our speaker, window %u ms, %d trials):\n", num_devices,
+           (unsigned)CHECK_WINDOW_MS, CHECK_TRIALS);
+    double first_hit_avg = (double)first_hit.total_ms / CHECK_TRIALS;
+    double ranked_avg = (double)ranked.total_ms / CHECK_TRIALS;
+    double allowlisted_avg = (double)allowlisted.total_ms / CHECK_TRIALS;
+    double first_hit_wasted = (double)first_hit.wasted / first_hit.attempts;
+    double ranked_wasted = (double)ranked.wasted / ranked.attempts;
+    check_print("first hit (before)", &first_hit);
+    check_print("ranked window", &ranked);
+    check_print("ranked window + allowlist", &allowlisted);
+    result |= ranked_avg < first_hit_avg && allowlisted_avg < ranked_avg && ranked_wasted < first_hit_wasted &&
+                      allowlisted.wasted == 0 && allowlisted.our_speaker == CHECK_TRIALS
+                  ? 0
+                  : 1;
+    printf("%s\n", result == 0 ? "OK" : "NG");
+    return result;
+}
@@ -0,0 +1,210 @@
+#include "host_commands.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "LittleFS.h"
+#include "fake_btstack.h"
+#include "host_stream.h"
+#include "audio/audio_pipeline.h"
+#include "audio/wav_source.h"
+
+// スピーカーで鳴るまでの遅れ(delay report・送信完了を待つパケット・まだ送っていない音声)を確かめます。
+// 仮想時間のスピーカーは、パケットを受け取ってから報告した遅延の後に鳴らすものとし(最初のパケットを受け取った時刻が基準)、
+//  - delay report の記録(数・変わった回数・最小・最大)
+//  - 送信完了を待つメディアパケット数が、コントローラ(fake_btstack)が送り終えていないメディアパケット数と一致すること。
+//    メディアパケットはコントローラの ACL の長さで分けて送られ、完了は ACL パケットごとに来る。
+//    delay report の応答(シグナリング)の完了も同じ接続で来るので、その数までは少なく数えてよい
+//  - AVRCP に返す再生位置(audio_pipeline_playback_position_ms)と、スピーカーで鳴っている位置の差が1パケット分以内であること
+//    (送った位置 audio_pipeline_position_ms の差は遅延の分だけある)
+//  - エンドツーエンドのレイテンシ(今時刻が来たサンプルが鳴るまで)の見積もりと、スピーカーでの値の差が1パケット分以内であること
+// を、空いたリンク・混んだリンク・ACL の長さが短いリンク・delay report の無いスピーカーで確認します。
+// 比べやすいように、ビットプールは固定します。
+
+static const int CHECK_SECONDS = 5;
+static const uint32_t CHECK_RATE = 48000;
+static const uint16_t CHECK_DELAY_100US = 1500;        // 最初に報告する遅延(150 ms)
+static const uint16_t CHECK_CHANGED_DELAY_100US = 1800; // 再生中に変わった遅延(180 ms)
+static const uint32_t CHECK_CHANGE_MS = 2500;
+// 最初のパケットが鳴り始めてから、これより後を比べる(ms)
+static const uint32_t CHECK_SETTLE_MS = 100;
+
+typedef struct
+{
+    const char *name;
+    uint32_t completion_delay_ms;    // パケットを送ってから送り終えるまで
+    uint32_t can_send_now_delay_ms;  // CAN_SEND_NOW の遅れ
+    bool delay_reports;              // スピーカーが delay report を送る
+    uint16_t acl_packet_length;      // コントローラの ACL の長さ
+} check_link_t;
+
+typedef struct
+{
+    uint32_t samples;
+    uint32_t in_flight_over;       // 送信完了を待つパケット数がコントローラより多かった回数
+    uint32_t max_in_flight_under;  // コントローラより少なかったパケット数の最大(シグナリングの完了の分)
+    uint32_t max_in_flight_packets;
+    uint64_t total_in_flight_us;
+    uint64_t total_local_us;
+    uint64_t total_latency_us;
+    int32_t max_position_error_ms; // 再生位置とスピーカーで鳴っている位置の差の最大(絶対値)
+    int64_t total_sent_error_ms;   // 送った位置とスピーカーで鳴っている位置の差の合計
+    int32_t max_latency_error_ms;  // レイテンシの見積もりとスピーカーでの値の差の最大(絶対値)
+    uint32_t packet_ms;            // 1パケットの音声の長さ
+    uint32_t media_packets;
+    uint32_t acl_packets;
+    uint32_t signaling_packets;
+    audio_latency_stats_t last;
+} check_result_t;
+
+static a2dp_media_sending_context_t check_context;
+static const check_link_t *check_current;
+static check_result_t check_result;
+
+static int32_t check_abs(int32_t value)
+{
+    return value < 0 ? -value : value;
+}
+
+static void check_each_ms(void)
+{
+    uint32_t now = fake_btstack_time_ms();
+    a2dp_media_sending_context_t *context = &check_context;
+    // delay report を受け取ると、BTstack は同じ接続で応答を返す。
+    if (check_current->delay_reports && (now == 1 || now == CHECK_CHANGE_MS))
+    {
+        audio_pipeline_set_sink_delay(context, now == 1 ? CHECK_DELAY_100US : CHECK_CHANGED_DELAY_100US);
+        fake_btstack_send_signaling(context->local_seid);
+    }
+    audio_pipeline_packets_completed(context, fake_btstack_take_completed_packets(context->local_seid));
+    audio_pipeline_loop();
+
+    const fake_a2dp_sink_t *sink = &fake_a2dp_sink;
+    audio_latency_stats_t stats;
+    audio_pipeline_get_latency_stats(context, &stats);
+    int32_t under = (int32_t)(sink->packets - sink->completed_packets) - (int32_t)stats.in_flight_packets;
+    if (under < 0)
+        check_result.in_flight_over++;
+    else if ((uint32_t)under > check_result.max_in_flight_under)
+        check_result.max_in_flight_under = under;
+    uint32_t delay_ms = stats.sink_delay_us / 1000;
+    if (sink->completed_packets == 0 || now < sink->first_completed_ms + delay_ms + CHECK_SETTLE_MS || context->fragment_offset != 0)
+        return;
+
+    // スピーカーは最初のパケットを受け取ってから delay_ms 後にRTPタイムスタンプ first_timestamp を鳴らし、そこから実時間で進む。
+    int32_t heard_ms = (int32_t)(now - sink->first_completed_ms - delay_ms) + (int32_t)(sink->first_timestamp * 1000 / CHECK_RATE);
+    int32_t position_error = (int32_t)audio_pipeline_playback_position_ms(context) - heard_ms;
+    if (check_abs(position_error) > check_result.max_position_error_ms)
+        check_result.max_position_error_ms = check_abs(position_error);
+    check_result.total_sent_error_ms += (int32_t)audio_pipeline_position_ms(context) - heard_ms;
+    // 今時刻が来たサンプルがスピーカーで鳴るまでの時間
+    int32_t due_ms = (int32_t)(context->clock.samples_due * 1000 / CHECK_RATE);
+    int32_t latency_ms = due_ms - heard_ms;
+    int32_t latency_error = (int32_t)(stats.total_us / 1000) - latency_ms;
+    if (check_abs(latency_error) > check_result.max_latency_error_ms)
+        check_result.max_latency_error_ms = check_abs(latency_error);
+
+    check_result.samples++;
+    check_result.total_in_flight_us += stats.in_flight_us;
+    check_result.total_local_us += stats.local_us;
+    check_result.total_latency_us += stats.total_us;
+    if (stats.in_flight_packets > check_result.max_in_flight_packets)
+        check_result.max_in_flight_packets = stats.in_flight_packets;
+    check_result.packet_ms = context->payload_plan.frames_per_packet * 128 * 1000 / CHECK_RATE;
+    check_result.last = stats;
+}
+
+static check_result_t check_run(const char *path, const check_link_t *link)
+{
+    static const media_codec_configuration_sbc_t configuration = {
+        0, 2, 48000, 16, 8, 2, 53, SBC_CHANNEL_MODE_JOINT_STEREO, SBC_ALLOCATION_METHOD_LOUDNESS};
+    check_result = {};
+    check_current = link;
+    if (wav_source_open(LittleFS, path, true) != 0)
+        return check_result;
+    audio_pipeline_init_encoder(&configuration);
+    fake_btstack_set_completion_delay_ms(link->completion_delay_ms);
+    fake_btstack_set_can_send_now_delay_ms(link->can_send_now_delay_ms);
+    fake_btstack_set_acl_packet_length(link->acl_packet_length);
+    host_stream_run(&check_context, CHECK_SECONDS, check_each_ms);
+    check_result.acl_packets = fake_a2dp_sink.acl_packets;
+    check_result.media_packets = fake_a2dp_sink.packets;
+    check_result.signaling_packets = fake_a2dp_sink.signaling_packets;
+    fake_btstack_set_acl_packet_length(1021);
+    fake_btstack_set_completion_delay_ms(0);
+    fake_btstack_set_can_send_now_delay_ms(0);
+    wav_source_close();
+    return check_result;
+}
+
+static void check_print(const check_link_t *link, const check_result_t *result)
+{
+    uint32_t n = result->samples > 0 ? result->samples : 1;
+    const sink_delay_stats_t *delay = &result->last.delay;
+    printf("  %s (sent -> completed %u ms, CAN_SEND_NOW +%u ms, ACL %u bytes):\n", link->name, (unsigned)link->completion_delay_ms,
+           (unsigned)link->can_send_now_delay_ms, (unsigned)link->acl_packet_length);
+    printf("    delay reports %u, %u changes, %u..%u ms, now %u ms\n", (unsigned)delay->reports, (unsigned)delay->changes,
+           (unsigned)delay->min_delay_100us / 10, (unsigned)delay->max_delay_100us / 10, (unsigned)result->last.sink_delay_us / 1000);
+    printf("    latency mean %.1f ms = local %.1f ms + in flight %.1f ms (max %u packets) + sink delay, max %.1f ms\n",
+           result->total_latency_us / 1e3 / n, result->total_local_us / 1e3 / n, result->total_in_flight_us / 1e3 / n,
+           (unsigned)result->max_in_flight_packets, result->last.max_total_us / 1e3);
+    printf("    vs speaker: play position error max %d ms (sent position mean %+.1f ms), latency error max %d ms, packet %u ms\n",
+           (int)result->max_position_error_ms, (double)result->total_sent_error_ms / n, (int)result->max_latency_error_ms,
+           (unsigned)result->packet_ms);
+    printf("    %u media packets in %u ACL packets, %u signaling packets, in flight over %u, under max %u packets\n",
+           (unsigned)result->media_packets, (unsigned)result->acl_packets, (unsigned)result->signaling_packets,
+           (unsigned)result->in_flight_over, (unsigned)result->max_in_flight_under);
+}
+
+static bool check_ok(const check_link_t *link, const check_result_t *result)
+{
+    const sink_delay_stats_t *delay = &result->last.delay;
+    bool delay_ok = link->delay_reports ? delay->reports == 2 && delay->changes == 1 && delay->min_delay_100us == CHECK_DELAY_100US &&
+                                              delay->max_delay_100us == CHECK_CHANGED_DELAY_100US &&
+                                              result->last.sink_delay_us == CHECK_CHANGED_DELAY_100US * 100u
+                                        : delay->reports == 0 && result->last.sink_delay_us == 0;
+    // 送信完了はパケット単位、まだ送っていない音声はタイマーの周期単位で数えるので、1パケットと1周期くらいまでずれる。
+    int32_t limit_ms = (int32_t)result->packet_ms + AUDIO_TIMEOUT_MS;
+    uint32_t n = result->samples > 0 ? result->samples : 1;
+    // 遅延を引かない送った位置は、スピーカーで鳴っている位置より遅延の分以上先を行く。
+    bool sent_ahead = !link->delay_reports || result->total_sent_error_ms / n >= CHECK_DELAY_100US / 10;
+    bool in_flight_ok = result->in_flight_over == 0 && result->max_in_flight_under <= result->signaling_packets;
+    return result->samples > 0 && delay_ok && in_flight_ok && result->max_position_error_ms <= limit_ms &&
+           result->max_latency_error_ms <= limit_ms && sent_ahead;
+}
+
+int check_latency_main(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+    const char *path = "latency_input.wav";
+    if (host_write_test_wav(path, CHECK_RATE, CHECK_SECONDS) != 0)
+        return 1;
+    LittleFS.setRoot("");
+    audio_pipeline_set_adaptive_bitpool(false);
+
+    static const check_link_t links[] = {
+        {"clear link", 3, 0, true, 1021},
+        {"busy link", 12, 8, true, 1021},
+        {"short ACL packets", 12, 8, true, 251},
+        {"no delay reports", 3, 0, false, 1021},
+    };
+    const int num_links = sizeof(links) / sizeof(links[0]);
+    check_result_t results[num_links];
+    for (int i = 0; i < num_links; i++)
+        results[i] = check_run(path, &links[i]);
+    audio_pipeline_set_adaptive_bitpool(true);
+
+    printf("streaming 48k joint bitpool 53 for %d s, sink delay %u ms then %u ms from %u ms:\n", CHECK_SECONDS,
+           (unsigned)CHECK_DELAY_100US / 10, (unsigned)CHECK_CHANGED_DELAY_100US / 10, (unsigned)CHECK_CHANGE_MS);
+    int result = 0;
+    for (int i = 0; i < num_links; i++)
+    {
+        check_print(&links[i], &results[i]);
+        result |= check_ok(&links[i], &results[i]) ? 0 : 1;
+    }
+    // 混んだリンクでは、送信完了を待つ音声が増える。
+    result |= results[1].total_in_flight_us / (results[1].samples + 1) > results[0].total_in_flight_us / (results[0].samples + 1) ? 0 : 1;
+    printf("%s\n", result == 0 ? "OK" : "NG");
+    return result;
+}
@@ -0,0 +1,137 @@
+#include "host_commands.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "LittleFS.h"
+#include "fake_btstack.h"
+#include "host_stream.h"
+#include "audio/audio_pipeline.h"
+#include "audio/wav_source.h"
+
+// メディアクロック(media_clock)で送るサンプル数が実時間からずれないことを、仮想時間で何時間もストリーミングして確かめます。
+// タイマーは期限の ms から 0..CHECK_JITTER_US 遅れて発火させ、1時間ごとに
+//  - 時計が数えたサンプル数と、経過時間 * サンプリング周波数 の差
+//  - RTPタイムスタンプの遅れ(送ったサンプル数と経過時間 * サンプリング周波数 の差)の最大値
+// を表示し、どちらも時間がたっても増えないこと(ドリフトが 0)を確認します。
+// あわせて、RTPタイムスタンプ + 組み立て中のパケット + 溜まったサンプル が時計の数えたサンプル数と毎ms一致することも確認します。
+
+static const uint32_t CHECK_JITTER_US = 900;
+
+typedef struct
+{
+    uint32_t sample_rate;
+    uint32_t tick_us;
+} check_clock_config_t;
+
+static const check_clock_config_t check_clock_configs[] = {{48000, 10000}, {44100, 10000}, {44100, 7500}};
+
+static a2dp_media_sending_context_t check_context;
+static uint32_t check_samples_per_frame;
+static uint64_t check_mismatches;
+static int64_t check_max_lag;       // この1時間の RTPタイムスタンプの遅れの最大値
+static int64_t check_first_max_lag; // 最初の1時間の遅れの最大値
+static int64_t check_last_max_lag;
+static int64_t check_max_offset;    // 時計の数えたサンプル数と理想値の差の絶対値の最大値
+static uint32_t check_hours;
+
+static void check_each_ms(void)
+{
+    audio_pipeline_loop();
+    const media_clock_t *clock = &check_context.clock;
+    uint64_t now_us = (uint64_t)fake_btstack_time_ms() * 1000;
+    uint64_t ideal = (now_us - clock->start_us) * clock->sample_rate / 1000000;
+
+    // RTPタイムスタンプは 0 から始まり 2^32 で戻るので、時計の値も下位32bitで比べる。
+    uint32_t accounted = check_context.rtp_timestamp + check_context.sbc_storage_frames * check_samples_per_frame +
+                         check_context.samples_ready;
+    if (accounted != (uint32_t)clock->samples_due)
+        check_mismatches++;
+
+    int64_t offset = (int64_t)ideal - (int64_t)clock->samples_due;
+    if (llabs(offset) > check_max_offset)
+        check_max_offset = llabs(offset);
+    uint64_t sent = clock->samples_due - check_context.sbc_storage_frames * check_samples_per_frame - check_context.samples_ready;
+    int64_t lag = (int64_t)ideal - (int64_t)sent;
+    if (lag > check_max_lag)
+        check_max_lag = lag;
+
+    if (now_us > 1000 && (now_us - 1000) % 3600000000ull == 0)
+    {
+        check_hours++;
+        printf("    %2u h: samples due %11llu, ideal %11llu (offset %lld), rtp timestamp lag max %lld samples\n",
+               (unsigned)check_hours, (unsigned long long)clock->samples_due, (unsigned long long)ideal,
+               (long long)offset, (long long)check_max_lag);
+        if (check_hours == 1)
+            check_first_max_lag = check_max_lag;
+        check_last_max_lag = check_max_lag;
+        check_max_lag = 0;
+    }
+}
+
+static int check_run(const char *path, const check_clock_config_t *config, int hours)
+{
+    media_codec_configuration_sbc_t configuration = {
+        0, 2, (int)config->sample_rate, 16, 8, 2, 53, SBC_CHANNEL_MODE_STEREO, SBC_ALLOCATION_METHOD_SNR};
+    if (wav_source_open(LittleFS, path, true) != 0)
+        return 1;
+    audio_pipeline_init_encoder(&configuration);
+    audio_pipeline_set_tick_us(config->tick_us);
+    check_samples_per_frame = configuration.block_length * configuration.subbands;
+    check_mismatches = 0;
+    check_max_lag = 0;
+    check_max_offset = 0;
+    check_hours = 0;
+
+    printf("  %u Hz, tick %u us:\n", (unsigned)config->sample_rate, (unsigned)config->tick_us);
+    fake_btstack_set_timer_jitter_us(CHECK_JITTER_US);
+    host_stream_run(&check_context, hours * 3600 + 1, check_each_ms);
+    fake_btstack_set_timer_jitter_us(0);
+    audio_pipeline_set_tick_us(AUDIO_TIMEOUT_MS * 1000);
+    wav_source_close();
+
+    media_clock_stats_t stats;
+    audio_pipeline_get_clock_stats(&check_context, &stats);
+    printf("    timer: %u ticks, jitter mean %u us, max %u us\n", (unsigned)stats.ticks, (unsigned)stats.mean_jitter_us,
+           (unsigned)stats.max_jitter_us);
+    uint32_t lower = 0;
+    for (int i = 0; i < MEDIA_CLOCK_JITTER_BUCKETS; i++)
+    {
+        if (i < MEDIA_CLOCK_JITTER_BUCKETS - 1)
+            printf("      %5u - %5u us: %u\n", (unsigned)lower, (unsigned)media_clock_jitter_limits_us[i], (unsigned)stats.histogram[i]);
+        else
+            printf("      %5u us -      : %u\n", (unsigned)lower, (unsigned)stats.histogram[i]);
+        if (i < MEDIA_CLOCK_JITTER_BUCKETS - 1)
+            lower = media_clock_jitter_limits_us[i];
+    }
+
+    // 時計は発火した時刻までのサンプルを数えるので、理想値との差は1周期 + ジッタ分のサンプル数を超えない。
+    int64_t max_offset = (int64_t)((uint64_t)(config->tick_us + 1000 + CHECK_JITTER_US) * config->sample_rate / 1000000);
+    bool ok = check_mismatches == 0 && check_max_offset <= max_offset && check_last_max_lag <= check_first_max_lag &&
+              check_hours == (uint32_t)hours;
+    printf("    max offset %lld samples (limit %lld), accounting mismatches %llu, rtp lag max first hour %lld / last hour %lld: %s\n",
+           (long long)check_max_offset, (long long)max_offset, (unsigned long long)check_mismatches,
+           (long long)check_first_max_lag, (long long)check_last_max_lag, ok ? "no drift" : "DRIFT");
+    return ok ? 0 : 1;
+}
+
+int check_media_clock_main(int argc, char **argv)
+{
+    int hours = argc > 1 ? atoi(argv[1]) : 3;
+    if (hours < 1)
+        hours = 1;
+    LittleFS.setRoot("");
+
+    printf("media clock: %d h of virtual time per configuration, timer jitter 0..%u us\n", hours, (unsigned)CHECK_JITTER_US);
+    int result = 0;
+    for (const check_clock_config_t &config : check_clock_configs)
+    {
+        // WAV は送信と同じ周波数にし、レート変換を挟まない。
+        const char *path = "clock_input.wav";
+        if (host_write_test_wav(path, config.sample_rate, 5) != 0)
+            return 1;
+        result |= check_run(path, &config, hours);
+    }
+    printf("%s\n", result == 0 ? "OK" : "NG");
+    return result;
+}
@@ -0,0 +1,267 @@
+#include "host_commands.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "LittleFS.h"
+#include "audio/mp3_decoder.h"
+#include "audio/mp3_frame.h"
+#include "audio/wav_source.h"
+
+// MP3 のファイル(mp3_frame、mp3_decoder と wav_source)を確かめます。
+//  - ID3v2/ID3v1 タグ、Xing/Info フレーム、VBR の解析と曲の長さ
+//  - wav_source から読んで、すべてのフレームをデコードし、ちょうどその分のサンプルを返すこと
+//  - フレームの境目・途中へのシーク、フレームの間のゴミからの同期の取り直し、同じ曲を続けて予約したときの曲間
+//  - 1フレームのデコードの時間、実時間に対する割合(RTF)、デコーダのヒープと wav_source のバッファの大きさ
+// テスト用のフレームは音の無いフレーム(サイド情報もメインデータも 0)です。
+// 実際の曲のデコードの時間は `program mp3 <file.mp3>` で測ります。
+
+static const uint32_t CHECK_SAMPLE_RATE = 48000;
+static const uint32_t CHECK_FRAMES = 200;
+static const uint32_t CHECK_READ_SAMPLES = 128;
+
+// MPEG-1 Layer III 48kHz のビットレートの番号
+static const int CHECK_128K = 9;  // 384 バイト
+static const int CHECK_192K = 11; // 576 バイト
+static const int CHECK_64K = 5;   // 192 バイト
+
+static void check_put_frame(std::vector<uint8_t> *file, int bitrate_index, int num_channels, uint32_t xing_frames)
+{
+    static const uint16_t kbps[] = {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320};
+    uint32_t frame_bytes = 144 * kbps[bitrate_index] * 1000 / CHECK_SAMPLE_RATE;
+    size_t start = file->size();
+    file->resize(start + frame_bytes);
+    uint8_t *frame = &(*file)[start];
+    frame[0] = 0xFF;
+    frame[1] = 0xFB; // MPEG-1, Layer III, CRC なし
+    frame[2] = (uint8_t)(bitrate_index << 4 | 1 << 2); // 48kHz、パディングなし
+    frame[3] = num_channels == 1 ? 0xC0 : 0x40;       // mono / joint stereo
+    if (xing_frames > 0)
+    {
+        uint8_t *xing = frame + 4 + (num_channels == 1 ? 17 : 32);
+        memcpy(xing, "Info", 4);
+        xing[7] = 1;
+        for (int i = 0; i < 4; i++)
+            xing[8 + i] = (uint8_t)(xing_frames >> (24 - 8 * i));
+    }
+}
+
+typedef struct
+{
+    int num_channels;
+    bool id3;            // ID3v2(中に同期ワードに見えるバイトを入れる)と ID3v1 タグ
+    bool vbr;            // 128k / 192k / 64k を順に使い、Info フレームにフレーム数を書く
+    uint32_t garbage_at; // このフレームの後に 37 バイトのゴミを入れる(0 なら入れない)
+} check_mp3_file_t;
+
+static const uint32_t CHECK_GARBAGE_BYTES = 37;
+
+static uint32_t check_write_mp3(const char *path, const check_mp3_file_t *spec, uint32_t *first_frame)
+{
+    std::vector<uint8_t> file;
+    if (spec->id3)
+    {
+        // ID3v2.3、中身 300 バイト
+        static const uint8_t id3[10] = {'I', 'D', '3', 3, 0, 0, 0, 0, 2, 44};
+        file.insert(file.end(), id3, id3 + 10);
+        file.resize(file.size() + 300, 0x20);
+        file[20] = 0xFF;
+        file[21] = 0xFB;
+    }
+    if (spec->vbr)
+        check_put_frame(&file, CHECK_128K, spec->num_channels, CHECK_FRAMES);
+    *first_frame = (uint32_t)file.size();
+    for (uint32_t i = 0; i < CHECK_FRAMES; i++)
+    {
+        static const int vbr[] = {CHECK_128K, CHECK_192K, CHECK_64K};
+        check_put_frame(&file, spec->vbr ? vbr[i % 3] : CHECK_128K, spec->num_channels, 0);
+        if (spec->garbage_at != 0 && i == spec->garbage_at)
+            file.resize(file.size() + CHECK_GARBAGE_BYTES, 0x00);
+    }
+    uint32_t end = (uint32_t)file.size();
+    if (spec->id3)
+    {
+        file.resize(file.size() + 128, 0);
+        memcpy(&file[end], "TAG", 3);
+    }
+    FILE *fp = fopen(path, "wb");
+    if (!fp)
+        return 0;
+    fwrite(file.data(), 1, file.size(), fp);
+    fclose(fp);
+    return end - *first_frame;
+}
+
+// num_samples サンプルを読んで、アンダーランが無いか
+static bool check_read_samples(uint32_t num_samples, int num_channels)
+{
+    static int16_t data[CHECK_READ_SAMPLES * 2];
+    wav_source_stats_t before, after;
+    wav_source_get_stats(&before);
+    for (uint32_t n = 0; n < num_samples; n += CHECK_READ_SAMPLES)
+    {
+        wav_source_service();
+        wav_source_read((uint8_t *)data, CHECK_READ_SAMPLES * num_channels * 2);
+    }
+    wav_source_get_stats(&after);
+    return after.underrun_bytes == before.underrun_bytes;
+}
+
+// ファイルの末尾より先まで読んで、デコードしたフレーム数
+static uint32_t check_read_to_end(int num_channels)
+{
+    static int16_t data[CHECK_READ_SAMPLES * 2];
+    uint32_t frames = mp3_decoder_frames();
+    for (uint32_t n = 0; n < (CHECK_FRAMES + 20) * 1152; n += CHECK_READ_SAMPLES)
+    {
+        wav_source_service();
+        wav_source_read((uint8_t *)data, CHECK_READ_SAMPLES * num_channels * 2);
+    }
+    return mp3_decoder_frames() - frames;
+}
+
+// sample にシークして、新しい位置に着いてから末尾までにデコードしたフレーム数
+static uint32_t check_seek(uint32_t sample, int num_channels, bool *landed)
+{
+    static int16_t data[CHECK_READ_SAMPLES * 2];
+    uint32_t landing_sample;
+    bool requested;
+    uint32_t before = wav_source_landings(&landing_sample, &requested);
+    uint32_t frames = mp3_decoder_frames();
+    wav_source_request_seek(sample);
+    *landed = false;
+    for (int reads = 0; reads < 100 && !*landed; reads++)
+    {
+        wav_source_service();
+        wav_source_read((uint8_t *)data, CHECK_READ_SAMPLES * num_channels * 2);
+        *landed = wav_source_landings(&landing_sample, &requested) != before && requested && landing_sample == sample;
+    }
+    check_read_to_end(num_channels);
+    return mp3_decoder_frames() - frames;
+}
+
+static const char *check_queue_path;
+static uint32_t check_queued;
+
+static void check_queue_again(void)
+{
+    if (check_queued < 2 && wav_source_queue(LittleFS, check_queue_path, check_queued + 1) == 0)
+        check_queued++;
+}
+
+typedef struct
+{
+    const char *name;
+    const char *path;
+    check_mp3_file_t spec;
+} check_case_t;
+
+static const check_case_t check_cases[] = {
+    {"mono 128k id3", "mp3_mono_id3.mp3", {1, true, false, 0}},
+    {"stereo vbr", "mp3_stereo_vbr.mp3", {2, false, true, 0}},
+    {"mono garbage", "mp3_mono_garbage.mp3", {1, false, false, 10}},
+};
+
+static bool check_case(const check_case_t *c)
+{
+    uint32_t first_frame;
+    uint32_t data_size = check_write_mp3(c->path, &c->spec, &first_frame);
+    int channels = c->spec.num_channels;
+    uint32_t total = CHECK_FRAMES * 1152;
+
+    // ヘッダ
+    File file = LittleFS.open(c->path, "r");
+    wav_format_t format;
+    bool parse_ok = file && wav_format_parse(file, &format) == WAV_FORMAT_OK && format.format_tag == WAV_FORMAT_MPEG_LAYER3 &&
+                    format.num_channels == channels && format.sample_rate == CHECK_SAMPLE_RATE &&
+                    format.samples_per_block == 1152 && format.data_offset == first_frame && format.data_size == data_size;
+    file.close();
+    // 曲の長さ。CBR はビットレート、VBR は Info フレームのフレーム数から(ゴミの分は長くなる)
+    uint32_t num_samples = parse_ok ? wav_format_num_samples(&format) : 0;
+    uint32_t length_error = num_samples > total ? num_samples - total : total - num_samples;
+    parse_ok &= length_error <= (c->spec.garbage_at ? CHECK_GARBAGE_BYTES * CHECK_SAMPLE_RATE / 16000 : 1);
+
+    // 全部読む。ちょうど CHECK_FRAMES x 1152 サンプルで全部のフレームをデコードし、その後はデコードするものが無い。
+    uint32_t errors = mp3_decoder_errors();
+    uint32_t frames = mp3_decoder_frames();
+    bool read_ok = parse_ok && wav_source_open(LittleFS, c->path, false) == 0 && wav_source_format()->bits_per_sample == 16 &&
+                   wav_source_format()->num_channels == channels;
+    read_ok &= check_read_samples(total, channels) && mp3_decoder_frames() - frames == CHECK_FRAMES;
+    read_ok &= check_read_to_end(channels) == 0;
+    uint32_t resync = wav_source_resync_bytes();
+    read_ok &= resync == (c->spec.garbage_at ? CHECK_GARBAGE_BYTES : 0);
+
+    // フレームの境目と途中へのシーク(CBR だけ。位置はビットレートで換算する)
+    bool seek_ok = read_ok;
+    if (!c->spec.vbr)
+    {
+        bool landed;
+        uint32_t frames_left = check_seek(50 * 1152, channels, &landed);
+        seek_ok &= landed && frames_left == CHECK_FRAMES - 50;
+        frames_left = check_seek(150 * 1152 + 500, channels, &landed);
+        seek_ok &= landed && frames_left == CHECK_FRAMES - 151;
+        seek_ok &= wav_source_resync_bytes() > resync;
+        frames_left = check_seek(0, channels, &landed);
+        seek_ok &= landed && frames_left == CHECK_FRAMES;
+    }
+    wav_source_close();
+
+    // 同じ曲を続けて予約して、3回分のフレームをデコードし、曲の境目に無音が入らないこと
+    check_queue_path = c->path;
+    check_queued = 0;
+    wav_source_set_queue_callback(check_queue_again);
+    frames = mp3_decoder_frames();
+    bool gapless_ok = seek_ok && wav_source_open(LittleFS, c->path, false) == 0 && check_read_samples(3 * total, channels);
+    wav_source_track_stats_t track;
+    wav_source_get_track_stats(&track);
+    gapless_ok &= track.changes == 2 && track.max_gap_samples == 0 && mp3_decoder_frames() - frames == 3 * CHECK_FRAMES;
+    wav_source_close();
+    wav_source_set_queue_callback(NULL);
+    errors = mp3_decoder_errors() - errors;
+
+    printf("  %-14s %6u samples (%+d), %u bytes/s, resync %u bytes, errors %u, parse %s, read %s, seek %s, gapless %s\n", c->name,
+           (unsigned)num_samples, (int)(num_samples - total), (unsigned)format.byte_rate, (unsigned)resync, (unsigned)errors,
+           parse_ok ? "ok" : "NG", read_ok ? "ok" : "NG", c->spec.vbr ? "-" : seek_ok ? "ok" : "NG", gapless_ok ? "ok" : "NG");
+    return parse_ok && read_ok && seek_ok && gapless_ok && errors == 0;
+}
+
+// ヘッダの解析: 無効なもの、MPEG-2 の大きさ
+static bool check_headers(void)
+{
+    mp3_frame_header_t header;
+    static const uint8_t mpeg1_pad[4] = {0xFF, 0xFB, 0x92, 0x64};  // MPEG-1 128k 44.1k パディング、joint stereo
+    static const uint8_t mpeg2[4] = {0xFF, 0xF3, 0x80, 0xC4};      // MPEG-2 64k 22.05k mono
+    static const uint8_t layer2[4] = {0xFF, 0xFD, 0x94, 0x00};     // Layer II
+    static const uint8_t free_format[4] = {0xFF, 0xFB, 0x04, 0x00}; // フリーフォーマット
+    static const uint8_t id3v2[10] = {'I', 'D', '3', 4, 0, 0x10, 0, 0, 1, 0};
+    bool ok = mp3_frame_parse_header(mpeg1_pad, &header) && header.frame_bytes == 418 && header.num_channels == 2 &&
+              header.samples == 1152 && header.side_info_bytes == 32;
+    ok &= mp3_frame_parse_header(mpeg2, &header) && header.version == 2 && header.sample_rate == 22050 &&
+          header.frame_bytes == 208 && header.samples == 576 && header.side_info_bytes == 9;
+    ok &= !mp3_frame_parse_header(layer2, &header) && !mp3_frame_parse_header(free_format, &header);
+    ok &= mp3_frame_id3v2_size(id3v2) == 10 + 128 + 10;
+    printf("  headers: %s\n", ok ? "ok" : "NG");
+    return ok;
+}
+
+int check_mp3_main(int argc, char **argv)
+{
+    LittleFS.setRoot("");
+    int result = check_headers() ? 0 : 1;
+    printf("MP3 files (%u frames at %u Hz):\n", (unsigned)CHECK_FRAMES, (unsigned)CHECK_SAMPLE_RATE);
+    for (const check_case_t &c : check_cases)
+        result |= check_case(&c) ? 0 : 1;
+
+    // 16bit ステレオの PCM(192000 bytes/s)と比べたファイルの読み込みと、使う RAM
+    printf("RAM: decoder heap %u bytes, wav_source frame and PCM buffers %u bytes\n", (unsigned)mp3_decoder_heap_bytes(),
+           (unsigned)(MP3_FRAME_MAX_BYTES + MP3_DECODER_MAX_SAMPLES * 2));
+    printf("file reads at 128 kbps: %u bytes/s, 1/%u of 16-bit stereo PCM\n", 128000 / 8,
+           (unsigned)(CHECK_SAMPLE_RATE * 4 / (128000 / 8)));
+    mp3_decoder_benchmark(LittleFS, "mp3_mono_id3.mp3", CHECK_FRAMES);
+    if (argc > 1)
+        result |= mp3_decoder_benchmark(LittleFS, argv[1], UINT32_MAX) == 0 ? 0 : 1;
+    printf("%s\n", result == 0 ? "OK" : "NG");
+    return result;
+}
@@ -0,0 +1,249 @@
+#include "host_commands.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "LittleFS.h"
+#include "fake_btstack.h"
+#include "host_stream.h"
+#include "audio/audio_pipeline.h"
+#include "audio/playlist.h"
+#include "audio/wav_source.h"
+
+// ディレクトリの WAV を曲間なしで続けて再生するプレイリスト(playlist)を確かめます。
+//  - 一覧: 名前順に並び、WAV でないファイル・ヘッダが壊れたファイル・周波数が違うファイルが入らない
+//  - 読み出し: 左チャンネルに通し番号を入れた 16bit ステレオの3曲を端数のある大きさで読み出し、
+//    通し番号が曲の境目でも欠けたり重なったりしないこと(曲間 0 サンプル)、曲番号が順に変わること
+//  - フォーマットが違う曲(8bit モノラル)への切り替えで入る無音が、境目を含む読み出しの残りだけであること
+//  - 最後の曲の次に最初の曲に戻ること(repeat)
+//  - 仮想時間でストリーミングして、補充が間に合わない無音(アンダーラン)が無く、曲が順に変わること
+// を確認します。
+
+static const uint32_t CHECK_RATE = 48000;
+// 曲ごとのサンプル数。フレーム(128)や読み出し(CHECK_READ_SAMPLES)の倍数にならないようにする。
+static const uint32_t check_samples[] = {48000 + 37, 12345, 30011};
+static const uint32_t CHECK_MONO_SAMPLES = 4801;
+static const uint32_t CHECK_READ_SAMPLES = 100;
+
+static a2dp_media_sending_context_t check_context;
+
+static void check_put_le(FILE *fp, uint32_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+        fputc((int)(value >> (8 * i)) & 0xFF, fp);
+}
+
+// 左に通し番号、右に曲番号 x 1000 を入れた WAV(bits 16 はステレオ、8 はモノラル)
+static int check_write_wav(const char *path, uint32_t sample_rate, int bits, uint32_t num_samples, uint32_t first, int track)
+{
+    FILE *fp = fopen(path, "wb");
+    if (!fp)
+        return -1;
+    int channels = bits == 16 ? 2 : 1;
+    uint32_t block_align = channels * bits / 8;
+    uint32_t data_size = num_samples * block_align;
+    fwrite("RIFF", 1, 4, fp);
+    check_put_le(fp, 36 + data_size + (data_size & 1), 4);
+    fwrite("WAVEfmt ", 1, 8, fp);
+    check_put_le(fp, 16, 4);
+    check_put_le(fp, 1, 2);
+    check_put_le(fp, channels, 2);
+    check_put_le(fp, sample_rate, 4);
+    check_put_le(fp, sample_rate * block_align, 4);
+    check_put_le(fp, block_align, 2);
+    check_put_le(fp, bits, 2);
+    fwrite("data", 1, 4, fp);
+    check_put_le(fp, data_size, 4);
+    for (uint32_t i = 0; i < num_samples; i++)
+    {
+        if (bits == 16)
+        {
+            check_put_le(fp, (uint16_t)(first + i), 2);
+            check_put_le(fp, (uint16_t)(track * 1000), 2);
+        }
+        else
+        {
+            fputc(0x80 + (int)((first + i) % 64), fp);
+        }
+    }
+    if (data_size & 1)
+        fputc(0, fp);
+    fclose(fp);
+    return 0;
+}
+
+static int check_make_dir(char *dir)
+{
+    if (mkdtemp(dir) == NULL)
+        return -1;
+    char path[256];
+    uint32_t first = 0;
+    // 00 はヘッダが壊れた WAV で、一覧に入らない。
+    snprintf(path, sizeof(path), "%s/00_broken.wav", dir);
+    FILE *fp = fopen(path, "wb");
+    if (!fp)
+        return -1;
+    fputs("RIFX not a wave file", fp);
+    fclose(fp);
+    for (int i = 0; i < 3; i++)
+    {
+        snprintf(path, sizeof(path), "%s/%02d_stereo.wav", dir, i + 1);
+        if (check_write_wav(path, CHECK_RATE, 16, check_samples[i], first, i + 1) != 0)
+            return -1;
+        first += check_samples[i];
+    }
+    snprintf(path, sizeof(path), "%s/04_Mono.WAV", dir);
+    if (check_write_wav(path, CHECK_RATE, 8, CHECK_MONO_SAMPLES, 0, 4) != 0)
+        return -1;
+    // 周波数が違う曲と WAV でないファイルは一覧に入らない。
+    snprintf(path, sizeof(path), "%s/05_44100.wav", dir);
+    if (check_write_wav(path, 44100, 16, 4410, 0, 5) != 0)
+        return -1;
+    snprintf(path, sizeof(path), "%s/notes.txt", dir);
+    fp = fopen(path, "wb");
+    if (!fp)
+        return -1;
+    fputs("not audio", fp);
+    fclose(fp);
+    return 0;
+}
+
+static void check_remove_dir(const char *dir)
+{
+    static const char *names[] = {"00_broken.wav", "01_stereo.wav", "02_stereo.wav", "03_stereo.wav", "04_Mono.WAV", "05_44100.wav", "notes.txt"};
+    char path[256];
+    for (const char *name : names)
+    {
+        snprintf(path, sizeof(path), "%s/%s", dir, name);
+        remove(path);
+    }
+    rmdir(dir);
+}
+
+static bool check_list(void)
+{
+    static const char *expected[] = {"01_stereo.wav", "02_stereo.wav", "03_stereo.wav", "04_Mono.WAV"};
+    bool ok = playlist_size() == 4;
+    for (int i = 0; ok && i < 4; i++)
+    {
+        const playlist_track_t *track = playlist_track(i);
+        uint32_t num_samples = i < 3 ? check_samples[i] : CHECK_MONO_SAMPLES;
+        ok = strcmp(track->name, expected[i]) == 0 && track->num_samples == num_samples &&
+             track->length_ms == num_samples * 1000 / CHECK_RATE;
+    }
+    printf("  list: %d tracks (%s)\n", playlist_size(), ok ? "ok" : "NG");
+    return ok;
+}
+
+// wav_source を直接読み出して、曲の境目でサンプルが欠けたり重なったりしないことを確かめる。
+static bool check_read(void)
+{
+    playlist_set_repeat(true);
+    if (playlist_start(0) != 0)
+        return false;
+    uint32_t total = check_samples[0] + check_samples[1] + check_samples[2];
+    uint32_t counter = 0;
+    uint32_t errors = 0;
+    uint32_t gaps[5] = {};
+    int order[5] = {};
+    int changes = 0;
+    static uint8_t data[CHECK_READ_SAMPLES * 4];
+    // 3曲と8bitの曲を読み、最初の曲に戻るまで
+    for (int reads = 0; changes < 5 && reads < 10000; reads++)
+    {
+        wav_source_service();
+        uint32_t block_align = wav_source_format()->block_align;
+        wav_source_read(data, CHECK_READ_SAMPLES * block_align);
+        for (uint32_t i = 0; block_align == 4 && counter < total && i < CHECK_READ_SAMPLES; i++, counter++)
+        {
+            // 通し番号と、その番号が入っている曲の番号
+            int track = counter < check_samples[0] ? 1 : counter < check_samples[0] + check_samples[1] ? 2 : 3;
+            uint16_t left = (uint16_t)(data[4 * i] | data[4 * i + 1] << 8);
+            uint16_t right = (uint16_t)(data[4 * i + 2] | data[4 * i + 3] << 8);
+            if (left != (uint16_t)counter || right != track * 1000)
+                errors++;
+        }
+        int index;
+        if (playlist_poll(&index))
+            order[changes++] = index;
+        wav_source_track_stats_t track_stats;
+        wav_source_get_track_stats(&track_stats);
+        if (track_stats.gaps > 0 && track_stats.gaps <= 5)
+            gaps[track_stats.gaps - 1] = track_stats.last_gap_samples;
+    }
+    // 3曲目から8bitの曲へは、境目を含む読み出しの残り(16bitステレオの無音)が曲間になる。
+    uint32_t format_gap = (CHECK_READ_SAMPLES - total % CHECK_READ_SAMPLES) % CHECK_READ_SAMPLES;
+    wav_source_stats_t stats;
+    wav_source_get_stats(&stats);
+    playlist_stop();
+    printf("  read %u samples in %u-sample reads: %u mismatches, order %d %d %d %d %d, gaps %u %u (format change %u, expected %u), underrun %u bytes\n",
+           (unsigned)counter, (unsigned)CHECK_READ_SAMPLES, (unsigned)errors, order[0] + 1, order[1] + 1, order[2] + 1,
+           order[3] + 1, order[4] + 1, (unsigned)gaps[0], (unsigned)gaps[1], (unsigned)gaps[2], (unsigned)format_gap,
+           (unsigned)stats.underrun_bytes);
+    return counter == total && errors == 0 && changes == 5 && order[0] == 1 && order[1] == 2 && order[2] == 3 &&
+           order[3] == 0 && gaps[0] == 0 && gaps[1] == 0 && gaps[2] == format_gap && stats.underrun_bytes == 0;
+}
+
+static int check_stream_order[8];
+static uint32_t check_stream_gaps[8];
+static int check_stream_changes;
+
+static void check_each_ms(void)
+{
+    audio_pipeline_loop();
+    int index;
+    if (check_stream_changes < 8 && playlist_poll(&index))
+        check_stream_order[check_stream_changes++] = index;
+    wav_source_track_stats_t stats;
+    wav_source_get_track_stats(&stats);
+    if (stats.gaps > 0 && stats.gaps <= 8)
+        check_stream_gaps[stats.gaps - 1] = stats.last_gap_samples;
+}
+
+// 仮想時間でストリーミングして、補充が間に合っていることと曲が順に変わることを確かめる。
+static bool check_stream(void)
+{
+    static const media_codec_configuration_sbc_t configuration = {0, 2, 48000, 16, 8, 2, 53, SBC_CHANNEL_MODE_JOINT_STEREO, SBC_ALLOCATION_METHOD_LOUDNESS};
+    playlist_set_repeat(false);
+    if (playlist_start(0) != 0)
+        return false;
+    audio_pipeline_init_encoder(&configuration);
+    check_stream_changes = 0;
+    uint32_t total = check_samples[0] + check_samples[1] + check_samples[2] + CHECK_MONO_SAMPLES;
+    int seconds = (int)(total / CHECK_RATE) + 2;
+    host_stream_run(&check_context, seconds, check_each_ms);
+    wav_source_stats_t stats;
+    wav_source_get_stats(&stats);
+    playlist_stop();
+    printf("  stream %d s: %u frames, frame errors %u, changes %d (order %d %d %d), gaps %u %u %u, underrun %u bytes, min level %u/%u\n",
+           seconds, (unsigned)fake_a2dp_sink.sbc_frames, (unsigned)fake_a2dp_sink.frame_errors, check_stream_changes,
+           check_stream_order[0] + 1, check_stream_order[1] + 1, check_stream_order[2] + 1, (unsigned)check_stream_gaps[0],
+           (unsigned)check_stream_gaps[1], (unsigned)check_stream_gaps[2], (unsigned)stats.underrun_bytes, (unsigned)stats.min_level, (unsigned)stats.capacity);
+    return fake_a2dp_sink.frame_errors == 0 && check_stream_changes == 3 && check_stream_order[0] == 1 &&
+           check_stream_order[1] == 2 && check_stream_order[2] == 3 && check_stream_gaps[0] == 0 &&
+           check_stream_gaps[1] == 0 && check_stream_gaps[2] < 128 && stats.underrun_bytes == 0;
+}
+
+int check_playlist_main(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+    char dir[] = "/tmp/playlist_XXXXXX";
+    if (check_make_dir(dir) != 0)
+    {
+        printf("cannot create %s\n", dir);
+        return 1;
+    }
+    LittleFS.setRoot(dir);
+    printf("playlist in %s:\n", dir);
+    playlist_build(LittleFS, "/");
+    int result = 0;
+    result |= check_list() ? 0 : 1;
+    result |= check_read() ? 0 : 1;
+    result |= check_stream() ? 0 : 1;
+    check_remove_dir(dir);
+    printf("%s\n", result == 0 ? "OK" : "NG");
+    return result;
+}
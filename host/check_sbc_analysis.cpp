@@ -0,0 +1,287 @@
+#include "host_commands.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "audio/audio_pipeline.h"
+#include "audio/sbc_analysis.h"
+
+// SBC 分析フィルタバンク(sbc_analysis)の確認とベンチマークです。
+//  1. ゴールデンコーパス(スイープ、全振幅のノイズと矩形波、インパルス、2音)を
+//     仕様の式を倍精度で計算したものと比べ、サブバンドサンプルの誤差を16bit PCMの単位で表示する
+//  2. 1フレーム(16ブロック x 8サブバンド x 2チャンネル)あたりの時間とサイクル数
+//  3. bluedroid の実装とも比べる(サブバンドサンプルの差、スケール)。実機のシリアルの `b` と同じ sbc_analysis_bluedroid_check() も呼ぶ
+//  4. SBC_ANALYSIS_FAST と --wrap でビルドしたとき(env:native)は、SBC_Encoder の分析をこの実装に切り替えて
+//     SBCフレームの一致率とエンコード1フレームの時間を比べる。この実装に切り替えるのはここだけで、ほかのコマンドは bluedroid の分析を使う
+//
+// 許容誤差: サブバンドサンプルの差の最大値が倍精度の式に対して 3 LSB、bluedroid に対して SBC_ANALYSIS_BLUEDROID_MAX_DIFFERENCE 以内。
+// bluedroid とのスケール(最小二乗)は 1 ± SBC_ANALYSIS_BLUEDROID_SCALE_TOLERANCE(SBC_ANALYSIS_BLUEDROID_SHIFT が合っていること)。
+// (Y を Q2 に丸める誤差が16項分たまる。全振幅に対して -80dB 程度で、ビットプール53の量子化雑音よりずっと小さい)
+
+static const int CHECK_BLOCKS = 16;
+static const int CHECK_CHANNELS = 2;
+static const int CHECK_FRAME_SAMPLES = CHECK_BLOCKS * SBC_ANALYSIS_SUBBANDS;
+static const int CHECK_NUM_FRAMES = 750; // 48kHz で 2 秒
+
+// A2DP仕様 表12.24 のプロトタイプフィルタ
+static const double check_proto[80] = {
+    0.00000000E+00, 1.56575398E-04, 3.43256425E-04, 5.54620202E-04, 8.23919506E-04, 1.13992507E-03,
+    1.47640169E-03, 1.78371725E-03, 2.01182542E-03, 2.10371989E-03, 1.99454554E-03, 1.61656283E-03,
+    9.02154502E-04, -1.78805361E-04, -1.64973098E-03, -3.49717454E-03, 5.65949473E-03, 8.02941163E-03,
+    1.04584443E-02, 1.27472335E-02, 1.46525263E-02, 1.59045603E-02, 1.62208471E-02, 1.53184106E-02,
+    1.29371806E-02, 8.85757540E-03, 2.92408442E-03, -4.91578024E-03, -1.46404076E-02, -2.61098752E-02,
+    -3.90751381E-02, -5.31873032E-02, 6.79989431E-02, 8.29847578E-02, 9.75753918E-02, 1.11196689E-01,
+    1.23264548E-01, 1.33264415E-01, 1.40753505E-01, 1.45389847E-01, 1.46955068E-01, 1.45389847E-01,
+    1.40753505E-01, 1.33264415E-01, 1.23264548E-01, 1.11196689E-01, 9.75753918E-02, 8.29847578E-02,
+    -6.79989431E-02, -5.31873032E-02, -3.90751381E-02, -2.61098752E-02, -1.46404076E-02, -4.91578024E-03,
+    2.92408442E-03, 8.85757540E-03, 1.29371806E-02, 1.53184106E-02, 1.62208471E-02, 1.59045603E-02,
+    1.46525263E-02, 1.27472335E-02, 1.04584443E-02, 8.02941163E-03, -5.65949473E-03, -3.49717454E-03,
+    -1.64973098E-03, -1.78805361E-04, 9.02154502E-04, 1.61656283E-03, 1.99454554E-03, 2.10371989E-03,
+    2.01182542E-03, 1.78371725E-03, 1.47640169E-03, 1.13992507E-03, 8.23919506E-04, 5.54620202E-04,
+    3.43256425E-04, 1.56575398E-04};
+
+// 仕様の式そのままの倍精度の分析(チャンネルごとに X[80] をずらす)
+static void check_reference(double history[][80], const int16_t *pcm, double *out)
+{
+    for (int block = 0; block < CHECK_BLOCKS; block++)
+    {
+        for (int ch = 0; ch < CHECK_CHANNELS; ch++)
+        {
+            double *x = history[ch];
+            memmove(x + 8, x, 72 * sizeof(double));
+            for (int i = 7; i >= 0; i--)
+                x[i] = pcm[(block * 8 + 7 - i) * CHECK_CHANNELS + ch];
+            double y[16];
+            for (int i = 0; i < 16; i++)
+            {
+                y[i] = 0;
+                for (int j = 0; j < 5; j++)
+                    y[i] += check_proto[i + 16 * j] * x[i + 16 * j];
+            }
+            for (int k = 0; k < 8; k++)
+            {
+                double s = 0;
+                for (int i = 0; i < 16; i++)
+                    s += cos((k + 0.5) * (i - 4) * M_PI / 8) * y[i];
+                *out++ = s;
+            }
+        }
+    }
+}
+
+typedef struct
+{
+    const char *name;
+    std::vector<int16_t> pcm;
+} check_signal_t;
+
+static int16_t check_clip(double v)
+{
+    return (int16_t)(v > 32767 ? 32767 : v < -32768 ? -32768 : lrint(v));
+}
+
+static std::vector<check_signal_t> check_corpus(void)
+{
+    std::vector<check_signal_t> corpus;
+    const int n = CHECK_NUM_FRAMES * CHECK_FRAME_SAMPLES;
+    const char *names[] = {"sweep", "noise", "square", "impulses", "two tones"};
+    srand(3);
+    for (int s = 0; s < 5; s++)
+    {
+        check_signal_t signal;
+        signal.name = names[s];
+        signal.pcm.resize(n * CHECK_CHANNELS);
+        double phase = 0;
+        for (int i = 0; i < n; i++)
+        {
+            double left = 0, right = 0;
+            switch (s)
+            {
+            case 0:
+                phase += 2 * M_PI * 20.0 * pow(1000.0, (double)i / n) / 48000;
+                left = 30000 * sin(phase);
+                right = -20000 * sin(phase * 0.5);
+                break;
+            case 1:
+                left = (rand() % 65536) - 32768;
+                right = (rand() % 65536) - 32768;
+                break;
+            case 2:
+                left = (i / 37) % 2 ? 32767 : -32768;
+                right = (i / 5) % 2 ? 32767 : -32768;
+                break;
+            case 3:
+                left = i % 997 == 0 ? 32767 : 0;
+                right = i % 1009 == 0 ? -32768 : 0;
+                break;
+            case 4:
+                left = 16000 * sin(2 * M_PI * 1000.0 * i / 48000) + 16000 * sin(2 * M_PI * 15000.0 * i / 48000);
+                right = 16000 * sin(2 * M_PI * 440.0 * i / 48000) + 16000 * sin(2 * M_PI * 23000.0 * i / 48000);
+                break;
+            }
+            signal.pcm[i * 2] = check_clip(left);
+            signal.pcm[i * 2 + 1] = check_clip(right);
+        }
+        corpus.push_back(signal);
+    }
+    return corpus;
+}
+
+static inline uint64_t check_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// 倍精度の式との比較
+static int check_against_reference(const std::vector<check_signal_t> &corpus)
+{
+    static sbc_analysis_t analysis;
+    const int count = CHECK_BLOCKS * CHECK_CHANNELS * SBC_ANALYSIS_SUBBANDS;
+    int result = 0;
+    printf("against the specification (double precision, tolerance 3 LSB):\n");
+    for (const check_signal_t &signal : corpus)
+    {
+        double history[CHECK_CHANNELS][80] = {};
+        sbc_analysis_init(&analysis);
+        double max_error = 0, sum_error = 0;
+        for (int frame = 0; frame < CHECK_NUM_FRAMES; frame++)
+        {
+            const int16_t *pcm = &signal.pcm[frame * CHECK_FRAME_SAMPLES * CHECK_CHANNELS];
+            int32_t fast[count];
+            double reference[count];
+            sbc_analysis_process(&analysis, pcm, CHECK_BLOCKS, CHECK_CHANNELS, fast);
+            check_reference(history, pcm, reference);
+            for (int i = 0; i < count; i++)
+            {
+                double error = fabs(fast[i] / (double)(1 << SBC_ANALYSIS_OUTPUT_Q) - reference[i]);
+                sum_error += error * error;
+                if (error > max_error)
+                    max_error = error;
+            }
+        }
+        bool ok = max_error <= 3.0;
+        printf("  %-10s max error %.3f LSB, rms %.4f LSB -> %s\n", signal.name, max_error,
+               sqrt(sum_error / ((double)CHECK_NUM_FRAMES * count)), ok ? "OK" : "NG");
+        result |= ok ? 0 : 1;
+    }
+    return result;
+}
+
+static void check_speed(const std::vector<check_signal_t> &corpus)
+{
+    static sbc_analysis_t analysis;
+    int32_t out[CHECK_BLOCKS * CHECK_CHANNELS * SBC_ANALYSIS_SUBBANDS];
+    const std::vector<int16_t> &pcm = corpus[1].pcm;
+    sbc_analysis_init(&analysis);
+    const int rounds = 20;
+    uint64_t start_ns = host_time_ns();
+    uint64_t start_cycles = check_cycles();
+    for (int r = 0; r < rounds; r++)
+    {
+        for (int frame = 0; frame < CHECK_NUM_FRAMES; frame++)
+        {
+            sbc_analysis_process(&analysis, &pcm[frame * CHECK_FRAME_SAMPLES * CHECK_CHANNELS], CHECK_BLOCKS, CHECK_CHANNELS, out);
+            __asm__ volatile("" : : "r"(out) : "memory");
+        }
+    }
+    uint64_t cycles = check_cycles() - start_cycles;
+    uint64_t elapsed_ns = host_time_ns() - start_ns;
+    double frames = (double)rounds * CHECK_NUM_FRAMES;
+    printf("fast analysis: %.3f us/frame", elapsed_ns / 1000.0 / frames);
+    if (cycles)
+        printf(", %.0f host cycles/frame", cycles / frames);
+    printf(" (16 blocks x 8 subbands x 2 ch, %d multiply-accumulates per block and channel)\n", 80 + 64);
+}
+
+// bluedroid との比較。スケールは最小二乗で求め、SBC_ANALYSIS_BLUEDROID_SHIFT が合っているか確かめる。
+// 差が許容誤差に入るのはスケールが合っているときだけなので、両方を見る。
+static int check_against_bluedroid(const std::vector<check_signal_t> &corpus)
+{
+    int result = 0;
+    printf("against bluedroid SbcAnalysisFilter8 (tolerance %.0f LSB, scale 1 +- %.0f%%):\n", SBC_ANALYSIS_BLUEDROID_MAX_DIFFERENCE,
+           SBC_ANALYSIS_BLUEDROID_SCALE_TOLERANCE * 100);
+    for (const check_signal_t &signal : corpus)
+    {
+        sbc_analysis_bluedroid_reset();
+        sbc_analysis_diff_t diff = {};
+        for (int frame = 0; frame < CHECK_NUM_FRAMES; frame++)
+            sbc_analysis_bluedroid_accumulate(&signal.pcm[frame * CHECK_FRAME_SAMPLES * CHECK_CHANNELS], CHECK_CHANNELS, &diff);
+        double scale = sbc_analysis_diff_scale(&diff);
+        bool ok = sbc_analysis_diff_ok(&diff);
+        printf("  %-10s max difference %.3f LSB, bluedroid / fast scale %.4f -> %s\n", signal.name, diff.max_difference, scale, ok ? "OK" : "NG");
+        if (!ok && fabs(scale) > 0)
+            printf("    (scale 2^%.2f: check SBC_ANALYSIS_BLUEDROID_SHIFT)\n", log2(fabs(scale)) + SBC_ANALYSIS_BLUEDROID_SHIFT);
+        result |= ok ? 0 : 1;
+    }
+    sbc_analysis_bluedroid_reset();
+    // 実機のシリアルの `b` で表示するものと同じ
+    printf("device check (sbc_analysis_bluedroid_check):\n");
+    result |= sbc_analysis_bluedroid_check() ? 0 : 1;
+    return result;
+}
+
+#ifdef SBC_ANALYSIS_FAST
+// エンコーダ全体: 同じ入力を bluedroid の分析とこの分析でエンコードし、フレームの一致率と時間を比べる。
+static void check_encoder(const std::vector<check_signal_t> &corpus)
+{
+    static const media_codec_configuration_sbc_t configuration = {
+        0, 2, 48000, 16, 8, 2, 53, SBC_CHANNEL_MODE_STEREO, SBC_ALLOCATION_METHOD_SNR};
+    uint64_t elapsed_ns[2] = {0, 0};
+    uint32_t identical = 0, frames = 0;
+    for (const check_signal_t &signal : corpus)
+    {
+        std::vector<uint8_t> encoded[2];
+        for (int fast = 0; fast < 2; fast++)
+        {
+            sbc_analysis_set_fast(fast);
+            audio_pipeline_set_mode(AUDIO_PIPELINE_SINGLE_CORE);
+            audio_pipeline_init_encoder(&configuration);
+            uint64_t start_ns = host_time_ns();
+            for (int frame = 0; frame < CHECK_NUM_FRAMES; frame++)
+            {
+                btstack_sbc_encoder_process_data((int16_t *)&signal.pcm[frame * CHECK_FRAME_SAMPLES * CHECK_CHANNELS]);
+                uint8_t *sbc = btstack_sbc_encoder_sbc_buffer();
+                encoded[fast].insert(encoded[fast].end(), sbc, sbc + btstack_sbc_encoder_sbc_buffer_length());
+            }
+            elapsed_ns[fast] += host_time_ns() - start_ns;
+        }
+        int length = encoded[0].size() / CHECK_NUM_FRAMES;
+        for (int frame = 0; frame < CHECK_NUM_FRAMES; frame++)
+        {
+            identical += memcmp(&encoded[0][frame * length], &encoded[1][frame * length], length) == 0;
+            frames++;
+        }
+    }
+    // ほかのコマンド(ベンチマークやエンコーダの確認)は、実機と同じ bluedroid の分析のままにする。
+    sbc_analysis_set_fast(false);
+    printf("encoder: %.1f%% of SBC frames byte-identical, %.3f us/frame with bluedroid analysis, %.3f us/frame with fast analysis\n",
+           100.0 * identical / frames, elapsed_ns[0] / 1000.0 / frames, elapsed_ns[1] / 1000.0 / frames);
+}
+#endif
+
+int check_sbc_analysis_main(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+    std::vector<check_signal_t> corpus = check_corpus();
+    int result = check_against_reference(corpus);
+    check_speed(corpus);
+    result |= check_against_bluedroid(corpus);
+#ifdef SBC_ANALYSIS_FAST
+    check_encoder(corpus);
+#else
+    // SBC_Encoder の分析を切り替えるには --wrap が要る(env:native)。
+    printf("built without SBC_ANALYSIS_FAST: encoder not run with the fast analysis (use env:native in platformio.ini)\n");
+#endif
+    return result;
+}
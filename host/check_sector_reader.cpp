@@ -0,0 +1,245 @@
+#include "host_commands.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "Arduino.h"
+#include "LittleFS.h"
+#include "audio/file_prefetch.h"
+#include "audio/sector_reader.h"
+#include "audio/wav_source.h"
+
+// セクタ単位の読み込み(sector_reader)と先読みの補充の読み込みを、カードの代わりのブロックデバイスで確かめます。
+// ブロックデバイスはメモリ上のディスクイメージで、1回の読み込みのコマンドの時間と1セクタの転送時間を遅延として入れられ、
+// 指定したセクタで失敗させることもできます。
+//  - いろいろな位置・長さ・4バイト境界にない読み込み先で読んだデータがイメージと一致すること
+//  - 1回に読むセクタ数を変えたときの転送速度と、1回の読み込み時間のパーセンタイルが入れた遅延どおりであること
+//  - 失敗したセクタで -1 を返すこと
+//  - WAV の先読みの補充の読み込みがファイルのセクタ境界にそろい、まとめて読んでいること
+// を確認します。
+
+static const uint32_t CHECK_IMAGE_SECTORS = 4096; // 2MB
+static const uint32_t CHECK_COMMAND_US = 300;      // CMD18 の応答とデータトークンまでの時間
+static const uint32_t CHECK_SECTOR_US = 25;        // 1セクタの転送時間(SPI 25MHz で約 170us だが、チェックを短くする)
+static const uint32_t CHECK_BENCH_SIZE = 512 * 1024;
+
+typedef struct
+{
+    block_device_t device;
+    std::vector<uint8_t> image;
+    uint32_t command_us;
+    uint32_t sector_us;
+    uint32_t fail_sector; // このセクタを含む読み込みを失敗させる(UINT32_MAX なら失敗しない)
+    // 読み込み中
+    bool busy;
+    bool failed;
+    uint32_t sector;
+    uint32_t count;
+    uint8_t *dst;
+    uint64_t due_ns;
+    // 統計
+    uint32_t commands;
+    uint32_t max_count;
+} check_device_t;
+
+static bool check_start_read(block_device_t *device, uint32_t sector, uint8_t *dst, uint32_t count)
+{
+    check_device_t *d = (check_device_t *)device->context;
+    if (d->busy || count == 0 || count > device->max_sectors || ((uintptr_t)dst & 3) != 0 ||
+        (uint64_t)sector + count > d->image.size() / BLOCK_DEVICE_SECTOR_SIZE)
+        return false;
+    d->busy = true;
+    d->failed = d->fail_sector >= sector && d->fail_sector < sector + count;
+    d->sector = sector;
+    d->count = count;
+    d->dst = dst;
+    d->due_ns = host_time_ns() + ((uint64_t)d->command_us + (uint64_t)d->sector_us * count) * 1000;
+    d->commands++;
+    if (count > d->max_count)
+        d->max_count = count;
+    return true;
+}
+
+static int check_poll(block_device_t *device)
+{
+    check_device_t *d = (check_device_t *)device->context;
+    if (!d->busy)
+        return -1;
+    if (host_time_ns() < d->due_ns)
+        return 0;
+    d->busy = false;
+    if (d->failed)
+        return -1;
+    memcpy(d->dst, &d->image[(size_t)d->sector * BLOCK_DEVICE_SECTOR_SIZE], (size_t)d->count * BLOCK_DEVICE_SECTOR_SIZE);
+    return 1;
+}
+
+static void check_device_init(check_device_t *d, uint32_t command_us, uint32_t sector_us)
+{
+    d->device.start_read = check_start_read;
+    d->device.poll = check_poll;
+    d->device.max_sectors = 64;
+    d->device.context = d;
+    d->command_us = command_us;
+    d->sector_us = sector_us;
+    d->fail_sector = UINT32_MAX;
+    d->busy = false;
+    d->commands = 0;
+    d->max_count = 0;
+}
+
+static check_device_t check_device;
+static sector_reader_t check_reader;
+
+// 先頭が first_sector、長さ size のデータを、いろいろな位置・長さで読んでイメージと比べる。
+static int check_data(void)
+{
+    const uint32_t first_sector = 100;
+    const uint32_t size = 300000; // セクタの倍数でない
+    const uint8_t *expected = &check_device.image[first_sector * BLOCK_DEVICE_SECTOR_SIZE];
+    static uint8_t buffer[70000 + 4] __attribute__((aligned(4)));
+    check_device_init(&check_device, 0, 0);
+    sector_reader_init(&check_reader, &check_device.device, first_sector, size, 0);
+    int errors = 0;
+    uint32_t reads = 0;
+    srand(1);
+    for (int i = 0; i < 2000; i++)
+    {
+        uint32_t offset = (i % 4 == 0) ? (rand() % (size / 512)) * 512 : rand() % size;
+        uint32_t length = (i % 3 == 0) ? (rand() % 64 + 1) * 512 : rand() % 70000 + 1;
+        uint32_t misalign = (i % 5 == 0) ? rand() % 4 : 0;
+        sector_reader_seek(&check_reader, offset);
+        int result = sector_reader_read(&check_reader, buffer + misalign, length);
+        uint32_t expected_length = length < size - offset ? length : size - offset;
+        if (result != (int)expected_length || memcmp(buffer + misalign, expected + offset, expected_length) != 0 ||
+            check_reader.position != offset + expected_length)
+            errors++;
+        reads++;
+    }
+    // 末尾では 0
+    sector_reader_seek(&check_reader, size);
+    errors += sector_reader_read(&check_reader, buffer, 100) == 0 ? 0 : 1;
+    printf("  data: %u reads at random offsets and lengths, %u commands (max %u sectors), mismatches %d\n",
+           (unsigned)reads, (unsigned)check_device.commands, (unsigned)check_device.max_count, errors);
+    return errors == 0 && check_device.max_count == 64 ? 0 : 1;
+}
+
+typedef struct
+{
+    double mbps;           // 読み込み中の転送速度
+    double sustained_mbps; // 全体の時間での転送速度
+    uint32_t p50_us;
+    uint32_t p99_us;
+} check_bench_t;
+
+static check_bench_t check_bench(uint32_t max_sectors)
+{
+    static uint8_t buffer[64 * BLOCK_DEVICE_SECTOR_SIZE] __attribute__((aligned(4)));
+    check_device_init(&check_device, CHECK_COMMAND_US, CHECK_SECTOR_US);
+    sector_reader_init(&check_reader, &check_device.device, 0, CHECK_BENCH_SIZE, max_sectors);
+    uint64_t start = host_time_ns();
+    while (sector_reader_read(&check_reader, buffer, sizeof(buffer)) > 0)
+        ;
+    uint64_t elapsed_us = (host_time_ns() - start) / 1000;
+    check_bench_t bench;
+    bench.mbps = read_stats_mbps(&check_reader.stats);
+    bench.sustained_mbps = (double)check_reader.position / elapsed_us;
+    bench.p50_us = read_stats_percentile_us(&check_reader.stats, 0.5);
+    bench.p99_us = read_stats_percentile_us(&check_reader.stats, 0.99);
+    char name[40];
+    snprintf(name, sizeof(name), "  %2u sectors per read", (unsigned)max_sectors);
+    read_stats_dump(name, &check_reader.stats);
+    printf("    sustained %.2f MB/s\n", bench.sustained_mbps);
+    return bench;
+}
+
+// 入れた遅延の1回の読み込みの時間が、パーセンタイルのバケットに入っていること(上は遅れを 1 バケット分まで許す)
+static bool check_latency(const check_bench_t *bench, uint32_t sectors)
+{
+    uint32_t injected = CHECK_COMMAND_US + CHECK_SECTOR_US * sectors;
+    uint32_t bucket = 0;
+    while (bucket < READ_STATS_BUCKETS - 1 && injected >= read_stats_limits_us[bucket])
+        bucket++;
+    uint32_t upper = bucket + 1 < READ_STATS_BUCKETS - 1 ? read_stats_limits_us[bucket + 1] : UINT32_MAX;
+    return bench->p50_us >= injected && bench->p50_us <= upper;
+}
+
+static int check_error(void)
+{
+    static uint8_t buffer[8 * BLOCK_DEVICE_SECTOR_SIZE] __attribute__((aligned(4)));
+    check_device_init(&check_device, 0, 0);
+    check_device.fail_sector = 20;
+    sector_reader_init(&check_reader, &check_device.device, 0, 64 * BLOCK_DEVICE_SECTOR_SIZE, 8);
+    int first = sector_reader_read(&check_reader, buffer, sizeof(buffer));  // 0-7
+    int second = sector_reader_read(&check_reader, buffer, sizeof(buffer)); // 8-15
+    int failed = sector_reader_read(&check_reader, buffer, sizeof(buffer)); // 16-23
+    printf("  error: reads %d, %d, then %d at the failing sector (position %u)\n", first, second, failed,
+           (unsigned)check_reader.position);
+    return first == (int)sizeof(buffer) && second == (int)sizeof(buffer) && failed == -1 &&
+                   check_reader.position == 16 * BLOCK_DEVICE_SECTOR_SIZE
+               ? 0
+               : 1;
+}
+
+// WAV の先読みを最後まで読み、補充の読み込みのバイト数を見る。
+static int check_prefetch(void)
+{
+    const char *path = "sector_reader_input.wav";
+    if (host_write_test_wav(path, 48000, 5) != 0)
+        return 1;
+    LittleFS.setRoot("");
+    if (wav_source_open(LittleFS, path, false) != 0)
+        return 1;
+    // 開いたときにリングを満たした分は統計に入らない(44バイトのヘッダの後の最初の読み込みはセクタ境界までの 468 バイト)
+    wav_source_stats_t stats;
+    wav_source_get_stats(&stats);
+    uint32_t initial = stats.level;
+    static uint8_t buffer[1000];
+    for (uint32_t i = 0; i < 48000 * 5 / sizeof(buffer); i++)
+    {
+        wav_source_service();
+        wav_source_read(buffer, sizeof(buffer));
+    }
+    wav_source_get_stats(&stats);
+    wav_source_close();
+    remove(path);
+    double average = stats.reads.reads ? (double)stats.reads.bytes / stats.reads.reads : 0;
+    printf("  wav prefetch: %u reads after the initial fill, %u bytes, average %.0f bytes per read (sector %u, max %u)\n",
+           (unsigned)stats.reads.reads, (unsigned)stats.reads.bytes, average, FILE_PREFETCH_SECTOR_SIZE,
+           FILE_PREFETCH_READ_SIZE);
+    // その後の読み込みはセクタ境界から始まるので、リングの折り返し以外はセクタの倍数になる
+    return initial + stats.reads.bytes == 48000 * 5 && average >= 2 * FILE_PREFETCH_SECTOR_SIZE ? 0 : 1;
+}
+
+int check_sector_reader_main(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+    check_device.image.resize((size_t)CHECK_IMAGE_SECTORS * BLOCK_DEVICE_SECTOR_SIZE);
+    uint32_t seed = 12345;
+    for (uint8_t &byte : check_device.image)
+    {
+        seed = seed * 1103515245u + 12345u;
+        byte = (uint8_t)(seed >> 16);
+    }
+
+    int result = 0;
+    printf("sector reader on a %u-sector image:\n", (unsigned)CHECK_IMAGE_SECTORS);
+    result |= check_data();
+    result |= check_error();
+
+    printf("reading %u KB with %u us per command + %u us per sector:\n", (unsigned)(CHECK_BENCH_SIZE / 1024),
+           (unsigned)CHECK_COMMAND_US, (unsigned)CHECK_SECTOR_US);
+    check_bench_t single = check_bench(1);
+    check_bench_t eight = check_bench(8);
+    check_bench_t multi = check_bench(64);
+    result |= check_latency(&single, 1) && check_latency(&eight, 8) && check_latency(&multi, 64) ? 0 : 1;
+    // コマンドの時間がセクタ数で割られるので、まとめて読むほど速い
+    result |= multi.sustained_mbps > eight.sustained_mbps && eight.sustained_mbps > 2 * single.sustained_mbps ? 0 : 1;
+
+    result |= check_prefetch();
+    printf("%s\n", result == 0 ? "OK" : "NG");
+    return result;
+}
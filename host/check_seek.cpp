@@ -0,0 +1,314 @@
+#include "host_commands.h"
+
+#include <atomic>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+
+#include "LittleFS.h"
+#include "fake_btstack.h"
+#include "host_stream.h"
+#include "audio/audio_pipeline.h"
+#include "audio/sbc_frame_queue.h"
+#include "audio/sbc_source.h"
+#include "audio/wav_source.h"
+
+// シーク(wav_source_request_seek / sbc_source_request_seek)と再生位置(audio_pipeline_position_ms)を確かめます。
+//  - 読み出し: 左チャンネルに通し番号を入れた WAV を読みながらシークし、新しい位置の最初のサンプルが要求した番号であること。
+//    曲の指定(wav_source_request_track)で別のファイルの先頭に移ること、曲の指定がまだ始まらないうちのシークがその曲の中になること
+//  - 仮想時間でストリーミングしながらシーク(続けて2回要求した場合は後の方)し、再生位置が シーク先 + 経過時間 になること、
+//    要求から新しい位置の音声が入った最初のパケットを送るまでの時間、アンダーラン・フレームの誤りが無いこと
+//    (シングルコア・デュアルコア・エンコード済みファイル)
+// を確認します。
+
+static const uint32_t CHECK_RATE = 48000;
+static const uint32_t CHECK_READ_SAMPLES = 100;
+static const uint16_t CHECK_RIGHT = 0x1234; // 無音と区別するための右チャンネルの値
+static const uint32_t CHECK_A_SAMPLES = 40000;
+static const uint32_t CHECK_B_SAMPLES = 20000;
+static const uint16_t CHECK_B_FIRST = 45000;
+static const int CHECK_SECONDS = 4;
+
+static const media_codec_configuration_sbc_t check_configuration = {
+    0, 2, 48000, 16, 8, 2, 53, SBC_CHANNEL_MODE_STEREO, SBC_ALLOCATION_METHOD_SNR};
+
+static void check_put_le(FILE *fp, uint32_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+        fputc((int)(value >> (8 * i)) & 0xFF, fp);
+}
+
+// 左に first からの通し番号、右に CHECK_RIGHT を入れた 16bit ステレオの WAV
+static int check_write_wav(const char *path, uint32_t num_samples, uint16_t first)
+{
+    FILE *fp = fopen(path, "wb");
+    if (!fp)
+        return -1;
+    uint32_t data_size = num_samples * 4;
+    fwrite("RIFF", 1, 4, fp);
+    check_put_le(fp, 36 + data_size, 4);
+    fwrite("WAVEfmt ", 1, 8, fp);
+    check_put_le(fp, 16, 4);
+    check_put_le(fp, 1, 2);
+    check_put_le(fp, 2, 2);
+    check_put_le(fp, CHECK_RATE, 4);
+    check_put_le(fp, CHECK_RATE * 4, 4);
+    check_put_le(fp, 4, 2);
+    check_put_le(fp, 16, 2);
+    fwrite("data", 1, 4, fp);
+    check_put_le(fp, data_size, 4);
+    for (uint32_t i = 0; i < num_samples; i++)
+    {
+        check_put_le(fp, (uint16_t)(first + i), 2);
+        check_put_le(fp, CHECK_RIGHT, 2);
+    }
+    fclose(fp);
+    return 0;
+}
+
+// 新しい位置の最初のサンプルを読むまで読み出し、その左チャンネルの値を返す。新しい位置の前は無音になっている。
+static bool check_read_landing(uint32_t *first)
+{
+    static uint8_t data[CHECK_READ_SAMPLES * 4];
+    uint32_t sample;
+    bool requested;
+    uint32_t before = wav_source_landings(&sample, &requested);
+    for (int reads = 0; reads < 100; reads++)
+    {
+        wav_source_service();
+        wav_source_read(data, sizeof(data));
+        if (wav_source_landings(&sample, &requested) == before)
+            continue;
+        for (uint32_t i = 0; i < CHECK_READ_SAMPLES; i++)
+        {
+            if ((data[4 * i + 2] | data[4 * i + 3] << 8) == CHECK_RIGHT)
+            {
+                *first = data[4 * i] | data[4 * i + 1] << 8;
+                return requested;
+            }
+        }
+        return false;
+    }
+    return false;
+}
+
+static bool check_read(const char *path_a, const char *path_b)
+{
+    if (wav_source_open(LittleFS, path_a, false) != 0)
+        return false;
+    static uint8_t data[CHECK_READ_SAMPLES * 4];
+    for (int i = 0; i < 3; i++)
+    {
+        wav_source_service();
+        wav_source_read(data, sizeof(data));
+    }
+    bool ok = true;
+    uint32_t first = 0;
+    wav_source_track_stats_t track;
+
+    wav_source_request_seek(30000);
+    bool seek_ok = check_read_landing(&first) && first == 30000 + 1;
+    printf("  seek to sample 30000: first sample %u (%s)\n", (unsigned)first - 1, seek_ok ? "ok" : "NG");
+    ok &= seek_ok;
+
+    wav_source_request_seek(1234);
+    seek_ok = check_read_landing(&first) && first == 1234 + 1;
+    printf("  seek back to sample 1234: first sample %u (%s)\n", (unsigned)first - 1, seek_ok ? "ok" : "NG");
+    ok &= seek_ok;
+
+    wav_source_request_track(LittleFS, path_b, 7);
+    seek_ok = check_read_landing(&first) && first == CHECK_B_FIRST;
+    wav_source_get_track_stats(&track);
+    seek_ok &= track.tag == 7 && track.changes == 1;
+    printf("  track b: first sample %u, tag %u, changes %u (%s)\n", (unsigned)(first - CHECK_B_FIRST), (unsigned)track.tag,
+           (unsigned)track.changes, seek_ok ? "ok" : "NG");
+    ok &= seek_ok;
+
+    wav_source_request_seek(777);
+    seek_ok = check_read_landing(&first) && first == CHECK_B_FIRST + 777;
+    wav_source_get_track_stats(&track);
+    seek_ok &= track.changes == 1;
+    printf("  seek in track b to sample 777: first sample %u, changes %u (%s)\n", (unsigned)(first - CHECK_B_FIRST),
+           (unsigned)track.changes, seek_ok ? "ok" : "NG");
+    ok &= seek_ok;
+
+    // 曲 a を指定して書き込み側が読み込み始めたが、読み出し側がまだ切り替わらないうちにシークする。
+    wav_source_request_track(LittleFS, path_a, 9);
+    wav_source_service();                // リングを捨てるように頼む
+    wav_source_read(data, sizeof(data)); // 捨てる
+    wav_source_service();                // 曲 a を開いて境目を置く
+    wav_source_request_seek(5000);
+    seek_ok = check_read_landing(&first) && first == 5000 + 1;
+    wav_source_get_track_stats(&track);
+    seek_ok &= track.tag == 9;
+    printf("  seek before track a starts: first sample %u of tag %u (%s)\n", (unsigned)first - 1, (unsigned)track.tag,
+           seek_ok ? "ok" : "NG");
+    ok &= seek_ok;
+
+    wav_source_stats_t stats;
+    wav_source_get_stats(&stats);
+    printf("  underrun %u bytes\n", (unsigned)stats.underrun_bytes);
+    ok &= stats.underrun_bytes == 0;
+    wav_source_close();
+    return ok;
+}
+
+typedef struct
+{
+    uint32_t at_ms;
+    uint32_t target_ms;
+} check_seek_t;
+
+// 2000 ms と 2001 ms は続けて要求し、後の方(3000 ms)だけが効く。
+static const check_seek_t check_seeks[] = {{1000, 6000}, {2000, 500}, {2001, 3000}};
+// 再生位置を見る時刻と、そのときに効いているシーク先(-1 は最初から)
+static const uint32_t check_probe_ms[] = {900, 1500, 3900};
+static const int check_probe_seek[] = {-1, 0, 2};
+
+static a2dp_media_sending_context_t check_context;
+static uint32_t check_ms;
+static uint32_t check_seen_seeks;
+static uint32_t check_landed_ms;
+static uint32_t check_positions[3];
+static uint32_t check_landings[3];
+
+static void check_each_ms(void)
+{
+    audio_pipeline_loop();
+    // デュアルコアモードでは、コア1が仮想時間に追いつくまで待つ(キューの半分)。
+    uint32_t level, max_level, underruns;
+    do
+    {
+        audio_pipeline_get_queue_stats(&level, &max_level, &underruns);
+    } while (audio_pipeline_get_mode() == AUDIO_PIPELINE_DUAL_CORE && level < SBC_FRAME_QUEUE_SLOTS / 2);
+    for (const check_seek_t &seek : check_seeks)
+    {
+        if (check_ms == seek.at_ms)
+            audio_pipeline_seek(&check_context, seek.target_ms);
+    }
+    audio_seek_stats_t stats;
+    audio_pipeline_get_seek_stats(&check_context, &stats);
+    if (stats.seeks != check_seen_seeks)
+    {
+        check_seen_seeks = stats.seeks;
+        check_landed_ms = check_ms;
+    }
+    for (int i = 0; i < 3; i++)
+    {
+        if (check_ms == check_probe_ms[i])
+        {
+            check_positions[i] = audio_pipeline_position_ms(&check_context);
+            check_landings[i] = check_landed_ms;
+        }
+    }
+    check_ms++;
+}
+
+static std::atomic<bool> check_core1_running;
+
+static bool check_stream(const char *name, audio_pipeline_mode_t mode)
+{
+    check_ms = 0;
+    check_seen_seeks = 0;
+    check_landed_ms = 0;
+    audio_pipeline_set_mode(mode);
+    audio_pipeline_init_encoder(&check_configuration);
+    std::thread core1;
+    if (mode == AUDIO_PIPELINE_DUAL_CORE)
+    {
+        check_core1_running = true;
+        core1 = std::thread([]() {
+            while (check_core1_running)
+                audio_pipeline_loop1();
+        });
+    }
+    host_stream_run(&check_context, CHECK_SECONDS, check_each_ms);
+    if (mode == AUDIO_PIPELINE_DUAL_CORE)
+    {
+        check_core1_running = false;
+        core1.join();
+    }
+    audio_pipeline_set_mode(AUDIO_PIPELINE_SINGLE_CORE);
+
+    audio_payload_stats_t payload;
+    audio_pipeline_get_payload_stats(&check_context, &payload);
+    audio_seek_stats_t seek;
+    audio_pipeline_get_seek_stats(&check_context, &seek);
+    audio_backlog_stats_t backlog;
+    audio_pipeline_get_backlog_stats(&check_context, &backlog);
+    // 送った位置はパケット単位で進み、タイマーの周期だけ遅れて詰める。
+    uint32_t packet_ms = payload.plan.frames_per_packet * 128 * 1000 / CHECK_RATE;
+    uint32_t tolerance_ms = packet_ms + 2 * AUDIO_TIMEOUT_MS;
+    // デュアルコアモードではキューに積んだ古いフレームを送ってから新しい位置になる。
+    uint32_t queue_ms = mode == AUDIO_PIPELINE_DUAL_CORE ? SBC_FRAME_QUEUE_SLOTS * 128 * 1000 / CHECK_RATE : 0;
+    bool ok = seek.seeks >= 2 && seek.max_latency_us <= (queue_ms + 2 * packet_ms + 2 * AUDIO_TIMEOUT_MS) * 1000 &&
+              backlog.underruns == 0 && fake_a2dp_sink.frame_errors == 0;
+    printf("  %-12s positions", name);
+    for (int i = 0; i < 3; i++)
+    {
+        uint32_t expected = check_probe_seek[i] < 0 ? check_probe_ms[i]
+                                                    : check_seeks[check_probe_seek[i]].target_ms + check_probe_ms[i] - check_landings[i];
+        int32_t error = (int32_t)(check_positions[i] - expected);
+        printf(" %u (%+d)", (unsigned)check_positions[i], (int)error);
+        // 新しい位置の前のフレームが遅れて送られると、その分だけ先に進む。
+        ok &= error <= AUDIO_TIMEOUT_MS && -error <= (int32_t)tolerance_ms;
+    }
+    printf(" ms, seeks %u, latency last %.1f max %.1f ms, underruns %u, frame errors %u (%s)\n", (unsigned)seek.seeks,
+           seek.last_latency_us / 1000.0, seek.max_latency_us / 1000.0, (unsigned)backlog.underruns,
+           (unsigned)fake_a2dp_sink.frame_errors, ok ? "ok" : "NG");
+    return ok;
+}
+
+int check_seek_main(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+    const char *path_a = "seek_a.wav";
+    const char *path_b = "seek_b.wav";
+    const char *path_stream = "seek_input.wav";
+    const char *path_sbc = "seek_input.sbc";
+    LittleFS.setRoot("");
+    if (check_write_wav(path_a, CHECK_A_SAMPLES, 1) != 0 || check_write_wav(path_b, CHECK_B_SAMPLES, CHECK_B_FIRST) != 0 ||
+        host_write_test_wav(path_stream, CHECK_RATE, 10) != 0)
+        return 1;
+
+    int result = 0;
+    printf("reading with seeks (%u-sample reads):\n", (unsigned)CHECK_READ_SAMPLES);
+    result |= check_read(path_a, path_b) ? 0 : 1;
+
+    printf("streaming %d s, seeks at", CHECK_SECONDS);
+    for (const check_seek_t &seek : check_seeks)
+        printf(" %u ms -> %u ms", (unsigned)seek.at_ms, (unsigned)seek.target_ms);
+    printf(", positions at %u %u %u ms (error vs target + elapsed):\n", (unsigned)check_probe_ms[0], (unsigned)check_probe_ms[1],
+           (unsigned)check_probe_ms[2]);
+    uint32_t sample;
+    bool requested;
+    for (audio_pipeline_mode_t mode : {AUDIO_PIPELINE_SINGLE_CORE, AUDIO_PIPELINE_DUAL_CORE})
+    {
+        if (wav_source_open(LittleFS, path_stream, false) != 0)
+            return 1;
+        result |= check_stream(mode == AUDIO_PIPELINE_SINGLE_CORE ? "single core" : "dual core", mode) ? 0 : 1;
+        wav_source_landings(&sample, &requested);
+        result |= sample == 3000 * CHECK_RATE / 1000 && requested ? 0 : 1;
+        wav_source_close();
+    }
+
+    if (host_transcode_sbc(path_stream, path_sbc, &check_configuration) != 0 || sbc_source_open(LittleFS, path_sbc, false) != 0)
+        return 1;
+    result |= check_stream("pre-encoded", AUDIO_PIPELINE_SINGLE_CORE) ? 0 : 1;
+    uint32_t frame;
+    sbc_source_landings(&frame);
+    sbc_source_stats_t sbc_stats;
+    sbc_source_get_stats(&sbc_stats);
+    printf("  pre-encoded: landed on frame %u (expected %u), underrun %u bytes\n", (unsigned)frame,
+           (unsigned)(3000 * CHECK_RATE / 1000 / 128), (unsigned)sbc_stats.underrun_bytes);
+    result |= frame == 3000 * CHECK_RATE / 1000 / 128 && sbc_stats.underrun_bytes == 0 ? 0 : 1;
+    sbc_source_close();
+
+    remove(path_a);
+    remove(path_b);
+    remove(path_sbc);
+    printf("%s\n", result == 0 ? "OK" : "NG");
+    return result;
+}
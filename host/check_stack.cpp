@@ -0,0 +1,86 @@
+#include "host_commands.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "LittleFS.h"
+#include "fake_btstack.h"
+#include "host_stream.h"
+#include "audio/audio_arena.h"
+#include "audio/audio_pipeline.h"
+#include "audio/stack_watermark.h"
+#include "audio/wav_source.h"
+
+// タイマーコールバックと送信(実機では BTstack のコンテキスト)が使うスタックを、設定を変えて stack_watermark で測ります。
+// 作業領域は audio_arena にあるので、1フレームのサンプル数・チャンネル数・WAVのフォーマット・レート変換が変わっても
+// スタックの使用量はほとんど変わらないことを確認します。
+// ホストの x86 のスタックなので大きさは実機と同じではありませんが、設定による増え方を比べられます。
+
+static const int CHECK_SECONDS = 2;
+// 設定によるスタックの使用量の差の上限(バイト)。大きな配列がスタックに戻ったらこれを超える。
+static const uint32_t CHECK_MAX_SPREAD = 256;
+
+typedef struct
+{
+    const char *name;
+    host_test_wav_t wav;
+    media_codec_configuration_sbc_t configuration;
+} check_stack_config_t;
+
+static const check_stack_config_t check_stack_configs[] = {
+    {"16bit stereo 48k", {48000, 48000 * CHECK_SECONDS, 2, 16, false, false},
+     {0, 2, 48000, 16, 8, 2, 53, SBC_CHANNEL_MODE_JOINT_STEREO, SBC_ALLOCATION_METHOD_LOUDNESS}},
+    {"24bit stereo 48k", {48000, 48000 * CHECK_SECONDS, 2, 24, false, false},
+     {0, 2, 48000, 16, 8, 2, 53, SBC_CHANNEL_MODE_STEREO, SBC_ALLOCATION_METHOD_SNR}},
+    {"8bit mono 48k, mono", {48000, 48000 * CHECK_SECONDS, 1, 8, false, false},
+     {0, 2, 48000, 16, 8, 2, 31, SBC_CHANNEL_MODE_MONO, SBC_ALLOCATION_METHOD_LOUDNESS}},
+    {"16bit stereo 44.1k->48k", {44100, 44100 * CHECK_SECONDS, 2, 16, false, false},
+     {0, 2, 48000, 16, 8, 2, 53, SBC_CHANNEL_MODE_JOINT_STEREO, SBC_ALLOCATION_METHOD_LOUDNESS}},
+    {"16bit stereo, 4 blocks", {48000, 48000 * CHECK_SECONDS, 2, 16, false, false},
+     {0, 2, 48000, 4, 8, 2, 53, SBC_CHANNEL_MODE_JOINT_STEREO, SBC_ALLOCATION_METHOD_LOUDNESS}},
+};
+
+static a2dp_media_sending_context_t check_context;
+
+int check_stack_main(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+    const char *path = "stack_input.wav";
+    LittleFS.setRoot("");
+    printf("audio arena: %u of %u bytes (pcm_frame %u, wav_data %u)\n", (unsigned)sizeof(audio_arena_t),
+           (unsigned)AUDIO_ARENA_BUDGET, (unsigned)sizeof(((audio_arena_t *)0)->pcm_frame),
+           (unsigned)sizeof(((audio_arena_t *)0)->wav_data));
+    printf("stack used by the timer callback and send (single core, %d s):\n", CHECK_SECONDS);
+    uint32_t min_used = UINT32_MAX;
+    uint32_t max_used = 0;
+    int result = 0;
+    for (const check_stack_config_t &config : check_stack_configs)
+    {
+        if (host_write_test_wav_ex(path, &config.wav) != 0)
+            return 1;
+        // 1回目は、共有ライブラリの関数を初めて呼んだときのシンボル解決(スタックを多く使う)を済ませるだけにする。
+        stack_watermark_stats_t stats;
+        for (int pass = 0; pass < 2; pass++)
+        {
+            if (wav_source_open(LittleFS, path, true) != 0)
+                return 1;
+            audio_pipeline_init_encoder(&config.configuration);
+            stack_watermark_paint();
+            host_stream_run(&check_context, CHECK_SECONDS, audio_pipeline_loop);
+            stack_watermark_get(&stats);
+            wav_source_close();
+        }
+        printf("  %-26s max used %5u bytes, frames %u, frame errors %u\n", config.name, (unsigned)stats.max_used,
+               (unsigned)fake_a2dp_sink.sbc_frames, (unsigned)fake_a2dp_sink.frame_errors);
+        if (stats.max_used < min_used)
+            min_used = stats.max_used;
+        if (stats.max_used > max_used)
+            max_used = stats.max_used;
+        result |= !stats.overflow && stats.max_used > 0 && fake_a2dp_sink.sbc_frames > 0 && fake_a2dp_sink.frame_errors == 0 ? 0 : 1;
+    }
+    printf("  spread between configurations %u bytes (limit %u)\n", (unsigned)(max_used - min_used), (unsigned)CHECK_MAX_SPREAD);
+    result |= max_used - min_used <= CHECK_MAX_SPREAD ? 0 : 1;
+    printf("%s\n", result == 0 ? "OK" : "NG");
+    return result;
+}
@@ -0,0 +1,214 @@
+#include "host_commands.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+
+#include "LittleFS.h"
+#include "fake_btstack.h"
+#include "host_stream.h"
+#include "audio/audio_pipeline.h"
+#include "audio/sbc_frame_queue.h"
+#include "audio/stage_profile.h"
+#include "audio/wav_source.h"
+
+// 段ごとの処理時間の記録(stage_profile)を確かめます。
+//  - 44.1kHz の WAV を 48kHz に変換してストリーミングし(シングルコア/デュアルコア)、各段が記録されること
+//  - バイナリレコードを読み戻し、チェックサムと回数がメモリ上の記録やシンクの受け取ったパケット数と合うこと
+//  - 記録を止めたときとの比較で、オーバーヘッドが小さいこと
+// を確認し、段ごとの分布を表示します。ホストの時刻は壁時計の ns です。
+
+static a2dp_media_sending_context_t check_context;
+static std::atomic<bool> check_core1_running;
+
+static void check_each_ms(void)
+{
+    if (audio_pipeline_get_mode() == AUDIO_PIPELINE_SINGLE_CORE)
+    {
+        audio_pipeline_loop();
+        return;
+    }
+    uint32_t level, max_level, underruns;
+    do
+    {
+        audio_pipeline_get_queue_stats(&level, &max_level, &underruns);
+    } while (level < SBC_FRAME_QUEUE_SLOTS / 2);
+}
+
+// 1回ストリーミングして、タイマーと送信にかかった壁時計の時間(ns)を返す。
+static uint64_t check_stream(const char *path, audio_pipeline_mode_t mode, int seconds)
+{
+    static const media_codec_configuration_sbc_t configuration = {
+        0, 2, 48000, 16, 8, 2, 53, SBC_CHANNEL_MODE_JOINT_STEREO, SBC_ALLOCATION_METHOD_LOUDNESS};
+    audio_pipeline_set_mode(mode);
+    if (wav_source_open(LittleFS, path, true) != 0)
+        return 0;
+    audio_pipeline_init_encoder(&configuration);
+    std::thread core1;
+    if (mode == AUDIO_PIPELINE_DUAL_CORE)
+    {
+        check_core1_running = true;
+        core1 = std::thread([]() {
+            while (check_core1_running)
+                audio_pipeline_loop1();
+        });
+    }
+    uint64_t busy_ns = host_stream_run(&check_context, seconds, check_each_ms);
+    if (mode == AUDIO_PIPELINE_DUAL_CORE)
+    {
+        check_core1_running = false;
+        core1.join();
+    }
+    audio_pipeline_set_mode(AUDIO_PIPELINE_SINGLE_CORE);
+    wav_source_close();
+    return busy_ns;
+}
+
+static uint32_t check_get_u32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint16_t check_get_u16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+// バケットの上限(サイクル数)
+static uint64_t check_bucket_limit(int bucket)
+{
+    return (uint64_t)1 << (STAGE_PROFILE_FIRST_BUCKET_BITS + bucket);
+}
+
+// 分布から、割合 fraction の回数が収まるバケットの上限を求める。
+static uint64_t check_percentile(const uint32_t *histogram, uint32_t count, double fraction)
+{
+    uint64_t sum = 0;
+    for (int b = 0; b < STAGE_PROFILE_BUCKETS; b++)
+    {
+        sum += histogram[b];
+        if (sum >= count * fraction)
+            return check_bucket_limit(b);
+    }
+    return check_bucket_limit(STAGE_PROFILE_BUCKETS - 1);
+}
+
+// レコードを読み戻して表示し、メモリ上の記録と比べる。読めなければ false。
+static bool check_decode(const uint8_t *record, size_t length)
+{
+    if (length < STAGE_PROFILE_HEADER_SIZE + 2 || memcmp(record, "SPRF", 4) != 0 || record[4] != STAGE_PROFILE_VERSION ||
+        record[5] != STAGE_PROFILE_NUM_STAGES || record[6] != STAGE_PROFILE_BUCKETS || check_get_u16(&record[12]) != length)
+    {
+        printf("    bad header\n");
+        return false;
+    }
+    uint16_t sum1 = 0, sum2 = 0;
+    for (size_t i = 0; i < length - 2; i++)
+    {
+        sum1 = (sum1 + record[i]) % 255;
+        sum2 = (sum2 + sum1) % 255;
+    }
+    if (check_get_u16(&record[length - 2]) != ((sum2 << 8) | sum1))
+    {
+        printf("    bad checksum\n");
+        return false;
+    }
+    uint32_t clock_hz = check_get_u32(&record[8]);
+    double ns_per_cycle = 1e9 / clock_hz;
+    printf("    record: %u bytes, clock %u Hz\n", (unsigned)length, (unsigned)clock_hz);
+    printf("    %-10s %8s %10s %10s %10s %10s  histogram (2^%d.. cycles)\n", "stage", "count", "mean ns", "p50 <ns", "p99 <ns",
+           "max ns", STAGE_PROFILE_FIRST_BUCKET_BITS);
+
+    const uint8_t *p = &record[STAGE_PROFILE_HEADER_SIZE];
+    bool ok = true;
+    for (int i = 0; i < STAGE_PROFILE_NUM_STAGES; i++)
+    {
+        uint32_t count = check_get_u32(p);
+        uint32_t max_cycles = check_get_u32(p + 4);
+        uint64_t total = check_get_u32(p + 8) | ((uint64_t)check_get_u32(p + 12) << 32);
+        uint32_t histogram[STAGE_PROFILE_BUCKETS];
+        uint32_t histogram_sum = 0;
+        p += 16;
+        for (int b = 0; b < STAGE_PROFILE_BUCKETS; b++)
+        {
+            histogram[b] = check_get_u32(p);
+            histogram_sum += histogram[b];
+            p += 4;
+        }
+        uint32_t ring_count = check_get_u32(p);
+        p += 4;
+        // リングの最後は最新の1回で、最大値を超えない。
+        uint32_t last_cycles = ring_count > 0 ? check_get_u32(p + 8 * (ring_count - 1) + 4) : 0;
+        p += 8 * ring_count;
+
+        const stage_profile_stage_stats_t *stats = stage_profile_get((stage_profile_stage_t)i);
+        ok &= count == stats->count && total == stats->total_cycles && histogram_sum == count && last_cycles <= max_cycles &&
+              ring_count == (count < STAGE_PROFILE_RING_ENTRIES ? count : STAGE_PROFILE_RING_ENTRIES);
+
+        printf("    %-10s %8u %10.0f %10.0f %10.0f %10.0f  ", stage_profile_stage_name((stage_profile_stage_t)i), (unsigned)count,
+               count ? total * ns_per_cycle / count : 0.0, check_percentile(histogram, count, 0.5) * ns_per_cycle,
+               check_percentile(histogram, count, 0.99) * ns_per_cycle, max_cycles * ns_per_cycle);
+        for (int b = 0; b < STAGE_PROFILE_BUCKETS; b++)
+            printf("%s%u", b ? " " : "", (unsigned)histogram[b]);
+        printf("\n");
+    }
+    if ((size_t)(p - record) != length - 2)
+    {
+        printf("    bad length\n");
+        return false;
+    }
+    return ok;
+}
+
+static int check_run(const char *path, audio_pipeline_mode_t mode, int seconds)
+{
+    printf("  %s:\n", mode == AUDIO_PIPELINE_SINGLE_CORE ? "single core" : "dual core");
+    stage_profile_reset();
+    check_stream(path, mode, seconds);
+    static uint8_t record[STAGE_PROFILE_RECORD_SIZE];
+    size_t length = stage_profile_serialize(record, sizeof(record));
+    bool ok = check_decode(record, length);
+
+    // 送ったパケットごとに待ちと送信が1回ずつ、送ったフレームは全部エンコードされている。
+    uint32_t packets = fake_a2dp_sink.packets;
+    ok &= stage_profile_get(STAGE_PROFILE_SEND)->count == packets && stage_profile_get(STAGE_PROFILE_SEND_WAIT)->count == packets &&
+          stage_profile_get(STAGE_PROFILE_ENCODE)->count >= fake_a2dp_sink.sbc_frames &&
+          stage_profile_get(STAGE_PROFILE_CONVERT)->count == stage_profile_get(STAGE_PROFILE_ENCODE)->count &&
+          stage_profile_get(STAGE_PROFILE_READ)->count > 0 && stage_profile_get(STAGE_PROFILE_REFILL)->count > 0;
+    printf("    packets %u, SBC frames %u: %s\n", (unsigned)packets, (unsigned)fake_a2dp_sink.sbc_frames, ok ? "OK" : "NG");
+    return ok ? 0 : 1;
+}
+
+int check_stage_profile_main(int argc, char **argv)
+{
+    int seconds = argc > 1 ? atoi(argv[1]) : 10;
+    const char *path = "profile_input.wav";
+    if (host_write_test_wav(path, 44100, 5) != 0)
+        return 1;
+    LittleFS.setRoot("");
+
+    printf("stage profile: 44.1 kHz WAV -> 48 kHz SBC, %d s of virtual time\n", seconds);
+    int result = check_run(path, AUDIO_PIPELINE_SINGLE_CORE, seconds);
+    result |= check_run(path, AUDIO_PIPELINE_DUAL_CORE, seconds);
+
+    // シングルコアでタイマーと送信の時間を、記録あり/なしで比べる(速い方を取る)。
+    uint64_t best[2] = {UINT64_MAX, UINT64_MAX};
+    for (int round = 0; round < 3; round++)
+    {
+        for (int enabled = 0; enabled < 2; enabled++)
+        {
+            stage_profile_set_enabled(enabled);
+            uint64_t ns = check_stream(path, AUDIO_PIPELINE_SINGLE_CORE, seconds);
+            if (ns < best[enabled])
+                best[enabled] = ns;
+        }
+    }
+    stage_profile_set_enabled(true);
+    double overhead = 100.0 * ((double)best[1] - (double)best[0]) / (double)best[0];
+    printf("  timer + send per second of audio: off %.3f ms, on %.3f ms (overhead %.1f%%)\n",
+           best[0] / 1e6 / seconds, best[1] / 1e6 / seconds, overhead);
+    printf("%s\n", result == 0 ? "OK" : "NG");
+    return result;
+}
@@ -0,0 +1,251 @@
+#include "host_commands.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "LittleFS.h"
+#include "audio/audio_pipeline.h"
+#include "audio/pcm_convert.h"
+#include "audio/wav_format.h"
+#include "audio/wav_source.h"
+
+// WAVヘッダの解析と変換カーネルを確かめます。
+//  1. 8/16/24bit、モノラル/ステレオ、EXTENSIBLE、LIST チャンクありの WAV を作って解析し、
+//     wav_source 経由で produce_audio() した結果を素直な式で変換したものと比べる
+//     (エンコーダがステレオの場合と MONO の場合。MONO ではステレオを (L + R) / 2 に混ぜる)
+//  2. 音量を下げて同じことをし、最初のブロックでゲインが直線に下がり、その後は参照に Q15 のゲインを掛けた値と一致すること
+//  3. サイズが壊れたチャンク(ファイル末尾を越える・32bit で回り込む)の後は読まずにエラーになり、止まらないこと
+//  4. 各カーネルの 1 サンプル(ステレオ1組)あたりの時間を計測する(ゲイン付きのカーネルとの比較は bench_pipeline)
+
+static const char *CHECK_WAV_FILE_NAME = "wav_input.wav";
+static const uint32_t CHECK_NUM_SAMPLES = 48000;
+// 音量を変えたときの確認に使う AVRCP の絶対音量
+static const uint8_t CHECK_VOLUME = 64;
+
+// produce_audio() が使っているはずの今のゲイン(Q15 << 16)。produce_audio() を呼ぶたびに同じように進める。
+static uint32_t check_level = PCM_GAIN_LEVEL(PCM_GAIN_UNITY);
+
+// 参照用の変換。src は1チャンネル分のサンプルの先頭。
+static int16_t check_reference_sample(const uint8_t *src, int bits)
+{
+    switch (bits)
+    {
+    case 8:
+        return (int16_t)((src[0] - 128) * 256);
+    case 16:
+        return (int16_t)(src[0] | (src[1] << 8));
+    default:
+        return (int16_t)(((int32_t)(src[0] | (src[1] << 8) | (src[2] << 16)) << 8) >> 16);
+    }
+}
+
+// ファイルの data チャンクを丸ごと読む。
+static uint8_t *check_read_data(const char *path, const wav_format_t *format)
+{
+    FILE *fp = fopen(path, "rb");
+    if (!fp)
+        return NULL;
+    uint8_t *data = (uint8_t *)malloc(format->data_size);
+    fseek(fp, format->data_offset, SEEK_SET);
+    size_t length = fread(data, 1, format->data_size, fp);
+    fclose(fp);
+    if (length != format->data_size)
+    {
+        free(data);
+        return NULL;
+    }
+    return data;
+}
+
+// 参照に i 番目のサンプルのゲインを掛ける。
+static int16_t check_gain_sample(int32_t sample, uint32_t level, int32_t step, int i)
+{
+    return (int16_t)((sample * (int32_t)((level + (uint32_t)(step * i)) >> 16)) >> 15);
+}
+
+static int check_format(const host_test_wav_t *wav, int output_channels, uint8_t volume)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "%2d bit %s%s%s -> %s", wav->bits_per_sample, wav->num_channels == 1 ? "mono  " : "stereo",
+             wav->extensible ? " extensible" : "", wav->extra_chunks ? " +LIST" : "", output_channels == 1 ? "mono" : "stereo");
+    uint16_t gain = pcm_gain_from_volume(volume);
+    if (host_write_test_wav_ex(CHECK_WAV_FILE_NAME, wav) != 0)
+        return 1;
+
+    // ヘッダ
+    File file = LittleFS.open(CHECK_WAV_FILE_NAME, "r");
+    wav_format_t format;
+    wav_format_result_t result = wav_format_parse(file, &format);
+    file.close();
+    int block_align = wav->num_channels * wav->bits_per_sample / 8;
+    if (result != WAV_FORMAT_OK || format.format_tag != WAV_FORMAT_PCM || format.num_channels != wav->num_channels ||
+        format.sample_rate != wav->sample_rate || format.bits_per_sample != wav->bits_per_sample ||
+        format.block_align != block_align || format.data_size != wav->num_samples * block_align)
+    {
+        printf("  %-42s header: %s -> NG\n", name, wav_format_result_string(result));
+        return 1;
+    }
+
+    // wav_source と produce_audio() を通した結果を参照と比べる。
+    uint8_t *data = check_read_data(CHECK_WAV_FILE_NAME, &format);
+    if (data == NULL || wav_source_open(LittleFS, CHECK_WAV_FILE_NAME, false) != 0)
+    {
+        free(data);
+        return 1;
+    }
+    // produce_audio() のチャンネル数はエンコーダのチャンネルモードで決まる。
+    media_codec_configuration_sbc_t configuration = {
+        0, output_channels, (int)wav->sample_rate, 16, 8, 2, 53,
+        output_channels == 1 ? SBC_CHANNEL_MODE_MONO : SBC_CHANNEL_MODE_STEREO, SBC_ALLOCATION_METHOD_SNR};
+    audio_pipeline_set_mode(AUDIO_PIPELINE_SINGLE_CORE);
+    audio_pipeline_init_encoder(&configuration);
+    audio_pipeline_set_volume_gain(true);
+    audio_pipeline_set_volume(volume);
+    static int16_t pcm_frame[128 * NUM_CHANNELS] __attribute__((aligned(4)));
+    uint32_t errors = 0;
+    for (uint32_t n = 0; n < wav->num_samples; n += 128)
+    {
+        wav_source_service();
+        produce_audio(pcm_frame, 128);
+        int32_t step = pcm_gain_step(check_level, gain, 128);
+        for (uint32_t i = 0; i < 128 && n + i < wav->num_samples; i++)
+        {
+            const uint8_t *src = data + (n + i) * block_align;
+            int16_t left = check_reference_sample(src, wav->bits_per_sample);
+            int16_t right = wav->num_channels == 1 ? left : check_reference_sample(src + block_align / 2, wav->bits_per_sample);
+            if (output_channels == 1)
+            {
+                if (pcm_frame[i] != check_gain_sample(((int32_t)left + right) >> 1, check_level, step, i))
+                    errors++;
+            }
+            else if (pcm_frame[i * 2] != check_gain_sample(left, check_level, step, i) ||
+                     pcm_frame[i * 2 + 1] != check_gain_sample(right, check_level, step, i))
+            {
+                errors++;
+            }
+        }
+        check_level = PCM_GAIN_LEVEL(gain);
+    }
+    // data の後ろの LIST チャンクを読まずに無音になること
+    wav_source_service();
+    produce_audio(pcm_frame, 128);
+    for (int i = 0; i < 128 * output_channels; i++)
+    {
+        if (pcm_frame[i] != 0)
+        {
+            errors++;
+            break;
+        }
+    }
+    wav_source_close();
+    free(data);
+
+    printf("  %-42s volume %3u, data at %4u, %6u bytes, errors %u -> %s\n", name, volume, (unsigned)format.data_offset,
+           (unsigned)format.data_size, errors, errors == 0 ? "OK" : "NG");
+    return errors == 0 ? 0 : 1;
+}
+
+static void bench_kernel(const char *name, pcm_convert_func_t convert, int block_align)
+{
+    static uint8_t src[128 * 6];
+    static int16_t dst[128 * NUM_CHANNELS] __attribute__((aligned(4)));
+    for (size_t i = 0; i < sizeof(src); i++)
+        src[i] = (uint8_t)(i * 37);
+    const int iterations = 200000;
+    uint64_t start_ns = host_time_ns();
+    for (int i = 0; i < iterations; i++)
+    {
+        if (convert)
+            convert(src, dst, 128);
+        else
+            memcpy(dst, src, 128 * block_align);
+        // 最適化でループが消えないようにする
+        __asm__ volatile("" : : "r"(dst) : "memory");
+    }
+    uint64_t elapsed_ns = host_time_ns() - start_ns;
+    printf("  %-26s %6.3f ns/sample\n", name, (double)elapsed_ns / iterations / 128);
+}
+
+// fmt の後にサイズが list_size の LIST、その後に data がある WAV を解析する。LIST が壊れていれば data には届かない。
+static int check_corrupt_chunk(uint32_t list_size)
+{
+    uint8_t wav[] = {'R', 'I', 'F', 'F', 52, 0, 0, 0, 'W', 'A', 'V', 'E',
+                     'f', 'm', 't', ' ', 16, 0, 0, 0, 1, 0, 1, 0, 0x80, 0xBB, 0, 0, 0, 0x77, 1, 0, 2, 0, 16, 0,
+                     'L', 'I', 'S', 'T', 0, 0, 0, 0, 'I', 'N', 'F', 'O',
+                     'd', 'a', 't', 'a', 4, 0, 0, 0, 0, 0, 0, 0};
+    wav[40] = (uint8_t)list_size;
+    wav[41] = (uint8_t)(list_size >> 8);
+    wav[42] = (uint8_t)(list_size >> 16);
+    wav[43] = (uint8_t)(list_size >> 24);
+    FILE *fp = fopen(CHECK_WAV_FILE_NAME, "wb");
+    if (!fp)
+        return 1;
+    fwrite(wav, 1, sizeof(wav), fp);
+    fclose(fp);
+    File file = LittleFS.open(CHECK_WAV_FILE_NAME, "r");
+    wav_format_t format;
+    wav_format_result_t result = wav_format_parse(file, &format);
+    file.close();
+    bool ok = result == (list_size == 4 ? WAV_FORMAT_OK : WAV_FORMAT_ERROR_NO_DATA);
+    printf("  LIST size 0x%08x: %s -> %s\n", (unsigned)list_size, wav_format_result_string(result), ok ? "OK" : "NG");
+    return ok ? 0 : 1;
+}
+
+int check_wav_format_main(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+    LittleFS.setRoot("");
+
+    static const host_test_wav_t formats[] = {
+        {48000, CHECK_NUM_SAMPLES, 1, 8, false, false},
+        {48000, CHECK_NUM_SAMPLES, 2, 8, false, true},
+        {48000, CHECK_NUM_SAMPLES, 1, 16, false, true},
+        {44100, CHECK_NUM_SAMPLES, 2, 16, false, false},
+        {48000, CHECK_NUM_SAMPLES, 2, 16, true, true},
+        {48000, CHECK_NUM_SAMPLES + 1, 1, 24, true, false},
+        {48000, CHECK_NUM_SAMPLES, 2, 24, false, true},
+    };
+    int result = 0;
+    printf("parse and convert:\n");
+    for (uint8_t volume : {(uint8_t)127, CHECK_VOLUME})
+    {
+        for (int output_channels = NUM_CHANNELS; output_channels >= 1; output_channels--)
+        {
+            for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++)
+                result |= check_format(&formats[i], output_channels, volume);
+        }
+    }
+
+    // 音量のカーブ: 127 で 1 倍、1 で -50dB、その間は単調に増える
+    bool monotonic = true;
+    for (int volume = 1; volume < 127; volume++)
+        monotonic &= pcm_gain_from_volume(volume) < pcm_gain_from_volume(volume + 1);
+    printf("volume curve: 0 -> %u, 1 -> %u, 64 -> %u, 127 -> %u (Q15), %s\n", pcm_gain_from_volume(0),
+           pcm_gain_from_volume(1), pcm_gain_from_volume(64), pcm_gain_from_volume(127), monotonic ? "monotonic" : "NOT monotonic");
+    result |= monotonic && pcm_gain_from_volume(0) == 0 && pcm_gain_from_volume(127) == PCM_GAIN_UNITY &&
+                      pcm_gain_from_volume(1) == 104
+                  ? 0
+                  : 1;
+
+    // 4 は正しいサイズ。0xFFFFFFF8 は body + サイズが同じ LIST に戻り、0xFFFFFFFF はパディングで body に戻る。
+    printf("corrupt chunk sizes:\n");
+    for (uint32_t list_size : {4u, 100u, 0xFFFFFFF8u, 0xFFFFFFFFu})
+        result |= check_corrupt_chunk(list_size);
+
+    printf("kernels (128 samples per call):\n");
+    bench_kernel("u8 mono", pcm_convert_u8_mono, 1);
+    bench_kernel("u8 stereo", pcm_convert_u8_stereo, 2);
+    bench_kernel("s16 mono", pcm_convert_s16_mono, 2);
+    bench_kernel("s16 stereo (copy)", NULL, 4);
+    bench_kernel("s24 mono", pcm_convert_s24_mono, 3);
+    bench_kernel("s24 stereo", pcm_convert_s24_stereo, 6);
+    bench_kernel("u8 mono -> mono", pcm_convert_mono_u8_mono, 1);
+    bench_kernel("u8 stereo -> mono", pcm_convert_mono_u8_stereo, 2);
+    bench_kernel("s16 mono -> mono (copy)", NULL, 2);
+    bench_kernel("s16 stereo -> mono", pcm_convert_mono_s16_stereo, 4);
+    bench_kernel("s24 mono -> mono", pcm_convert_mono_s24_mono, 3);
+    bench_kernel("s24 stereo -> mono", pcm_convert_mono_s24_stereo, 6);
+    return result;
+}
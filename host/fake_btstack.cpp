@@ -0,0 +1,362 @@
+#include "fake_btstack.h"
+
+#include <string.h>
+#include "btstack.h"
+#include "audio/sbc_file.h"
+#include "pico/time.h"
+
+fake_a2dp_sink_t fake_a2dp_sinks[FAKE_MAX_SINKS];
+fake_a2dp_sink_t &fake_a2dp_sink = fake_a2dp_sinks[0];
+
+#define FAKE_MAX_TIMERS 8
+// 送り終えていない ACL パケットの数の上限。超えたら一番古いパケットは送り終えたことにする
+#define FAKE_MAX_IN_CONTROLLER 32
+
+static uint32_t fake_time_ms;
+static uint32_t fake_timer_jitter_max_us;
+static uint32_t fake_timer_jitter_us; // 発火中のタイマーの遅れ
+static uint32_t fake_jitter_seed;
+static btstack_timer_source_t *fake_timers[FAKE_MAX_TIMERS];
+// 2-DH5 の L2CAP MTU 相当
+static int fake_max_media_payload_size = 1011;
+static uint32_t fake_completion_delay_ms;
+static uint16_t fake_acl_packet_length = 1021;
+// L2CAP ヘッダとRTPヘッダ
+#define FAKE_MEDIA_HEADER_SIZE (4 + 12)
+
+// シンクごとの CAN_SEND_NOW とフラグメントの組み立ての状態
+typedef struct
+{
+    bool can_send_now_pending;
+    uint32_t can_send_now_requested_ms;
+    uint32_t can_send_now_delay_ms;
+    uint8_t fragment_frame[1024]; // フラグメントを組み立てる領域
+    int fragment_length;
+    int fragment_left; // 次のフラグメントのヘッダにあるはずの残りの数。0 は組み立て中でない
+    uint32_t sent_ms[FAKE_MAX_IN_CONTROLLER]; // 送り終えていない ACL パケットを送った時刻(送った順のリング)
+    uint8_t media_end[FAKE_MAX_IN_CONTROLLER]; // メディアパケットの最後の ACL パケットなら 1
+    int in_controller_first;
+    int in_controller_count;
+} fake_sink_state_t;
+
+static fake_sink_state_t fake_sink_states[FAKE_MAX_SINKS];
+
+static int fake_sink_index(uint8_t local_seid)
+{
+    return local_seid >= 1 && local_seid <= FAKE_MAX_SINKS ? local_seid - 1 : 0;
+}
+
+void fake_btstack_reset(void)
+{
+    fake_time_ms = 1;
+    fake_timer_jitter_us = 0;
+    fake_jitter_seed = 1;
+    memset(fake_timers, 0, sizeof(fake_timers));
+    for (int i = 0; i < FAKE_MAX_SINKS; i++)
+    {
+        fake_sink_state_t *state = &fake_sink_states[i];
+        state->can_send_now_pending = false;
+        state->can_send_now_requested_ms = 0;
+        state->fragment_length = 0;
+        state->fragment_left = 0;
+        state->in_controller_first = 0;
+        state->in_controller_count = 0;
+        fake_a2dp_sink_t *sink = &fake_a2dp_sinks[i];
+        FILE *dump = sink->dump;
+        memset(sink, 0, sizeof(*sink));
+        sink->dump = dump;
+        sink->frame_hash = 2166136261u;
+    }
+}
+
+uint32_t fake_btstack_time_ms(void)
+{
+    return fake_time_ms;
+}
+
+void fake_btstack_advance_ms(uint32_t ms)
+{
+    while (ms--)
+    {
+        fake_time_ms++;
+        for (int i = 0; i < FAKE_MAX_TIMERS; i++)
+        {
+            btstack_timer_source_t *timer = fake_timers[i];
+            if (timer == NULL || (int32_t)(timer->timeout - fake_time_ms) > 0)
+                continue;
+            // BTstack と同じく、発火したタイマーはリストから外してから呼び出す。
+            fake_timers[i] = NULL;
+            if (fake_timer_jitter_max_us > 0)
+            {
+                fake_jitter_seed = fake_jitter_seed * 1103515245u + 12345u;
+                fake_timer_jitter_us = (fake_jitter_seed >> 8) % fake_timer_jitter_max_us;
+            }
+            timer->process(timer);
+            fake_timer_jitter_us = 0;
+        }
+    }
+}
+
+bool fake_btstack_take_can_send_now(void)
+{
+    return fake_btstack_take_can_send_now_for(1);
+}
+
+bool fake_btstack_take_can_send_now_for(uint8_t local_seid)
+{
+    fake_sink_state_t *state = &fake_sink_states[fake_sink_index(local_seid)];
+    if (fake_time_ms - state->can_send_now_requested_ms < state->can_send_now_delay_ms)
+        return false;
+    bool pending = state->can_send_now_pending;
+    state->can_send_now_pending = false;
+    return pending;
+}
+
+void fake_btstack_set_max_media_payload_size(int size)
+{
+    fake_max_media_payload_size = size;
+}
+
+void fake_btstack_set_timer_jitter_us(uint32_t max_us)
+{
+    fake_timer_jitter_max_us = max_us;
+}
+
+uint64_t time_us_64(void)
+{
+    return (uint64_t)fake_time_ms * 1000 + fake_timer_jitter_us;
+}
+
+void fake_btstack_set_can_send_now_delay_ms(uint32_t ms)
+{
+    for (fake_sink_state_t &state : fake_sink_states)
+        state.can_send_now_delay_ms = ms;
+}
+
+void fake_btstack_set_sink_can_send_now_delay_ms(uint8_t local_seid, uint32_t ms)
+{
+    fake_sink_states[fake_sink_index(local_seid)].can_send_now_delay_ms = ms;
+}
+
+void fake_btstack_set_completion_delay_ms(uint32_t ms)
+{
+    fake_completion_delay_ms = ms;
+}
+
+static void fake_sink_complete_oldest(fake_a2dp_sink_t *sink, fake_sink_state_t *state)
+{
+    if (state->media_end[state->in_controller_first])
+    {
+        if (sink->completed_packets == 0)
+            sink->first_completed_ms = fake_time_ms;
+        sink->completed_packets++;
+    }
+    state->in_controller_first = (state->in_controller_first + 1) % FAKE_MAX_IN_CONTROLLER;
+    state->in_controller_count--;
+}
+
+static void fake_sink_send_acl(fake_a2dp_sink_t *sink, fake_sink_state_t *state, bool media_end)
+{
+    if (state->in_controller_count == FAKE_MAX_IN_CONTROLLER)
+        fake_sink_complete_oldest(sink, state);
+    int index = (state->in_controller_first + state->in_controller_count) % FAKE_MAX_IN_CONTROLLER;
+    state->sent_ms[index] = fake_time_ms;
+    state->media_end[index] = media_end;
+    state->in_controller_count++;
+}
+
+void fake_btstack_set_acl_packet_length(uint16_t length)
+{
+    fake_acl_packet_length = length;
+}
+
+void fake_btstack_send_signaling(uint8_t local_seid)
+{
+    fake_a2dp_sink_t *sink = &fake_a2dp_sinks[fake_sink_index(local_seid)];
+    sink->signaling_packets++;
+    fake_sink_send_acl(sink, &fake_sink_states[fake_sink_index(local_seid)], false);
+}
+
+uint16_t hci_max_acl_data_packet_length(void)
+{
+    return fake_acl_packet_length;
+}
+
+uint16_t fake_btstack_take_completed_packets(uint8_t local_seid)
+{
+    fake_a2dp_sink_t *sink = &fake_a2dp_sinks[fake_sink_index(local_seid)];
+    fake_sink_state_t *state = &fake_sink_states[fake_sink_index(local_seid)];
+    uint16_t completed = 0;
+    while (state->in_controller_count > 0 && fake_time_ms - state->sent_ms[state->in_controller_first] >= fake_completion_delay_ms)
+    {
+        fake_sink_complete_oldest(sink, state);
+        completed++;
+    }
+    return completed;
+}
+
+// ---- btstack_run_loop ----
+
+uint32_t btstack_run_loop_get_time_ms(void)
+{
+    return fake_time_ms;
+}
+
+void btstack_run_loop_set_timer(btstack_timer_source_t *timer, uint32_t timeout_in_ms)
+{
+    timer->timeout = fake_time_ms + timeout_in_ms;
+}
+
+void btstack_run_loop_set_timer_handler(btstack_timer_source_t *timer, void (*process)(btstack_timer_source_t *_timer))
+{
+    timer->process = process;
+}
+
+void btstack_run_loop_set_timer_context(btstack_timer_source_t *timer, void *context)
+{
+    timer->context = context;
+}
+
+void *btstack_run_loop_get_timer_context(btstack_timer_source_t *timer)
+{
+    return timer->context;
+}
+
+void btstack_run_loop_add_timer(btstack_timer_source_t *timer)
+{
+    for (int i = 0; i < FAKE_MAX_TIMERS; i++)
+    {
+        if (fake_timers[i] == timer)
+            return;
+    }
+    for (int i = 0; i < FAKE_MAX_TIMERS; i++)
+    {
+        if (fake_timers[i] == NULL)
+        {
+            fake_timers[i] = timer;
+            return;
+        }
+    }
+}
+
+int btstack_run_loop_remove_timer(btstack_timer_source_t *timer)
+{
+    for (int i = 0; i < FAKE_MAX_TIMERS; i++)
+    {
+        if (fake_timers[i] == timer)
+        {
+            fake_timers[i] = NULL;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// ---- a2dp_source ----
+
+// フラグメントを組み立て、最後のフラグメントでフレームの長さを確かめる。
+static void fake_sink_fragment(fake_a2dp_sink_t *sink, fake_sink_state_t *state, const uint8_t *payload, int payload_size)
+{
+    bool start = payload[0] & 0x40;
+    bool last = payload[0] & 0x20;
+    int left = payload[0] & 0x0f;
+    sink->fragments++;
+    if (start)
+    {
+        if (state->fragment_left != 0)
+            sink->frame_errors++;
+        state->fragment_length = 0;
+    }
+    else if (left != state->fragment_left)
+    {
+        sink->frame_errors++;
+        state->fragment_left = 0;
+        return;
+    }
+    if (state->fragment_length + payload_size - 1 > (int)sizeof(state->fragment_frame) || last != (left == 1))
+    {
+        sink->frame_errors++;
+        state->fragment_left = 0;
+        return;
+    }
+    memcpy(&state->fragment_frame[state->fragment_length], payload + 1, payload_size - 1);
+    state->fragment_length += payload_size - 1;
+    sink->payload_bytes += payload_size;
+    for (int i = 1; i < payload_size; i++)
+        sink->frame_hash = (sink->frame_hash ^ payload[i]) * 16777619u;
+    if (sink->dump)
+        fwrite(payload + 1, 1, payload_size - 1, sink->dump);
+    state->fragment_left = left - 1;
+    if (!last)
+        return;
+    if (state->fragment_frame[0] != 0x9c || sbc_file_frame_length(state->fragment_frame) != state->fragment_length)
+        sink->frame_errors++;
+    else
+        sink->last_bitpool = state->fragment_frame[2];
+    sink->sbc_frames++;
+    state->fragment_left = 0;
+}
+
+uint8_t a2dp_source_stream_send_media_payload_rtp(uint16_t a2dp_cid, uint8_t local_seid, uint8_t marker, uint32_t timestamp, uint8_t *payload, uint16_t payload_size)
+{
+    UNUSED(a2dp_cid);
+    UNUSED(marker);
+    fake_a2dp_sink_t *sink = &fake_a2dp_sinks[fake_sink_index(local_seid)];
+    fake_sink_state_t *state = &fake_sink_states[fake_sink_index(local_seid)];
+    if (sink->packets == 0)
+        sink->first_timestamp = timestamp;
+    sink->last_timestamp = timestamp;
+    sink->packets++;
+    if (payload_size > sink->max_payload_size)
+        sink->max_payload_size = payload_size;
+    int acl_packets = (payload_size + FAKE_MEDIA_HEADER_SIZE + fake_acl_packet_length - 1) / fake_acl_packet_length;
+    for (int i = 0; i < acl_packets; i++)
+        fake_sink_send_acl(sink, state, i == acl_packets - 1);
+    sink->acl_packets += acl_packets;
+    if (payload[0] & 0x80)
+    {
+        fake_sink_fragment(sink, state, payload, payload_size);
+        return ERROR_CODE_SUCCESS;
+    }
+    if (state->fragment_left != 0)
+    {
+        // 前のフレームのフラグメントが途中で終わった。
+        sink->frame_errors++;
+        state->fragment_left = 0;
+    }
+    sink->sbc_frames += payload[0] & 0x0f;
+    // フレームヘッダをたどって、ペイロードの長さとフレーム数が合うか確かめる。
+    int offset = 1;
+    int frames = 0;
+    while (offset + 3 <= payload_size && payload[offset] == 0x9c)
+    {
+        sink->last_bitpool = payload[offset + 2];
+        offset += sbc_file_frame_length(&payload[offset]);
+        frames++;
+    }
+    if (offset != payload_size || frames != (payload[0] & 0x0f))
+        sink->frame_errors++;
+    sink->payload_bytes += payload_size;
+    for (int i = 1; i < payload_size; i++)
+        sink->frame_hash = (sink->frame_hash ^ payload[i]) * 16777619u;
+    if (sink->dump)
+        fwrite(payload + 1, 1, payload_size - 1, sink->dump);
+    return ERROR_CODE_SUCCESS;
+}
+
+uint8_t a2dp_source_stream_endpoint_request_can_send_now(uint16_t a2dp_cid, uint8_t local_seid)
+{
+    UNUSED(a2dp_cid);
+    fake_sink_state_t *state = &fake_sink_states[fake_sink_index(local_seid)];
+    state->can_send_now_pending = true;
+    state->can_send_now_requested_ms = fake_time_ms;
+    fake_a2dp_sinks[fake_sink_index(local_seid)].can_send_now_requests++;
+    return ERROR_CODE_SUCCESS;
+}
+
+int a2dp_max_media_payload_size(uint16_t a2dp_cid, uint8_t local_seid)
+{
+    UNUSED(a2dp_cid);
+    UNUSED(local_seid);
+    return fake_max_media_payload_size;
+}
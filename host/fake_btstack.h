@@ -0,0 +1,65 @@
+#ifndef HOST_FAKE_BTSTACK_H
+#define HOST_FAKE_BTSTACK_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// ホストビルドで BTstack の代わりをする部分です。
+//  - btstack_run_loop: 仮想時間の時計と、その時計で発火するタイマー
+//  - time_us_64(): 仮想時間の us。タイマーのコールバック中は、発火の遅れ(ジッタ)を足した時刻を返す
+//  - a2dp_source: 送られた RTP ペイロードを記録するシンク。local_seid 1..FAKE_MAX_SINKS ごとに別のシンク
+//  - コントローラ: 送られたパケットを ACL の長さで分け、送信完了の遅れの後に送り終えたことにする
+//    (HCI Number Of Completed Packets の代わり)。メディア以外のパケット(シグナリングや AVRCP)も同じ接続で送れる
+
+// RTPペイロードを受け取るシンクの記録
+typedef struct
+{
+    uint32_t packets;          // 送信されたパケット数
+    uint32_t sbc_frames;       // パケットに含まれていたSBCフレーム数
+    uint64_t payload_bytes;    // SBCメディアヘッダを含むペイロードのバイト数
+    uint32_t first_timestamp;  // 最初のパケットのRTPタイムスタンプ
+    uint32_t last_timestamp;   // 最後のパケットのRTPタイムスタンプ
+    uint32_t can_send_now_requests;
+    uint32_t frame_hash;       // SBCフレームのバイト列の FNV-1a ハッシュ(モード間で出力を比べるため)
+    uint32_t frame_errors;     // SBCメディアヘッダのフレーム数と、フレームヘッダから求めた長さが合わなかったパケット数
+    uint32_t fragments;        // フラグメント(A2DP仕様 4.3.4)のパケット数。組み立てたフレームは sbc_frames に数える
+    int max_payload_size;      // 一番大きかったペイロード
+    uint8_t last_bitpool;      // 最後のフレームのビットプール
+    uint32_t completed_packets;  // コントローラが全部の ACL パケットを送り終えたメディアパケット数
+    uint32_t first_completed_ms; // 最初のメディアパケットを送り終えた時刻
+    uint32_t acl_packets;        // メディアパケットを送った ACL パケット数
+    uint32_t signaling_packets;  // メディア以外の ACL パケット数(fake_btstack_send_signaling())
+    FILE *dump;                // NULL でなければペイロード(ヘッダを除く)を書き出す
+} fake_a2dp_sink_t;
+
+#define FAKE_MAX_SINKS 2
+
+// local_seid n のシンクは fake_a2dp_sinks[n - 1]。fake_a2dp_sink は local_seid 1 のシンク
+extern fake_a2dp_sink_t fake_a2dp_sinks[FAKE_MAX_SINKS];
+extern fake_a2dp_sink_t &fake_a2dp_sink;
+
+void fake_btstack_reset(void);
+uint32_t fake_btstack_time_ms(void);
+// 仮想時間を ms 進め、期限が来たタイマーを発火させます。
+void fake_btstack_advance_ms(uint32_t ms);
+// a2dp_source_stream_endpoint_request_can_send_now() が呼ばれていれば true を返してクリアします。
+bool fake_btstack_take_can_send_now(void);
+// 同じく、local_seid のシンクについて
+bool fake_btstack_take_can_send_now_for(uint8_t local_seid);
+void fake_btstack_set_max_media_payload_size(int size);
+// タイマーが期限の ms から 0..max_us 遅れて発火したことにします(疑似乱数, デフォルトは 0)。
+void fake_btstack_set_timer_jitter_us(uint32_t max_us);
+// CAN_SEND_NOW を要求されてから、送信できるようになるまでの時間(混んだリンクの代わり)。デフォルトは 0。
+void fake_btstack_set_can_send_now_delay_ms(uint32_t ms);
+// 同じく、local_seid のシンクだけ。fake_btstack_set_can_send_now_delay_ms() は全部のシンクに設定します。
+void fake_btstack_set_sink_can_send_now_delay_ms(uint8_t local_seid, uint32_t ms);
+// パケットを送ってから、コントローラが送り終えるまでの時間。デフォルトは 0。
+void fake_btstack_set_completion_delay_ms(uint32_t ms);
+// local_seid のシンクの接続で、前回から送り終えた ACL パケット数を返します(HCI_EVENT_NUMBER_OF_COMPLETED_PACKETS の代わり)。
+uint16_t fake_btstack_take_completed_packets(uint8_t local_seid);
+// hci_max_acl_data_packet_length() が返すコントローラの ACL の長さ。デフォルトは 1021(CYW43439)。
+void fake_btstack_set_acl_packet_length(uint16_t length);
+// local_seid のシンクの接続で、メディア以外の ACL パケット(delay report の応答など)を1つ送ります。
+void fake_btstack_send_signaling(uint8_t local_seid);
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef HOST_COMMANDS_H
+#define HOST_COMMANDS_H
+
+#include <stdint.h>
+#include <time.h>
+
+// ホストプログラムのサブコマンドです。host_main.cpp の一覧に登録します。
+int bench_pipeline_main(int argc, char **argv);
+int check_frame_queue_main(int argc, char **argv);
+int check_wav_format_main(int argc, char **argv);
+int bench_resampler_main(int argc, char **argv);
+int transcode_sbc_main(int argc, char **argv);
+int check_sbc_analysis_main(int argc, char **argv);
+int check_bitpool_main(int argc, char **argv);
+int bench_channels_main(int argc, char **argv);
+int check_media_clock_main(int argc, char **argv);
+int check_stage_profile_main(int argc, char **argv);
+int check_backlog_main(int argc, char **argv);
+int check_payload_main(int argc, char **argv);
+int check_stack_main(int argc, char **argv);
+int check_playlist_main(int argc, char **argv);
+int check_seek_main(int argc, char **argv);
+int check_sector_reader_main(int argc, char **argv);
+int transcode_adpcm_main(int argc, char **argv);
+int check_ima_adpcm_main(int argc, char **argv);
+int check_mp3_main(int argc, char **argv);
+int check_connect_main(int argc, char **argv);
+int check_inquiry_main(int argc, char **argv);
+int check_fanout_main(int argc, char **argv);
+int check_latency_main(int argc, char **argv);
+
+// ベンチマーク用の壁時計(ns)
+static inline uint64_t host_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// テスト用の unsigned 8-bit モノラル WAV(44バイトヘッダ)を作ります。
+int host_write_test_wav(const char *path, int sample_rate, int seconds);
+
+typedef struct
+{
+    uint32_t sample_rate;
+    uint32_t num_samples;
+    int num_channels;    // 1 または 2
+    int bits_per_sample; // 8, 16, 24
+    bool extensible;     // WAVE_FORMAT_EXTENSIBLE の fmt チャンクにする
+    bool extra_chunks;   // data の前後に奇数サイズの LIST チャンクを入れる
+} host_test_wav_t;
+
+// フォーマットを指定してテスト用の WAV を作ります。
+int host_write_test_wav_ex(const char *path, const host_test_wav_t *wav);
+
+// インターリーブした 16bit PCM を block_align バイトのブロックの IMA-ADPCM の WAV にします(transcode_adpcm.cpp)。
+// decoded が NULL でなければ、エンコーダが1サンプルずつ進めた予測値(デコード結果と同じになるはずのもの)を
+// ブロックの数 x samples_per_block サンプル分書きます。
+int host_write_adpcm_wav(const char *path, const int16_t *pcm, uint32_t num_samples, int num_channels, uint32_t sample_rate,
+                         uint32_t block_align, int16_t *decoded);
+uint32_t host_adpcm_samples_per_block(uint32_t block_align, int num_channels);
+// wav_source が読める WAV を IMA-ADPCM の WAV に変換します。
+int host_transcode_adpcm(const char *wav_path, const char *adpcm_path, uint32_t block_align);
+
+#endif
@@ -0,0 +1,66 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "host_commands.h"
+
+// env:native でビルドされるホストプログラムです。
+//   pio run -e native
+//   .pio/build/native/program <command> [args...]
+
+typedef struct
+{
+    const char *name;
+    int (*run)(int argc, char **argv);
+    const char *usage;
+} host_command_t;
+
+static const host_command_t host_commands[] = {
+    {"bench", bench_pipeline_main, "bench [wav_file] [seconds]  パイプラインのスループットを計測"},
+    {"queue", check_frame_queue_main, "queue [seconds]  SBCフレームキューを2スレッドで確認"},
+    {"wav", check_wav_format_main, "wav  WAVヘッダの解析と変換カーネルを確認し、サンプルあたりの時間を計測"},
+    {"resample", bench_resampler_main, "resample  サンプリングレート変換の SNR とサンプルあたりの時間を計測"},
+    {"transcode", transcode_sbc_main, "transcode <in.wav> <out.sbc> [sampling_frequency] [bitpool]  エンコード済みSBCファイルを作る"},
+    {"analysis", check_sbc_analysis_main, "analysis  SBC分析フィルタバンクを仕様の式(と bluedroid)と比べ、1フレームの時間を計測"},
+    {"bitpool", check_bitpool_main, "bitpool  リンクの混み具合に応じたビットプールの制御を確認"},
+    {"channels", bench_channels_main, "channels [seconds]  モノラルのWAVを STEREO / JOINT_STEREO / MONO でエンコードして時間とペイロードを比べる"},
+    {"clock", check_media_clock_main, "clock [hours]  メディアクロックが何時間たっても実時間からずれないことを確認"},
+    {"profile", check_stage_profile_main, "profile [seconds]  段ごとの処理時間の記録とバイナリレコードを確認"},
+    {"backlog", check_backlog_main, "backlog  送信が途切れたときに溜まるサンプルの上限と、捨てたフレーム・アンダーランの数を確認"},
+    {"payload", check_payload_main, "payload  1パケットのフレーム数の決め方(電波の時間)と SBC フラグメンテーションを確認"},
+    {"stack", check_stack_main, "stack    設定を変えてタイマーコールバックと送信のスタックの最大使用量を測り、作業領域の大きさを表示"},
+    {"playlist", check_playlist_main, "playlist  ディレクトリの WAV を曲間なしで続けて再生し、曲の境目で欠けるサンプルが無いことを確認"},
+    {"seek", check_seek_main, "seek      ストリーミング中にシークし、新しい位置の最初のサンプル・再生位置・要求から最初のパケットまでの時間を確認"},
+    {"adpcm", transcode_adpcm_main, "adpcm <in.wav> <out.wav> [block_align]  IMA-ADPCM の WAV を作る"},
+    {"ima", check_ima_adpcm_main, "ima       IMA-ADPCM のデコードと wav_source からの読み出し・シークを確認し、u8 と比べてサンプルあたりの時間を計測"},
+    {"mp3", check_mp3_main, "mp3 [file.mp3]  MP3 のフレームの解析・wav_source からの読み出し・シークを確認し、デコードの時間(RTF)とヒープを計測"},
+    {"connect", check_connect_main, "connect   知っているスピーカーへの直接の接続とインクワイアリへの切り替えを確認し、最初のパケットまでの時間を経路ごとに表示"},
+    {"inquiry", check_inquiry_main, "inquiry   インクワイアリの結果の順位付けを確認し、混んだ環境でスピーカーにつながるまでの時間と無駄な接続の割合を比べる"},
+    {"fanout", check_fanout_main, "fanout    2つのシンクに1回だけエンコードしたフレームを送り、シンクごとのリングの深さと2回エンコードしたときの処理時間を比べる"},
+    {"latency", check_latency_main, "latency   delay report と送信完了を待つパケットから、スピーカーで鳴っている位置とエンドツーエンドのレイテンシを見積もり、仮想のスピーカーと比べる"},
+    {"sdread", check_sector_reader_main, "sdread    遅延を入れたブロックデバイスでセクタ単位の読み込みのデータ・転送速度・読み込み時間のパーセンタイルを確認"},
+};
+
+static void usage(void)
+{
+    printf("usage: program <command> [args...]\n");
+    for (size_t i = 0; i < sizeof(host_commands) / sizeof(host_commands[0]); i++)
+    {
+        printf("  %s\n", host_commands[i].usage);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        usage();
+        return 1;
+    }
+    for (size_t i = 0; i < sizeof(host_commands) / sizeof(host_commands[0]); i++)
+    {
+        if (strcmp(argv[1], host_commands[i].name) == 0)
+            return host_commands[i].run(argc - 1, argv + 1);
+    }
+    usage();
+    return 1;
+}
@@ -0,0 +1,42 @@
+#include "host_stream.h"
+
+#include <string.h>
+
+#include "host_commands.h"
+#include "fake_btstack.h"
+
+uint64_t host_stream_run(a2dp_media_sending_context_t *context, int seconds, void (*each_ms)(void))
+{
+    return host_stream_run_sinks(context, 1, seconds, each_ms);
+}
+
+uint64_t host_stream_run_sinks(a2dp_media_sending_context_t *contexts, int num_sinks, int seconds, void (*each_ms)(void))
+{
+    memset(contexts, 0, num_sinks * sizeof(*contexts));
+    for (int i = 0; i < num_sinks; i++)
+    {
+        contexts[i].a2dp_cid = i + 1;
+        contexts[i].local_seid = i + 1;
+    }
+
+    fake_btstack_reset();
+    uint64_t busy_ns = 0;
+    for (int i = 0; i < num_sinks; i++)
+        a2dp_demo_timer_start(&contexts[i]);
+    for (int ms = 0; ms < seconds * 1000; ms++)
+    {
+        if (each_ms)
+            each_ms();
+        uint64_t start_ns = host_time_ns();
+        fake_btstack_advance_ms(1);
+        for (int i = 0; i < num_sinks; i++)
+        {
+            if (fake_btstack_take_can_send_now_for(contexts[i].local_seid))
+                a2dp_demo_send_media_packet(&contexts[i]);
+        }
+        busy_ns += host_time_ns() - start_ns;
+    }
+    for (int i = 0; i < num_sinks; i++)
+        a2dp_demo_timer_stop(&contexts[i]);
+    return busy_ns;
+}
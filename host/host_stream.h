@@ -0,0 +1,19 @@
+#ifndef HOST_STREAM_H
+#define HOST_STREAM_H
+
+#include <stdint.h>
+#include "audio/audio_pipeline.h"
+
+// 仮想時間で seconds 秒分ストリーミングします。
+// 仮想時間を1msずつ進め、その前に each_ms(loop() の代わり)を呼びます。CAN_SEND_NOW はすぐに来るものとします。
+// タイマーコールバックと送信(実機では BTstack のコンテキスト)にかかった壁時計の時間(ns)を返します。
+// each_ms の時間は含みません。
+uint64_t host_stream_run(a2dp_media_sending_context_t *context, int seconds, void (*each_ms)(void));
+// num_sinks 個のシンク(local_seid 1..num_sinks, fake_a2dp_sinks)に同時にストリーミングします。
+// CAN_SEND_NOW はシンクごとに fake_btstack_take_can_send_now_for() で見ます。
+uint64_t host_stream_run_sinks(a2dp_media_sending_context_t *contexts, int num_sinks, int seconds, void (*each_ms)(void));
+
+// WAV を configuration でエンコードした SBC ファイル(sbc_file)を作ります(transcode_sbc.cpp)。
+int host_transcode_sbc(const char *wav_path, const char *sbc_path, const media_codec_configuration_sbc_t *configuration);
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef HOST_SHIM_ARDUINO_H
+#define HOST_SHIM_ARDUINO_H
+
+// ホストビルド用の Arduino.h の代わりです。パイプラインが使う分だけを用意しています。
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+// pico-sdk の RAM 配置の指定。ホストでは何もしない。
+#define __not_in_flash_func(func_name) func_name
+
+class HostSerial
+{
+public:
+    void begin(unsigned long) {}
+    int printf(const char *format, ...) __attribute__((format(printf, 2, 3)))
+    {
+        va_list args;
+        va_start(args, format);
+        int n = vprintf(format, args);
+        va_end(args);
+        return n;
+    }
+    size_t print(const char *s) { return fputs(s, stdout) < 0 ? 0 : strlen(s); }
+    size_t println(const char *s = "") { return print(s) + print("\r\n"); }
+    size_t println(unsigned long v) { return (size_t)::printf("%lu\r\n", v); }
+    size_t write(const uint8_t *buffer, size_t size) { return fwrite(buffer, 1, size, stdout); }
+    int available(void) { return 0; }
+    int read(void) { return -1; }
+};
+extern HostSerial Serial;
+
+// arduino-pico の rp2040 ヘルパの代わり。getCycleCount() はサイクルの代わりに壁時計の ns を返す。
+// getFreeHeap() は malloc で確保済みのバイト数を引いた値を返す(差だけが意味を持つ)。
+class HostRP2040
+{
+public:
+    uint32_t getCycleCount(void);
+    int getFreeHeap(void);
+};
+extern HostRP2040 rp2040;
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+
+#endif
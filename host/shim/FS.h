@@ -0,0 +1,139 @@
+#ifndef HOST_SHIM_FS_H
+#define HOST_SHIM_FS_H
+
+// arduino-pico の fs::FS / fs::File をホストのファイルで置き換えたものです。
+// FS はルートディレクトリを持ち、open() したパスはその下のファイルになります。
+
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <string>
+#include <memory>
+
+namespace fs
+{
+
+enum SeekMode
+{
+    SeekSet = 0,
+    SeekCur = 1,
+    SeekEnd = 2
+};
+
+class File
+{
+public:
+    File() {}
+    explicit File(FILE *fp, const char *name) : _fp(fp, fclose), _name(name) {}
+
+    size_t read(uint8_t *buf, size_t size) { return _fp ? fread(buf, 1, size, _fp.get()) : 0; }
+    int read(void)
+    {
+        uint8_t c;
+        return read(&c, 1) == 1 ? c : -1;
+    }
+    size_t write(const uint8_t *buf, size_t size) { return _fp ? fwrite(buf, 1, size, _fp.get()) : 0; }
+    bool seek(uint32_t pos, SeekMode mode)
+    {
+        static const int whence[] = {SEEK_SET, SEEK_CUR, SEEK_END};
+        return _fp && fseek(_fp.get(), (long)pos, whence[mode]) == 0;
+    }
+    bool seek(uint32_t pos) { return seek(pos, SeekSet); }
+    size_t position() const { return _fp ? (size_t)ftell(_fp.get()) : 0; }
+    size_t size() const
+    {
+        if (!_fp)
+            return 0;
+        long pos = ftell(_fp.get());
+        fseek(_fp.get(), 0, SEEK_END);
+        long length = ftell(_fp.get());
+        fseek(_fp.get(), pos, SEEK_SET);
+        return (size_t)length;
+    }
+    const char *name() const { return _name.c_str(); }
+    void close() { _fp.reset(); }
+    operator bool() const { return _fp != nullptr; }
+
+private:
+    std::shared_ptr<FILE> _fp;
+    std::string _name;
+};
+
+// ディレクトリのエントリを順にたどります。fileName() は std::string を返します(実機は String)。
+class Dir
+{
+public:
+    Dir() {}
+    explicit Dir(const std::string &path) : _dir(opendir(path.c_str()), closedir_if_open), _path(path) {}
+
+    bool next()
+    {
+        if (!_dir)
+            return false;
+        while (struct dirent *entry = readdir(_dir.get()))
+        {
+            _name = entry->d_name;
+            if (_name == "." || _name == "..")
+                continue;
+            struct stat st;
+            _is_file = stat((_path + "/" + _name).c_str(), &st) == 0 && S_ISREG(st.st_mode);
+            _size = _is_file ? (size_t)st.st_size : 0;
+            return true;
+        }
+        return false;
+    }
+    std::string fileName() const { return _name; }
+    size_t fileSize() const { return _size; }
+    bool isFile() const { return _is_file; }
+    bool isDirectory() const { return !_is_file; }
+    File openFile(const char *mode)
+    {
+        FILE *fp = fopen((_path + "/" + _name).c_str(), mode[0] == 'r' ? "rb" : "wb");
+        return fp ? File(fp, _name.c_str()) : File();
+    }
+
+private:
+    static void closedir_if_open(DIR *dir)
+    {
+        if (dir)
+            closedir(dir);
+    }
+    std::shared_ptr<DIR> _dir;
+    std::string _path;
+    std::string _name;
+    size_t _size = 0;
+    bool _is_file = false;
+};
+
+class FS
+{
+public:
+    explicit FS(const char *root = ".") : _root(root) {}
+
+    bool begin() { return true; }
+    void setRoot(const char *root) { _root = root; }
+    File open(const char *path, const char *mode)
+    {
+        // ルートが空の場合はホストのパスをそのまま使う
+        std::string full = _root.empty() ? std::string(path) : _root + "/" + path;
+        FILE *fp = fopen(full.c_str(), mode[0] == 'r' ? "rb" : "wb");
+        return fp ? File(fp, path) : File();
+    }
+    Dir openDir(const char *path) { return Dir(_root.empty() ? std::string(path) : _root + "/" + path); }
+
+private:
+    std::string _root;
+};
+
+} // namespace fs
+
+using fs::Dir;
+using fs::File;
+using fs::FS;
+using fs::SeekCur;
+using fs::SeekEnd;
+using fs::SeekMode;
+using fs::SeekSet;
+
+#endif
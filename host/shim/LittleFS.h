@@ -0,0 +1,9 @@
+#ifndef HOST_SHIM_LITTLEFS_H
+#define HOST_SHIM_LITTLEFS_H
+
+#include "FS.h"
+
+// ホストビルドでは LittleFS はカレントディレクトリ(setRoot で変更可)になります。
+extern fs::FS LittleFS;
+
+#endif
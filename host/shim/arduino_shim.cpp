@@ -0,0 +1,44 @@
+#include "Arduino.h"
+#include "LittleFS.h"
+
+#include <malloc.h>
+#include <time.h>
+#include <unistd.h>
+
+HostSerial Serial;
+HostRP2040 rp2040;
+fs::FS LittleFS(".");
+
+static uint64_t host_monotonic_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+uint32_t HostRP2040::getCycleCount(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec);
+}
+
+int HostRP2040::getFreeHeap(void)
+{
+    return (int)(0x7FFFFFFF - mallinfo2().uordblks);
+}
+
+unsigned long millis(void)
+{
+    return (unsigned long)(host_monotonic_us() / 1000u);
+}
+
+unsigned long micros(void)
+{
+    return (unsigned long)host_monotonic_us();
+}
+
+void delay(unsigned long ms)
+{
+    usleep(ms * 1000u);
+}
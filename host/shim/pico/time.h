@@ -0,0 +1,10 @@
+#ifndef HOST_SHIM_PICO_TIME_H
+#define HOST_SHIM_PICO_TIME_H
+
+#include <stdint.h>
+
+// ホストビルド用の pico/time.h の代わりです。
+// メディアクロックが使う time_us_64() は fake_btstack の仮想時間を返します(host/fake_btstack.cpp)。
+uint64_t time_us_64(void);
+
+#endif
@@ -0,0 +1,113 @@
+#include "host_commands.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static void put_le32(FILE *fp, uint32_t v)
+{
+    uint8_t b[4] = {(uint8_t)v, (uint8_t)(v >> 8), (uint8_t)(v >> 16), (uint8_t)(v >> 24)};
+    fwrite(b, 1, 4, fp);
+}
+
+static void put_le16(FILE *fp, uint16_t v)
+{
+    uint8_t b[2] = {(uint8_t)v, (uint8_t)(v >> 8)};
+    fwrite(b, 1, 2, fp);
+}
+
+static void put_sample(FILE *fp, int bits, double v)
+{
+    switch (bits)
+    {
+    case 8:
+        fputc((int)lrint(128 + 127 * v), fp);
+        break;
+    case 16:
+        put_le16(fp, (uint16_t)(int16_t)lrint(32767 * v));
+        break;
+    case 24:
+    {
+        int32_t s = (int32_t)lrint(8388607 * v);
+        uint8_t b[3] = {(uint8_t)s, (uint8_t)(s >> 8), (uint8_t)(s >> 16)};
+        fwrite(b, 1, 3, fp);
+        break;
+    }
+    }
+}
+
+int host_write_test_wav_ex(const char *path, const host_test_wav_t *wav)
+{
+    FILE *fp = fopen(path, "wb");
+    if (!fp)
+        return -1;
+    static const char list_chunk[] = "INFOISFT\x06\0\0\0host\0\0INAM\x05\0\0\0test\0"; // 奇数サイズ(31バイト)
+    uint32_t list_size = sizeof(list_chunk) - 1;
+    int block_align = wav->num_channels * wav->bits_per_sample / 8;
+    uint32_t data_size = wav->num_samples * block_align;
+    uint32_t fmt_size = wav->extensible ? 40 : 16;
+
+    uint32_t riff_size = 4 + 8 + fmt_size + 8 + data_size + (data_size & 1);
+    if (wav->extra_chunks)
+        riff_size += 2 * (8 + list_size + 1);
+    fwrite("RIFF", 1, 4, fp);
+    put_le32(fp, riff_size);
+    fwrite("WAVEfmt ", 1, 8, fp);
+    put_le32(fp, fmt_size);
+    put_le16(fp, wav->extensible ? 0xFFFE : 1);
+    put_le16(fp, wav->num_channels);
+    put_le32(fp, wav->sample_rate);
+    put_le32(fp, wav->sample_rate * block_align);
+    put_le16(fp, block_align);
+    put_le16(fp, wav->bits_per_sample);
+    if (wav->extensible)
+    {
+        static const uint8_t pcm_guid_tail[14] = {0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00,
+                                                  0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71};
+        put_le16(fp, 22);
+        put_le16(fp, wav->bits_per_sample);
+        put_le32(fp, wav->num_channels == 1 ? 0x4 : 0x3);
+        put_le16(fp, 1);
+        fwrite(pcm_guid_tail, 1, sizeof(pcm_guid_tail), fp);
+    }
+    if (wav->extra_chunks)
+    {
+        // data の前の奇数サイズの LIST チャンク(パディング付き)
+        fwrite("LIST", 1, 4, fp);
+        put_le32(fp, list_size);
+        fwrite(list_chunk, 1, list_size, fp);
+        fputc(0, fp);
+    }
+    fwrite("data", 1, 4, fp);
+    put_le32(fp, data_size);
+    // 100Hz から 10kHz へのスイープに少しノイズを混ぜる。右チャンネルは反転して別のノイズ。
+    double phase = 0;
+    srand(1);
+    for (uint32_t n = 0; n < wav->num_samples; n++)
+    {
+        double f = 100.0 * pow(100.0, (double)n / wav->num_samples);
+        phase += 2 * M_PI * f / wav->sample_rate;
+        double v = 0.6 * sin(phase) + 0.05 * ((rand() / (double)RAND_MAX) - 0.5);
+        put_sample(fp, wav->bits_per_sample, v);
+        if (wav->num_channels == 2)
+            put_sample(fp, wav->bits_per_sample, -0.8 * v + 0.05 * ((rand() / (double)RAND_MAX) - 0.5));
+    }
+    if (data_size & 1)
+        fputc(0, fp);
+    if (wav->extra_chunks)
+    {
+        // data の後ろのチャンク。再生されてはいけない。
+        fwrite("LIST", 1, 4, fp);
+        put_le32(fp, list_size);
+        fwrite(list_chunk, 1, list_size, fp);
+        fputc(0, fp);
+    }
+    fclose(fp);
+    return 0;
+}
+
+int host_write_test_wav(const char *path, int sample_rate, int seconds)
+{
+    host_test_wav_t wav = {(uint32_t)sample_rate, (uint32_t)sample_rate * seconds, 1, 8, false, false};
+    return host_write_test_wav_ex(path, &wav);
+}
@@ -0,0 +1,242 @@
+#include "host_commands.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "LittleFS.h"
+#include "audio/pcm_convert.h"
+#include "audio/wav_source.h"
+
+// WAV を IMA-ADPCM の WAV に変換するツールです。LittleFS に入れる曲を 16bit の 1/4 の大きさにします。
+//   program adpcm <in.wav> <out.wav> [block_align]
+// エンコーダは IMA-ADPCM の標準の手順そのままで、各ブロックの最初のサンプルをヘッダに入れ、ステップの番号は前のブロックから引き継ぎます。
+// 最後のブロックの足りない分は最後のサンプルで埋めます。
+
+static const int16_t adpcm_step[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45, 50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+    130, 143, 157, 173, 190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963, 1060,
+    1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484,
+    7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767};
+static const int adpcm_index_adjust[8] = {-1, -1, -1, -1, 2, 4, 6, 8};
+
+typedef struct
+{
+    int predictor;
+    int index;
+} adpcm_state_t;
+
+static int adpcm_encode_sample(adpcm_state_t *state, int sample)
+{
+    int step = adpcm_step[state->index];
+    int delta = sample - state->predictor;
+    int code = 0;
+    if (delta < 0)
+    {
+        code = 8;
+        delta = -delta;
+    }
+    if (delta >= step)
+    {
+        code |= 4;
+        delta -= step;
+    }
+    if (delta >= step >> 1)
+    {
+        code |= 2;
+        delta -= step >> 1;
+    }
+    if (delta >= step >> 2)
+        code |= 1;
+    // デコーダと同じ式で予測値を進める。
+    int diff = step >> 3;
+    if (code & 4)
+        diff += step;
+    if (code & 2)
+        diff += step >> 1;
+    if (code & 1)
+        diff += step >> 2;
+    state->predictor += (code & 8) ? -diff : diff;
+    if (state->predictor > 32767)
+        state->predictor = 32767;
+    if (state->predictor < -32768)
+        state->predictor = -32768;
+    state->index += adpcm_index_adjust[code & 7];
+    if (state->index < 0)
+        state->index = 0;
+    if (state->index > 88)
+        state->index = 88;
+    return code;
+}
+
+static void adpcm_put_le(FILE *fp, uint32_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+        fputc((int)(value >> (8 * i)) & 0xFF, fp);
+}
+
+uint32_t host_adpcm_samples_per_block(uint32_t block_align, int num_channels)
+{
+    return 1 + (block_align - 4 * num_channels) * 2 / num_channels;
+}
+
+int host_write_adpcm_wav(const char *path, const int16_t *pcm, uint32_t num_samples, int num_channels, uint32_t sample_rate,
+                         uint32_t block_align, int16_t *decoded)
+{
+    uint32_t samples_per_block = host_adpcm_samples_per_block(block_align, num_channels);
+    uint32_t num_blocks = (num_samples + samples_per_block - 1) / samples_per_block;
+    uint32_t data_size = num_blocks * block_align;
+    FILE *fp = fopen(path, "wb");
+    if (!fp)
+        return -1;
+    fwrite("RIFF", 1, 4, fp);
+    adpcm_put_le(fp, 4 + (8 + 20) + (8 + 4) + 8 + data_size, 4);
+    fwrite("WAVEfmt ", 1, 8, fp);
+    adpcm_put_le(fp, 20, 4);
+    adpcm_put_le(fp, 0x0011, 2);
+    adpcm_put_le(fp, num_channels, 2);
+    adpcm_put_le(fp, sample_rate, 4);
+    adpcm_put_le(fp, (uint32_t)((uint64_t)sample_rate * block_align / samples_per_block), 4);
+    adpcm_put_le(fp, block_align, 2);
+    adpcm_put_le(fp, 4, 2);
+    adpcm_put_le(fp, 2, 2);
+    adpcm_put_le(fp, samples_per_block, 2);
+    fwrite("fact", 1, 4, fp);
+    adpcm_put_le(fp, 4, 4);
+    adpcm_put_le(fp, num_samples, 4);
+    fwrite("data", 1, 4, fp);
+    adpcm_put_le(fp, data_size, 4);
+
+    adpcm_state_t state[2] = {};
+    std::vector<uint8_t> block(block_align);
+    for (uint32_t b = 0; b < num_blocks; b++)
+    {
+        uint32_t first = b * samples_per_block;
+        // ブロックの sample 番目のサンプル(ファイルの末尾の後は最後のサンプル)
+        auto sample_at = [&](uint32_t sample, int channel) -> int {
+            uint32_t n = first + sample < num_samples ? first + sample : num_samples - 1;
+            return pcm[n * num_channels + channel];
+        };
+        memset(block.data(), 0, block_align);
+        for (int c = 0; c < num_channels; c++)
+        {
+            state[c].predictor = sample_at(0, c);
+            if (decoded)
+                decoded[(size_t)first * num_channels + c] = (int16_t)state[c].predictor;
+            block[4 * c] = (uint8_t)state[c].predictor;
+            block[4 * c + 1] = (uint8_t)(state[c].predictor >> 8);
+            block[4 * c + 2] = (uint8_t)state[c].index;
+            block[4 * c + 3] = 0;
+        }
+        // 4バイト(8サンプル)ずつ、チャンネルを交互に並べる。
+        uint32_t groups = (samples_per_block - 1) / 8;
+        for (uint32_t g = 0; g < groups; g++)
+        {
+            for (int c = 0; c < num_channels; c++)
+            {
+                uint8_t *out = &block[4 * num_channels + (g * num_channels + c) * 4];
+                for (int i = 0; i < 8; i++)
+                {
+                    int code = adpcm_encode_sample(&state[c], sample_at(1 + g * 8 + i, c));
+                    if (decoded)
+                        decoded[((size_t)first + 1 + g * 8 + i) * num_channels + c] = (int16_t)state[c].predictor;
+                    out[i / 2] |= (uint8_t)(code << (4 * (i & 1)));
+                }
+            }
+        }
+        fwrite(block.data(), 1, block_align, fp);
+    }
+    fclose(fp);
+    return 0;
+}
+
+// WAV(wav_source が読めるもの)をチャンネル数そのままの 16bit PCM で読む。
+static bool adpcm_read_pcm(const char *path, std::vector<int16_t> *pcm, int *num_channels, uint32_t *sample_rate)
+{
+    if (wav_source_open(LittleFS, path, false) != 0)
+        return false;
+    const wav_format_t *format = wav_source_format();
+    *num_channels = format->num_channels;
+    *sample_rate = format->sample_rate;
+    uint32_t num_samples = wav_format_num_samples(format);
+    pcm->resize((size_t)num_samples * *num_channels);
+    pcm_convert_func_t convert = pcm_convert_select(format, *num_channels);
+    const uint32_t chunk = 128;
+    std::vector<uint8_t> data(chunk * format->block_align);
+    for (uint32_t n = 0; n < num_samples; n += chunk)
+    {
+        uint32_t count = num_samples - n < chunk ? num_samples - n : chunk;
+        wav_source_service();
+        // 変換のカーネルは偶数サンプルずつなので、読み出しは chunk 単位で行い、使う分だけ写す。
+        wav_source_read(data.data(), chunk * format->block_align);
+        int16_t out[chunk * 2];
+        if (convert)
+            convert(data.data(), out, chunk);
+        else
+            memcpy(out, data.data(), chunk * format->block_align);
+        memcpy(&(*pcm)[(size_t)n * *num_channels], out, count * *num_channels * sizeof(int16_t));
+    }
+    wav_source_close();
+    return true;
+}
+
+int host_transcode_adpcm(const char *wav_path, const char *adpcm_path, uint32_t block_align)
+{
+    std::vector<int16_t> pcm;
+    int num_channels;
+    uint32_t sample_rate;
+    if (!adpcm_read_pcm(wav_path, &pcm, &num_channels, &sample_rate))
+        return -1;
+    uint32_t num_samples = pcm.size() / num_channels;
+    if (num_samples == 0)
+        return -1;
+    return host_write_adpcm_wav(adpcm_path, pcm.data(), num_samples, num_channels, sample_rate, block_align, NULL);
+}
+
+int transcode_adpcm_main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        printf("usage: adpcm <in.wav> <out.wav> [block_align]\n");
+        return 1;
+    }
+    uint32_t block_align = argc > 3 ? (uint32_t)atoi(argv[3]) : WAV_FORMAT_MAX_ADPCM_BLOCK_ALIGN;
+    LittleFS.setRoot("");
+    std::vector<int16_t> pcm;
+    int num_channels;
+    uint32_t sample_rate;
+    if (!adpcm_read_pcm(argv[1], &pcm, &num_channels, &sample_rate))
+        return 1;
+    if (block_align > WAV_FORMAT_MAX_ADPCM_BLOCK_ALIGN || block_align <= 8u * num_channels || block_align % (4 * num_channels) != 0)
+    {
+        printf("block_align must be a multiple of %d up to %d\n", 4 * num_channels, WAV_FORMAT_MAX_ADPCM_BLOCK_ALIGN);
+        return 1;
+    }
+    uint32_t num_samples = pcm.size() / num_channels;
+    if (host_write_adpcm_wav(argv[2], pcm.data(), num_samples, num_channels, sample_rate, block_align, NULL) != 0)
+        return 1;
+
+    // 書いたファイルを wav_source で読み戻して、元の 16bit PCM との SNR を出す。
+    std::vector<int16_t> decoded;
+    int decoded_channels;
+    uint32_t decoded_rate;
+    if (!adpcm_read_pcm(argv[2], &decoded, &decoded_channels, &decoded_rate) || decoded.size() < pcm.size())
+        return 1;
+    double signal = 0, noise = 0;
+    for (size_t i = 0; i < pcm.size(); i++)
+    {
+        signal += (double)pcm[i] * pcm[i];
+        noise += (double)(pcm[i] - decoded[i]) * (pcm[i] - decoded[i]);
+    }
+    FILE *fp = fopen(argv[2], "rb");
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fclose(fp);
+    printf("%s: %u samples x %d ch, block %u bytes (%u samples), %ld bytes (16-bit PCM %u bytes), SNR %.1f dB\n", argv[2],
+           (unsigned)num_samples, num_channels, (unsigned)block_align,
+           (unsigned)host_adpcm_samples_per_block(block_align, num_channels), size, (unsigned)(num_samples * num_channels * 2),
+           10 * log10(signal / (noise > 0 ? noise : 1)));
+    return 0;
+}
@@ -0,0 +1,211 @@
+#include "host_commands.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "LittleFS.h"
+#include "fake_btstack.h"
+#include "host_stream.h"
+#include "audio/audio_pipeline.h"
+#include "audio/sbc_file.h"
+#include "audio/sbc_source.h"
+#include "audio/wav_source.h"
+
+// WAV をエンコード済みのSBCファイル(.sbc)に変換するツールです。
+//   program transcode <in.wav> <out.sbc> [sampling_frequency] [bitpool]
+// 変換の後で、次のことを確かめます。
+//  1. インデックスを使ったシークで、ファイルを先頭から順に読んだときと同じフレームが読めること
+//  2. ファイルから送ったフレーム列がライブエンコードと同じで、タイマー + 送信の時間がどれだけ減るか
+
+int host_transcode_sbc(const char *wav_path, const char *sbc_path, const media_codec_configuration_sbc_t *configuration)
+{
+    audio_pipeline_set_mode(AUDIO_PIPELINE_SINGLE_CORE);
+    if (wav_source_open(LittleFS, wav_path, false) != 0)
+        return -1;
+    audio_pipeline_init_encoder(configuration);
+
+    const wav_format_t *format = wav_source_format();
+    uint64_t input_samples = format->data_size / format->block_align;
+    uint64_t output_samples = input_samples * configuration->sampling_frequency / format->sample_rate;
+    int samples_per_frame = configuration->block_length * configuration->subbands;
+
+    sbc_file_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.sampling_frequency = configuration->sampling_frequency;
+    header.channel_mode = configuration->channel_mode;
+    header.allocation_method = configuration->allocation_method;
+    header.block_length = configuration->block_length;
+    header.subbands = configuration->subbands;
+    header.bitpool = configuration->max_bitpool_value;
+    header.frame_length = audio_sbc_frame_length(configuration, configuration->max_bitpool_value);
+    header.samples_per_frame = samples_per_frame;
+    header.num_frames = (output_samples + samples_per_frame - 1) / samples_per_frame;
+    header.data_offset = SBC_FILE_HEADER_SIZE;
+
+    FILE *fp = fopen(sbc_path, "wb");
+    if (!fp)
+        return -1;
+    uint8_t buffer[SBC_FILE_HEADER_SIZE];
+    fwrite(buffer, 1, sizeof(buffer), fp); // 後で書き直す
+
+    std::vector<uint32_t> index;
+    uint32_t offset = header.data_offset;
+    for (uint32_t frame = 0; frame < header.num_frames; frame++)
+    {
+        uint8_t sbc_frame[SBC_STORAGE_SIZE];
+        wav_source_service();
+        int length = audio_pipeline_encode_frame(sbc_frame, sizeof(sbc_frame));
+        if (length <= 0)
+        {
+            fclose(fp);
+            return -1;
+        }
+        if (frame % SBC_FILE_INDEX_INTERVAL == 0)
+            index.push_back(offset);
+        fwrite(sbc_frame, 1, length, fp);
+        offset += length;
+    }
+    wav_source_close();
+
+    header.index_offset = offset;
+    header.index_count = index.size();
+    for (uint32_t entry : index)
+    {
+        uint8_t b[4] = {(uint8_t)entry, (uint8_t)(entry >> 8), (uint8_t)(entry >> 16), (uint8_t)(entry >> 24)};
+        fwrite(b, 1, 4, fp);
+    }
+    sbc_file_header_encode(&header, buffer);
+    fseek(fp, 0, SEEK_SET);
+    fwrite(buffer, 1, sizeof(buffer), fp);
+    fclose(fp);
+
+    printf("%s -> %s: %u frames of %u bytes (%.1f s), index %u entries (%u bytes)\n", wav_path, sbc_path,
+           header.num_frames, header.frame_length, (double)header.num_frames * samples_per_frame / header.sampling_frequency,
+           header.index_count, header.index_count * 4);
+    return 0;
+}
+
+// インデックスでのシークと、先頭から順に読んだフレームを比べる。
+static int check_seek(const char *sbc_path)
+{
+    if (sbc_source_open(LittleFS, sbc_path, false) != 0)
+        return 1;
+    uint32_t num_frames = sbc_source_header()->num_frames;
+    std::vector<uint32_t> offsets;
+    std::vector<uint8_t> frames;
+    uint8_t frame[SBC_STORAGE_SIZE];
+    for (uint32_t i = 0; i < num_frames; i++)
+    {
+        sbc_source_service();
+        int length = sbc_source_read_frame(frame, sizeof(frame));
+        if (length <= 0)
+        {
+            printf("seek: frame %u could not be read\n", i);
+            return 1;
+        }
+        offsets.push_back(frames.size());
+        frames.insert(frames.end(), frame, frame + length);
+    }
+    offsets.push_back(frames.size());
+
+    uint32_t errors = 0;
+    uint64_t seek_ns = 0;
+    const int num_seeks = 200;
+    srand(2);
+    for (int i = 0; i < num_seeks; i++)
+    {
+        uint32_t target = rand() % num_frames;
+        uint64_t start_ns = host_time_ns();
+        if (sbc_source_seek_frame(target) != 0)
+        {
+            errors++;
+            continue;
+        }
+        seek_ns += host_time_ns() - start_ns;
+        int length = sbc_source_read_frame(frame, sizeof(frame));
+        if (sbc_source_position() != (target + 1) % num_frames || length != (int)(offsets[target + 1] - offsets[target]) ||
+            memcmp(frame, &frames[offsets[target]], length) != 0)
+            errors++;
+    }
+    sbc_source_close();
+    printf("seek: %d random seeks, %.1f us per seek (including refill), errors %u -> %s\n",
+           num_seeks, seek_ns / 1000.0 / num_seeks, errors, errors == 0 ? "OK" : "NG");
+    return errors == 0 ? 0 : 1;
+}
+
+// ライブエンコードとエンコード済みファイルで送ったフレーム列と、コア0の時間を比べる。
+static int check_playback(const char *wav_path, const char *sbc_path, const media_codec_configuration_sbc_t *configuration, int seconds)
+{
+    static a2dp_media_sending_context_t context;
+    audio_pipeline_set_mode(AUDIO_PIPELINE_SINGLE_CORE);
+
+    if (wav_source_open(LittleFS, wav_path, false) != 0)
+        return 1;
+    audio_pipeline_init_encoder(configuration);
+    uint64_t live_ns = host_stream_run(&context, seconds, audio_pipeline_loop);
+    fake_a2dp_sink_t live = fake_a2dp_sink;
+    wav_source_close();
+
+    if (sbc_source_open(LittleFS, sbc_path, false) != 0)
+        return 1;
+    audio_pipeline_init_encoder(configuration);
+    if (!audio_pipeline_is_pre_encoded())
+        return 1;
+    uint64_t file_ns = host_stream_run(&context, seconds, audio_pipeline_loop);
+    fake_a2dp_sink_t file = fake_a2dp_sink;
+    sbc_source_close();
+
+    // ビットプールが合わない設定では、ファイルがあってもライブエンコードになること
+    media_codec_configuration_sbc_t mismatch = *configuration;
+    mismatch.max_bitpool_value = configuration->max_bitpool_value - 1;
+    wav_source_open(LittleFS, wav_path, false);
+    sbc_source_open(LittleFS, sbc_path, false);
+    audio_pipeline_init_encoder(&mismatch);
+    host_stream_run(&context, 1, audio_pipeline_loop);
+    bool fallback = !audio_pipeline_is_pre_encoded() && fake_a2dp_sink.sbc_frames > 0;
+    sbc_source_close();
+    wav_source_close();
+
+    bool same = live.sbc_frames == file.sbc_frames && live.frame_hash == file.frame_hash;
+    printf("playback (%d s): live %u frames hash %08x, file %u frames hash %08x -> %s\n",
+           seconds, live.sbc_frames, live.frame_hash, file.sbc_frames, file.frame_hash, same ? "same" : "DIFFERENT");
+    printf("  timer + send per second of audio: live encode %.3f ms, pre-encoded %.3f ms (%.1f%% saved)\n",
+           live_ns / 1e6 / seconds, file_ns / 1e6 / seconds, 100.0 * (1.0 - (double)file_ns / live_ns));
+    printf("  mismatched configuration falls back to live encoding -> %s\n", fallback ? "OK" : "NG");
+    return same && fallback ? 0 : 1;
+}
+
+int transcode_sbc_main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        printf("usage: transcode <in.wav> <out.sbc> [sampling_frequency] [bitpool]\n");
+        return 1;
+    }
+    // 既定は main.cpp の構成(ステレオ, 16ブロック, 8サブバンド, SNR, ビットプール53)
+    media_codec_configuration_sbc_t configuration = {
+        0, 2, 48000, 16, 8, 2, 53, SBC_CHANNEL_MODE_STEREO, SBC_ALLOCATION_METHOD_SNR};
+    if (argc > 3)
+        configuration.sampling_frequency = atoi(argv[3]);
+    if (argc > 4)
+        configuration.max_bitpool_value = atoi(argv[4]);
+    LittleFS.setRoot("");
+
+    if (host_transcode_sbc(argv[1], argv[2], &configuration) != 0)
+    {
+        printf("transcode failed\n");
+        return 1;
+    }
+    int result = check_seek(argv[2]);
+    if (sbc_source_open(LittleFS, argv[2], false) != 0)
+        return 1;
+    int seconds = (int)((uint64_t)sbc_source_header()->num_frames * sbc_source_header()->samples_per_frame / configuration.sampling_frequency);
+    sbc_source_close();
+    if (seconds > 10)
+        seconds = 10;
+    if (seconds >= 1)
+        result |= check_playback(argv[1], argv[2], &configuration, seconds);
+    return result;
+}
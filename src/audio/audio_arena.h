@@ -0,0 +1,35 @@
+#ifndef AUDIO_ARENA_H
+#define AUDIO_ARENA_H
+
+#include <stdint.h>
+#include "resampler.h"
+
+// タイマーコールバック(BTstack のコンテキスト)とコア1のエンコードで使う作業領域を1つにまとめ、静的に置きます。
+// スタックには大きな配列を置かないので、エンコーダの設定が変わっても使うメモリは変わりません。
+// 大きさが AUDIO_ARENA_BUDGET を超えないことはコンパイル時に確かめます。
+// 作業領域を使うのはエンコーダを使う側(シングルコアモードではコア0、デュアルコアモードではコア1)だけです。
+//
+// 各領域は AUDIO_ARENA_ALIGN バイト境界に置きます(pcm_convert のワード単位の読み書きと、DMA の転送単位に合わせる)。
+
+// SBC の1フレームのサンプル数の最大(16ブロック x 8サブバンド)
+#define AUDIO_ARENA_FRAME_SAMPLES (16 * 8)
+#define AUDIO_ARENA_MAX_CHANNELS 2
+// WAVの1サンプル(全チャンネル)のバイト数の最大(24bitステレオ)
+#define AUDIO_ARENA_MAX_BLOCK_ALIGN 6
+#define AUDIO_ARENA_ALIGN 8
+#ifndef AUDIO_ARENA_BUDGET
+#define AUDIO_ARENA_BUDGET 2048
+#endif
+
+typedef struct
+{
+    // エンコーダに渡す1フレームの16bit PCM
+    int16_t pcm_frame[AUDIO_ARENA_FRAME_SAMPLES * AUDIO_ARENA_MAX_CHANNELS] __attribute__((aligned(AUDIO_ARENA_ALIGN)));
+    // 先読みリングから取り出した変換前のデータ(1フレーム分、またはレート変換の入力1ブロック分)
+    uint8_t wav_data[AUDIO_ARENA_FRAME_SAMPLES * AUDIO_ARENA_MAX_BLOCK_ALIGN] __attribute__((aligned(AUDIO_ARENA_ALIGN)));
+} audio_arena_t;
+
+static_assert(sizeof(audio_arena_t) <= AUDIO_ARENA_BUDGET, "audio arena exceeds AUDIO_ARENA_BUDGET");
+static_assert(RESAMPLER_INPUT_BLOCK <= AUDIO_ARENA_FRAME_SAMPLES, "resampler input block does not fit in the audio arena");
+
+#endif
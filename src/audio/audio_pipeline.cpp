@@ -0,0 +1,1350 @@
+#include "audio_pipeline.h"
+
+#include "sbc_encoder.h"
+#include "sbc_enc_func_declare.h"
+#include "sbc_types.h"
+#include "sbc_dct.h"
+#include "btstack_sbc_encoder_bluedroid.c"
+
+#include <atomic>
+#include "Arduino.h"
+#include "btstack_config.h"
+#include "pico/time.h"
+
+#include "audio_arena.h"
+#include "bitpool_control.h"
+#include "pcm_convert.h"
+#include "resampler.h"
+#include "sbc_fanout.h"
+#include "sbc_frame_queue.h"
+#include "sbc_source.h"
+#include "stack_watermark.h"
+#include "stage_profile.h"
+#include "wav_source.h"
+
+// ネゴシエーションされたサンプリング周波数。audio_pipeline_init_encoder() で設定する。
+int current_sample_rate = 48000;
+
+static audio_pipeline_mode_t pipeline_mode = AUDIO_PIPELINE_SINGLE_CORE;
+static uint32_t audio_tick_us = AUDIO_TIMEOUT_MS * 1000;
+static audio_backlog_policy_t backlog_policy = AUDIO_BACKLOG_DROP_AUDIO;
+static uint32_t backlog_max_ms = AUDIO_BACKLOG_MAX_MS;
+static payload_planner_rate_t baseband_rate = PAYLOAD_PLANNER_2M;
+static bool payload_planning = true;
+
+// SBC（Subband Coding）エンコーダの内部状態を保持するための構造体変数です。
+// デュアルコアモードではコア1だけが触ります。
+static btstack_sbc_encoder_state_t sbc_encoder_state;
+
+// エンコーダを使う側(シングルコアモードではコア0、デュアルコアモードではコア1)から見た設定とフレームの長さ
+static media_codec_configuration_sbc_t encode_configuration;
+static uint16_t encode_frame_length;
+static bool zero_copy = true;
+
+// コア0(パケットを詰める側)から見たSBCフレームの情報
+static uint16_t sbc_frame_length;
+static unsigned int sbc_samples_per_frame;
+static media_codec_configuration_sbc_t encoder_configuration;
+
+// 送信の詰まり具合でビットプールを決める。コア0だけが触る。
+static bitpool_control_t bitpool_control;
+static bool adaptive_bitpool = true;
+// デュアルコアモードでコア0が決めたビットプール。コア1は次のフレームの前に反映する。
+static std::atomic<uint8_t> requested_bitpool(0);
+static uint8_t producer_bitpool; // コア1だけが使う
+
+// デュアルコアモードでコア1からコア0へフレームを渡すキュー
+static sbc_frame_queue_t sbc_frame_queue;
+// コア0は世代を奇数にしてから設定を書き、次の偶数の世代にする。コア1は偶数の世代が変わったらエンコーダを初期化する。
+static media_codec_configuration_sbc_t pending_configuration;
+static std::atomic<uint16_t> encoder_generation(0);
+static uint16_t producer_generation; // コア1だけが使う
+static std::atomic<bool> producer_enabled(false);
+
+// 2つ以上のシンクに送るときに1回だけ作ったフレームを共有するリングと、読み出し側の番号ごとのシンク。コア0だけが触る。
+static sbc_fanout_t sbc_fanout;
+static a2dp_media_sending_context_t *fanout_sinks[SBC_FANOUT_MAX_READERS];
+
+// ネゴシエーションされた設定がエンコード済みファイル(sbc_source)と一致し、そのフレームを送っている。
+// コア0が書き、コア1はエンコードを止める。
+static std::atomic<bool> pre_encoded(false);
+
+// WAVとSBCのサンプリング周波数が違うときに使う。エンコーダと同じコアだけが触る。
+static resampler_t pcm_resampler;
+// タイマーコールバックとコア1のエンコードの作業領域(audio_arena.h)
+static audio_arena_t audio_arena;
+// エンコーダに渡すPCMのチャンネル数。エンコーダと同じコアだけが触る。
+static int pcm_channels = NUM_CHANNELS;
+// 音量の目標のゲイン(Q15)。どちらのコアからも書き、produce_audio() が読む。
+static std::atomic<uint16_t> volume_gain(PCM_GAIN_UNITY);
+static uint32_t volume_level = PCM_GAIN_LEVEL(PCM_GAIN_UNITY); // 今のゲイン。produce_audio() だけが触る
+// 全部のシンクで共有する音量と、それを PCM に掛けるか。コア0だけが触る。
+static uint8_t pipeline_volume = 127;
+static bool volume_gain_enabled = false;
+
+void audio_pipeline_set_mode(audio_pipeline_mode_t mode)
+{
+    pipeline_mode = mode;
+    sbc_frame_queue_init(&sbc_frame_queue);
+    sbc_fanout_init(&sbc_fanout);
+}
+
+audio_pipeline_mode_t audio_pipeline_get_mode(void)
+{
+    return pipeline_mode;
+}
+
+void audio_pipeline_set_tick_us(uint32_t tick_us)
+{
+    audio_tick_us = tick_us;
+}
+
+void audio_pipeline_get_clock_stats(const a2dp_media_sending_context_t *context, media_clock_stats_t *stats)
+{
+    media_clock_get_stats(&context->clock, stats);
+}
+
+void audio_pipeline_dump_clock_stats(const a2dp_media_sending_context_t *context)
+{
+    media_clock_stats_t stats;
+    audio_pipeline_get_clock_stats(context, &stats);
+    Serial.printf("media clock: %u ticks of %u us, jitter mean %u us, max %u us\n\r", (unsigned)stats.ticks,
+                  (unsigned)context->clock.tick_us, (unsigned)stats.mean_jitter_us, (unsigned)stats.max_jitter_us);
+    Serial.printf("  jitter histogram:");
+    for (int i = 0; i < MEDIA_CLOCK_JITTER_BUCKETS; i++)
+    {
+        if (i < MEDIA_CLOCK_JITTER_BUCKETS - 1)
+            Serial.printf(" <%u:%u", (unsigned)media_clock_jitter_limits_us[i], (unsigned)stats.histogram[i]);
+        else
+            Serial.printf(" >=%u:%u", (unsigned)media_clock_jitter_limits_us[i - 1], (unsigned)stats.histogram[i]);
+    }
+    Serial.printf("\n\r");
+}
+
+void audio_pipeline_set_backlog_policy(audio_backlog_policy_t policy, uint32_t max_ms)
+{
+    backlog_policy = policy;
+    backlog_max_ms = max_ms;
+}
+
+void audio_pipeline_get_backlog_stats(const a2dp_media_sending_context_t *context, audio_backlog_stats_t *stats)
+{
+    *stats = context->backlog;
+}
+
+void audio_pipeline_dump_backlog_stats(const a2dp_media_sending_context_t *context)
+{
+    const audio_backlog_stats_t *stats = &context->backlog;
+    Serial.printf("backlog: %u ms (max %u ms, limit %u ms), underruns %u, overruns %u, dropped %u frames\n\r",
+                  (unsigned)((uint64_t)context->samples_ready * 1000 / current_sample_rate),
+                  (unsigned)((uint64_t)stats->max_backlog_samples * 1000 / current_sample_rate), (unsigned)backlog_max_ms,
+                  (unsigned)stats->underruns, (unsigned)stats->overruns, (unsigned)stats->dropped_frames);
+}
+
+void audio_pipeline_set_baseband_rate(payload_planner_rate_t rate)
+{
+    baseband_rate = rate;
+}
+
+void audio_pipeline_set_payload_planning(bool enable)
+{
+    payload_planning = enable;
+}
+
+void audio_pipeline_get_payload_stats(const a2dp_media_sending_context_t *context, audio_payload_stats_t *stats)
+{
+    stats->plan = context->payload_plan;
+    stats->packets = context->media_packets;
+    stats->baseband_slots = context->baseband_slots;
+    uint64_t elapsed_us = context->clock.samples_due * 1000000 / current_sample_rate;
+    stats->packets_per_second = elapsed_us ? (uint32_t)((uint64_t)context->media_packets * 1000000 / elapsed_us) : 0;
+    stats->airtime_us_per_second =
+        elapsed_us ? (uint32_t)((uint64_t)context->baseband_slots * PAYLOAD_PLANNER_SLOT_US * 1000000 / elapsed_us) : 0;
+}
+
+void audio_pipeline_dump_payload_stats(const a2dp_media_sending_context_t *context)
+{
+    audio_payload_stats_t stats;
+    audio_pipeline_get_payload_stats(context, &stats);
+    Serial.printf("payload: %u frames x %u fragments per packet (%u bytes, %u %s packets, %u slots), %u packets/s, airtime %u us/s\n\r",
+                  stats.plan.frames_per_packet, stats.plan.fragments, stats.plan.payload_size, stats.plan.baseband_packets,
+                  payload_planner_rate_name(baseband_rate), stats.plan.slots, (unsigned)stats.packets_per_second,
+                  (unsigned)stats.airtime_us_per_second);
+}
+
+// 今のフレームの長さで、1パケットに入れるフレーム数を決める。
+static void audio_pipeline_plan_payload(a2dp_media_sending_context_t *context)
+{
+    payload_plan_t *plan = &context->payload_plan;
+    if (payload_planner_plan(plan, baseband_rate, context->max_media_payload_size, sbc_frame_length) != 0)
+    {
+        // フラグメントでも送れない(MTU が小さすぎる)。1フレームずつ詰めようとして送らない。
+        plan->frames_per_packet = 1;
+        plan->fragments = 1;
+    }
+    if (!payload_planning && plan->fragments == 1)
+    {
+        plan->frames_per_packet = payload_planner_fill_frames(context->max_media_payload_size, sbc_frame_length);
+        plan->payload_size = 1 + plan->frames_per_packet * sbc_frame_length;
+        plan->slots = payload_planner_slots(baseband_rate, plan->payload_size, &plan->baseband_packets);
+    }
+    // フラグメントするときは1フレームをまるごと sbc_storage に入れてから分けて送る。
+    context->sbc_storage_limit = plan->fragments > 1 ? SBC_STORAGE_SIZE - 1 : context->max_media_payload_size - 1;
+}
+
+uint16_t audio_sbc_frame_length(const media_codec_configuration_sbc_t *configuration, int bitpool)
+{
+    int num_channels = configuration->channel_mode == SBC_CHANNEL_MODE_MONO ? 1 : 2;
+    int bits;
+    switch (configuration->channel_mode)
+    {
+    case SBC_CHANNEL_MODE_JOINT_STEREO:
+        bits = configuration->subbands + configuration->block_length * bitpool;
+        break;
+    case SBC_CHANNEL_MODE_STEREO:
+        bits = configuration->block_length * bitpool;
+        break;
+    default:
+        bits = configuration->block_length * num_channels * bitpool;
+        break;
+    }
+    return 4 + (4 * configuration->subbands * num_channels) / 8 + (bits + 7) / 8;
+}
+
+// エンコーダを初期化するときに、WAVの周波数からSBCの周波数への変換を選ぶ。
+static void audio_pipeline_configure_resampler(const media_codec_configuration_sbc_t *configuration)
+{
+    uint32_t input_rate = wav_source_format()->sample_rate;
+    // WAVを開いていない場合は無音になるので、変換もしない。
+    if (input_rate == 0)
+        input_rate = configuration->sampling_frequency;
+    if (resampler_configure(&pcm_resampler, input_rate, configuration->sampling_frequency, pcm_channels) != 0)
+        Serial.printf("resampler: %u Hz -> %u Hz is not supported\n\r", (unsigned)input_rate, (unsigned)configuration->sampling_frequency);
+    else if (resampler_active(&pcm_resampler))
+        Serial.printf("resampler: %u Hz -> %u Hz (%u/%u)\n\r", (unsigned)input_rate, (unsigned)configuration->sampling_frequency,
+                      pcm_resampler.up, pcm_resampler.down);
+}
+
+// ソースが新しい位置(曲の先頭・シーク先)の最初のサンプルを読んだ回数の、見終わった分。
+// WAV はエンコーダを使う側、エンコード済みファイルはコア0が見る。
+static uint32_t wav_landings_seen;
+static uint32_t sbc_landings_seen;
+// audio_pipeline_encode_frames() で新しい位置が始まったフレームの番号(なければ -1)と、その位置
+static int encode_landing_frame = -1;
+static uint32_t landing_ms;
+static bool landing_requested;
+
+// WAV の新しい位置の最初のサンプルを読んでいたら、その曲の中の位置を landing_ms に入れて true を返す。
+static bool audio_pipeline_take_wav_landing(void)
+{
+    uint32_t sample;
+    bool requested;
+    uint32_t landings = wav_source_landings(&sample, &requested);
+    if (landings == wav_landings_seen)
+        return false;
+    wav_landings_seen = landings;
+    uint32_t rate = wav_source_format()->sample_rate;
+    landing_ms = rate == 0 ? 0 : (uint32_t)((uint64_t)sample * 1000 / rate);
+    landing_requested = requested;
+    return true;
+}
+
+// エンコード済みファイルのシーク先の最初のフレームを読んでいたら、同じく landing_ms に入れて true を返す。
+static bool audio_pipeline_take_sbc_landing(void)
+{
+    uint32_t frame;
+    uint32_t landings = sbc_source_landings(&frame);
+    if (landings == sbc_landings_seen)
+        return false;
+    sbc_landings_seen = landings;
+    const sbc_file_header_t *header = sbc_source_header();
+    landing_ms = (uint32_t)((uint64_t)frame * header->samples_per_frame * 1000 / header->sampling_frequency);
+    landing_requested = true;
+    return true;
+}
+
+// sbc_storage の index 番目のフレームが新しい位置の最初のフレーム。パケットを送るときに再生位置の基準にする。
+static void audio_pipeline_mark_position(a2dp_media_sending_context_t *context, int index, uint32_t position_ms, bool requested)
+{
+    context->position_mark = index + 1;
+    context->position_mark_ms = position_ms;
+    context->position_mark_requested = requested;
+}
+
+// RTPタイムスタンプ rtp のサンプルを曲の position_ms の位置にする。要求したシークなら、要求してからの時間を記録する。
+static void audio_pipeline_set_position(a2dp_media_sending_context_t *context, uint32_t rtp, uint32_t position_ms, bool requested)
+{
+    context->position_rtp = rtp;
+    context->position_ms = position_ms;
+    if (requested && context->seek_request_us != 0)
+    {
+        audio_seek_stats_t *stats = &context->seek;
+        uint32_t latency = (uint32_t)(time_us_64() - context->seek_request_us);
+        stats->seeks++;
+        stats->last_latency_us = latency;
+        if (latency > stats->max_latency_us)
+            stats->max_latency_us = latency;
+        context->seek_request_us = 0;
+    }
+}
+
+// sbc_storage に新しい位置の最初のフレームがあれば、そのRTPタイムスタンプを再生位置の基準にする。
+// 要求したシークなら、要求してからの時間を記録する。パケットを送るときか捨てるときに、RTPタイムスタンプを進める前に呼ぶ。
+static void audio_pipeline_apply_position_mark(a2dp_media_sending_context_t *context)
+{
+    if (context->position_mark == 0)
+        return;
+    audio_pipeline_set_position(context, context->rtp_timestamp + (context->position_mark - 1) * sbc_samples_per_frame,
+                                context->position_mark_ms, context->position_mark_requested);
+    context->position_mark = 0;
+}
+
+uint32_t audio_pipeline_position_ms(const a2dp_media_sending_context_t *context)
+{
+    uint32_t samples = context->rtp_timestamp - context->position_rtp;
+    return context->position_ms + (uint32_t)((uint64_t)samples * 1000 / current_sample_rate);
+}
+
+void audio_pipeline_seek(a2dp_media_sending_context_t *context, uint32_t position_ms)
+{
+    audio_pipeline_seek_requested(context);
+    if (pre_encoded.load(std::memory_order_relaxed))
+    {
+        const sbc_file_header_t *header = sbc_source_header();
+        sbc_source_request_seek((uint32_t)((uint64_t)position_ms * header->sampling_frequency / 1000 / header->samples_per_frame));
+        return;
+    }
+    wav_source_request_seek((uint32_t)((uint64_t)position_ms * wav_source_format()->sample_rate / 1000));
+}
+
+void audio_pipeline_seek_requested(a2dp_media_sending_context_t *context)
+{
+    context->seek_request_us = time_us_64();
+}
+
+void audio_pipeline_get_seek_stats(const a2dp_media_sending_context_t *context, audio_seek_stats_t *stats)
+{
+    *stats = context->seek;
+}
+
+void audio_pipeline_dump_seek_stats(const a2dp_media_sending_context_t *context)
+{
+    const audio_seek_stats_t *stats = &context->seek;
+    Serial.printf("position: %u ms, seeks %u, latency last %u us max %u us\n\r", (unsigned)audio_pipeline_position_ms(context),
+                  (unsigned)stats->seeks, (unsigned)stats->last_latency_us, (unsigned)stats->max_latency_us);
+}
+
+static uint32_t audio_pipeline_samples_to_us(uint32_t num_samples)
+{
+    return (uint32_t)((uint64_t)num_samples * 1000000 / current_sample_rate);
+}
+
+uint32_t audio_pipeline_playback_position_ms(const a2dp_media_sending_context_t *context)
+{
+    // 送った位置から、まだスピーカーで鳴っていない分(送信完了を待つパケットとスピーカーの遅延)を引く。
+    uint32_t delay_samples = (uint32_t)((uint64_t)sink_latency_delay_us(&context->latency) * current_sample_rate / 1000000);
+    int64_t samples = (int64_t)(int32_t)(context->rtp_timestamp - context->position_rtp) - context->latency.in_flight_samples - delay_samples;
+    if (samples <= 0)
+        return context->position_ms;
+    return context->position_ms + (uint32_t)((uint64_t)samples * 1000 / current_sample_rate);
+}
+
+void audio_pipeline_reset_latency(a2dp_media_sending_context_t *context)
+{
+    sink_latency_init(&context->latency);
+    context->max_latency_us = 0;
+}
+
+void audio_pipeline_set_sink_delay(a2dp_media_sending_context_t *context, uint16_t delay_100us)
+{
+    sink_latency_delay_report(&context->latency, delay_100us, btstack_run_loop_get_time_ms());
+}
+
+// BTstack は L2CAP ヘッダ・RTPヘッダを付けたメディアパケットを、コントローラの ACL の長さで分けて送る。
+static uint8_t audio_pipeline_acl_packets(int payload_size)
+{
+    int acl_length = hci_max_acl_data_packet_length();
+    if (acl_length <= 0)
+        return 1;
+    int length = payload_size + PAYLOAD_PLANNER_L2CAP_HEADER_SIZE + PAYLOAD_PLANNER_RTP_HEADER_SIZE;
+    return (uint8_t)((length + acl_length - 1) / acl_length);
+}
+
+void audio_pipeline_packets_completed(a2dp_media_sending_context_t *context, uint16_t num_packets)
+{
+    sink_latency_completed(&context->latency, num_packets);
+}
+
+void audio_pipeline_get_latency_stats(const a2dp_media_sending_context_t *context, audio_latency_stats_t *stats)
+{
+    stats->local_us = audio_pipeline_samples_to_us(context->samples_ready + context->sbc_storage_frames * sbc_samples_per_frame);
+    stats->in_flight_us = audio_pipeline_samples_to_us(context->latency.in_flight_samples);
+    stats->sink_delay_us = sink_latency_delay_us(&context->latency);
+    stats->total_us = stats->local_us + stats->in_flight_us + stats->sink_delay_us;
+    stats->max_total_us = context->max_latency_us;
+    stats->in_flight_packets = context->latency.count;
+    stats->delay = context->latency.delay;
+}
+
+void audio_pipeline_dump_latency_stats(const a2dp_media_sending_context_t *context)
+{
+    audio_latency_stats_t stats;
+    audio_pipeline_get_latency_stats(context, &stats);
+    Serial.printf("latency: %u us = local %u us + in flight %u us (%u packets) + sink delay %u us, max %u us\n\r", (unsigned)stats.total_us,
+                  (unsigned)stats.local_us, (unsigned)stats.in_flight_us, (unsigned)stats.in_flight_packets, (unsigned)stats.sink_delay_us,
+                  (unsigned)stats.max_total_us);
+    Serial.printf("delay reports: %u, %u changes, last %u us (%u..%u us) at %u ms\n\r", (unsigned)stats.delay.reports, (unsigned)stats.delay.changes,
+                  (unsigned)stats.delay.delay_100us * 100, (unsigned)stats.delay.min_delay_100us * 100, (unsigned)stats.delay.max_delay_100us * 100,
+                  (unsigned)stats.delay.last_report_ms);
+}
+
+// produce_audio() がリングからの取り出しにかかったサイクル数。変換の時間から除く。
+static uint32_t produce_read_cycles;
+
+// SBCの周波数の16bit PCM(pcm_channels チャンネル)を1フレーム分作る。
+static int audio_pipeline_produce_frame(int16_t *pcm_frame, int num_samples)
+{
+    uint32_t start = stage_profile_now();
+    produce_read_cycles = 0;
+    int result;
+    if (resampler_active(&pcm_resampler))
+        result = resampler_process(&pcm_resampler, pcm_frame, num_samples, produce_audio);
+    else
+        result = produce_audio(pcm_frame, num_samples);
+    stage_profile_record_cycles(STAGE_PROFILE_CONVERT, start, stage_profile_now() - start - produce_read_cycles);
+    return result;
+}
+
+// エンコーダのビットプールだけを変える。btstack_sbc_encoder_init() は分析フィルタの履歴も消してしまい
+// 音が途切れるので、bluedroid のパラメータを直接書き換える。次にエンコードするフレームから反映される。
+// エンコーダを使う側から、フレームの境目で呼ぶ。
+static void audio_pipeline_apply_bitpool(int bitpool)
+{
+    bd_encoder_state.context.s16BitPool = bitpool;
+    encode_frame_length = audio_sbc_frame_length(&encode_configuration, bitpool);
+}
+
+// エンコーダを初期化し、PCMのチャンネル数とレート変換を合わせる。エンコーダを使う側から呼ぶ。
+static void audio_pipeline_setup_encoder(const media_codec_configuration_sbc_t *configuration)
+{
+    btstack_sbc_encoder_init(&sbc_encoder_state,
+                             SBC_MODE_STANDARD,
+                             configuration->block_length, configuration->subbands,
+                             configuration->allocation_method, configuration->sampling_frequency,
+                             configuration->max_bitpool_value,
+                             configuration->channel_mode);
+    encode_configuration = *configuration;
+    encode_frame_length = audio_sbc_frame_length(configuration, configuration->max_bitpool_value);
+    pcm_channels = configuration->channel_mode == SBC_CHANNEL_MODE_MONO ? 1 : NUM_CHANNELS;
+    audio_pipeline_configure_resampler(configuration);
+    audio_pipeline_take_wav_landing();
+}
+
+void audio_pipeline_set_zero_copy(bool enable)
+{
+    zero_copy = enable;
+}
+
+// 1フレームを sbc_frame にエンコードしてバイト数を返す。
+// btstack_sbc_encoder_process_data() はエンコーダ内のバッファに書くので、同じ翻訳単位にある bluedroid のパラメータ
+// (bd_encoder_state)で入力と出力先を指定し、SBC_Encoder() に送信するパケットへ直接書かせる。
+static int audio_pipeline_encode_into(int16_t *pcm_frame, uint8_t *sbc_frame)
+{
+    if (!zero_copy)
+    {
+        btstack_sbc_encoder_process_data(pcm_frame);
+        int length = btstack_sbc_encoder_sbc_buffer_length();
+        memcpy(sbc_frame, btstack_sbc_encoder_sbc_buffer(), length);
+        return length;
+    }
+    bd_encoder_state.context.ps16PcmBuffer = pcm_frame;
+    bd_encoder_state.context.pu8Packet = sbc_frame;
+    SBC_Encoder(&bd_encoder_state.context);
+    return bd_encoder_state.context.u16PacketLength;
+}
+
+int audio_pipeline_encode_frames(uint8_t *sbc_frames, int max_length, int num_frames, int *encoded_frames)
+{
+    int16_t *pcm_frame = audio_arena.pcm_frame;
+    int num_samples = btstack_sbc_encoder_num_audio_frames();
+    int length = 0;
+    int frames = 0;
+    encode_landing_frame = -1;
+    // 出力先に直接書くので、次のフレームが入ることを先に確かめる。
+    while (frames < num_frames && length + encode_frame_length <= max_length)
+    {
+        if (audio_pipeline_produce_frame(pcm_frame, num_samples) == -1)
+            break;
+        if (audio_pipeline_take_wav_landing())
+            encode_landing_frame = frames;
+        // ここでエンコードされる。
+        uint32_t start = stage_profile_now();
+        length += audio_pipeline_encode_into(pcm_frame, &sbc_frames[length]);
+        stage_profile_record(STAGE_PROFILE_ENCODE, start);
+        frames++;
+    }
+    *encoded_frames = frames;
+    return length;
+}
+
+int audio_pipeline_encode_frame(uint8_t *sbc_frame, int max_length)
+{
+    int encoded_frames;
+    int length = audio_pipeline_encode_frames(sbc_frame, max_length, 1, &encoded_frames);
+    return encoded_frames == 1 ? length : -1;
+}
+
+void audio_pipeline_init_encoder(const media_codec_configuration_sbc_t *negotiated)
+{
+    const media_codec_configuration_sbc_t *configuration = negotiated;
+    current_sample_rate = configuration->sampling_frequency;
+    // 共有のリングに残っているのは前の設定のフレーム。
+    sbc_fanout_flush(&sbc_fanout);
+    // エンコード済みのファイルがそのまま送れるなら、エンコーダは使わない。
+    if (sbc_source_is_open() && sbc_file_matches(sbc_source_header(), configuration))
+    {
+        const sbc_file_header_t *header = sbc_source_header();
+        sbc_samples_per_frame = header->samples_per_frame;
+        sbc_frame_length = header->frame_length;
+        audio_pipeline_take_sbc_landing();
+        pre_encoded.store(true, std::memory_order_release);
+        Serial.printf("playing pre-encoded SBC frames (bitpool %u)\n\r", header->bitpool);
+        return;
+    }
+    if (sbc_source_is_open())
+        Serial.printf("SBC file does not match the negotiated configuration, encoding live\n\r");
+    pre_encoded.store(false, std::memory_order_release);
+    encoder_configuration = *configuration;
+    // モノラルはチャンネルあたりのビットが倍になるので、推奨値までビットプールを下げる。
+    if (encoder_configuration.channel_mode == SBC_CHANNEL_MODE_MONO && encoder_configuration.max_bitpool_value > SBC_MONO_MAX_BITPOOL)
+        encoder_configuration.max_bitpool_value = btstack_max(SBC_MONO_MAX_BITPOOL, encoder_configuration.min_bitpool_value);
+    configuration = &encoder_configuration;
+    bitpool_control_init(&bitpool_control, configuration->min_bitpool_value, configuration->max_bitpool_value);
+    requested_bitpool.store(configuration->max_bitpool_value, std::memory_order_relaxed);
+    sbc_samples_per_frame = configuration->block_length * configuration->subbands;
+    sbc_frame_length = audio_sbc_frame_length(configuration, configuration->max_bitpool_value);
+    if (pipeline_mode == AUDIO_PIPELINE_DUAL_CORE)
+    {
+        // 書き込むのはコア0だけなので、読み出して足して書けばよい。書いている間は奇数にして、コア1に読ませない
+        // (wav_source_request() と同じ)。0 は未設定を表すので、偶数の世代は 0 を飛ばす。
+        uint16_t previous = encoder_generation.load(std::memory_order_relaxed);
+        uint16_t generation = previous + 2;
+        if (generation == 0)
+            generation = 2;
+        encoder_generation.store(previous + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        pending_configuration = *configuration;
+        encoder_generation.store(generation, std::memory_order_release);
+        return;
+    }
+    audio_pipeline_setup_encoder(configuration);
+}
+
+bool audio_pipeline_is_pre_encoded(void)
+{
+    return pre_encoded.load(std::memory_order_relaxed);
+}
+
+uint8_t audio_pipeline_preferred_channel_mode(void)
+{
+    if (sbc_source_is_open())
+    {
+        switch (sbc_source_header()->channel_mode)
+        {
+        case SBC_CHANNEL_MODE_MONO:
+            return AVDTP_SBC_MONO;
+        case SBC_CHANNEL_MODE_DUAL_CHANNEL:
+            return AVDTP_SBC_DUAL_CHANNEL;
+        case SBC_CHANNEL_MODE_STEREO:
+            return AVDTP_SBC_STEREO;
+        default:
+            return AVDTP_SBC_JOINT_STEREO;
+        }
+    }
+    // モノラルのWAVは MONO にすると、分析もビットも1チャンネル分で済む。
+    if (wav_source_format()->num_channels == 1)
+        return AVDTP_SBC_MONO;
+    return AVDTP_SBC_JOINT_STEREO;
+}
+
+void audio_pipeline_set_adaptive_bitpool(bool enable)
+{
+    adaptive_bitpool = enable;
+}
+
+void audio_pipeline_get_bitpool_stats(bitpool_control_stats_t *stats)
+{
+    bitpool_control_get_stats(&bitpool_control, stats);
+}
+
+void audio_pipeline_dump_bitpool_stats(void)
+{
+    bitpool_control_stats_t stats;
+    audio_pipeline_get_bitpool_stats(&stats);
+    Serial.printf("bitpool: %u (%u..%u), %u switches, send latency %u ms (max %u ms), max backlog %u ms\n\r",
+                  stats.bitpool, stats.min_bitpool, stats.max_bitpool, (unsigned)stats.switches,
+                  (unsigned)stats.latency_ms, (unsigned)stats.max_latency_ms, (unsigned)stats.max_backlog_ms);
+}
+
+// 次のパケットからビットプールを変える。共有のリングを読んでいるシンクは、どれも新しいフレームの長さでパケットを作る。
+static void audio_pipeline_change_bitpool(int bitpool)
+{
+    sbc_frame_length = audio_sbc_frame_length(&encoder_configuration, bitpool);
+    for (a2dp_media_sending_context_t *sink : fanout_sinks)
+    {
+        if (sink != NULL)
+            audio_pipeline_plan_payload(sink);
+    }
+    if (pipeline_mode == AUDIO_PIPELINE_DUAL_CORE)
+        requested_bitpool.store(bitpool, std::memory_order_release);
+    else
+        audio_pipeline_apply_bitpool(bitpool);
+}
+
+// パケットを送った直後(フレームの境目)に、送信レイテンシと溜まったサンプルから次のパケットのビットプールを決める。
+// 2つ以上のシンクに送っているときは、どのシンクのパケットでも決める。1つでも詰まっていれば上げないので、一番詰まっているシンクに合う。
+static void audio_pipeline_update_bitpool(a2dp_media_sending_context_t *context)
+{
+    if (!adaptive_bitpool || pre_encoded.load(std::memory_order_relaxed))
+        return;
+    uint32_t latency_ms = btstack_run_loop_get_time_ms() - context->time_can_send_requested;
+    uint32_t backlog_ms = (uint32_t)((uint64_t)context->samples_ready * 1000 / current_sample_rate);
+    int previous = bitpool_control.bitpool;
+    int bitpool = bitpool_control_update(&bitpool_control, latency_ms, backlog_ms);
+    if (bitpool == previous)
+        return;
+    audio_pipeline_change_bitpool(bitpool);
+}
+
+bool audio_pipeline_set_bitpool_range(int min_bitpool, int max_bitpool)
+{
+    if (pre_encoded.load(std::memory_order_relaxed))
+    {
+        int bitpool = sbc_source_header()->bitpool;
+        return bitpool >= min_bitpool && bitpool <= max_bitpool;
+    }
+    if (encoder_configuration.channel_mode == SBC_CHANNEL_MODE_MONO && max_bitpool > SBC_MONO_MAX_BITPOOL)
+        max_bitpool = btstack_max(SBC_MONO_MAX_BITPOOL, min_bitpool);
+    if (min_bitpool > max_bitpool)
+        return false;
+    encoder_configuration.min_bitpool_value = min_bitpool;
+    encoder_configuration.max_bitpool_value = max_bitpool;
+    int previous = bitpool_control.bitpool;
+    bitpool_control_set_range(&bitpool_control, min_bitpool, max_bitpool);
+    // 制御しないときは最大値に固定する。広げたときも最大値まで上げる。
+    if (!adaptive_bitpool)
+        bitpool_control.bitpool = max_bitpool;
+    if (bitpool_control.bitpool != previous)
+        audio_pipeline_change_bitpool(bitpool_control.bitpool);
+    return true;
+}
+
+void audio_pipeline_loop(void)
+{
+    // WAVデータの先読みリングを補充する。ファイルの読み込みはオーディオのタイマーコールバックの外で行う。
+    // エンコード済みのフレームはコア0のタイマーで読み出すので、デュアルコアモードでもここで補充する。
+    if (pre_encoded.load(std::memory_order_relaxed))
+        sbc_source_service();
+    else if (pipeline_mode == AUDIO_PIPELINE_SINGLE_CORE)
+        wav_source_service();
+}
+
+void audio_pipeline_loop1(void)
+{
+    if (pipeline_mode != AUDIO_PIPELINE_DUAL_CORE)
+        return;
+
+    uint16_t generation = encoder_generation.load(std::memory_order_acquire);
+    // 0 は未設定、奇数はコア0が設定を書いている途中。
+    if (generation == 0 || (generation & 1))
+        return;
+    if (generation != producer_generation)
+    {
+        media_codec_configuration_sbc_t configuration = pending_configuration;
+        // コピー中にコア0が設定を書き始めていたら(世代が奇数か次の世代になっていたら)、次の呼び出しでやり直す。
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (encoder_generation.load(std::memory_order_relaxed) != generation)
+            return;
+        audio_pipeline_setup_encoder(&configuration);
+        producer_generation = generation;
+        producer_bitpool = configuration.max_bitpool_value;
+    }
+    if (!producer_enabled.load(std::memory_order_acquire) || pre_encoded.load(std::memory_order_relaxed))
+        return;
+
+    // キューに空きがある間、読み込み・変換・エンコードしてフレームを積む。
+    sbc_frame_slot_t *slot;
+    while ((slot = sbc_frame_queue_acquire(&sbc_frame_queue)) != NULL)
+    {
+        // コア0がビットプールを変えていたら、このフレームから反映する。
+        uint8_t bitpool = requested_bitpool.load(std::memory_order_acquire);
+        if (bitpool != producer_bitpool)
+        {
+            audio_pipeline_apply_bitpool(bitpool);
+            producer_bitpool = bitpool;
+        }
+        wav_source_service();
+        int length = audio_pipeline_encode_frame(slot->data, SBC_FRAME_MAX_SIZE);
+        if (length == -1)
+            return;
+        slot->length = length;
+        slot->generation = producer_generation;
+        slot->landing = encode_landing_frame < 0 ? 0 : landing_requested ? 2 : 1;
+        slot->landing_ms = landing_ms;
+        sbc_frame_queue_push(&sbc_frame_queue);
+    }
+}
+
+void audio_pipeline_dump_memory(void)
+{
+    Serial.printf("audio arena: %u of %u bytes\n\r", (unsigned)sizeof(audio_arena), (unsigned)AUDIO_ARENA_BUDGET);
+    stack_watermark_dump();
+}
+
+int audio_pipeline_num_sinks(void)
+{
+    return sbc_fanout_num_readers(&sbc_fanout);
+}
+
+void audio_pipeline_get_fanout_stats(const a2dp_media_sending_context_t *context, audio_fanout_stats_t *stats)
+{
+    if (context->fanout_reader == 0)
+    {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    sbc_fanout_get_reader_stats(&sbc_fanout, context->fanout_reader - 1, stats);
+}
+
+void audio_pipeline_dump_fanout_stats(void)
+{
+    Serial.printf("fanout: %d sinks, %u frames made once, %u frames read\n\r", audio_pipeline_num_sinks(), (unsigned)sbc_fanout.frames,
+                  (unsigned)sbc_fanout.reads);
+    for (const a2dp_media_sending_context_t *sink : fanout_sinks)
+    {
+        if (sink == NULL)
+            continue;
+        audio_fanout_stats_t stats;
+        audio_pipeline_get_fanout_stats(sink, &stats);
+        Serial.printf("  sink a2dp_cid 0x%02x: queue %u frames (max %u), lost %u frames\n\r", sink->a2dp_cid, (unsigned)stats.level,
+                      (unsigned)stats.max_level, (unsigned)stats.lost);
+    }
+}
+
+void audio_pipeline_get_queue_stats(uint32_t *level, uint32_t *max_level, uint32_t *underruns)
+{
+    *level = sbc_frame_queue_level(&sbc_frame_queue);
+    *max_level = sbc_frame_queue.max_level;
+    *underruns = sbc_frame_queue.underruns;
+}
+
+static void audio_pipeline_update_volume_gain(void)
+{
+    volume_gain.store(volume_gain_enabled ? pcm_gain_from_volume(pipeline_volume) : PCM_GAIN_UNITY, std::memory_order_relaxed);
+}
+
+void audio_pipeline_set_volume(uint8_t volume)
+{
+    pipeline_volume = volume > 127 ? 127 : volume;
+    audio_pipeline_update_volume_gain();
+}
+
+uint8_t audio_pipeline_get_volume(void)
+{
+    return pipeline_volume;
+}
+
+void audio_pipeline_set_volume_gain(bool enable)
+{
+    volume_gain_enabled = enable;
+    audio_pipeline_update_volume_gain();
+}
+
+// WAVファイルからnum_samples分のデータを読み込む処理を実装
+// 16bitでチャンネル数が同じならエンコーダのバッファに直接読み込み、それ以外はフォーマットごとのカーネルで変換する。
+// 音量が 127 でないか、まだ変えている途中なら、ゲイン付きのカーネルで変換と一緒にゲインを掛ける。
+int produce_audio(int16_t *pcm_buffer, int num_samples)
+{
+    const wav_format_t *format = wav_source_format();
+    uint16_t gain = volume_gain.load(std::memory_order_relaxed);
+    pcm_convert_gain_func_t convert_gain = NULL;
+    if (gain != PCM_GAIN_UNITY || volume_level != PCM_GAIN_LEVEL(PCM_GAIN_UNITY))
+        convert_gain = pcm_convert_select_gain(format, pcm_channels);
+    pcm_convert_func_t convert = convert_gain == NULL ? pcm_convert_select(format, pcm_channels) : NULL;
+    int data_size = num_samples * format->block_align;
+    if (data_size == 0)
+    {
+        memset(pcm_buffer, 0, num_samples * pcm_channels * sizeof(int16_t));
+        return 0;
+    }
+    uint32_t start = stage_profile_now();
+    uint8_t *wav_data = audio_arena.wav_data;
+    bool direct = convert == NULL && convert_gain == NULL;
+    int result = wav_source_read(direct ? (uint8_t *)pcm_buffer : wav_data, data_size);
+    uint32_t cycles = stage_profile_now() - start;
+    stage_profile_record_cycles(STAGE_PROFILE_READ, start, cycles);
+    produce_read_cycles += cycles;
+    if (result == -1 || direct)
+        return result;
+    if (convert_gain != NULL)
+    {
+        convert_gain(wav_data, pcm_buffer, num_samples, volume_level, pcm_gain_step(volume_level, gain, num_samples));
+        volume_level = PCM_GAIN_LEVEL(gain);
+        return 0;
+    }
+    convert(wav_data, pcm_buffer, num_samples);
+    return 0;
+}
+
+// 2つ以上のシンクに送っているか、シンクが抜けた後でまだ共有のリングに読んでいないフレームが残っている。
+static bool audio_pipeline_fanout_active(const a2dp_media_sending_context_t *context)
+{
+    if (context->fanout_reader == 0)
+        return false;
+    return sbc_fanout_num_readers(&sbc_fanout) > 1 || sbc_fanout_level(&sbc_fanout, context->fanout_reader - 1) > 0;
+}
+
+// 共有のリングに積むフレームを1つ作る。エンコード済みファイルはファイルから読み、デュアルコアモードはコア1のキューから移し、
+// シングルコアモードはここでエンコードする。作れなかったときは -1 を返す。
+static int audio_pipeline_produce_fanout_frame(sbc_frame_slot_t *slot)
+{
+    slot->landing = 0;
+    if (pre_encoded.load(std::memory_order_relaxed))
+    {
+        uint32_t start = stage_profile_now();
+        int length = sbc_source_read_frame(slot->data, SBC_FRAME_MAX_SIZE);
+        stage_profile_record(STAGE_PROFILE_READ, start);
+        if (length == 0)
+            return -1;
+        slot->length = length;
+        if (audio_pipeline_take_sbc_landing())
+        {
+            slot->landing = landing_requested ? 2 : 1;
+            slot->landing_ms = landing_ms;
+        }
+        return 0;
+    }
+    if (pipeline_mode == AUDIO_PIPELINE_DUAL_CORE)
+    {
+        // 設定が変わる前にエンコードされたフレームは捨てる。
+        uint16_t generation = encoder_generation.load(std::memory_order_relaxed);
+        const sbc_frame_slot_t *queued;
+        while ((queued = sbc_frame_queue_front(&sbc_frame_queue)) != NULL && queued->generation != generation)
+            sbc_frame_queue_pop(&sbc_frame_queue);
+        if (queued == NULL)
+            return -1;
+        memcpy(slot, queued, offsetof(sbc_frame_slot_t, data) + queued->length);
+        sbc_frame_queue_pop(&sbc_frame_queue);
+        return 0;
+    }
+    int length = audio_pipeline_encode_frame(slot->data, SBC_FRAME_MAX_SIZE);
+    if (length == -1)
+        return -1;
+    slot->length = length;
+    if (encode_landing_frame >= 0)
+    {
+        slot->landing = landing_requested ? 2 : 1;
+        slot->landing_ms = landing_ms;
+    }
+    return 0;
+}
+
+// シンクが次に読むフレーム。共有のリングを全部読んでいたら(一番先を行くシンク)、フレームを1つ作って積む。
+static const sbc_frame_slot_t *audio_pipeline_fanout_front(a2dp_media_sending_context_t *context)
+{
+    int reader = context->fanout_reader - 1;
+    const sbc_frame_slot_t *slot = sbc_fanout_front(&sbc_fanout, reader);
+    if (slot != NULL)
+        return slot;
+    if (audio_pipeline_produce_fanout_frame(sbc_fanout_acquire(&sbc_fanout)) != 0)
+        return NULL;
+    sbc_fanout_push(&sbc_fanout);
+    return sbc_fanout_front(&sbc_fanout, reader);
+}
+
+// 共有のリングで1周遅れて、ほかのシンクのために上書きされたフレームを捨てたフレームとして数える。
+// 組み立て中のパケットはその前の音声なので一緒に捨て、RTPタイムスタンプを実時間に合わせる。
+static void audio_pipeline_take_fanout_lost(a2dp_media_sending_context_t *context)
+{
+    uint32_t lost = sbc_fanout_take_lost(&sbc_fanout, context->fanout_reader - 1);
+    if (lost == 0)
+        return;
+    if (context->sbc_storage_frames > 0)
+    {
+        audio_pipeline_apply_position_mark(context);
+        context->backlog.dropped_frames += context->sbc_storage_frames;
+        context->rtp_timestamp += context->sbc_storage_frames * sbc_samples_per_frame;
+        context->sbc_storage_count = 0;
+        context->sbc_storage_frames = 0;
+    }
+    uint32_t num_samples = lost * sbc_samples_per_frame;
+    context->backlog.dropped_frames += lost;
+    context->rtp_timestamp += num_samples;
+    context->samples_ready -= btstack_min(num_samples, context->samples_ready);
+}
+
+// 共有のリングを使っているとき、捨てると決めたフレームをこのシンクの読み出し位置から飛ばす。
+// リングを全部読んでいたら、ほかのシンクのためにフレームを作って積み、このシンクは読まずに飛ばす。
+// RTPタイムスタンプは捨てる分だけ先に進めてある。
+static void audio_pipeline_skip_fanout_frames(a2dp_media_sending_context_t *context)
+{
+    const sbc_frame_slot_t *slot;
+    while (context->skip_frames > 0 && (slot = audio_pipeline_fanout_front(context)) != NULL)
+    {
+        // 新しい位置の最初のフレームを捨てても、再生位置の基準は残す。
+        if (slot->landing)
+            audio_pipeline_set_position(context, context->rtp_timestamp - context->skip_frames * sbc_samples_per_frame,
+                                        slot->landing_ms, slot->landing == 2);
+        context->skip_frames--;
+        sbc_fanout_pop(&sbc_fanout, context->fanout_reader - 1);
+    }
+}
+
+// デュアルコアモードで、捨てると決めたフレームをキューから取り出して捨てる。まだ届いていない分は残す。
+// RTPタイムスタンプは捨てる分だけ先に進めてある。
+static void audio_pipeline_skip_queued_frames(a2dp_media_sending_context_t *context)
+{
+    uint16_t generation = encoder_generation.load(std::memory_order_relaxed);
+    const sbc_frame_slot_t *slot;
+    while (context->skip_frames > 0 && (slot = sbc_frame_queue_front(&sbc_frame_queue)) != NULL)
+    {
+        if (slot->generation == generation)
+        {
+            // 新しい位置の最初のフレームを捨てても、再生位置の基準は残す。
+            if (slot->landing)
+                audio_pipeline_set_position(context, context->rtp_timestamp - context->skip_frames * sbc_samples_per_frame,
+                                            slot->landing_ms, slot->landing == 2);
+            context->skip_frames--;
+        }
+        sbc_frame_queue_pop(&sbc_frame_queue);
+    }
+}
+
+// 溜まりすぎたときに、num_frames フレーム分の音声を読まずに捨てる。
+static void audio_pipeline_skip_source(a2dp_media_sending_context_t *context, uint32_t num_frames)
+{
+    if (audio_pipeline_fanout_active(context))
+    {
+        // ほかのシンクはまだその音声を読むので、ソースではなくこのシンクの読み出し位置を進める。
+        context->skip_frames += num_frames;
+        audio_pipeline_skip_fanout_frames(context);
+        return;
+    }
+    if (pre_encoded.load(std::memory_order_relaxed))
+    {
+        sbc_source_skip_frames(num_frames);
+        return;
+    }
+    if (pipeline_mode == AUDIO_PIPELINE_DUAL_CORE)
+    {
+        // WAVを読んでいるのはコア1なので、エンコード済みのフレームを捨てる。
+        context->skip_frames += num_frames;
+        audio_pipeline_skip_queued_frames(context);
+        return;
+    }
+    uint32_t num_samples = num_frames * sbc_samples_per_frame;
+    if (resampler_active(&pcm_resampler))
+        num_samples = (uint32_t)((uint64_t)num_samples * pcm_resampler.input_rate / pcm_resampler.output_rate);
+    wav_source_skip(num_samples);
+}
+
+// オーディオデータをSBC (Subband Coding) 形式にエンコードし、エンコードされたデータを送信用のバッファに格納するための関数です。具体的には、以下の処理を行っています。
+//  1.SBCエンコーディングの実行:関数は、PCM (Pulse Code Modulation) 形式のオーディオデータをSBC形式にエンコードします。エンコードは、btstack_sbc_encoder_process_data 関数を使用して行われます。
+//  2.オーディオバッファの充填:エンコードされたSBCデータは、context->sbc_storage というバッファに格納されます。このバッファは、Bluetooth経由でリモートデバイスに送信されるためのデータを保持します。
+//  3.サンプルの消費:エンコードに使用されたオーディオサンプルの数だけ、context->samples_ready からサンプル数が減算されます。これにより、どれだけのオーディオデータがエンコードされて送信の準備ができているかを追跡します。
+//  4.バッファの管理:関数は、エンコードされたデータが最大ペイロードサイズを超えないように、バッファの容量を管理します。バッファがいっぱいになると、送信の準備が整ったとみなされます。
+// デュアルコアモード: コア1がエンコード済みのフレームをキューから取り出して詰めるだけ。
+static int a2dp_demo_fill_sbc_audio_buffer_from_queue(a2dp_media_sending_context_t *context)
+{
+    int total_num_bytes_read = 0;
+    uint16_t generation = encoder_generation.load(std::memory_order_relaxed);
+    // 溜まりすぎて捨てると決めたフレームが届くまでは、その後のフレームを詰めない。
+    audio_pipeline_skip_queued_frames(context);
+    if (context->skip_frames > 0)
+        return 0;
+    while (context->samples_ready >= sbc_samples_per_frame && context->sbc_storage_frames < context->payload_plan.frames_per_packet)
+    {
+        const sbc_frame_slot_t *slot = sbc_frame_queue_front(&sbc_frame_queue);
+        if (slot == NULL)
+        {
+            context->backlog.underruns++;
+            break;
+        }
+        // 設定が変わる前にエンコードされたフレームは捨てる。
+        if (slot->generation == generation)
+        {
+            // ビットプールを変える前のフレームが残っていることがあるので、長さはフレームごとに見る。
+            if (context->sbc_storage_limit - context->sbc_storage_count < slot->length)
+                break;
+            // first byte in sbc storage contains sbc media header
+            memcpy(&context->sbc_storage[1 + context->sbc_storage_count], slot->data, slot->length);
+            if (slot->landing)
+                audio_pipeline_mark_position(context, context->sbc_storage_frames, slot->landing_ms, slot->landing == 2);
+            context->sbc_storage_count += slot->length;
+            context->sbc_storage_frames++;
+            context->samples_ready -= sbc_samples_per_frame;
+            total_num_bytes_read += sbc_samples_per_frame;
+        }
+        sbc_frame_queue_pop(&sbc_frame_queue);
+    }
+    return total_num_bytes_read;
+}
+
+// 2つ以上のシンクに送っているとき: 共有のリングから、このシンクがまだ読んでいないフレームを sbc_storage に詰める。
+// 一番先を行くシンクがフレームを作り、ほかのシンクは同じスロットを読むだけ。
+static int a2dp_demo_fill_sbc_audio_buffer_from_fanout(a2dp_media_sending_context_t *context)
+{
+    int total_num_bytes_read = 0;
+    audio_pipeline_take_fanout_lost(context);
+    audio_pipeline_skip_fanout_frames(context);
+    if (context->skip_frames > 0)
+        return 0;
+    while (context->samples_ready >= sbc_samples_per_frame && context->sbc_storage_frames < context->payload_plan.frames_per_packet)
+    {
+        const sbc_frame_slot_t *slot = audio_pipeline_fanout_front(context);
+        if (slot == NULL)
+        {
+            // シーク先のフレームを待っている間は、送るのが1周期遅れるだけなので数えない。
+            if (!pre_encoded.load(std::memory_order_relaxed) || !sbc_source_seeking())
+                context->backlog.underruns++;
+            break;
+        }
+        // ビットプールを変える前のフレームが残っていることがあるので、長さはフレームごとに見る。
+        if (context->sbc_storage_limit - context->sbc_storage_count < slot->length)
+            break;
+        // first byte in sbc storage contains sbc media header
+        memcpy(&context->sbc_storage[1 + context->sbc_storage_count], slot->data, slot->length);
+        if (slot->landing)
+            audio_pipeline_mark_position(context, context->sbc_storage_frames, slot->landing_ms, slot->landing == 2);
+        context->sbc_storage_count += slot->length;
+        context->sbc_storage_frames++;
+        context->samples_ready -= sbc_samples_per_frame;
+        total_num_bytes_read += sbc_samples_per_frame;
+        sbc_fanout_pop(&sbc_fanout, context->fanout_reader - 1);
+    }
+    return total_num_bytes_read;
+}
+
+// エンコード済みファイル: 先読みリングからフレームを sbc_storage に直接コピーするだけ。
+static int a2dp_demo_fill_sbc_audio_buffer_from_file(a2dp_media_sending_context_t *context)
+{
+    int total_num_bytes_read = 0;
+    while (context->samples_ready >= sbc_samples_per_frame && (context->sbc_storage_limit - context->sbc_storage_count) >= sbc_frame_length &&
+           context->sbc_storage_frames < context->payload_plan.frames_per_packet)
+    {
+        // first byte in sbc storage contains sbc media header
+        uint32_t start = stage_profile_now();
+        int length = sbc_source_read_frame(&context->sbc_storage[1 + context->sbc_storage_count],
+                                           context->sbc_storage_limit - context->sbc_storage_count);
+        stage_profile_record(STAGE_PROFILE_READ, start);
+        if (length == 0)
+        {
+            // シーク先のフレームを待っている間は、送るのが1周期遅れるだけなので数えない。
+            if (!sbc_source_seeking())
+                context->backlog.underruns++;
+            break;
+        }
+        if (audio_pipeline_take_sbc_landing())
+            audio_pipeline_mark_position(context, context->sbc_storage_frames, landing_ms, landing_requested);
+        context->sbc_storage_count += length;
+        context->sbc_storage_frames++;
+        context->samples_ready -= sbc_samples_per_frame;
+        total_num_bytes_read += sbc_samples_per_frame;
+    }
+    return total_num_bytes_read;
+}
+
+// 次に sbc_storage に詰めるフレームのバイト数。
+// デュアルコアモードと共有のリングでは、ビットプールを変える前にエンコードしたフレームが残っていることがある。
+static uint16_t audio_pipeline_next_frame_length(const a2dp_media_sending_context_t *context)
+{
+    if (audio_pipeline_fanout_active(context))
+    {
+        const sbc_frame_slot_t *slot = sbc_fanout_front(&sbc_fanout, context->fanout_reader - 1);
+        return slot != NULL ? slot->length : sbc_frame_length;
+    }
+    if (pipeline_mode == AUDIO_PIPELINE_DUAL_CORE && !pre_encoded.load(std::memory_order_relaxed))
+    {
+        const sbc_frame_slot_t *slot = sbc_frame_queue_front(&sbc_frame_queue);
+        if (slot != NULL && slot->generation == encoder_generation.load(std::memory_order_relaxed))
+            return slot->length;
+    }
+    return sbc_frame_length;
+}
+
+int a2dp_demo_fill_sbc_audio_buffer(a2dp_media_sending_context_t *context)
+{
+    if (audio_pipeline_fanout_active(context))
+        return a2dp_demo_fill_sbc_audio_buffer_from_fanout(context);
+    if (pre_encoded.load(std::memory_order_relaxed))
+        return a2dp_demo_fill_sbc_audio_buffer_from_file(context);
+    if (pipeline_mode == AUDIO_PIPELINE_DUAL_CORE)
+        return a2dp_demo_fill_sbc_audio_buffer_from_queue(context);
+
+    // perform sbc encoding
+    // 時刻が来ていて、パケットに入る分のフレームを1回でエンコードし、sbc_storage に直接書き込む。
+    unsigned int num_audio_samples_per_sbc_buffer = btstack_sbc_encoder_num_audio_frames();
+    int room = context->sbc_storage_limit - context->sbc_storage_count;
+    int num_frames = context->samples_ready / num_audio_samples_per_sbc_buffer;
+    if (num_frames > context->payload_plan.frames_per_packet - context->sbc_storage_frames)
+        num_frames = context->payload_plan.frames_per_packet - context->sbc_storage_frames;
+    if (num_frames > room / sbc_frame_length)
+        num_frames = room / sbc_frame_length;
+    if (num_frames <= 0)
+        return 0;
+    // first byte in sbc storage contains sbc media header
+    int encoded_frames;
+    int length = audio_pipeline_encode_frames(&context->sbc_storage[1 + context->sbc_storage_count], room, num_frames, &encoded_frames);
+    if (encoded_frames < num_frames)
+        context->backlog.underruns++;
+    if (encode_landing_frame >= 0)
+        audio_pipeline_mark_position(context, context->sbc_storage_frames + encode_landing_frame, landing_ms, landing_requested);
+    context->sbc_storage_count += length;
+    context->sbc_storage_frames += encoded_frames;
+    context->samples_ready -= encoded_frames * num_audio_samples_per_sbc_buffer;
+    return encoded_frames * num_audio_samples_per_sbc_buffer;
+}
+
+// 組み立てたパケットの送信を要求する。
+static void audio_pipeline_request_send(a2dp_media_sending_context_t *context)
+{
+    context->sbc_ready_to_send = 1;
+    context->time_can_send_requested = btstack_run_loop_get_time_ms();
+    context->cycles_can_send_requested = stage_profile_now();
+    a2dp_source_stream_endpoint_request_can_send_now(context->a2dp_cid, context->local_seid);
+}
+
+// 上限を超えて溜まったサンプルをフレーム単位で打ち切る。タイマーでサンプルを数えた直後に呼ぶ。
+static void audio_pipeline_limit_backlog(a2dp_media_sending_context_t *context)
+{
+    audio_backlog_stats_t *stats = &context->backlog;
+    if (context->samples_ready > stats->max_backlog_samples)
+        stats->max_backlog_samples = context->samples_ready;
+    uint32_t max_samples = (uint32_t)((uint64_t)backlog_max_ms * current_sample_rate / 1000);
+    if (backlog_max_ms == 0 || context->samples_ready <= max_samples)
+        return;
+    if (!context->backlog_over)
+        stats->overruns++;
+    context->backlog_over = 1;
+    if (backlog_policy == AUDIO_BACKLOG_DROP_AUDIO && context->sbc_storage_frames > 0 && context->fragment_offset == 0)
+    {
+        // 組み立て中(送信待ち)のパケットが一番古い音声なので、先に捨てる。CAN_SEND_NOW が来たときに空なら何も送らない。
+        audio_pipeline_apply_position_mark(context);
+        stats->dropped_frames += context->sbc_storage_frames;
+        context->rtp_timestamp += context->sbc_storage_frames * sbc_samples_per_frame;
+        context->sbc_storage_count = 0;
+        context->sbc_storage_frames = 0;
+        context->sbc_ready_to_send = 0;
+    }
+    uint32_t num_frames = context->samples_ready > max_samples ? (context->samples_ready - max_samples) / sbc_samples_per_frame : 0;
+    if (num_frames == 0)
+        return;
+    uint32_t num_samples = num_frames * sbc_samples_per_frame;
+    context->samples_ready -= num_samples;
+    stats->dropped_frames += num_frames;
+    // AUDIO_BACKLOG_DROP_TIME では、組み立て中のパケットから後ろが飛ばした時間の後に鳴る。
+    context->rtp_timestamp += num_samples;
+    if (backlog_policy == AUDIO_BACKLOG_DROP_AUDIO)
+        audio_pipeline_skip_source(context, num_frames);
+    else
+        context->position_rtp += num_samples; // 音声は捨てないので、曲の中の位置は進まない
+}
+
+// 溜まったサンプルをパケットに詰め、いっぱいになったら送信を要求する。
+static void a2dp_demo_fill_and_request(a2dp_media_sending_context_t *context)
+{
+    // オーディオバッファの充填。
+    // オーディオバッファをSBCエンコードされたオーディオデータで充填します。これにより、Bluetooth経由で送信するためのデータが準備されます。
+    // この中で、SBC にエンコードしている。
+    a2dp_demo_fill_sbc_audio_buffer(context);
+
+    // 送信の準備。
+    // 送信するデータが十分に溜まったら（バッファが最大ペイロードサイズを超えたら）、送信リクエストを行います。これにより、リモートデバイスにオーディオデータが送信されます。
+    if ((context->sbc_storage_count + audio_pipeline_next_frame_length(context)) > context->sbc_storage_limit ||
+        context->sbc_storage_frames >= context->payload_plan.frames_per_packet)
+    {
+        // schedule sending
+        audio_pipeline_request_send(context);
+    }
+}
+
+// A2DPを使用して音声データを定期的に送信するためのタイムアウトハンドラです。
+// 関数の役割は、一定の間隔でオーディオデータをエンコードし、送信の準備が整ったら送信リクエストを行うことです。
+// この関数は、定期的に呼び出されることで、オーディオデータのエンコードと送信を一定の間隔で行い、安定したオーディオストリーミングを実現します。
+static void a2dp_demo_audio_timeout_handler(btstack_timer_source_t *timer)
+{
+    a2dp_media_sending_context_t *context = (a2dp_media_sending_context_t *)btstack_run_loop_get_timer_context(timer);
+    // 開始時刻からの経過時間(us)で、時刻が来たサンプルを数えます。前回との差を足していくのではないので、
+    // タイマーの遅れやミリ秒への丸めがあってもRTPタイムスタンプは実時間からずれません。
+    uint64_t now_us = time_us_64();
+    context->samples_ready += media_clock_advance(&context->clock, now_us);
+    audio_pipeline_limit_backlog(context);
+
+    if (!context->sbc_ready_to_send)
+        a2dp_demo_fill_and_request(context);
+
+    // タイマーの設定。次の周期の期限か、組み立て中のパケットが揃う時刻(最後のサンプルの時刻)の早い方に発火させます。
+    uint64_t until_sample = 0;
+    if (!context->sbc_ready_to_send)
+    {
+        int room_frames = btstack_min(context->payload_plan.frames_per_packet - context->sbc_storage_frames,
+                                      (context->sbc_storage_limit - context->sbc_storage_count) / sbc_frame_length);
+        int64_t needed = (int64_t)room_frames * sbc_samples_per_frame - context->samples_ready;
+        if (needed > 0)
+            until_sample = context->clock.samples_due + needed;
+    }
+    btstack_run_loop_set_timer(&context->audio_timer, media_clock_schedule(&context->clock, now_us, until_sample));
+    // タイマーの追加。設定したタイマーを実行ループに追加し、タイムアウトイベントの監視を開始します。
+    btstack_run_loop_add_timer(&context->audio_timer);
+}
+
+void a2dp_demo_timer_start(a2dp_media_sending_context_t *context)
+{
+    // 2つ目のシンクからは、フレームを共有のリングで受け取る。先に始めたシンクも次のフレームからリングを読む。
+    if (context->fanout_reader == 0)
+    {
+        int reader = sbc_fanout_add_reader(&sbc_fanout);
+        if (reader < 0)
+        {
+            Serial.printf("audio pipeline: no room for another sink (max %d)\n\r", SBC_FANOUT_MAX_READERS);
+            return;
+        }
+        context->fanout_reader = reader + 1;
+        fanout_sinks[reader] = context;
+    }
+    context->max_media_payload_size = btstack_min(a2dp_max_media_payload_size(context->a2dp_cid, context->local_seid), SBC_STORAGE_SIZE);
+    // L2CAP ヘッダとRTPヘッダを付けて、BTstack の ACL バッファ(HCI_ACL_PAYLOAD_SIZE)に入るようにする。
+    // コントローラへは、さらにコントローラの ACL の長さで分けて送られる(送信完了もその単位で来る)。
+    context->max_media_payload_size = btstack_min(context->max_media_payload_size,
+                                                  HCI_ACL_PAYLOAD_SIZE - PAYLOAD_PLANNER_L2CAP_HEADER_SIZE - PAYLOAD_PLANNER_RTP_HEADER_SIZE);
+    audio_pipeline_plan_payload(context);
+    context->fragment_offset = 0;
+    context->media_packets = 0;
+    context->baseband_slots = 0;
+    context->sbc_storage_count = 0;
+    context->sbc_storage_frames = 0;
+    context->sbc_ready_to_send = 0;
+    context->streaming = 1;
+    memset(&context->backlog, 0, sizeof(context->backlog));
+    context->backlog_over = 0;
+    context->skip_frames = 0;
+    context->position_mark = 0;
+    sink_latency_reset_in_flight(&context->latency);
+    btstack_run_loop_remove_timer(&context->audio_timer);
+    btstack_run_loop_set_timer_handler(&context->audio_timer, a2dp_demo_audio_timeout_handler);
+    btstack_run_loop_set_timer_context(&context->audio_timer, context);
+    // 今をサンプル 0 の時刻にする。
+    uint64_t now_us = time_us_64();
+    media_clock_start(&context->clock, current_sample_rate, audio_tick_us, now_us);
+    btstack_run_loop_set_timer(&context->audio_timer, media_clock_schedule(&context->clock, now_us, 0));
+    btstack_run_loop_add_timer(&context->audio_timer);
+    producer_enabled.store(true, std::memory_order_release);
+}
+
+void a2dp_demo_timer_stop(a2dp_media_sending_context_t *context)
+{
+    context->samples_ready = 0;
+    context->streaming = 1;
+    context->position_mark = 0;
+    context->sbc_storage_count = 0;
+    context->sbc_storage_frames = 0;
+    context->sbc_ready_to_send = 0;
+    sink_latency_reset_in_flight(&context->latency);
+    btstack_run_loop_remove_timer(&context->audio_timer);
+    if (context->fanout_reader != 0)
+    {
+        sbc_fanout_remove_reader(&sbc_fanout, context->fanout_reader - 1);
+        fanout_sinks[context->fanout_reader - 1] = NULL;
+        context->fanout_reader = 0;
+    }
+    // ほかのシンクがまだストリーミングしていれば、コア1はエンコードを続ける。
+    producer_enabled.store(sbc_fanout_num_readers(&sbc_fanout) > 0, std::memory_order_release);
+}
+
+// この関数は、A2DP (Advanced Audio Distribution Profile) を使用してSBC (Subband Coding) エンコードされたオーディオデータをBluetooth経由で送信するためのものです。
+// この関数は、定期的に呼び出され、エンコード済みのオーディオデータをBluetooth経由でリモートデバイスに送信する役割を果たします。
+void a2dp_demo_send_media_packet(a2dp_media_sending_context_t *context)
+{
+    // 送信を待っている間に、溜まりすぎてパケットを捨てていた。
+    if (context->sbc_storage_frames == 0)
+    {
+        context->sbc_ready_to_send = 0;
+        return;
+    }
+    // ストレージ内のバイト数の計算
+    // 現在ストレージに保持されているエンコード済みオーディオデータのバイト数を計算します。
+    int bytes_in_storage = context->sbc_storage_count;
+    // SBCフレーム数
+    // ビットプールが変わるとフレームの長さも変わるので、詰めたときに数えたフレーム数を使います。
+    uint8_t num_sbc_frames = context->sbc_storage_frames;
+    // Prepend SBC Header
+    // SBCヘッダの追加
+    // SBCフレームの数を最初のバイトに格納して、SBCヘッダを追加します。これは、受信側がどのくらいのフレーム数を受け取るべきかを知るために必要です。
+    context->sbc_storage[0] = num_sbc_frames; // (fragmentation << 7) | (starting_packet << 6) | (last_packet << 5) | num_frames;
+    uint8_t *payload = context->sbc_storage;
+    int payload_size = bytes_in_storage + 1;
+    bool last_fragment = true;
+    if (payload_size > context->max_media_payload_size)
+    {
+        // 1フレームが MTU に入らないので、フラグメントに分けて1つずつ送る(A2DP仕様 4.3.4)。RTPタイムスタンプはどれも同じ。
+        // ヘッダは、前のフラグメントで送り終えたバイトの位置に書く。
+        int fragment_size = context->max_media_payload_size - 1;
+        int remaining = bytes_in_storage - context->fragment_offset;
+        int length = btstack_min(remaining, fragment_size);
+        last_fragment = length == remaining;
+        payload = &context->sbc_storage[context->fragment_offset];
+        payload[0] = 0x80 | (context->fragment_offset == 0 ? 0x40 : 0) | (last_fragment ? 0x20 : 0) |
+                     ((remaining + fragment_size - 1) / fragment_size);
+        payload_size = length + 1;
+        context->fragment_offset = last_fragment ? 0 : context->fragment_offset + length;
+    }
+    // オーディオデータの送信
+    // エンコード済みのオーディオデータ（SBCフレーム）をBluetooth経由で送信します。この関数は、A2DPのストリームエンドポイントID、RTPタイムスタンプ、およびエンコード済みデータを含むSBCストレージを引数として取ります。
+    uint32_t start = stage_profile_now();
+    stage_profile_record_cycles(STAGE_PROFILE_SEND_WAIT, context->cycles_can_send_requested, start - context->cycles_can_send_requested);
+    a2dp_source_stream_send_media_payload_rtp(
+        context->a2dp_cid,
+        context->local_seid,
+        0,
+        context->rtp_timestamp,
+        payload,
+        payload_size);
+    stage_profile_record(STAGE_PROFILE_SEND, start);
+    // RTPタイムスタンプを進めるのは最後のフラグメントなので、サンプルもそのパケットに数える。
+    sink_latency_sent(&context->latency, last_fragment ? num_sbc_frames * sbc_samples_per_frame : 0, audio_pipeline_acl_packets(payload_size));
+    // 新しい位置の音声が入った最初のパケット(フラグメントなら最初のフラグメント)を送った。
+    audio_pipeline_apply_position_mark(context);
+    context->media_packets++;
+    context->baseband_slots += payload_planner_slots(baseband_rate, payload_size, NULL);
+    if (!last_fragment)
+    {
+        // 残りのフラグメントは次の CAN_SEND_NOW で送る。
+        audio_pipeline_request_send(context);
+        return;
+    }
+
+    // update rtp_timestamp
+    unsigned int num_audio_samples_per_sbc_buffer = sbc_samples_per_frame;
+    // 次回のオーディオパケットを送信する際に使用するRTPタイムスタンプを更新します。RTPタイムスタンプは、オーディオデータの同期を保つために重要です。
+    context->rtp_timestamp += num_sbc_frames * num_audio_samples_per_sbc_buffer;
+    context->backlog_over = 0;
+
+    // ストレージと送信フラグのリセット
+    // オーディオデータが送信された後にストレージと送信フラグをリセットします。これにより、次のオーディオデータのエンコードと送信の準備が整います。
+    context->sbc_storage_count = 0;
+    context->sbc_storage_frames = 0;
+    context->sbc_ready_to_send = 0;
+
+    audio_latency_stats_t latency;
+    audio_pipeline_get_latency_stats(context, &latency);
+    if (latency.total_us > context->max_latency_us)
+        context->max_latency_us = latency.total_us;
+
+    // 次のパケットのビットプールを決める。
+    audio_pipeline_update_bitpool(context);
+
+    // 次のパケットの分のサンプルの時刻がもう来ていれば(途切れの後や、フラグメントで1フレームずつ送るとき)、
+    // タイマーの周期を待たずに続けて送る。
+    if (context->samples_ready >= context->payload_plan.frames_per_packet * sbc_samples_per_frame)
+        a2dp_demo_fill_and_request(context);
+}
@@ -0,0 +1,302 @@
+#ifndef AUDIO_PIPELINE_H
+#define AUDIO_PIPELINE_H
+
+#include <stdint.h>
+#include "btstack.h"
+#include "bitpool_control.h"
+#include "media_clock.h"
+#include "payload_planner.h"
+#include "sbc_fanout.h"
+#include "sink_latency.h"
+
+// WAV読み込み -> 16bitステレオへの変換 -> (サンプリングレート変換) -> SBCエンコード -> RTP送信 までのオーディオパイプラインです。
+// main.cpp と sdcard_play.cpp から共通で使い、ホストビルド(env:native)でも同じコードをベンチマークします。
+//
+// AUDIO_PIPELINE_DUAL_CORE モードでは、読み込み・変換・エンコードをコア1(loop1)で行い、
+// できたSBCフレームを sbc_frame_queue でコア0に渡します。コア0のタイマーと CAN_SEND_NOW では
+// キューからフレームを取り出してパケットに詰め、送信するだけになります。
+//
+// エンコード済みのファイル(sbc_source)を開いていて、ネゴシエーションされた設定と一致する場合は、
+// エンコードせずにファイルのフレームをそのまま sbc_storage にコピーします。一致しなければWAVをエンコードします。
+//
+// チャンネルモードが MONO のときは、変換とレート変換を1チャンネルで行い、エンコーダにもモノラルを渡します。
+//
+// 送るサンプル数とタイマーの期限は media_clock がマイクロ秒の時計から開始時刻を基準に決めます(ずれがたまらない)。
+// タイマーの周期は audio_pipeline_set_tick_us() で変えられます(デフォルトは AUDIO_TIMEOUT_MS)。
+//
+// 送信が止まって溜まったサンプル(samples_ready)は audio_pipeline_set_backlog_policy() の上限で打ち切ります。
+// 上限を超えた分はフレーム単位で、音声を捨てる(AUDIO_BACKLOG_DROP_AUDIO)か時間を飛ばす(AUDIO_BACKLOG_DROP_TIME)かし、
+// どちらも RTPタイムスタンプを飛ばした分だけ進めて実時間に合わせます。AUDIO_BACKLOG_DROP_AUDIO では、
+// 送れずに待っているパケットも古い音声として捨てます。止まった後にまとめて送ってレイテンシが伸びる代わりに、
+// 短い途切れになります。
+//
+// 1パケットのフレーム数は payload_planner がベースバンドのパケット(2-DH5 / 3-DH5)と L2CAP MTU に合わせて決め、
+// ビットプールが変わってフレームの長さが変わるたびに決め直します。1フレームが MTU に入らないときはフラグメントに分けて送ります。
+//
+// シングルコアモードでは、1パケット分のフレームを audio_pipeline_encode_frames() でまとめてエンコードし、
+// エンコーダに送信するパケット(sbc_storage)へ直接書かせます。エンコーダ内のバッファからのコピーはしません。
+//
+// 1フレームの PCM や変換前のデータなどの作業領域は、スタックではなく静的な audio_arena に置きます。
+//
+// 読み込み・変換・エンコード・送信の各段の処理時間は stage_profile に記録します。
+//
+// ライブでエンコードしているときは、パケットを送るたびに bitpool_control が送信レイテンシと溜まったサンプルから
+// 次のパケットのビットプールを決めます。ビットプールはフレームの境目でだけ変わります。
+//
+// 再生位置は送ったRTPタイムスタンプから求めます。ソースが新しい位置(曲の先頭・シーク先)の最初のサンプルを読んだら、
+// そのフレームに印を付け、パケットを送るときにそのフレームのRTPタイムスタンプと曲の中の位置を基準にします。
+//
+// 2つのシンク(スピーカー)に同時に送るときは、コンテキストをシンクごとに用意し、それぞれで a2dp_demo_timer_start() します。
+// 2つ目のシンクがストリーミングを始めると、フレームは1回だけ作って(エンコード・ファイル・コア1のキュー)共有のリング(sbc_fanout)に置き、
+// どのシンクもそこから自分のパケットに詰めます。RTPタイムスタンプ・CAN_SEND_NOW・パケットの作り方はシンクごとで、
+// 遅いシンクはリングの中で読み出し位置が遅れるだけです。リング1周分遅れたシンクは、読めなかったフレームを
+// 捨てたフレームとして数えて RTPタイムスタンプを進めます。エンコーダは1つなので、設定(周波数・チャンネルモードなど)は
+// 全部のシンクで同じにし、ビットプールは一番詰まっているシンクに合わせます。音量も全部のシンクで同じです。
+//
+// スピーカーで鳴るまでの遅れ(エンドツーエンドのレイテンシ)は、時刻が来たのにまだ送っていない音声(溜まったサンプルと
+// 組み立て中のパケット)、送ったがコントローラから送信完了が来ていないパケット、スピーカーが delay report で知らせた遅延の和です。
+// AVRCP の PLAY_STATUS_QUERY には、送った位置から後の2つを引いた、スピーカーで今鳴っている位置を返します。
+
+#define NUM_CHANNELS 2
+#define AUDIO_TIMEOUT_MS 10
+#define SBC_STORAGE_SIZE 1030
+// SBCメディアヘッダのフレーム数は4bitなので、1パケットに入れられるのは15フレームまで
+#define SBC_MAX_FRAMES_PER_PACKET 15
+// MONO のビットプールの上限。A2DP仕様の推奨値(モノラルの高音質は 31、ジョイントステレオは 53)に合わせ、
+// ステレオと同じくらいの音質でペイロードを半分近くにする。
+#define SBC_MONO_MAX_BITPOOL 31
+// 溜まったサンプルの上限のデフォルト(ms)
+#define AUDIO_BACKLOG_MAX_MS 200
+
+typedef enum
+{
+    AUDIO_BACKLOG_DROP_AUDIO = 0, // 上限を超えた分の音声を捨て、再生位置を実時間に合わせる
+    AUDIO_BACKLOG_DROP_TIME,      // 音声は捨てずに上限を超えた分の時間を飛ばし、止まった所から続ける
+} audio_backlog_policy_t;
+
+typedef struct
+{
+    uint32_t underruns;           // 送るべきサンプルがあるのにフレームを用意できなかった回数
+    uint32_t overruns;            // 溜まったサンプルが上限を超えた回数(次にパケットを送れるまでは1回)
+    uint32_t dropped_frames;      // 上限を超えて捨てた(飛ばした)フレーム数
+    uint32_t max_backlog_samples; // 溜まったサンプルの最大値(打ち切る前)
+} audio_backlog_stats_t;
+
+typedef struct
+{
+    payload_plan_t plan;           // 今のフレームの長さでのパケットの作り方
+    uint32_t packets;              // 送ったメディアパケット数(フラグメントは1つずつ数える)
+    uint32_t baseband_slots;       // それに使ったベースバンドのスロット数の見積もり
+    uint32_t packets_per_second;   // ストリーミング開始からの平均
+    uint32_t airtime_us_per_second; // 同じく、1秒あたりの電波の時間(us)
+} audio_payload_stats_t;
+
+// シンクごとの共有のリングの状態
+typedef sbc_fanout_reader_stats_t audio_fanout_stats_t;
+
+// シンクで鳴るまでの遅れ。どれも us
+typedef struct
+{
+    uint32_t local_us;       // 時刻が来たのにまだ BTstack に渡していない音声(溜まったサンプルと組み立て中のパケット)
+    uint32_t in_flight_us;   // BTstack に渡したが、送信完了が来ていないパケットの音声
+    uint32_t sink_delay_us;  // スピーカーが delay report で知らせた遅延
+    uint32_t total_us;       // その和
+    uint32_t max_total_us;   // パケットを送ったときの和の最大
+    uint32_t in_flight_packets;
+    sink_delay_stats_t delay; // delay report の記録
+} audio_latency_stats_t;
+
+typedef struct
+{
+    uint32_t seeks;           // シーク・曲の指定の後の最初のパケットを送った回数
+    uint32_t last_latency_us; // 要求してから、新しい位置の音声が入った最初のパケットを送るまでの時間
+    uint32_t max_latency_us;
+} audio_seek_stats_t;
+
+// A2DPメディア送信に関連する情報を追跡するための構造体です。
+// A2DP接続のID、ローカルおよびリモートのストリームエンドポイントID、ストリームの状態、音量など、メディア送信に関する情報を保持します。
+typedef struct
+{
+    uint16_t a2dp_cid;     // A2DP接続のID
+    uint8_t local_seid;    // ローカルのストリームエンドポイントID
+    uint8_t remote_seid;   // リモートのストリームエンドポイントID
+    uint8_t stream_opened; // ストリームが開いているかどうかのフラグ
+    uint16_t avrcp_cid;
+    bd_addr_t remote_address;
+    hci_con_handle_t con_handle; // 送信完了(HCI Number Of Completed Packets)をこの接続の分だけ数える
+
+    media_clock_t clock; // 送るべきサンプル数とタイマーの期限を決める
+    uint32_t samples_ready;
+    btstack_timer_source_t audio_timer;
+    uint8_t streaming;
+    int max_media_payload_size; // RTPペイロードの最大(SBCメディアヘッダを含む)。L2CAP MTU と HCI_ACL_PAYLOAD_SIZE から決まる
+    uint16_t sbc_storage_limit; // sbc_storage に詰めるフレームのバイト数の上限
+    payload_plan_t payload_plan;
+    uint16_t fragment_offset; // フラグメントを送っているとき、次に送るフレームの位置
+    uint32_t media_packets;
+    uint32_t baseband_slots;
+    uint32_t rtp_timestamp;
+    uint32_t time_can_send_requested; // CAN_SEND_NOW を要求した時刻(ms)
+    uint32_t cycles_can_send_requested; // 同じ時刻の stage_profile_now()
+
+    audio_backlog_stats_t backlog;
+    uint8_t backlog_over;         // 上限を超えてから、まだパケットを送れていない
+    uint32_t skip_frames;         // デュアルコアモードでキュー(共有のリングを使うときはリング)から捨てる残りのフレーム数
+    uint8_t fanout_reader;        // 共有のリングの読み出し側の番号 + 1(0 はストリーミングしていない)
+
+    // 再生位置。RTPタイムスタンプ position_rtp のサンプルが曲の position_ms の位置。
+    // 新しい位置(曲の先頭・シーク先)の最初のフレームを送ったときに置き直す。
+    uint32_t position_rtp;
+    uint32_t position_ms;
+    uint8_t position_mark;          // sbc_storage の中の新しい位置の最初のフレームの番号 + 1(0 はなし)
+    uint8_t position_mark_requested; // それが要求したシーク・曲の指定によるもの
+    uint32_t position_mark_ms;
+    uint64_t seek_request_us; // シークを要求した時刻(0 は要求なし)
+    audio_seek_stats_t seek;
+
+    sink_latency_t latency;  // delay report と、送信完了を待つパケット
+    uint32_t max_latency_us; // パケットを送ったときのエンドツーエンドのレイテンシの最大
+
+    uint8_t sbc_storage[SBC_STORAGE_SIZE];
+    uint16_t sbc_storage_count;
+    uint8_t sbc_storage_frames; // sbc_storage に入っているSBCフレーム数
+    uint8_t sbc_ready_to_send;
+
+    uint8_t absolute_volume; // スピーカーが AVRCP の絶対音量を扱う(VOLUME_CHANGED を通知し、SetAbsoluteVolume を断らない)
+    uint8_t sink_volume;     // スピーカーの絶対音量(最後に通知されたか、送った値)
+} a2dp_media_sending_context_t;
+
+// SBCコーデックのパラメータ(サンプリング周波数、チャンネルモード、ブロック長、サブバンド数、ビットプール値など)を保持する構造体です。
+typedef struct
+{
+    int reconfigure;                                   // 再設定が必要かどうかのフラグ
+    int num_channels;                                  // チャンネル数（モノラルまたはステレオ）
+    int sampling_frequency;                            // サンプリング周波数（Hz）
+    int block_length;                                  // ブロック長
+    int subbands;                                      // サブバンド数
+    int min_bitpool_value;                             // 最小ビットプール値
+    int max_bitpool_value;                             // 最大ビットプール値
+    btstack_sbc_channel_mode_t channel_mode;           // チャンネルモード（モノ、デュアル、ステレオ、ジョイントステレオ）
+    btstack_sbc_allocation_method_t allocation_method; // 割り当て方法（SNRまたはLOUDNESS）
+} media_codec_configuration_sbc_t;
+
+typedef enum
+{
+    AUDIO_PIPELINE_SINGLE_CORE = 0, // すべてコア0の BTstack コールバック内で行う
+    AUDIO_PIPELINE_DUAL_CORE,       // 読み込み・変換・エンコードをコア1で行う
+} audio_pipeline_mode_t;
+
+// ネゴシエーションされたサンプリング周波数(SBCエンコーダとRTPタイムスタンプの周波数)
+extern int current_sample_rate;
+
+// setup() で、ストリーミングを始める前に呼びます。
+void audio_pipeline_set_mode(audio_pipeline_mode_t mode);
+audio_pipeline_mode_t audio_pipeline_get_mode(void);
+// オーディオのタイマーの周期(us)。ストリーミングを始める前に呼びます。BTstack のタイマーは ms 単位なので、
+// ms で割り切れない周期は期限を ms に切り上げて発火させます(送るサンプル数は us の時計で数えるので影響しません)。
+void audio_pipeline_set_tick_us(uint32_t tick_us);
+// タイマーの期限からの遅れの分布
+void audio_pipeline_get_clock_stats(const a2dp_media_sending_context_t *context, media_clock_stats_t *stats);
+void audio_pipeline_dump_clock_stats(const a2dp_media_sending_context_t *context);
+// 溜まったサンプルの上限(ms, 0 は上限なし)と、超えたときの扱い。
+void audio_pipeline_set_backlog_policy(audio_backlog_policy_t policy, uint32_t max_ms);
+void audio_pipeline_get_backlog_stats(const a2dp_media_sending_context_t *context, audio_backlog_stats_t *stats);
+void audio_pipeline_dump_backlog_stats(const a2dp_media_sending_context_t *context);
+// 送る側のコントローラが使う EDR のレート(デフォルトは 2-DH5)。ストリーミングを始める前に呼びます。
+void audio_pipeline_set_baseband_rate(payload_planner_rate_t rate);
+// false にすると payload_planner を使わず、MTU に入るだけフレームを詰めます(比較用)。
+void audio_pipeline_set_payload_planning(bool enable);
+void audio_pipeline_get_payload_stats(const a2dp_media_sending_context_t *context, audio_payload_stats_t *stats);
+void audio_pipeline_dump_payload_stats(const a2dp_media_sending_context_t *context);
+// 今の曲の中の再生位置(ms)。最後に送ったパケットまでの位置で、スピーカーのバッファの分は含みません。
+// AVRCP の PLAY_STATUS_QUERY に答えるときに呼びます。
+uint32_t audio_pipeline_position_ms(const a2dp_media_sending_context_t *context);
+// 今の曲の position_ms から再生するように要求します。ストリーミングは止めず、先読みリングだけを捨てて読み直します。
+// WAV はサンプル番号、エンコード済みファイルはフレーム番号(インデックス)にしてソースに渡します。
+void audio_pipeline_seek(a2dp_media_sending_context_t *context, uint32_t position_ms);
+// プレイリストの曲を指定したときなど、ソースに直接要求したときに呼び、シークと同じく時間を測ります。
+void audio_pipeline_seek_requested(a2dp_media_sending_context_t *context);
+void audio_pipeline_get_seek_stats(const a2dp_media_sending_context_t *context, audio_seek_stats_t *stats);
+void audio_pipeline_dump_seek_stats(const a2dp_media_sending_context_t *context);
+// スピーカーで今鳴っている曲の中の位置(ms)。audio_pipeline_position_ms() から、送信完了を待つパケットと
+// スピーカーの遅延の分を引きます。新しい位置(曲の先頭・シーク先)の音がまだ鳴っていなければ、その位置を返します。
+uint32_t audio_pipeline_playback_position_ms(const a2dp_media_sending_context_t *context);
+// 新しいシンクに接続したときに呼び、delay report の記録と送信完了を待つパケットを消します。
+void audio_pipeline_reset_latency(a2dp_media_sending_context_t *context);
+// A2DP_SUBEVENT_SIGNALING_DELAY_REPORT で呼び出します。
+void audio_pipeline_set_sink_delay(a2dp_media_sending_context_t *context, uint16_t delay_100us);
+// HCI_EVENT_NUMBER_OF_COMPLETED_PACKETS で、このシンクの接続ハンドルの分(ACL パケットの数)を渡します。
+void audio_pipeline_packets_completed(a2dp_media_sending_context_t *context, uint16_t num_packets);
+void audio_pipeline_get_latency_stats(const a2dp_media_sending_context_t *context, audio_latency_stats_t *stats);
+void audio_pipeline_dump_latency_stats(const a2dp_media_sending_context_t *context);
+// loop() から呼びます。シングルコアモードでは先読みリングを補充します。
+void audio_pipeline_loop(void);
+// loop1() から呼びます。デュアルコアモードではここでエンコードしてキューに積みます。
+void audio_pipeline_loop1(void);
+// デュアルコアモードのキューの状態
+void audio_pipeline_get_queue_stats(uint32_t *level, uint32_t *max_level, uint32_t *underruns);
+// 作業領域(audio_arena)の大きさと、コア0のスタックの最大使用量(stack_watermark)を表示します。
+void audio_pipeline_dump_memory(void);
+// ストリーミングしているシンクの数
+int audio_pipeline_num_sinks(void);
+// 共有のリングの、このシンクがまだ読んでいないフレーム数と読めなかったフレーム数
+void audio_pipeline_get_fanout_stats(const a2dp_media_sending_context_t *context, audio_fanout_stats_t *stats);
+// 作ったフレーム数と、シンクごとのリングの状態を表示します。
+void audio_pipeline_dump_fanout_stats(void);
+
+// 設定とビットプールから SBC フレームのバイト数を計算します(A2DP仕様 12.9)。
+uint16_t audio_sbc_frame_length(const media_codec_configuration_sbc_t *configuration, int bitpool);
+
+// ネゴシエーションされた設定でSBCエンコーダを初期化します。
+// WAVのサンプリング周波数が違う場合はレート変換も設定します(wav_source を先に開いておきます)。
+// デュアルコアモードでは設定を預け、コア1が次のフレームの前に初期化します。
+void audio_pipeline_init_encoder(const media_codec_configuration_sbc_t *configuration);
+// エンコード済みファイルのフレームを送っているか
+bool audio_pipeline_is_pre_encoded(void);
+
+// ネゴシエーションで優先するチャンネルモード(AVDTP_SBC_MONO など)を、開いているファイルから選びます。
+// エンコード済みファイルはそのモード、モノラルのWAVは MONO、それ以外は JOINT_STEREO です。
+// avdtp_set_preferred_channel_mode() に渡します。スピーカーが対応していなければ BTstack が他のモードを選びます。
+uint8_t audio_pipeline_preferred_channel_mode(void);
+
+// ビットプールを送信の詰まり具合で変えるか(デフォルトは true)。false ではネゴシエーションされた最大値に固定します。
+void audio_pipeline_set_adaptive_bitpool(bool enable);
+// ビットプールの範囲を min..max にします(モノラルの上限は init_encoder と同じくかけます)。
+// 2台目のスピーカーに同じフレームを送るときに、両方のスピーカーの範囲の共通部分を渡します。
+// 範囲が空のとき、またはエンコード済みのフレームのビットプールが範囲に入らないときは、何も変えずに false を返します。
+bool audio_pipeline_set_bitpool_range(int min_bitpool, int max_bitpool);
+void audio_pipeline_get_bitpool_stats(bitpool_control_stats_t *stats);
+void audio_pipeline_dump_bitpool_stats(void);
+
+// 最大 num_frames フレームを読み込み・変換してエンコードし、sbc_frames に続けて直接書き込みます。
+// 書き込んだバイト数を返し、フレーム数を encoded_frames に入れます。max_length に次のフレームが入らないか、
+// PCM を用意できなかったところで止めます。
+// エンコーダを使う側(シングルコアモードではコア0、デュアルコアモードではコア1)から呼びます。
+int audio_pipeline_encode_frames(uint8_t *sbc_frames, int max_length, int num_frames, int *encoded_frames);
+// 1フレームだけエンコードしてバイト数を返します。できなかったときは -1 を返します。
+int audio_pipeline_encode_frame(uint8_t *sbc_frame, int max_length);
+// false にすると btstack_sbc_encoder_process_data() でエンコーダ内のバッファに書き、そこからコピーします(比較用)。
+void audio_pipeline_set_zero_copy(bool enable);
+
+// 音量(AVRCP の絶対音量 0..127)。どのシンクにも同じフレームを送るので、パイプラインに1つだけ持ちます。
+// audio_pipeline_set_volume_gain(true) のときだけ pcm_gain_from_volume() のゲインを PCM に掛けます
+// (絶対音量を扱わないスピーカー向け。扱うスピーカーは自分で音量を変えるので、掛けると二重に下がります)。
+// produce_audio() が変換のカーネルの中でゲインを掛け、次に読み出すブロックの中で新しい音量まで直線に変えます。
+// 掛けないときと 127 ではゲインの無い変換(16bit で同じチャンネル数ならエンコーダのバッファに直接読み込み)のままです。
+// エンコード済みファイル(sbc_source)のフレームには掛かりません。コア0から呼びます。
+void audio_pipeline_set_volume(uint8_t volume);
+uint8_t audio_pipeline_get_volume(void);
+// 音量を PCM に掛けるか。デフォルトは掛けません。
+void audio_pipeline_set_volume_gain(bool enable);
+
+// WAVファイルからnum_samples分のデータを読み込み、エンコーダのチャンネル数(MONO なら1、それ以外は2)の16bit PCMにします。
+// pcm_buffer は4バイト境界に置いて下さい(pcm_convert.h)。
+int produce_audio(int16_t *pcm_buffer, int num_samples);
+
+int a2dp_demo_fill_sbc_audio_buffer(a2dp_media_sending_context_t *context);
+void a2dp_demo_timer_start(a2dp_media_sending_context_t *context);
+void a2dp_demo_timer_stop(a2dp_media_sending_context_t *context);
+// A2DP_SUBEVENT_STREAMING_CAN_SEND_MEDIA_PACKET_NOW で呼び出します。
+void a2dp_demo_send_media_packet(a2dp_media_sending_context_t *context);
+
+#endif
@@ -0,0 +1,82 @@
+#include "audio_ring.h"
+
+#include <string.h>
+
+void audio_ring_init(audio_ring_t *ring, uint8_t *buffer, uint32_t size)
+{
+    ring->buffer = buffer;
+    ring->size = size;
+    audio_ring_reset(ring);
+}
+
+void audio_ring_reset(audio_ring_t *ring)
+{
+    ring->head.store(0, std::memory_order_relaxed);
+    ring->tail.store(0, std::memory_order_release);
+}
+
+uint8_t *audio_ring_write_ptr(audio_ring_t *ring, uint32_t *contiguous)
+{
+    uint32_t head = ring->head.load(std::memory_order_relaxed);
+    uint32_t offset = head & (ring->size - 1);
+    uint32_t space = audio_ring_space(ring);
+    uint32_t to_end = ring->size - offset;
+    *contiguous = space < to_end ? space : to_end;
+    return ring->buffer + offset;
+}
+
+void audio_ring_commit(audio_ring_t *ring, uint32_t length)
+{
+    // データを書いてから head を進める(release)。読み出し側は acquire で head を読む。
+    ring->head.store(ring->head.load(std::memory_order_relaxed) + length, std::memory_order_release);
+}
+
+uint32_t audio_ring_write(audio_ring_t *ring, const uint8_t *data, uint32_t length)
+{
+    uint32_t written = 0;
+    while (written < length)
+    {
+        uint32_t contiguous;
+        uint8_t *dst = audio_ring_write_ptr(ring, &contiguous);
+        if (contiguous == 0)
+            break;
+        if (contiguous > length - written)
+            contiguous = length - written;
+        memcpy(dst, data + written, contiguous);
+        audio_ring_commit(ring, contiguous);
+        written += contiguous;
+    }
+    return written;
+}
+
+uint32_t audio_ring_peek(const audio_ring_t *ring, uint8_t *data, uint32_t length)
+{
+    uint32_t tail = ring->tail.load(std::memory_order_relaxed);
+    uint32_t level = ring->head.load(std::memory_order_acquire) - tail;
+    if (length > level)
+        length = level;
+    uint32_t offset = tail & (ring->size - 1);
+    uint32_t first = ring->size - offset;
+    if (first > length)
+        first = length;
+    memcpy(data, ring->buffer + offset, first);
+    memcpy(data + first, ring->buffer, length - first);
+    return length;
+}
+
+uint32_t audio_ring_read(audio_ring_t *ring, uint8_t *data, uint32_t length)
+{
+    length = audio_ring_peek(ring, data, length);
+    ring->tail.store(ring->tail.load(std::memory_order_relaxed) + length, std::memory_order_release);
+    return length;
+}
+
+uint32_t audio_ring_skip(audio_ring_t *ring, uint32_t length)
+{
+    uint32_t tail = ring->tail.load(std::memory_order_relaxed);
+    uint32_t level = ring->head.load(std::memory_order_acquire) - tail;
+    if (length > level)
+        length = level;
+    ring->tail.store(tail + length, std::memory_order_release);
+    return length;
+}
@@ -0,0 +1,44 @@
+#ifndef AUDIO_RING_H
+#define AUDIO_RING_H
+
+#include <stdint.h>
+#include <atomic>
+
+// 書き込み側1つ・読み出し側1つ(SPSC)のロックフリーなバイトリングバッファです。
+// 書き込みは loop() やコア1、読み出しは BTstack のタイマーコールバックのように、
+// 別のコンテキストから同時に呼ばれても安全です。
+// head/tail は剰余を取らずに増やし続け、size は2のべき乗にします。
+typedef struct
+{
+    uint8_t *buffer;
+    uint32_t size;
+    std::atomic<uint32_t> head; // 書き込み位置(書き込み側だけが更新)
+    std::atomic<uint32_t> tail; // 読み出し位置(読み出し側だけが更新)
+} audio_ring_t;
+
+void audio_ring_init(audio_ring_t *ring, uint8_t *buffer, uint32_t size);
+// 読み出し側が止まっているときだけ呼べます。
+void audio_ring_reset(audio_ring_t *ring);
+
+static inline uint32_t audio_ring_level(const audio_ring_t *ring)
+{
+    return ring->head.load(std::memory_order_acquire) - ring->tail.load(std::memory_order_acquire);
+}
+
+static inline uint32_t audio_ring_space(const audio_ring_t *ring)
+{
+    return ring->size - audio_ring_level(ring);
+}
+
+// 書き込み側: 連続して書き込める領域を返します。書いた後に audio_ring_commit() します。
+uint8_t *audio_ring_write_ptr(audio_ring_t *ring, uint32_t *contiguous);
+void audio_ring_commit(audio_ring_t *ring, uint32_t length);
+uint32_t audio_ring_write(audio_ring_t *ring, const uint8_t *data, uint32_t length);
+
+// 読み出し側: 最大 length バイトをコピーし、コピーできたバイト数を返します。
+uint32_t audio_ring_read(audio_ring_t *ring, uint8_t *data, uint32_t length);
+// 取り出さずにコピーだけします。
+uint32_t audio_ring_peek(const audio_ring_t *ring, uint8_t *data, uint32_t length);
+uint32_t audio_ring_skip(audio_ring_t *ring, uint32_t length);
+
+#endif
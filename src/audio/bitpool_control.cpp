@@ -0,0 +1,78 @@
+#include "bitpool_control.h"
+
+#include <string.h>
+
+void bitpool_control_init(bitpool_control_t *control, int min_bitpool, int max_bitpool)
+{
+    memset(control, 0, sizeof(*control));
+    bitpool_control_set_range(control, min_bitpool, max_bitpool);
+    control->bitpool = (uint8_t)max_bitpool;
+}
+
+void bitpool_control_set_range(bitpool_control_t *control, int min_bitpool, int max_bitpool)
+{
+    int floor = min_bitpool > BITPOOL_CONTROL_FLOOR ? min_bitpool : BITPOOL_CONTROL_FLOOR;
+    if (floor > max_bitpool)
+        floor = max_bitpool;
+    control->min_bitpool = (uint8_t)floor;
+    control->max_bitpool = (uint8_t)max_bitpool;
+    if (control->bitpool > max_bitpool)
+        control->bitpool = (uint8_t)max_bitpool;
+    else if (control->bitpool < floor)
+        control->bitpool = (uint8_t)floor;
+}
+
+int bitpool_control_update(bitpool_control_t *control, uint32_t latency_ms, uint32_t backlog_ms)
+{
+    // 1回だけ遅れたパケットで下げないように、レイテンシは平均(係数 1/4)で見る。
+    control->latency_q4 += ((int32_t)(latency_ms << 4) - (int32_t)control->latency_q4) / 4;
+    uint32_t latency_avg_ms = control->latency_q4 >> 4;
+    if (latency_ms > control->max_latency_ms)
+        control->max_latency_ms = latency_ms;
+    if (backlog_ms > control->max_backlog_ms)
+        control->max_backlog_ms = backlog_ms;
+    if (control->hold > 0)
+        control->hold--;
+
+    // レイテンシが大きくても、サンプルが溜まっていなければ送信は間に合っているので下げない。
+    bool congested = backlog_ms > BITPOOL_CONTROL_BACKLOG_HIGH_MS ||
+                     (latency_avg_ms > BITPOOL_CONTROL_LATENCY_HIGH_MS && backlog_ms > BITPOOL_CONTROL_BACKLOG_LOW_MS);
+    bool clear = latency_avg_ms <= BITPOOL_CONTROL_LATENCY_LOW_MS && backlog_ms <= BITPOOL_CONTROL_BACKLOG_LOW_MS;
+    if (congested)
+    {
+        control->good = 0;
+        if (control->hold == 0 && control->bitpool > control->min_bitpool)
+        {
+            int bitpool = control->bitpool - BITPOOL_CONTROL_STEP_DOWN;
+            control->bitpool = (uint8_t)(bitpool > control->min_bitpool ? bitpool : control->min_bitpool);
+            control->hold = BITPOOL_CONTROL_HOLD_PACKETS;
+            control->switches++;
+        }
+    }
+    else if (clear)
+    {
+        if (control->bitpool < control->max_bitpool && ++control->good >= BITPOOL_CONTROL_RECOVER_PACKETS)
+        {
+            int bitpool = control->bitpool + BITPOOL_CONTROL_STEP_UP;
+            control->bitpool = (uint8_t)(bitpool < control->max_bitpool ? bitpool : control->max_bitpool);
+            control->good = 0;
+            control->switches++;
+        }
+    }
+    else
+    {
+        control->good = 0;
+    }
+    return control->bitpool;
+}
+
+void bitpool_control_get_stats(const bitpool_control_t *control, bitpool_control_stats_t *stats)
+{
+    stats->bitpool = control->bitpool;
+    stats->min_bitpool = control->min_bitpool;
+    stats->max_bitpool = control->max_bitpool;
+    stats->switches = control->switches;
+    stats->latency_ms = control->latency_q4 >> 4;
+    stats->max_latency_ms = control->max_latency_ms;
+    stats->max_backlog_ms = control->max_backlog_ms;
+}
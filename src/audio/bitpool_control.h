@@ -0,0 +1,63 @@
+#ifndef AUDIO_BITPOOL_CONTROL_H
+#define AUDIO_BITPOOL_CONTROL_H
+
+#include <stdint.h>
+
+// 送信の詰まり具合でSBCのビットプールを上げ下げするコントローラです。
+// パケットを送るたびに、CAN_SEND_NOW を要求してから送れるまでの時間(送信レイテンシ)と、
+// まだエンコードしていないサンプル(samples_ready)の量を渡します。
+//  - 溜まったサンプルが上限を超えたら(レイテンシが上限を超えているときは下限を超えたら)
+//    BITPOOL_CONTROL_STEP_DOWN 下げ、効果が出るまで BITPOOL_CONTROL_HOLD_PACKETS パケット待つ
+//  - 両方が下限以下のまま BITPOOL_CONTROL_RECOVER_PACKETS パケット続いたら BITPOOL_CONTROL_STEP_UP 上げる
+// ビットプールを下げるとフレームが短くなり、1パケットに入る音声が長くなるので、同じ送信機会で多くのサンプルを送れます。
+// 範囲はネゴシエーションされた min..max で、下側は BITPOOL_CONTROL_FLOOR でも制限します(音質を保つため)。
+
+#ifndef BITPOOL_CONTROL_FLOOR
+#define BITPOOL_CONTROL_FLOOR 18
+#endif
+#define BITPOOL_CONTROL_STEP_DOWN 6
+#define BITPOOL_CONTROL_STEP_UP 4
+#define BITPOOL_CONTROL_HOLD_PACKETS 8
+#define BITPOOL_CONTROL_RECOVER_PACKETS 20
+// 送信レイテンシ(平均, ms)のしきい値。オーディオのタイマー周期は 10ms
+#define BITPOOL_CONTROL_LATENCY_HIGH_MS 20
+#define BITPOOL_CONTROL_LATENCY_LOW_MS 8
+// 送信時点で溜まっているサンプルのしきい値(ms)
+#define BITPOOL_CONTROL_BACKLOG_HIGH_MS 40
+#define BITPOOL_CONTROL_BACKLOG_LOW_MS 15
+
+typedef struct
+{
+    uint8_t bitpool;         // 現在のビットプール
+    uint8_t min_bitpool;     // 下げられる下限
+    uint8_t max_bitpool;     // ネゴシエーションされた最大値
+    uint32_t switches;       // ビットプールを変えた回数
+    uint32_t latency_ms;     // 送信レイテンシの平均
+    uint32_t max_latency_ms; // 送信レイテンシの最大値
+    uint32_t max_backlog_ms; // 送信時点で溜まっていたサンプルの最大値
+} bitpool_control_stats_t;
+
+typedef struct
+{
+    uint8_t bitpool;
+    uint8_t min_bitpool;
+    uint8_t max_bitpool;
+    uint8_t hold;         // 下げた後、次に下げられるまでのパケット数
+    uint16_t good;        // 詰まっていないパケットが続いた数
+    uint32_t latency_q4;  // 送信レイテンシの指数移動平均(ms の Q4)
+    uint32_t switches;
+    uint32_t max_latency_ms;
+    uint32_t max_backlog_ms;
+} bitpool_control_t;
+
+// ネゴシエーションされた範囲で初期化します。最初は max_bitpool から始めます。
+void bitpool_control_init(bitpool_control_t *control, int min_bitpool, int max_bitpool);
+// 範囲だけを変えます(2台目のスピーカーの範囲に狭めるときなど)。統計はそのままで、今のビットプールは新しい範囲に収めます。
+void bitpool_control_set_range(bitpool_control_t *control, int min_bitpool, int max_bitpool);
+
+// パケットを送るたびに呼び、次のパケットのビットプールを返します。
+int bitpool_control_update(bitpool_control_t *control, uint32_t latency_ms, uint32_t backlog_ms);
+
+void bitpool_control_get_stats(const bitpool_control_t *control, bitpool_control_stats_t *stats);
+
+#endif
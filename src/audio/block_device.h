@@ -0,0 +1,26 @@
+#ifndef AUDIO_BLOCK_DEVICE_H
+#define AUDIO_BLOCK_DEVICE_H
+
+#include <stdint.h>
+
+// 512 バイトのセクタ単位で読み込むブロックデバイスです。sector_reader が使います。
+// 実機は SPI の SD カード(sd_block_device.cpp, CMD18 と DMA)、ホストは host/check_sector_reader.cpp の
+// 遅延を入れられるディスクイメージです。
+//
+// start_read() は読み込みを始めるだけで、終わるまでは poll() を呼びます。DMA の転送中は CPU を他のことに使えます。
+// 同時に読み込めるのは1つだけです。
+
+#define BLOCK_DEVICE_SECTOR_SIZE 512
+
+typedef struct block_device
+{
+    // sector から count セクタを dst に読み込み始めます。dst は4バイト境界に置きます。始められなければ false を返します。
+    bool (*start_read)(struct block_device *device, uint32_t sector, uint8_t *dst, uint32_t count);
+    // 読み込みが終わっていれば 1、まだなら 0、失敗したら -1 を返します。
+    int (*poll)(struct block_device *device);
+    // 1回の start_read() で読めるセクタ数の最大
+    uint32_t max_sectors;
+    void *context;
+} block_device_t;
+
+#endif
@@ -0,0 +1,160 @@
+#include "connect_planner.h"
+
+#include <Arduino.h>
+#include <string.h>
+
+static bool connect_planner_is_zero(const uint8_t *address)
+{
+    for (int i = 0; i < CONNECT_PLANNER_ADDRESS_SIZE; i++)
+    {
+        if (address[i] != 0)
+            return false;
+    }
+    return true;
+}
+
+static int connect_planner_find(const connect_planner_t *planner, const uint8_t *address)
+{
+    for (int i = 0; i < planner->num_candidates; i++)
+    {
+        if (memcmp(planner->candidates[i], address, CONNECT_PLANNER_ADDRESS_SIZE) == 0)
+            return i;
+    }
+    return -1;
+}
+
+void connect_planner_init(connect_planner_t *planner, uint8_t max_page_timeouts)
+{
+    memset(planner, 0, sizeof(*planner));
+    planner->max_page_timeouts = max_page_timeouts;
+}
+
+bool connect_planner_add_candidate(connect_planner_t *planner, const uint8_t *address)
+{
+    if (connect_planner_is_zero(address) || connect_planner_find(planner, address) >= 0 ||
+        planner->num_candidates >= CONNECT_PLANNER_MAX_CANDIDATES)
+        return false;
+    memcpy(planner->candidates[planner->num_candidates++], address, CONNECT_PLANNER_ADDRESS_SIZE);
+    return true;
+}
+
+// 次の候補をページングするか、候補が無いか、ページタイムアウトが上限に達したか、どの候補にも断られたらインクワイアリにする。
+static connect_planner_action_t connect_planner_next(connect_planner_t *planner, uint8_t *address)
+{
+    if (planner->num_candidates == 0 || planner->page_timeouts >= planner->max_page_timeouts ||
+        planner->failures >= planner->num_candidates)
+    {
+        if (planner->path == CONNECT_PATH_DIRECT && planner->num_candidates > 0)
+            planner->stats.fallbacks++;
+        planner->path = CONNECT_PATH_INQUIRY;
+        return CONNECT_PLANNER_INQUIRY;
+    }
+    planner->path = CONNECT_PATH_DIRECT;
+    memcpy(address, planner->candidates[planner->next_candidate], CONNECT_PLANNER_ADDRESS_SIZE);
+    planner->next_candidate = (planner->next_candidate + 1) % planner->num_candidates;
+    return CONNECT_PLANNER_PAGE;
+}
+
+connect_planner_action_t connect_planner_start(connect_planner_t *planner, uint32_t now_ms, uint8_t *address)
+{
+    planner->start_ms = now_ms;
+    planner->next_candidate = 0;
+    planner->page_timeouts = 0;
+    planner->failures = 0;
+    planner->path = CONNECT_PATH_DIRECT;
+    planner->waiting_first_packet = false;
+    return connect_planner_next(planner, address);
+}
+
+connect_planner_action_t connect_planner_disconnected(connect_planner_t *planner, uint32_t now_ms, uint8_t *address)
+{
+    planner->reconnect = true;
+    planner->stats.reconnects++;
+    return connect_planner_start(planner, now_ms, address);
+}
+
+connect_planner_action_t connect_planner_failed(connect_planner_t *planner, uint8_t status, uint8_t *address)
+{
+    planner->waiting_first_packet = false;
+    // インクワイアリで見つけた相手に失敗したら、また探す。
+    if (planner->path == CONNECT_PATH_INQUIRY)
+        return CONNECT_PLANNER_INQUIRY;
+    if (status == CONNECT_PLANNER_PAGE_TIMEOUT)
+    {
+        planner->page_timeouts++;
+        planner->stats.page_timeouts++;
+    }
+    else
+    {
+        planner->failures++;
+        planner->stats.failures++;
+    }
+    return connect_planner_next(planner, address);
+}
+
+void connect_planner_connected(connect_planner_t *planner, const uint8_t *address)
+{
+    planner->waiting_first_packet = true;
+    if (connect_planner_is_zero(address))
+        return;
+    int index = connect_planner_find(planner, address);
+    if (index < 0)
+        index = planner->num_candidates < CONNECT_PLANNER_MAX_CANDIDATES ? planner->num_candidates++ : planner->num_candidates - 1;
+    memmove(planner->candidates[1], planner->candidates[0], index * CONNECT_PLANNER_ADDRESS_SIZE);
+    memcpy(planner->candidates[0], address, CONNECT_PLANNER_ADDRESS_SIZE);
+}
+
+bool connect_planner_first_packet(connect_planner_t *planner, uint32_t now_ms)
+{
+    if (!planner->waiting_first_packet)
+        return false;
+    planner->waiting_first_packet = false;
+    uint32_t elapsed_ms = now_ms - planner->start_ms;
+    connect_path_stats_t *stats = &planner->stats.paths[planner->path];
+    if (stats->connections == 0 || elapsed_ms < stats->min_ms)
+        stats->min_ms = elapsed_ms;
+    if (elapsed_ms > stats->max_ms)
+        stats->max_ms = elapsed_ms;
+    stats->connections++;
+    stats->last_ms = elapsed_ms;
+    stats->total_ms += elapsed_ms;
+    Serial.printf("connect: first media packet %u ms after %s via %s (%u page timeouts, %u other failures)\n\r", (unsigned)elapsed_ms,
+                  planner->reconnect ? "disconnect" : "boot", connect_planner_path_name(planner->path),
+                  (unsigned)planner->page_timeouts, (unsigned)planner->failures);
+    return true;
+}
+
+void connect_planner_get_stats(const connect_planner_t *planner, connect_planner_stats_t *stats)
+{
+    *stats = planner->stats;
+}
+
+void connect_planner_dump_stats(const connect_planner_t *planner)
+{
+    const connect_planner_stats_t *stats = &planner->stats;
+    Serial.printf("connect: %u candidates, page timeouts %u, other failures %u, fallbacks to inquiry %u, reconnects %u\n\r",
+                  (unsigned)planner->num_candidates, (unsigned)stats->page_timeouts, (unsigned)stats->failures,
+                  (unsigned)stats->fallbacks, (unsigned)stats->reconnects);
+    for (int i = 0; i < CONNECT_PATH_NUM_PATHS; i++)
+    {
+        const connect_path_stats_t *path = &stats->paths[i];
+        if (path->connections == 0)
+            continue;
+        Serial.printf("  %-7s %u connections, to first packet last %u ms, min %u ms, avg %u ms, max %u ms\n\r",
+                      connect_planner_path_name((connect_path_t)i), (unsigned)path->connections, (unsigned)path->last_ms,
+                      (unsigned)path->min_ms, (unsigned)(path->total_ms / path->connections), (unsigned)path->max_ms);
+    }
+}
+
+const char *connect_planner_path_name(connect_path_t path)
+{
+    switch (path)
+    {
+    case CONNECT_PATH_DIRECT:
+        return "direct";
+    case CONNECT_PATH_INQUIRY:
+        return "inquiry";
+    default:
+        return "?";
+    }
+}
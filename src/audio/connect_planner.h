@@ -0,0 +1,90 @@
+#ifndef AUDIO_CONNECT_PLANNER_H
+#define AUDIO_CONNECT_PLANNER_H
+
+#include <stdint.h>
+
+// 起動時と切断後に、どのスピーカーへどの順で接続するかを決めます(BTstack には触りません)。
+//
+// 知っているスピーカー(main.cpp の device_addr_string と、BTstack がフラッシュに持っているリンクキーの相手)を候補にして、
+// インクワイアリをせずに直接ページングして接続します。ページタイムアウト(相手の電源が入っていない、範囲外など)は
+// 次の候補に移り、合わせて max_page_timeouts 回になったらインクワイアリに切り替えます。
+// それ以外の失敗(認証の失敗、接続の拒否など。相手はそこにいる)はページタイムアウトには数えずに次の候補に移り、
+// 候補の数だけ続いたら(どの候補も断ったら)インクワイアリに切り替えます。インクワイアリで見つけた
+// スピーカーへの接続に失敗した場合は、もう一度インクワイアリします。
+// 最後に接続したスピーカーを候補の先頭に置くので、切断後の再接続はまずそのスピーカーをページングします。
+//
+// 起動(または切断)から最初のメディアパケットを送るまでの時間を、直接接続とインクワイアリの経路ごとに記録します。
+
+#define CONNECT_PLANNER_MAX_CANDIDATES 4
+#define CONNECT_PLANNER_ADDRESS_SIZE 6
+// BTstack の ERROR_CODE_PAGE_TIMEOUT
+#define CONNECT_PLANNER_PAGE_TIMEOUT 0x04
+
+typedef enum
+{
+    CONNECT_PLANNER_PAGE = 0, // address にページングして接続する
+    CONNECT_PLANNER_INQUIRY,  // インクワイアリで探す
+} connect_planner_action_t;
+
+typedef enum
+{
+    CONNECT_PATH_DIRECT = 0, // 候補に直接ページング
+    CONNECT_PATH_INQUIRY,    // インクワイアリで見つけたスピーカー
+    CONNECT_PATH_NUM_PATHS,
+} connect_path_t;
+
+// 経路ごとの、起動(または切断)から最初のメディアパケットまでの時間
+typedef struct
+{
+    uint32_t connections;
+    uint32_t last_ms;
+    uint32_t min_ms;
+    uint32_t max_ms;
+    uint64_t total_ms;
+} connect_path_stats_t;
+
+typedef struct
+{
+    connect_path_stats_t paths[CONNECT_PATH_NUM_PATHS];
+    uint32_t page_timeouts; // 直接の接続でページタイムアウトした回数の合計
+    uint32_t failures;      // 直接の接続でページタイムアウト以外の理由で失敗した回数の合計
+    uint32_t fallbacks;     // インクワイアリに切り替えた回数
+    uint32_t reconnects;    // 切断後に接続し直し始めた回数
+} connect_planner_stats_t;
+
+typedef struct
+{
+    uint8_t candidates[CONNECT_PLANNER_MAX_CANDIDATES][CONNECT_PLANNER_ADDRESS_SIZE];
+    uint8_t num_candidates;
+    uint8_t next_candidate;    // 次にページングする候補
+    uint8_t page_timeouts;     // 今の接続でページタイムアウトした数
+    uint8_t max_page_timeouts; // これだけページタイムアウトしたらインクワイアリに切り替える
+    uint8_t failures;          // 今の接続でページタイムアウト以外の理由で失敗した数
+    connect_path_t path;       // 今試している経路
+    uint32_t start_ms;         // 起動または切断の時刻
+    bool reconnect;            // 切断後の接続
+    bool waiting_first_packet; // 接続したが、まだメディアパケットを送っていない
+    connect_planner_stats_t stats;
+} connect_planner_t;
+
+void connect_planner_init(connect_planner_t *planner, uint8_t max_page_timeouts);
+// 候補を後ろに加えます。0 のアドレス、もう入っているもの、いっぱいのときは加えずに false を返します。
+bool connect_planner_add_candidate(connect_planner_t *planner, const uint8_t *address);
+
+// 起動したとき(now_ms は起動からの時刻)に呼び、最初にすることを返します。PAGE のときは address にアドレスを入れます。
+connect_planner_action_t connect_planner_start(connect_planner_t *planner, uint32_t now_ms, uint8_t *address);
+// 接続が切れたときに呼びます。時間は now_ms から測り、最後に接続したスピーカーから直接ページングし直します。
+connect_planner_action_t connect_planner_disconnected(connect_planner_t *planner, uint32_t now_ms, uint8_t *address);
+// 接続に失敗したとき(A2DP の SIGNALING_CONNECTION_ESTABLISHED の status が 0 でない)に呼び、次にすることを返します。
+// status が CONNECT_PLANNER_PAGE_TIMEOUT のときだけページタイムアウトとして数えます。
+connect_planner_action_t connect_planner_failed(connect_planner_t *planner, uint8_t status, uint8_t *address);
+// 接続したときに呼びます。address を候補の先頭に置きます(候補がいっぱいなら一番後ろを捨てます)。
+void connect_planner_connected(connect_planner_t *planner, const uint8_t *address);
+// メディアパケットを送ったときに呼びます。接続してから最初のパケットなら時間を記録して true を返します。
+bool connect_planner_first_packet(connect_planner_t *planner, uint32_t now_ms);
+
+void connect_planner_get_stats(const connect_planner_t *planner, connect_planner_stats_t *stats);
+void connect_planner_dump_stats(const connect_planner_t *planner);
+const char *connect_planner_path_name(connect_path_t path);
+
+#endif
@@ -0,0 +1,274 @@
+#include "file_prefetch.h"
+
+#include "Arduino.h"
+#include "stage_profile.h"
+
+void file_prefetch_init(file_prefetch_t *prefetch, uint8_t *buffer, uint32_t size)
+{
+    audio_ring_init(&prefetch->ring, buffer, size);
+    prefetch->refilling = false;
+    prefetch->discard_pending = 0;
+    prefetch->boundary_pending.store(false, std::memory_order_relaxed);
+    prefetch->flush_request.store(0, std::memory_order_relaxed);
+    prefetch->flush_ack.store(0, std::memory_order_relaxed);
+    prefetch->flushing = false;
+}
+
+// 予約した次のファイルに切り替え、次に commit する位置を境目にする。
+static void file_prefetch_switch_next(file_prefetch_t *prefetch, uint32_t boundary)
+{
+    prefetch->file = prefetch->next_file;
+    prefetch->next_file = File();
+    prefetch->data_offset = prefetch->next_data_offset;
+    prefetch->data_end = prefetch->next_data_end;
+    prefetch->file.seek(prefetch->data_offset, SeekSet);
+    // 読み出し側は commit を acquire で読むので、境目は次のファイルのデータより先に見える。
+    prefetch->boundary.store(boundary, std::memory_order_relaxed);
+    prefetch->boundary_pending.store(true, std::memory_order_release);
+}
+
+// ファイルから最大 FILE_PREFETCH_READ_SIZE バイトをリングに読み込む。
+// ファイルの位置がセクタの途中なら次の境界まで、境界からならセクタの倍数だけ読む。
+static int file_prefetch_refill_block(file_prefetch_t *prefetch)
+{
+    uint32_t contiguous;
+    uint8_t *dst = audio_ring_write_ptr(&prefetch->ring, &contiguous);
+    if (contiguous > FILE_PREFETCH_READ_SIZE)
+        contiguous = FILE_PREFETCH_READ_SIZE;
+
+    uint32_t start = micros();
+    uint32_t profile_start = stage_profile_now();
+    uint32_t position = prefetch->file.position();
+    uint32_t remaining = prefetch->data_end - position;
+    if (contiguous > remaining)
+        contiguous = remaining;
+    uint32_t to_boundary = FILE_PREFETCH_SECTOR_SIZE - position % FILE_PREFETCH_SECTOR_SIZE;
+    if (to_boundary < FILE_PREFETCH_SECTOR_SIZE)
+    {
+        if (contiguous > to_boundary)
+            contiguous = to_boundary;
+    }
+    else if (contiguous >= FILE_PREFETCH_SECTOR_SIZE)
+    {
+        contiguous -= contiguous % FILE_PREFETCH_SECTOR_SIZE;
+    }
+    uint32_t read_start = micros();
+    int length = prefetch->file.read(dst, contiguous);
+    if (length > 0)
+        read_stats_record(&prefetch->reads, length, micros() - read_start);
+    if (prefetch->file.position() >= prefetch->data_end)
+    {
+        if (prefetch->loop)
+        {
+            // クローズと再オープンの代わりにデータの先頭へシークする。
+            prefetch->file.seek(prefetch->data_offset, SeekSet);
+        }
+        else
+        {
+            prefetch->file.close();
+            if (prefetch->next_file)
+                file_prefetch_switch_next(prefetch, prefetch->ring.head.load(std::memory_order_relaxed) + (length > 0 ? length : 0));
+        }
+    }
+    uint32_t elapsed = micros() - start;
+    stage_profile_record(STAGE_PROFILE_REFILL, profile_start);
+
+    if (length > 0)
+        audio_ring_commit(&prefetch->ring, length);
+    prefetch->refills++;
+    if (elapsed > prefetch->worst_refill_us)
+        prefetch->worst_refill_us = elapsed;
+    return length;
+}
+
+void file_prefetch_service(file_prefetch_t *prefetch)
+{
+    const uint32_t low_watermark = prefetch->ring.size / 2;
+    const uint32_t high_watermark = prefetch->ring.size - FILE_PREFETCH_BLOCK_SIZE;
+    // シークの前に読み出し側がリングを捨てるのを待っている間は補充しない。
+    if (prefetch->flushing)
+        return;
+    uint32_t level = audio_ring_level(&prefetch->ring);
+    if (!prefetch->refilling && level <= low_watermark)
+        prefetch->refilling = true;
+    while (prefetch->refilling && prefetch->file)
+    {
+        if (audio_ring_level(&prefetch->ring) >= high_watermark)
+        {
+            prefetch->refilling = false;
+            break;
+        }
+        if (file_prefetch_refill_block(prefetch) <= 0)
+            break;
+    }
+    if (!prefetch->file)
+        prefetch->refilling = false;
+}
+
+void file_prefetch_start(file_prefetch_t *prefetch, File &file, uint32_t data_offset, uint32_t data_size, uint32_t start, bool loop)
+{
+    prefetch->file = file;
+    prefetch->data_offset = data_offset;
+    prefetch->data_end = data_offset + data_size;
+    prefetch->loop = loop;
+    prefetch->file.seek(start, SeekSet);
+
+    // 再生前にリングを満たしておく。
+    audio_ring_reset(&prefetch->ring);
+    prefetch->discard_pending = 0;
+    prefetch->boundary_pending.store(false, std::memory_order_relaxed);
+    prefetch->flush_ack.store(prefetch->flush_request.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    prefetch->flushing = false;
+    prefetch->refilling = true;
+    file_prefetch_service(prefetch);
+    file_prefetch_reset_stats(prefetch);
+}
+
+bool file_prefetch_queue(file_prefetch_t *prefetch, File &file, uint32_t data_offset, uint32_t data_size)
+{
+    if (!file_prefetch_can_queue(prefetch))
+        return false;
+    prefetch->next_file = file;
+    prefetch->next_data_offset = data_offset;
+    prefetch->next_data_end = data_offset + data_size;
+    if (!prefetch->file)
+    {
+        // 間に合わなかった。今のリングの末尾から次のファイルにする。
+        file_prefetch_switch_next(prefetch, prefetch->ring.head.load(std::memory_order_relaxed));
+        prefetch->refilling = true;
+    }
+    return true;
+}
+
+uint32_t file_prefetch_remaining(const file_prefetch_t *prefetch)
+{
+    if (!prefetch->file)
+        return 0;
+    return prefetch->data_end - prefetch->file.position();
+}
+
+bool file_prefetch_flush(file_prefetch_t *prefetch)
+{
+    uint32_t request = prefetch->flush_request.load(std::memory_order_relaxed);
+    if (!prefetch->flushing)
+    {
+        if (prefetch->next_file)
+            prefetch->next_file.close();
+        prefetch->flushing = true;
+        prefetch->refilling = false;
+        prefetch->flush_position.store(prefetch->ring.head.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        prefetch->flush_request.store(request + 1, std::memory_order_release);
+        return false;
+    }
+    if (prefetch->flush_ack.load(std::memory_order_acquire) != request)
+        return false;
+    prefetch->flushing = false;
+    return true;
+}
+
+void file_prefetch_jump(file_prefetch_t *prefetch, File &file, uint32_t data_offset, uint32_t data_size, uint32_t start, bool boundary)
+{
+    if (prefetch->file && &file != &prefetch->file)
+        prefetch->file.close();
+    if (&file != &prefetch->file)
+        prefetch->file = file;
+    prefetch->data_offset = data_offset;
+    prefetch->data_end = data_offset + data_size;
+    prefetch->file.seek(start, SeekSet);
+    if (boundary)
+    {
+        // リングは空なので、今の書き込み位置がそのまま境目になる。
+        prefetch->boundary.store(prefetch->ring.head.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        prefetch->boundary_pending.store(true, std::memory_order_release);
+    }
+    prefetch->refilling = true;
+}
+
+void file_prefetch_stop(file_prefetch_t *prefetch)
+{
+    if (prefetch->file)
+        prefetch->file.close();
+    if (prefetch->next_file)
+        prefetch->next_file.close();
+    prefetch->boundary_pending.store(false, std::memory_order_relaxed);
+    prefetch->flush_ack.store(prefetch->flush_request.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    prefetch->flushing = false;
+    prefetch->refilling = false;
+    audio_ring_reset(&prefetch->ring);
+}
+
+void file_prefetch_discard(file_prefetch_t *prefetch, uint32_t length)
+{
+    prefetch->discard_pending += length;
+    file_prefetch_available(prefetch);
+}
+
+uint32_t file_prefetch_available(file_prefetch_t *prefetch)
+{
+    uint32_t request = prefetch->flush_request.load(std::memory_order_acquire);
+    if (request != prefetch->flush_ack.load(std::memory_order_relaxed))
+    {
+        // シーク前のデータ(境目があればその先も)を捨てる。書き込み側はこの間は補充しない。
+        uint32_t position = prefetch->flush_position.load(std::memory_order_relaxed);
+        audio_ring_skip(&prefetch->ring, position - prefetch->ring.tail.load(std::memory_order_relaxed));
+        prefetch->boundary_pending.store(false, std::memory_order_relaxed);
+        prefetch->discard_pending = 0;
+        prefetch->flush_ack.store(request, std::memory_order_release);
+    }
+    if (prefetch->discard_pending > 0)
+    {
+        uint32_t until = file_prefetch_until_boundary(prefetch);
+        uint32_t length = prefetch->discard_pending < until ? prefetch->discard_pending : until;
+        prefetch->discard_pending -= audio_ring_skip(&prefetch->ring, length);
+        // 次のファイルの分は捨てずに、そこから再生する。
+        if (prefetch->discard_pending > 0 && file_prefetch_until_boundary(prefetch) == 0)
+            prefetch->discard_pending = 0;
+    }
+    return prefetch->discard_pending > 0 ? 0 : audio_ring_level(&prefetch->ring);
+}
+
+bool file_prefetch_cross_boundary(file_prefetch_t *prefetch)
+{
+    if (file_prefetch_until_boundary(prefetch) != 0)
+        return false;
+    prefetch->boundary_pending.store(false, std::memory_order_release);
+    return true;
+}
+
+uint32_t file_prefetch_read(file_prefetch_t *prefetch, uint8_t *dst, uint32_t length)
+{
+    if (file_prefetch_available(prefetch) == 0)
+        return 0;
+    length = audio_ring_read(&prefetch->ring, dst, length);
+    uint32_t level = audio_ring_level(&prefetch->ring);
+    if (level < prefetch->min_level)
+        prefetch->min_level = level;
+    return length;
+}
+
+void file_prefetch_count_underrun(file_prefetch_t *prefetch, uint32_t length)
+{
+    // ファイル末尾に達した後の無音は数えない。
+    if (prefetch->file)
+        prefetch->underrun_bytes += length;
+}
+
+void file_prefetch_get_stats(const file_prefetch_t *prefetch, file_prefetch_stats_t *stats)
+{
+    stats->level = audio_ring_level(&prefetch->ring);
+    stats->min_level = prefetch->min_level;
+    stats->capacity = prefetch->ring.size;
+    stats->refills = prefetch->refills;
+    stats->worst_refill_us = prefetch->worst_refill_us;
+    stats->underrun_bytes = prefetch->underrun_bytes;
+    stats->reads = prefetch->reads;
+}
+
+void file_prefetch_reset_stats(file_prefetch_t *prefetch)
+{
+    prefetch->min_level = audio_ring_level(&prefetch->ring);
+    prefetch->underrun_bytes = 0;
+    prefetch->refills = 0;
+    prefetch->worst_refill_us = 0;
+    read_stats_reset(&prefetch->reads);
+}
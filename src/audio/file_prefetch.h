@@ -0,0 +1,149 @@
+#ifndef AUDIO_FILE_PREFETCH_H
+#define AUDIO_FILE_PREFETCH_H
+
+#include <stdint.h>
+#include <FS.h>
+#include "audio_ring.h"
+#include "read_stats.h"
+
+// ファイルの一部(WAVの data チャンク、.sbc のフレーム列)を先読みリングに読み込みます。
+// wav_source と sbc_source が使います。
+//
+// file_prefetch_service() を loop() などから呼んでリングを補充し、
+// オーディオのタイマーコールバックからは file_prefetch_read() でリングから取り出すだけにします。
+// これでフラッシュやSPIの読み込み待ちが 10ms のオーディオ周期に入らなくなります。
+//
+// 次のファイルを file_prefetch_queue() で予約しておくと、今のファイルの末尾に達したときに
+// 同じ補充の中で次のファイルに切り替え、リングに続けて読み込みます(曲間の無いプレイリスト)。
+// 切り替えた位置はリングの書き込み位置(境目)として残し、読み出し側は境目をまたがずに取り出して
+// file_prefetch_cross_boundary() で次のファイルに進みます。境目は同時に1つまでです。
+//
+// シークはリングを空にして詰め直さずに行います。書き込み側が file_prefetch_flush() で補充を止めて今の書き込み位置を
+// 知らせ、読み出し側が次に取り出すときにそこまでを捨てて(audio_ring_skip() なのでデータの量によらない)応答します。
+// その後で書き込み側が file_prefetch_jump() で新しい位置から読み込みます。読み出し側は止めません。
+//
+// 補充の1回の読み込みは、ファイルの位置を FILE_PREFETCH_SECTOR_SIZE の境界にそろえ、最大 FILE_PREFETCH_READ_SIZE バイトにします。
+// SdFat はセクタ境界から始まるセクタ単位の読み込みをキャッシュを通さずに読み込み先へ直接マルチブロック読み込み(CMD18)するので、
+// 境界をまたぐ半端な読み込みで同じセクタを2回読むことがなくなります。1回ごとの時間とバイト数は read_stats に記録します。
+
+#define FILE_PREFETCH_BLOCK_SIZE 1024
+#define FILE_PREFETCH_SECTOR_SIZE 512
+#define FILE_PREFETCH_READ_SIZE 4096
+
+typedef struct
+{
+    uint32_t level;           // 現在リングに入っているバイト数
+    uint32_t min_level;       // 再生開始後の最小のバイト数
+    uint32_t capacity;        // リングの大きさ
+    uint32_t refills;         // ファイルの読み込み回数
+    uint32_t worst_refill_us; // 1回の読み込み(シーク、ループ時の巻き戻しを含む)にかかった最大時間
+    uint32_t underrun_bytes;  // リングが空で無音を返したバイト数
+    read_stats_t reads;       // ファイルの読み込み1回ごとの時間とバイト数
+} file_prefetch_stats_t;
+
+typedef struct
+{
+    File file;
+    uint32_t data_offset; // 読み込む範囲の先頭
+    uint32_t data_end;    // 読み込む範囲の終わり。この後ろにチャンクなどがあっても読まない。
+    bool loop;
+    bool refilling;
+    audio_ring_t ring;
+
+    uint32_t discard_pending; // 読み出し側が捨てる残りのバイト数(まだリングに届いていない分)
+
+    // 予約した次のファイル。書き込み側だけが触る。
+    File next_file;
+    uint32_t next_data_offset;
+    uint32_t next_data_end;
+    // 次のファイルの先頭のリングの書き込み位置。boundary_pending が true の間だけ有効。
+    // 書き込み側が次のファイルのデータを commit する前に書き、読み出し側が境目をまたいだら false にする。
+    std::atomic<uint32_t> boundary;
+    std::atomic<bool> boundary_pending;
+
+    // シークの前に捨てる範囲。書き込み側が flush_position を書いて flush_request を進め、
+    // 読み出し側がそこまで捨てたら flush_ack を flush_request にそろえる。
+    std::atomic<uint32_t> flush_position;
+    std::atomic<uint32_t> flush_request;
+    std::atomic<uint32_t> flush_ack;
+    bool flushing; // 書き込み側が応答を待っている
+
+    // 統計。min_level と underrun_bytes は読み出し側、それ以外は書き込み側が更新する。
+    volatile uint32_t min_level;
+    volatile uint32_t underrun_bytes;
+    volatile uint32_t refills;
+    volatile uint32_t worst_refill_us;
+    read_stats_t reads;
+} file_prefetch_t;
+
+// buffer の大きさは2のべき乗で、FILE_PREFETCH_BLOCK_SIZE の倍数にします。
+void file_prefetch_init(file_prefetch_t *prefetch, uint8_t *buffer, uint32_t size);
+// file の [data_offset, data_offset + data_size) を start から読み始め、リングを満たします。
+// loop が true の場合、末尾に達したら data_offset に戻って繰り返します。
+// 読み出し側が止まっているときだけ呼べます。
+void file_prefetch_start(file_prefetch_t *prefetch, File &file, uint32_t data_offset, uint32_t data_size, uint32_t start, bool loop);
+void file_prefetch_stop(file_prefetch_t *prefetch);
+
+// 今のファイルの末尾の後に続けて読むファイルを予約します。書き込み側から呼びます。
+// 予約済み、または読み出し側がまだ前の境目をまたいでいない場合は false を返します。
+// 今のファイルがすでに末尾に達して閉じている場合は、すぐに切り替えます(その間の無音は読み出し側で数えます)。
+bool file_prefetch_queue(file_prefetch_t *prefetch, File &file, uint32_t data_offset, uint32_t data_size);
+static inline bool file_prefetch_can_queue(const file_prefetch_t *prefetch)
+{
+    return !prefetch->flushing && !prefetch->next_file && !prefetch->boundary_pending.load(std::memory_order_acquire);
+}
+// 今のファイルのまだリングに読み込んでいないバイト数(閉じていれば 0)。書き込み側から呼びます。
+uint32_t file_prefetch_remaining(const file_prefetch_t *prefetch);
+
+// シークの準備。予約した次のファイルを閉じて補充を止め、リングにあるデータを読み出し側に捨てさせます。
+// 読み出し側が捨て終わっていれば true を返します。false の間は次の補充のときにまた呼びます。書き込み側から呼びます。
+bool file_prefetch_flush(file_prefetch_t *prefetch);
+// file_prefetch_flush() が true を返した後に、file の [data_offset, data_offset + data_size) を start から読み始めます。
+// file が今のファイルと違えば今のファイルを閉じます。boundary が true なら境目を置き、読み出し側は
+// file_prefetch_cross_boundary() で新しいファイル(フォーマット)に進みます。リングの補充は次の file_prefetch_service() で行います。
+void file_prefetch_jump(file_prefetch_t *prefetch, File &file, uint32_t data_offset, uint32_t data_size, uint32_t start, bool boundary);
+// 読み出し側が捨てた回数。読み出し側で前回の値と比べると、シークの後の最初のデータが分かります。
+static inline uint32_t file_prefetch_flushes(const file_prefetch_t *prefetch)
+{
+    return prefetch->flush_ack.load(std::memory_order_relaxed);
+}
+
+// リングが半分以下になっていれば、1ブロックを残して満杯になるまでファイルから補充します。
+// タイマーコールバックの外(loop() など)から呼びます。
+void file_prefetch_service(file_prefetch_t *prefetch);
+
+static inline uint32_t file_prefetch_level(const file_prefetch_t *prefetch)
+{
+    return audio_ring_level(&prefetch->ring);
+}
+
+// ファイルがまだ開いている(末尾に達していない)か
+static inline bool file_prefetch_active(const file_prefetch_t *prefetch)
+{
+    return (bool)prefetch->file;
+}
+
+// 次のファイルとの境目までに取り出せるバイト数。境目が無ければ UINT32_MAX。読み出し側から呼びます。
+static inline uint32_t file_prefetch_until_boundary(const file_prefetch_t *prefetch)
+{
+    if (!prefetch->boundary_pending.load(std::memory_order_acquire))
+        return UINT32_MAX;
+    return prefetch->boundary.load(std::memory_order_relaxed) - prefetch->ring.tail.load(std::memory_order_relaxed);
+}
+// 境目まで取り出し終わっていれば境目を消して true を返します。ここから次のファイルのデータです。
+bool file_prefetch_cross_boundary(file_prefetch_t *prefetch);
+
+// length バイトを読まずに捨てます。境目の先は捨てません。リングにない分は、補充されたときに読み出し側で捨てます。読み出し側から呼びます。
+void file_prefetch_discard(file_prefetch_t *prefetch, uint32_t length);
+// 捨てる分を除いて、すぐに取り出せるバイト数。読み出し側から呼びます。
+uint32_t file_prefetch_available(file_prefetch_t *prefetch);
+
+// 最大 length バイトをリングから取り出し、取り出したバイト数を返します。
+uint32_t file_prefetch_read(file_prefetch_t *prefetch, uint8_t *dst, uint32_t length);
+// 足りなかったバイト数を統計に加えます。
+void file_prefetch_count_underrun(file_prefetch_t *prefetch, uint32_t length);
+
+void file_prefetch_get_stats(const file_prefetch_t *prefetch, file_prefetch_stats_t *stats);
+void file_prefetch_reset_stats(file_prefetch_t *prefetch);
+
+#endif
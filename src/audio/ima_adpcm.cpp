@@ -0,0 +1,97 @@
+#include "ima_adpcm.h"
+
+#include "Arduino.h"
+
+static const int16_t ima_adpcm_step[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45, 50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+    130, 143, 157, 173, 190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963, 1060,
+    1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484,
+    7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767};
+
+static const int8_t ima_adpcm_index_adjust[8] = {-1, -1, -1, -1, 2, 4, 6, 8};
+
+// [ステップの番号][ニブルの下位3ビット] の差分と次のステップの番号
+static uint16_t ima_adpcm_diff[89][8];
+static uint8_t ima_adpcm_next[89][8];
+static bool ima_adpcm_ready;
+
+static void ima_adpcm_init_tables(void)
+{
+    for (int index = 0; index < 89; index++)
+    {
+        int step = ima_adpcm_step[index];
+        for (int code = 0; code < 8; code++)
+        {
+            // 仕様どおり step/8 + (bit2 ? step) + (bit1 ? step/2) + (bit0 ? step/4) をシフトで切り捨てて足す。
+            int diff = step >> 3;
+            if (code & 4)
+                diff += step;
+            if (code & 2)
+                diff += step >> 1;
+            if (code & 1)
+                diff += step >> 2;
+            ima_adpcm_diff[index][code] = (uint16_t)diff;
+            int next = index + ima_adpcm_index_adjust[code];
+            ima_adpcm_next[index][code] = (uint8_t)(next < 0 ? 0 : next > 88 ? 88 : next);
+        }
+    }
+    ima_adpcm_ready = true;
+}
+
+uint32_t ima_adpcm_samples_per_block(uint32_t block_align, int num_channels)
+{
+    uint32_t header = 4 * num_channels;
+    if (num_channels < 1 || num_channels > IMA_ADPCM_MAX_CHANNELS || block_align <= header || (block_align - header) % header != 0)
+        return 0;
+    return 1 + (block_align - header) * 2 / num_channels;
+}
+
+// 1チャンネルの groups x 4 バイト(8 x groups サンプル)をデコードする。
+// data は4バイトごとに stride バイト進み(ステレオは他方のチャンネルを飛ばす)、pcm は channels 個おきに書く。
+static void __not_in_flash_func(ima_adpcm_decode_channel)(const uint8_t *data, uint32_t groups, uint32_t stride, int channels,
+                                                         int32_t predictor, uint32_t index, int16_t *pcm)
+{
+#define IMA_ADPCM_SAMPLE(nibble)                                    \
+    {                                                               \
+        uint32_t code = (nibble) & 7;                               \
+        int32_t diff = ima_adpcm_diff[index][code];                 \
+        predictor += ((nibble) & 8) ? -diff : diff;                 \
+        if ((uint32_t)(predictor + 32768) > 65535)                  \
+            predictor = predictor < 0 ? -32768 : 32767;             \
+        index = ima_adpcm_next[index][code];                        \
+        *pcm = (int16_t)predictor;                                  \
+        pcm += channels;                                            \
+    }
+    for (uint32_t group = 0; group < groups; group++)
+    {
+        // 4バイト(8サンプル)ずつ。32bit で1回に読む。
+        uint32_t word = data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+        for (int i = 0; i < 8; i++)
+        {
+            IMA_ADPCM_SAMPLE(word);
+            word >>= 4;
+        }
+        data += stride;
+    }
+#undef IMA_ADPCM_SAMPLE
+}
+
+uint32_t __not_in_flash_func(ima_adpcm_decode_block)(const uint8_t *block, uint32_t block_align, int num_channels, int16_t *pcm)
+{
+    uint32_t samples = ima_adpcm_samples_per_block(block_align, num_channels);
+    if (samples == 0)
+        return 0;
+    if (!ima_adpcm_ready)
+        ima_adpcm_init_tables();
+    uint32_t groups = (samples - 1) / 8;
+    for (int channel = 0; channel < num_channels; channel++)
+    {
+        const uint8_t *header = block + 4 * channel;
+        int32_t predictor = (int16_t)(header[0] | (header[1] << 8));
+        uint32_t index = header[2] > 88 ? 88 : header[2];
+        pcm[channel] = (int16_t)predictor;
+        ima_adpcm_decode_channel(block + 4 * num_channels + 4 * channel, groups, 4 * num_channels, num_channels,
+                                 predictor, index, pcm + num_channels + channel);
+    }
+    return samples;
+}
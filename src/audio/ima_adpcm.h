@@ -0,0 +1,23 @@
+#ifndef AUDIO_IMA_ADPCM_H
+#define AUDIO_IMA_ADPCM_H
+
+#include <stdint.h>
+
+// WAV の IMA-ADPCM(フォーマットタグ 0x0011)の1ブロックを16bit PCM にデコードします。
+// ブロックはチャンネルごとの4バイトのヘッダ(最初のサンプル int16、ステップの番号 uint8、予約 uint8)と、
+// 4bit のサンプル(下位ニブルが先)が続きます。ステレオは L 4バイト(8サンプル)、R 4バイトの順に交互に並びます。
+// 1ブロックのサンプル数は 1 + (block_align - 4 x チャンネル数) x 2 / チャンネル数 です。
+//
+// 差分はステップの番号(89通り)とニブルの下位3ビットの表を最初に作って引き、
+// 1サンプルを表引き2回、加減算とクランプだけでデコードします。表は RAM に置きます(実機ではフラッシュから読まない)。
+
+#define IMA_ADPCM_MAX_CHANNELS 2
+
+// 1ブロックのサンプル数(1チャンネル分)。ブロックの大きさがチャンネル数に合わなければ 0 を返します。
+uint32_t ima_adpcm_samples_per_block(uint32_t block_align, int num_channels);
+
+// block_align バイトの1ブロックをデコードし、チャンネルをインターリーブした16bit PCM を pcm に書きます。
+// 書いたサンプル数(1チャンネル分)を返します。
+uint32_t ima_adpcm_decode_block(const uint8_t *block, uint32_t block_align, int num_channels, int16_t *pcm);
+
+#endif
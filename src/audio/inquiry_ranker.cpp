@@ -0,0 +1,200 @@
+#include "inquiry_ranker.h"
+
+#include <Arduino.h>
+#include <stdio.h>
+#include <string.h>
+
+// Class of Device (Assigned Numbers 2.8): メジャークラスは bit 12..8、マイナークラスは bit 7..2
+#define INQUIRY_RANKER_MAJOR_AUDIO_VIDEO 0x04
+
+bool inquiry_ranker_is_audio_sink(uint32_t class_of_device)
+{
+    if (((class_of_device >> 8) & 0x1f) != INQUIRY_RANKER_MAJOR_AUDIO_VIDEO)
+        return false;
+    switch ((class_of_device >> 2) & 0x3f)
+    {
+    case 0x01: // Wearable Headset Device
+    case 0x02: // Hands-free Device
+    case 0x05: // Loudspeaker
+    case 0x06: // Headphones
+    case 0x07: // Portable Audio
+    case 0x08: // Car audio
+    case 0x0a: // HiFi Audio Device
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool inquiry_ranker_is_speaker(uint32_t class_of_device)
+{
+    if (!inquiry_ranker_is_audio_sink(class_of_device))
+        return false;
+    switch ((class_of_device >> 2) & 0x3f)
+    {
+    case 0x05:
+    case 0x07:
+    case 0x08:
+    case 0x0a:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool inquiry_ranker_is_allowlisted(const inquiry_ranker_t *ranker, const uint8_t *address, const char *name)
+{
+    char address_string[18];
+    snprintf(address_string, sizeof(address_string), "%02X:%02X:%02X:%02X:%02X:%02X", address[0], address[1], address[2],
+             address[3], address[4], address[5]);
+    for (int i = 0; i < ranker->allowlist_size; i++)
+    {
+        const char *entry = ranker->allowlist[i];
+        if (strcasecmp(entry, address_string) == 0)
+            return true;
+        if (name[0] != 0 && strncmp(name, entry, strlen(entry)) == 0)
+            return true;
+    }
+    return false;
+}
+
+static int16_t inquiry_ranker_score(const inquiry_ranker_device_t *device)
+{
+    int score = device->rssi;
+    if (device->name[0] != 0)
+        score += INQUIRY_RANKER_NAME_BONUS;
+    if (inquiry_ranker_is_speaker(device->class_of_device))
+        score += INQUIRY_RANKER_SPEAKER_BONUS;
+    if (device->allowlisted)
+        score += INQUIRY_RANKER_ALLOWLIST_SCORE;
+    return (int16_t)score;
+}
+
+void inquiry_ranker_init(inquiry_ranker_t *ranker, const char *const *allowlist, int allowlist_size)
+{
+    memset(ranker, 0, sizeof(*ranker));
+    ranker->allowlist = allowlist;
+    ranker->allowlist_size = allowlist_size;
+}
+
+void inquiry_ranker_reset(inquiry_ranker_t *ranker)
+{
+    // 試して結果の来ないまま窓を閉じたものは無駄な試行
+    if (ranker->attempting)
+        ranker->stats.wasted++;
+    ranker->attempting = false;
+    ranker->num_devices = 0;
+}
+
+int inquiry_ranker_add(inquiry_ranker_t *ranker, const uint8_t *address, uint32_t class_of_device, int rssi, const char *name,
+                       int name_len)
+{
+    ranker->stats.results++;
+    inquiry_ranker_device_t candidate = {};
+    memcpy(candidate.address, address, 6);
+    candidate.class_of_device = class_of_device;
+    candidate.rssi = (int8_t)rssi;
+    if (name != NULL && name_len > 0)
+    {
+        int length = name_len < INQUIRY_RANKER_NAME_SIZE - 1 ? name_len : INQUIRY_RANKER_NAME_SIZE - 1;
+        memcpy(candidate.name, name, length);
+        candidate.name[length] = 0;
+    }
+
+    inquiry_ranker_device_t *device = NULL;
+    for (int i = 0; i < ranker->num_devices; i++)
+    {
+        if (memcmp(ranker->devices[i].address, address, 6) == 0)
+            device = &ranker->devices[i];
+    }
+    if (device != NULL)
+    {
+        // 同じデバイス: 強い方の RSSI と、来ていれば名前を使う
+        if (candidate.rssi > device->rssi)
+            device->rssi = candidate.rssi;
+        if (candidate.name[0] != 0)
+            memcpy(device->name, candidate.name, sizeof(device->name));
+        device->allowlisted = device->allowlisted || inquiry_ranker_is_allowlisted(ranker, address, device->name);
+        device->score = inquiry_ranker_score(device);
+        return device->score;
+    }
+
+    candidate.allowlisted = inquiry_ranker_is_allowlisted(ranker, address, candidate.name);
+    if (!candidate.allowlisted && !inquiry_ranker_is_audio_sink(class_of_device))
+    {
+        ranker->stats.ignored++;
+        return -1;
+    }
+    candidate.score = inquiry_ranker_score(&candidate);
+    if (ranker->num_devices < INQUIRY_RANKER_MAX_DEVICES)
+    {
+        device = &ranker->devices[ranker->num_devices++];
+    }
+    else
+    {
+        // いっぱいなら、まだ試していない中で一番低いものより高ければ入れ替える
+        for (int i = 0; i < ranker->num_devices; i++)
+        {
+            if (!ranker->devices[i].tried && (device == NULL || ranker->devices[i].score < device->score))
+                device = &ranker->devices[i];
+        }
+        if (device == NULL || device->score >= candidate.score)
+            return candidate.score;
+    }
+    *device = candidate;
+    return candidate.score;
+}
+
+bool inquiry_ranker_next(inquiry_ranker_t *ranker, uint8_t *address, const inquiry_ranker_device_t **device)
+{
+    if (ranker->attempting)
+        ranker->stats.wasted++;
+    ranker->attempting = false;
+    inquiry_ranker_device_t *best = NULL;
+    for (int i = 0; i < ranker->num_devices; i++)
+    {
+        inquiry_ranker_device_t *candidate = &ranker->devices[i];
+        if (!candidate->tried && (best == NULL || candidate->score > best->score))
+            best = candidate;
+    }
+    if (best == NULL)
+        return false;
+    best->tried = true;
+    ranker->attempting = true;
+    ranker->stats.attempts++;
+    memcpy(address, best->address, 6);
+    if (device != NULL)
+        *device = best;
+    return true;
+}
+
+void inquiry_ranker_connected(inquiry_ranker_t *ranker)
+{
+    if (ranker->attempting)
+        ranker->stats.connects++;
+    ranker->attempting = false;
+    ranker->num_devices = 0;
+}
+
+bool inquiry_ranker_has_allowlisted(const inquiry_ranker_t *ranker)
+{
+    for (int i = 0; i < ranker->num_devices; i++)
+    {
+        if (ranker->devices[i].allowlisted && !ranker->devices[i].tried)
+            return true;
+    }
+    return false;
+}
+
+void inquiry_ranker_get_stats(const inquiry_ranker_t *ranker, inquiry_ranker_stats_t *stats)
+{
+    *stats = ranker->stats;
+}
+
+void inquiry_ranker_dump_stats(const inquiry_ranker_t *ranker)
+{
+    const inquiry_ranker_stats_t *stats = &ranker->stats;
+    Serial.printf("inquiry: %u results, %u ignored by class, attempts %u, connected %u, wasted %u (%u%%)\n\r",
+                  (unsigned)stats->results, (unsigned)stats->ignored, (unsigned)stats->attempts, (unsigned)stats->connects,
+                  (unsigned)stats->wasted, stats->attempts ? (unsigned)(stats->wasted * 100 / stats->attempts) : 0u);
+}
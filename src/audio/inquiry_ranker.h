@@ -0,0 +1,78 @@
+#ifndef AUDIO_INQUIRY_RANKER_H
+#define AUDIO_INQUIRY_RANKER_H
+
+#include <stdint.h>
+
+// インクワイアリで見つかったデバイスを、最初に見つかったものではなく、スピーカーらしさと電波の強さで選びます(BTstack には触りません)。
+//
+// インクワイアリの間(収集の窓)に GAP_EVENT_INQUIRY_RESULT を inquiry_ranker_add() に渡し、終わったら
+// inquiry_ranker_next() で点数の高い順に接続を試します。
+//  - Class of Device のメジャークラスが Audio/Video で、マイナークラスが音を出すもの(ヘッドセット、ハンズフリー、
+//    スピーカー、ヘッドホン、ポータブルオーディオ、カーオーディオ、HiFi)だけを候補にします。スマートフォンや PC は入れません。
+//  - 許可リスト(アドレス "XX:XX:XX:XX:XX:XX" か、EIR の名前の先頭)に合うものは、クラスにかかわらず候補にして一番先に試します。
+//  - 点数は RSSI(dBm)。EIR の名前が来たものは INQUIRY_RANKER_NAME_BONUS を足します(名前を返すものは応答の良い機器が多い)。
+//    スピーカー(ラウドスピーカー、ポータブルオーディオ、カーオーディオ、HiFi)は INQUIRY_RANKER_SPEAKER_BONUS を足し、
+//    近くの人のスマートフォンにつながっていることの多いヘッドセット・ヘッドホンより先に試します。
+// 同じアドレスの結果が何度も来たら、RSSI は強い方を使い、名前は来たときに覚えます。
+
+#define INQUIRY_RANKER_MAX_DEVICES 8
+#define INQUIRY_RANKER_NAME_SIZE 32
+#define INQUIRY_RANKER_ALLOWLIST_SCORE 1000
+#define INQUIRY_RANKER_NAME_BONUS 6
+#define INQUIRY_RANKER_SPEAKER_BONUS 10
+// RSSI が無い結果の RSSI(dBm)
+#define INQUIRY_RANKER_UNKNOWN_RSSI -90
+
+typedef struct
+{
+    uint8_t address[6];
+    uint32_t class_of_device;
+    int8_t rssi;
+    bool allowlisted;
+    bool tried;
+    char name[INQUIRY_RANKER_NAME_SIZE];
+    int16_t score;
+} inquiry_ranker_device_t;
+
+typedef struct
+{
+    uint32_t results;  // 受け取ったインクワイアリの結果(同じデバイスの重複を含む)
+    uint32_t ignored;  // クラスで外したデバイスの結果
+    uint32_t attempts; // inquiry_ranker_next() で接続を試した回数
+    uint32_t wasted;   // そのうち接続できなかった回数(inquiry_ranker_connected() の前に次を試したか、窓を閉じた)
+    uint32_t connects;
+} inquiry_ranker_stats_t;
+
+typedef struct
+{
+    inquiry_ranker_device_t devices[INQUIRY_RANKER_MAX_DEVICES];
+    uint8_t num_devices;
+    bool attempting; // inquiry_ranker_next() で返したデバイスの結果をまだ聞いていない
+    const char *const *allowlist;
+    int allowlist_size;
+    inquiry_ranker_stats_t stats;
+} inquiry_ranker_t;
+
+void inquiry_ranker_init(inquiry_ranker_t *ranker, const char *const *allowlist, int allowlist_size);
+// 新しいインクワイアリを始めるときに、集めたデバイスを捨てます(統計は残します)。
+void inquiry_ranker_reset(inquiry_ranker_t *ranker);
+// rssi は無ければ INQUIRY_RANKER_UNKNOWN_RSSI、name は無ければ NULL。候補にしたらその点数を、外したら -1 を返します。
+// 候補がいっぱいのときは一番点数の低いものと比べて入れ替えます。
+int inquiry_ranker_add(inquiry_ranker_t *ranker, const uint8_t *address, uint32_t class_of_device, int rssi, const char *name,
+                       int name_len);
+// まだ試していない候補で一番点数の高いものを address に入れて true を返します。無ければ false。
+// 前に返したデバイスに接続できていなければ、無駄な試行として数えます。
+bool inquiry_ranker_next(inquiry_ranker_t *ranker, uint8_t *address, const inquiry_ranker_device_t **device);
+// inquiry_ranker_next() で返したデバイスに接続できたときに呼びます。候補を捨てます。
+void inquiry_ranker_connected(inquiry_ranker_t *ranker);
+// 許可リストに合う候補があるか(あれば窓を閉じてすぐに試せます)
+bool inquiry_ranker_has_allowlisted(const inquiry_ranker_t *ranker);
+// Class of Device が音を出す Audio/Video 機器か
+bool inquiry_ranker_is_audio_sink(uint32_t class_of_device);
+// そのうち、身に着けるものでないスピーカーか
+bool inquiry_ranker_is_speaker(uint32_t class_of_device);
+
+void inquiry_ranker_get_stats(const inquiry_ranker_t *ranker, inquiry_ranker_stats_t *stats);
+void inquiry_ranker_dump_stats(const inquiry_ranker_t *ranker);
+
+#endif
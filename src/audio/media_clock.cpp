@@ -0,0 +1,77 @@
+#include "media_clock.h"
+
+#include <string.h>
+
+const uint32_t media_clock_jitter_limits_us[MEDIA_CLOCK_JITTER_BUCKETS - 1] = {50, 100, 250, 500, 1000, 2000, 5000};
+
+void media_clock_start(media_clock_t *clock, uint32_t sample_rate, uint32_t tick_us, uint64_t now_us)
+{
+    memset(clock, 0, sizeof(*clock));
+    clock->sample_rate = sample_rate;
+    clock->tick_us = tick_us;
+    clock->start_us = now_us;
+    clock->next_tick_us = now_us + tick_us;
+    clock->deadline_us = clock->next_tick_us;
+}
+
+static void media_clock_record_jitter(media_clock_t *clock, uint64_t now_us)
+{
+    // 期限の ms を切り上げてタイマーを設定するので、早く発火することはない。念のため 0 に丸める。
+    uint32_t jitter_us = now_us > clock->deadline_us ? (uint32_t)(now_us - clock->deadline_us) : 0;
+    int bucket = 0;
+    while (bucket < MEDIA_CLOCK_JITTER_BUCKETS - 1 && jitter_us >= media_clock_jitter_limits_us[bucket])
+        bucket++;
+    clock->histogram[bucket]++;
+    clock->ticks++;
+    clock->total_jitter_us += jitter_us;
+    if (jitter_us > clock->max_jitter_us)
+        clock->max_jitter_us = jitter_us;
+}
+
+uint32_t media_clock_advance(media_clock_t *clock, uint64_t now_us)
+{
+    media_clock_record_jitter(clock, now_us);
+    uint64_t samples_due = (now_us - clock->start_us) * clock->sample_rate / 1000000;
+    uint32_t samples = (uint32_t)(samples_due - clock->samples_due);
+    clock->samples_due = samples_due;
+    return samples;
+}
+
+uint64_t media_clock_sample_time_us(const media_clock_t *clock, uint64_t sample)
+{
+    // サンプルの時刻が来た後に発火するように切り上げる。
+    return clock->start_us + (sample * 1000000 + clock->sample_rate - 1) / clock->sample_rate;
+}
+
+uint32_t media_clock_schedule(media_clock_t *clock, uint64_t now_us, uint64_t until_sample)
+{
+    // 周期の期限は開始時刻からの絶対値で進める。遅れて過ぎてしまった期限は飛ばす。
+    while (clock->next_tick_us <= now_us)
+        clock->next_tick_us += clock->tick_us;
+    uint64_t deadline_us = clock->next_tick_us;
+    if (until_sample > clock->samples_due)
+    {
+        uint64_t sample_us = media_clock_sample_time_us(clock, until_sample);
+        if (sample_us < deadline_us)
+            deadline_us = sample_us;
+    }
+    clock->deadline_us = deadline_us;
+    // ms のタイマーは現在の ms(切り捨て)からの相対なので、期限を切り上げた ms との差にする。
+    return (uint32_t)((deadline_us + 999) / 1000 - now_us / 1000);
+}
+
+void media_clock_get_stats(const media_clock_t *clock, media_clock_stats_t *stats)
+{
+    stats->ticks = clock->ticks;
+    stats->max_jitter_us = clock->max_jitter_us;
+    stats->mean_jitter_us = clock->ticks ? (uint32_t)(clock->total_jitter_us / clock->ticks) : 0;
+    memcpy(stats->histogram, clock->histogram, sizeof(stats->histogram));
+}
+
+void media_clock_reset_stats(media_clock_t *clock)
+{
+    clock->ticks = 0;
+    clock->max_jitter_us = 0;
+    clock->total_jitter_us = 0;
+    memset(clock->histogram, 0, sizeof(clock->histogram));
+}
@@ -0,0 +1,58 @@
+#ifndef AUDIO_MEDIA_CLOCK_H
+#define AUDIO_MEDIA_CLOCK_H
+
+#include <stdint.h>
+
+// マイクロ秒の時計から、送るべきサンプル数とタイマーの期限を決めるメディアクロックです。
+// ストリーミング開始時の時刻をサンプル 0 の時刻とし、時刻 t までに送るべきサンプル数を
+//   (t - start) * sample_rate / 1000000
+// と開始時からの絶対値で数えます。前回との差を足していくのではないので、タイマーが遅れたり
+// ミリ秒に丸めたりしても誤差はたまらず、RTPタイムスタンプは実時間からずれません。
+//
+// タイマーの期限も開始時刻 + k * tick_us の絶対値で決め、組み立て中のパケットが揃う時刻(最後のサンプルの時刻)の方が
+// 早ければそちらにします。期限に対してタイマーが実際に発火した時刻の遅れ(ジッタ)を分布として記録します。
+
+#define MEDIA_CLOCK_JITTER_BUCKETS 8
+
+// ジッタの分布の各バケットの上限(us)。最後のバケットはそれ以上
+extern const uint32_t media_clock_jitter_limits_us[MEDIA_CLOCK_JITTER_BUCKETS - 1];
+
+typedef struct
+{
+    uint32_t ticks;                                  // タイマーの発火回数
+    uint32_t max_jitter_us;                          // 期限からの遅れの最大値
+    uint32_t mean_jitter_us;                         // 期限からの遅れの平均
+    uint32_t histogram[MEDIA_CLOCK_JITTER_BUCKETS];  // 遅れの分布
+} media_clock_stats_t;
+
+typedef struct
+{
+    uint32_t sample_rate;
+    uint32_t tick_us;       // タイマーの周期
+    uint64_t start_us;      // サンプル 0 の時刻
+    uint64_t samples_due;   // 最後に数えた、時刻が来たサンプル数
+    uint64_t next_tick_us;  // 次の周期の期限
+    uint64_t deadline_us;   // 次にタイマーが発火するはずの時刻
+    uint32_t ticks;
+    uint32_t max_jitter_us;
+    uint64_t total_jitter_us;
+    uint32_t histogram[MEDIA_CLOCK_JITTER_BUCKETS];
+} media_clock_t;
+
+// now_us をサンプル 0 の時刻として数え始めます。
+void media_clock_start(media_clock_t *clock, uint32_t sample_rate, uint32_t tick_us, uint64_t now_us);
+
+// タイマーが発火したときに呼び、期限からの遅れを記録して、前回から時刻が来たサンプル数を返します。
+uint32_t media_clock_advance(media_clock_t *clock, uint64_t now_us);
+
+// sample 番目(0 始まり)のサンプルの時刻
+uint64_t media_clock_sample_time_us(const media_clock_t *clock, uint64_t sample);
+
+// 次の期限を決め、タイマーに設定する ms(切り上げ)を返します。
+// until_sample が samples_due より先なら、そのサンプルの時刻と次の周期の期限の早い方にします。
+uint32_t media_clock_schedule(media_clock_t *clock, uint64_t now_us, uint64_t until_sample);
+
+void media_clock_get_stats(const media_clock_t *clock, media_clock_stats_t *stats);
+void media_clock_reset_stats(media_clock_t *clock);
+
+#endif
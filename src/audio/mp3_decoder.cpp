@@ -0,0 +1,136 @@
+#include "mp3_decoder.h"
+
+#include "Arduino.h"
+#include "libhelix-mp3/mp3dec.h"
+#include "mp3_frame.h"
+#include "stage_profile.h"
+
+static HMP3Decoder mp3_decoder;
+static uint32_t mp3_decoder_heap;
+static uint32_t mp3_decoder_frame_count;
+static uint32_t mp3_decoder_error_count;
+
+// ヒープの空きの差から、デコーダが確保した大きさを測る。
+static HMP3Decoder mp3_decoder_allocate(uint32_t *heap_bytes)
+{
+    uint32_t before = rp2040.getFreeHeap();
+    HMP3Decoder decoder = MP3InitDecoder();
+    *heap_bytes = before - rp2040.getFreeHeap();
+    return decoder;
+}
+
+bool mp3_decoder_begin(void)
+{
+    if (mp3_decoder == NULL)
+        mp3_decoder = mp3_decoder_allocate(&mp3_decoder_heap);
+    return mp3_decoder != NULL;
+}
+
+uint32_t mp3_decoder_heap_bytes(void)
+{
+    return mp3_decoder_heap;
+}
+
+static uint32_t mp3_decoder_run(HMP3Decoder decoder, const uint8_t *frame, uint32_t length, int16_t *pcm)
+{
+    unsigned char *input = (unsigned char *)frame;
+    int bytes_left = (int)length;
+    if (MP3Decode(decoder, &input, &bytes_left, pcm, 0) != ERR_MP3_NONE)
+        return 0;
+    MP3FrameInfo info;
+    MP3GetLastFrameInfo(decoder, &info);
+    return info.nChans > 0 ? (uint32_t)(info.outputSamps / info.nChans) : 0;
+}
+
+uint32_t __not_in_flash_func(mp3_decoder_decode)(const uint8_t *frame, uint32_t length, int16_t *pcm)
+{
+    uint32_t samples = mp3_decoder != NULL ? mp3_decoder_run(mp3_decoder, frame, length, pcm) : 0;
+    if (samples == 0)
+        mp3_decoder_error_count++;
+    else
+        mp3_decoder_frame_count++;
+    return samples;
+}
+
+uint32_t mp3_decoder_frames(void)
+{
+    return mp3_decoder_frame_count;
+}
+
+uint32_t mp3_decoder_errors(void)
+{
+    return mp3_decoder_error_count;
+}
+
+int mp3_decoder_benchmark(fs::FS &fs, const char *path, uint32_t max_frames)
+{
+    File file = fs.open(path, "r");
+    mp3_frame_stream_t stream;
+    if (!file || !mp3_frame_parse_file(file, &stream))
+    {
+        Serial.printf("%s: no MP3 frames\n\r", path);
+        if (file)
+            file.close();
+        return -1;
+    }
+    uint32_t heap_bytes;
+    HMP3Decoder decoder = mp3_decoder_allocate(&heap_bytes);
+    if (decoder == NULL)
+    {
+        Serial.println("MP3 decoder: out of memory");
+        file.close();
+        return -1;
+    }
+    static uint8_t frame[MP3_FRAME_MAX_BYTES];
+    static int16_t pcm[MP3_DECODER_MAX_SAMPLES];
+    uint32_t position = stream.data_offset;
+    uint32_t end = stream.data_offset + stream.data_size;
+    uint32_t frames = 0, errors = 0, samples = 0;
+    uint64_t total_cycles = 0;
+    uint32_t max_cycles = 0;
+    mp3_frame_header_t header;
+    while (frames < max_frames && position + MP3_FRAME_HEADER_SIZE <= end)
+    {
+        file.seek(position, SeekSet);
+        if (file.read(frame, MP3_FRAME_HEADER_SIZE) != MP3_FRAME_HEADER_SIZE || !mp3_frame_parse_header(frame, &header) ||
+            !mp3_frame_same_stream(&header, &stream.header) || position + header.frame_bytes > end)
+        {
+            position++;
+            continue;
+        }
+        file.read(frame + MP3_FRAME_HEADER_SIZE, header.frame_bytes - MP3_FRAME_HEADER_SIZE);
+        uint32_t start = stage_profile_now();
+        uint32_t decoded = mp3_decoder_run(decoder, frame, header.frame_bytes, pcm);
+        uint32_t cycles = stage_profile_now() - start;
+        total_cycles += cycles;
+        if (cycles > max_cycles)
+            max_cycles = cycles;
+        samples += decoded;
+        errors += decoded == 0 ? 1 : 0;
+        frames++;
+        position += header.frame_bytes;
+    }
+    MP3FreeDecoder(decoder);
+    file.close();
+    if (frames == 0)
+        return -1;
+
+    // 実時間に対する割合(RTF): デコードの時間 / 音の長さ
+    double seconds = (double)total_cycles / STAGE_PROFILE_CLOCK_HZ;
+    double audio_seconds = (double)samples / stream.header.sample_rate;
+    double average = (double)total_cycles / frames;
+    Serial.printf("%s: MPEG-%s Layer III %u Hz %u ch, %u kbps (first frame), %u frames, %u errors\n\r", path,
+                  stream.header.version == 1 ? "1" : stream.header.version == 2 ? "2" : "2.5",
+                  (unsigned)stream.header.sample_rate, stream.header.num_channels, (unsigned)(stream.header.bitrate / 1000),
+                  (unsigned)frames, (unsigned)errors);
+    double real_time = audio_seconds > 0 ? seconds / audio_seconds : 0.0;
+#ifdef F_CPU
+    // 1秒の音をデコードするのに要るクロック
+    Serial.printf("  decode %.0f cycles/frame (max %u), real-time factor %.4f (%.1f MHz), heap %u bytes\n\r", average,
+                  (unsigned)max_cycles, real_time, real_time * F_CPU / 1e6, (unsigned)heap_bytes);
+#else
+    Serial.printf("  decode %.0f ns/frame (max %u), real-time factor %.4f, heap %u bytes\n\r", average, (unsigned)max_cycles,
+                  real_time, (unsigned)heap_bytes);
+#endif
+    return 0;
+}
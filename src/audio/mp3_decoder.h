@@ -0,0 +1,35 @@
+#ifndef AUDIO_MP3_DECODER_H
+#define AUDIO_MP3_DECODER_H
+
+#include <stdint.h>
+#include <FS.h>
+
+// MP3(Layer III)の1フレームを 16bit PCM にデコードします。デコーダは固定小数点の libhelix(platformio.ini の lib_deps)です。
+// wav_source が先読みリングからフレームを1つずつ取り出して渡します(フレームの区切りは mp3_frame)。
+//
+// libhelix は前のフレームのデータ(ビットリザーバ)を使うので、シークの後の最初のフレームはデコードできずに
+// エラーになることがあります。そのフレームは音を返さず、次のフレームから続けます。
+//
+// デコーダの作業領域(約 24KB)は最初の mp3_decoder_begin() でヒープに確保し、そのまま使い続けます。
+
+// 1フレームのデコード結果の最大(1152 サンプル x 2 チャンネル)
+#define MP3_DECODER_MAX_SAMPLES (1152 * 2)
+
+// デコーダを確保します。確保できなければ false を返します。2回目以降は何もしません。
+bool mp3_decoder_begin(void);
+// mp3_decoder_begin() で確保したヒープのバイト数
+uint32_t mp3_decoder_heap_bytes(void);
+
+// length バイトの1フレームをデコードし、チャンネルをインターリーブした 16bit PCM を pcm に書きます。
+// 書いたサンプル数(1チャンネル分)を返します。デコードできなければ 0 を返します。
+uint32_t mp3_decoder_decode(const uint8_t *frame, uint32_t length, int16_t *pcm);
+// デコードしたフレームとデコードできなかったフレームの数
+uint32_t mp3_decoder_frames(void);
+uint32_t mp3_decoder_errors(void);
+
+// path の先頭から最大 max_frames フレームを別に確保したデコーダでデコードし、1フレームの時間(実機ではサイクル数)・
+// 実時間に対する割合・ヒープの大きさを表示します。ファイルの読み込みの時間は含めません。
+// 失敗したら -1、成功したら 0 を返します。ストリーミングしていないときに呼びます。
+int mp3_decoder_benchmark(fs::FS &fs, const char *path, uint32_t max_frames);
+
+#endif
@@ -0,0 +1,127 @@
+#include "mp3_frame.h"
+
+#include <string.h>
+
+// [MPEG-1 かどうか][ビットレートの番号] kbit/s
+static const uint16_t mp3_frame_bitrates[2][15] = {
+    {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160},
+    {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320},
+};
+static const uint32_t mp3_frame_sample_rates[3] = {44100, 48000, 32000};
+
+bool mp3_frame_parse_header(const uint8_t *data, mp3_frame_header_t *header)
+{
+    // AAAAAAAA AAABBCCD EEEEFFGH IIJJKLMM
+    // A: 同期, B: バージョン, C: レイヤー, D: CRC なし, E: ビットレート, F: サンプリング周波数, G: パディング, I: チャンネルモード
+    if (data[0] != 0xFF || (data[1] & 0xE0) != 0xE0)
+        return false;
+    uint32_t version_bits = (data[1] >> 3) & 3;
+    uint32_t layer_bits = (data[1] >> 1) & 3;
+    uint32_t bitrate_index = data[2] >> 4;
+    uint32_t rate_index = (data[2] >> 2) & 3;
+    if (version_bits == 1 || layer_bits != 1 || bitrate_index == 0 || bitrate_index == 15 || rate_index == 3)
+        return false;
+    bool mpeg1 = version_bits == 3;
+    header->version = mpeg1 ? 1 : version_bits == 2 ? 2 : 3;
+    header->crc = (data[1] & 1) == 0;
+    header->sample_rate = mp3_frame_sample_rates[rate_index] >> (header->version - 1);
+    header->bitrate = mp3_frame_bitrates[mpeg1][bitrate_index] * 1000u;
+    header->channel_mode = data[3] >> 6;
+    header->num_channels = header->channel_mode == 3 ? 1 : 2;
+    header->samples = mpeg1 ? 1152 : 576;
+    // 1フレームのバイト数 = サンプル数 / 8 x ビットレート / サンプリング周波数 + パディング
+    header->frame_bytes = (uint16_t)(header->samples / 8 * header->bitrate / header->sample_rate + ((data[2] >> 1) & 1));
+    header->side_info_bytes = mpeg1 ? (header->num_channels == 1 ? 17 : 32) : (header->num_channels == 1 ? 9 : 17);
+    return true;
+}
+
+uint32_t mp3_frame_id3v2_size(const uint8_t *data)
+{
+    if (memcmp(data, "ID3", 3) != 0 || ((data[6] | data[7] | data[8] | data[9]) & 0x80) != 0)
+        return 0;
+    // 大きさは 7bit ずつの4バイト(ヘッダを含まない)。フッタがあれば 10 バイト足す。
+    uint32_t size = (uint32_t)data[6] << 21 | (uint32_t)data[7] << 14 | (uint32_t)data[8] << 7 | data[9];
+    return 10 + size + ((data[5] & 0x10) ? 10 : 0);
+}
+
+int32_t mp3_frame_xing_frames(const uint8_t *data, uint32_t length, const mp3_frame_header_t *header)
+{
+    uint32_t offset = MP3_FRAME_HEADER_SIZE + (header->crc ? 2 : 0) + header->side_info_bytes;
+    if (offset + 12 > length || (memcmp(data + offset, "Xing", 4) != 0 && memcmp(data + offset, "Info", 4) != 0))
+        return -1;
+    // フラグの bit0 がフレーム数
+    if ((data[offset + 7] & 1) == 0)
+        return 0;
+    const uint8_t *p = data + offset + 8;
+    return (int32_t)((uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3]);
+}
+
+// position のフレームのヘッダを読み、次のフレームのヘッダも同じストリームなら true(次がファイルの末尾でもよい)。
+static bool mp3_frame_confirm(File &file, uint32_t position, uint32_t file_size, mp3_frame_header_t *header)
+{
+    uint8_t data[MP3_FRAME_HEADER_SIZE];
+    mp3_frame_header_t next;
+    file.seek(position, SeekSet);
+    if (file.read(data, sizeof(data)) != sizeof(data) || !mp3_frame_parse_header(data, header))
+        return false;
+    uint32_t next_position = position + header->frame_bytes;
+    if (next_position + MP3_FRAME_HEADER_SIZE > file_size)
+        return next_position <= file_size;
+    file.seek(next_position, SeekSet);
+    return file.read(data, sizeof(data)) == sizeof(data) && mp3_frame_parse_header(data, &next) &&
+           mp3_frame_same_stream(header, &next);
+}
+
+bool mp3_frame_parse_file(File &file, mp3_frame_stream_t *stream)
+{
+    uint32_t file_size = file.size();
+    uint8_t data[64];
+    memset(stream, 0, sizeof(*stream));
+    file.seek(0, SeekSet);
+    if (file.read(data, 10) != 10)
+        return false;
+    uint32_t start = mp3_frame_id3v2_size(data);
+
+    // 同期ワードを 64 バイトずつ読んで探す。読んだ範囲の最後の1バイトは次の読み込みの先頭にもう一度入れる。
+    uint32_t first = UINT32_MAX;
+    for (uint32_t position = start; first == UINT32_MAX && position + MP3_FRAME_HEADER_SIZE <= file_size &&
+                                    position < start + MP3_FRAME_SYNC_SEARCH;
+         position += sizeof(data) - 1)
+    {
+        file.seek(position, SeekSet);
+        uint32_t length = file.read(data, sizeof(data));
+        for (uint32_t i = 0; i + 1 < length; i++)
+        {
+            if (data[i] == 0xFF && (data[i + 1] & 0xE0) == 0xE0 && mp3_frame_confirm(file, position + i, file_size, &stream->header))
+            {
+                first = position + i;
+                break;
+            }
+        }
+    }
+    if (first == UINT32_MAX)
+        return false;
+
+    // ID3v1 タグ(末尾の 128 バイト)はデータに含めない。
+    uint32_t end = file_size;
+    if (file_size >= first + 128)
+    {
+        file.seek(file_size - 128, SeekSet);
+        if (file.read(data, 3) == 3 && memcmp(data, "TAG", 3) == 0)
+            end = file_size - 128;
+    }
+
+    // Xing/Info フレームは音を含まないので飛ばし、フレーム数を曲の長さに使う。
+    file.seek(first, SeekSet);
+    uint32_t length = file.read(data, sizeof(data));
+    int32_t frames = mp3_frame_xing_frames(data, length, &stream->header);
+    if (frames >= 0)
+    {
+        stream->num_frames = (uint32_t)frames;
+        first += stream->header.frame_bytes;
+    }
+    stream->data_offset = first;
+    stream->data_size = end > first ? end - first : 0;
+    file.seek(first, SeekSet);
+    return stream->data_size > 0;
+}
@@ -0,0 +1,62 @@
+#ifndef AUDIO_MP3_FRAME_H
+#define AUDIO_MP3_FRAME_H
+
+#include <stdint.h>
+#include <FS.h>
+
+// MPEG-1/2/2.5 Layer III のフレームヘッダと、MP3 ファイルの先頭(ID3v2 タグ、Xing/Info フレーム)・末尾(ID3v1 タグ)の解析です。
+// デコードは mp3_decoder がします。ここはフレームの区切りを見つけるだけです。
+//
+// フレームの大きさはヘッダのビットレートとパディングで決まり、VBR ではフレームごとに変わります。
+// 同期ワード(11bit の 1)はデータの中にも現れるので、ファイルの先頭では次のフレームのヘッダも正しいことを確かめます。
+
+#define MP3_FRAME_HEADER_SIZE 4
+// 一番大きいフレーム(MPEG-1 320kbps 32kHz、MPEG-2 160kbps 8kHz とパディング)
+#define MP3_FRAME_MAX_BYTES 1441
+// 1フレームのサンプル数(1チャンネル分)。MPEG-2/2.5 は 576
+#define MP3_FRAME_MAX_SAMPLES 1152
+// ファイルの先頭(ID3v2 タグの後)で最初のフレームを探す範囲
+#define MP3_FRAME_SYNC_SEARCH 16384
+
+typedef struct
+{
+    uint8_t version;         // 1: MPEG-1, 2: MPEG-2, 3: MPEG-2.5
+    uint8_t num_channels;    // 1 または 2
+    uint8_t channel_mode;    // 0: stereo, 1: joint stereo, 2: dual channel, 3: mono
+    bool crc;                // ヘッダの後に 2 バイトの CRC がある
+    uint32_t sample_rate;
+    uint32_t bitrate;        // bit/s
+    uint16_t frame_bytes;    // ヘッダを含むフレームのバイト数
+    uint16_t samples;        // 1フレームのサンプル数(1チャンネル分)
+    uint8_t side_info_bytes; // ヘッダ(と CRC)の後のサイド情報のバイト数
+} mp3_frame_header_t;
+
+typedef struct
+{
+    mp3_frame_header_t header; // 最初のオーディオのフレームのヘッダ
+    uint32_t data_offset;      // 最初のオーディオのフレーム(Xing/Info フレームの次)
+    uint32_t data_size;        // 最後のフレームの終わり(ID3v1 タグの前)まで
+    uint32_t num_frames;       // Xing/Info フレームのフレーム数。無ければ 0
+} mp3_frame_stream_t;
+
+// 4バイトのフレームヘッダを解析します。Layer III で、ビットレート・サンプリング周波数が有効なら true を返します
+// (フリーフォーマットは扱いません)。
+bool mp3_frame_parse_header(const uint8_t *data, mp3_frame_header_t *header);
+
+// header と同じストリームの次のフレームか(バージョン・サンプリング周波数・チャンネル数が同じ)
+static inline bool mp3_frame_same_stream(const mp3_frame_header_t *a, const mp3_frame_header_t *b)
+{
+    return a->version == b->version && a->sample_rate == b->sample_rate && a->num_channels == b->num_channels;
+}
+
+// ID3v2 タグ(10バイトのヘッダ)の大きさ。ID3v2 タグでなければ 0 を返します。
+uint32_t mp3_frame_id3v2_size(const uint8_t *data);
+
+// フレームが Xing/Info フレーム(エンコーダが先頭に置く、音の無いフレーム)なら、フレーム数を返します。
+// そうでなければ -1 を返します。フレーム数が書かれていなければ 0 です。data は length バイト。
+int32_t mp3_frame_xing_frames(const uint8_t *data, uint32_t length, const mp3_frame_header_t *header);
+
+// file の先頭から ID3v2 タグを飛ばして最初のフレームを探し、ストリームの範囲を返します。見つからなければ false を返します。
+bool mp3_frame_parse_file(File &file, mp3_frame_stream_t *stream);
+
+#endif
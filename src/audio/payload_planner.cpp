@@ -0,0 +1,90 @@
+#include "payload_planner.h"
+
+#include <string.h>
+
+// ベースバンドのパケットに入るバイト数(DH1, DH3, DH5)と、返事を含むスロット数
+static const uint16_t payload_planner_sizes[2][3] = {{54, 367, 679}, {83, 552, 1021}};
+static const uint8_t payload_planner_packet_slots[3] = {2, 4, 6};
+
+uint32_t payload_planner_slots(payload_planner_rate_t rate, int payload_size, uint8_t *baseband_packets)
+{
+    const uint16_t *sizes = payload_planner_sizes[rate];
+    uint32_t length = PAYLOAD_PLANNER_L2CAP_HEADER_SIZE + PAYLOAD_PLANNER_RTP_HEADER_SIZE + payload_size;
+    uint32_t packets = length / sizes[2];
+    uint32_t slots = packets * payload_planner_packet_slots[2];
+    uint32_t remainder = length % sizes[2];
+    if (remainder > 0)
+    {
+        int type = 0;
+        while (remainder > sizes[type])
+            type++;
+        slots += payload_planner_packet_slots[type];
+        packets++;
+    }
+    if (baseband_packets)
+        *baseband_packets = packets;
+    return slots;
+}
+
+int payload_planner_fill_frames(int max_payload_size, int frame_length)
+{
+    int frames = (max_payload_size - 1) / frame_length;
+    return frames > PAYLOAD_PLANNER_MAX_FRAMES ? PAYLOAD_PLANNER_MAX_FRAMES : frames;
+}
+
+int payload_planner_plan(payload_plan_t *plan, payload_planner_rate_t rate, int max_payload_size, int frame_length)
+{
+    memset(plan, 0, sizeof(*plan));
+    if (max_payload_size < 2 || frame_length <= 0)
+        return -1;
+    int max_frames = payload_planner_fill_frames(max_payload_size, frame_length);
+    if (max_frames == 0)
+    {
+        // 1フレームをフラグメントに分ける。フラグメントの数はメディアヘッダの4bitに入る分まで。
+        int fragment_size = max_payload_size - 1;
+        int fragments = (frame_length + fragment_size - 1) / fragment_size;
+        if (fragments > PAYLOAD_PLANNER_MAX_FRAMES)
+            return -1;
+        plan->frames_per_packet = 1;
+        plan->fragments = fragments;
+        plan->payload_size = max_payload_size;
+        uint32_t slots = 0;
+        uint32_t packets = 0;
+        for (int remaining = frame_length; remaining > 0; remaining -= fragment_size)
+        {
+            uint8_t n;
+            slots += payload_planner_slots(rate, 1 + (remaining < fragment_size ? remaining : fragment_size), &n);
+            packets += n;
+        }
+        plan->baseband_packets = packets;
+        plan->slots = slots;
+        return 0;
+    }
+
+    // フレームあたりのスロット数 slots / frames が最小のものを選ぶ(割り算を避けて掛け算で比べる)。
+    uint32_t best_slots = 0;
+    int best_frames = 0;
+    uint8_t best_packets = 0;
+    for (int frames = 1; frames <= max_frames; frames++)
+    {
+        uint8_t packets;
+        uint32_t slots = payload_planner_slots(rate, 1 + frames * frame_length, &packets);
+        if (best_frames == 0 || slots * best_frames < best_slots * frames)
+        {
+            best_slots = slots;
+            best_frames = frames;
+            best_packets = packets;
+        }
+    }
+    plan->frames_per_packet = best_frames;
+    plan->fragments = 1;
+    plan->payload_size = 1 + best_frames * frame_length;
+    plan->baseband_packets = best_packets;
+    plan->slots = best_slots;
+    return 0;
+}
+
+const char *payload_planner_rate_name(payload_planner_rate_t rate)
+{
+    return rate == PAYLOAD_PLANNER_3M ? "3-DH5" : "2-DH5";
+}
@@ -0,0 +1,50 @@
+#ifndef AUDIO_PAYLOAD_PLANNER_H
+#define AUDIO_PAYLOAD_PLANNER_H
+
+#include <stdint.h>
+
+// 1つのRTPパケットに入れるSBCフレーム数を、ベースバンドのパケット(EDR の 2-DHx / 3-DHx)が埋まるように決めます。
+//
+// メディアパケットは L2CAP ヘッダ(4) + RTPヘッダ(12) + SBCメディアヘッダ(1) + フレーム の L2CAP PDU になり、
+// コントローラがこれを DH5 ごとに区切って送ります。最後の半端は入る中で一番短いパケット(DH1/DH3/DH5)になるとします。
+// 各パケットは相手からの1スロットの返事と合わせて DH1: 2, DH3: 4, DH5: 6 スロット(1スロット 625us)の時間を使います。
+// フレーム数 1..15 のうち、フレームあたりのスロット数が一番少ないもの(同じならフレームが少ない方)を選びます。
+// フレームを詰めるだけ詰めると最後の DH5 がほとんど空になることがあり、そのときは1つ手前で送る方が電波の時間が短くなります。
+//
+// 1フレームが1パケットに入らないときは、A2DP仕様 4.3.4 の SBC フラグメンテーションで1フレームを複数のパケットに分けます。
+// 仕様ではフラグメントしたパケットには1フレームの一部しか入れられないので、フレームをまたいで分けることはしません。
+
+// 送る側(コントローラ)が使う EDR のレート
+typedef enum
+{
+    PAYLOAD_PLANNER_2M = 0, // 2-DH1 / 2-DH3 / 2-DH5
+    PAYLOAD_PLANNER_3M,     // 3-DH1 / 3-DH3 / 3-DH5
+} payload_planner_rate_t;
+
+#define PAYLOAD_PLANNER_L2CAP_HEADER_SIZE 4
+#define PAYLOAD_PLANNER_RTP_HEADER_SIZE 12
+#define PAYLOAD_PLANNER_MAX_FRAMES 15
+#define PAYLOAD_PLANNER_SLOT_US 625
+
+typedef struct
+{
+    uint8_t frames_per_packet; // 1パケットのフレーム数。フラグメントするときは 1
+    uint8_t fragments;         // 1フレームを分けるパケット数(分けないときは 1)
+    uint16_t payload_size;     // 1パケットの最大のペイロード(SBCメディアヘッダを含む)
+    uint8_t baseband_packets;  // 1パケット分(フラグメントするときは全部のフラグメント)を送るベースバンドのパケット数
+    uint8_t slots;             // そのスロット数(返事を含む)
+} payload_plan_t;
+
+// max_payload_size(RTPペイロードの最大, SBCメディアヘッダを含む)と frame_length からパケットの作り方を決めます。
+// 1フレームも作れないとき(max_payload_size が 2 未満など)は -1 を返します。
+int payload_planner_plan(payload_plan_t *plan, payload_planner_rate_t rate, int max_payload_size, int frame_length);
+
+// ペイロードが payload_size バイトのメディアパケット1つを送るのに使うスロット数とベースバンドのパケット数
+uint32_t payload_planner_slots(payload_planner_rate_t rate, int payload_size, uint8_t *baseband_packets);
+
+// パケットが埋まるまでフレームを詰める場合(以前の送り方)のフレーム数
+int payload_planner_fill_frames(int max_payload_size, int frame_length);
+
+const char *payload_planner_rate_name(payload_planner_rate_t rate);
+
+#endif
@@ -0,0 +1,382 @@
+#include "pcm_convert.h"
+
+#include <math.h>
+#include <stddef.h>
+
+// 16bitの値を L と R の両方に入れた32bitの値にする。
+static inline uint32_t pcm_convert_dup(uint32_t sample16)
+{
+    return (sample16 & 0xffff) | (sample16 << 16);
+}
+
+// unsigned 8-bit: 0x80 が無音。上位バイトに置いて符号を反転すると signed 16-bit になる。
+void pcm_convert_u8_mono(const uint8_t *src, int16_t *dst, int num_samples)
+{
+    uint32_t *out = (uint32_t *)dst;
+    const uint8_t *end = src + num_samples;
+    while (src < end)
+    {
+        *out++ = pcm_convert_dup((uint32_t)(*src++ ^ 0x80) << 8);
+    }
+}
+
+void pcm_convert_u8_stereo(const uint8_t *src, int16_t *dst, int num_samples)
+{
+    uint32_t *out = (uint32_t *)dst;
+    const uint8_t *end = src + num_samples * 2;
+    while (src < end)
+    {
+        uint32_t left = (uint32_t)(src[0] ^ 0x80) << 8;
+        uint32_t right = (uint32_t)(src[1] ^ 0x80) << 24;
+        *out++ = left | right;
+        src += 2;
+    }
+}
+
+void pcm_convert_s16_mono(const uint8_t *src, int16_t *dst, int num_samples)
+{
+    uint32_t *out = (uint32_t *)dst;
+    const uint8_t *end = src + num_samples * 2;
+    while (src < end)
+    {
+        *out++ = pcm_convert_dup(src[0] | ((uint32_t)src[1] << 8));
+        src += 2;
+    }
+}
+
+// 24bit は下位バイトを捨てて上位2バイトを使う。
+void pcm_convert_s24_mono(const uint8_t *src, int16_t *dst, int num_samples)
+{
+    uint32_t *out = (uint32_t *)dst;
+    const uint8_t *end = src + num_samples * 3;
+    while (src < end)
+    {
+        *out++ = pcm_convert_dup(src[1] | ((uint32_t)src[2] << 8));
+        src += 3;
+    }
+}
+
+void pcm_convert_s24_stereo(const uint8_t *src, int16_t *dst, int num_samples)
+{
+    uint32_t *out = (uint32_t *)dst;
+    const uint8_t *end = src + num_samples * 6;
+    while (src < end)
+    {
+        *out++ = (src[1] | ((uint32_t)src[2] << 8)) | ((uint32_t)src[4] << 16) | ((uint32_t)src[5] << 24);
+        src += 6;
+    }
+}
+
+// ---- モノラル出力 ----
+
+// 2つの16bitの値を1つの32bitにする(前のサンプルが下位)。
+static inline uint32_t pcm_convert_pair(uint32_t first16, uint32_t second16)
+{
+    return (first16 & 0xffff) | (second16 << 16);
+}
+
+void pcm_convert_mono_u8_mono(const uint8_t *src, int16_t *dst, int num_samples)
+{
+    uint32_t *out = (uint32_t *)dst;
+    const uint8_t *end = src + num_samples;
+    while (src < end)
+    {
+        *out++ = ((uint32_t)(src[0] ^ 0x80) << 8) | ((uint32_t)(src[1] ^ 0x80) << 24);
+        src += 2;
+    }
+}
+
+// u8 は L + R が9bitに収まるので、符号付きにしてから足して 7bit 左に送る。
+void pcm_convert_mono_u8_stereo(const uint8_t *src, int16_t *dst, int num_samples)
+{
+    uint32_t *out = (uint32_t *)dst;
+    const uint8_t *end = src + num_samples * 2;
+    while (src < end)
+    {
+        int32_t first = ((int32_t)src[0] + src[1] - 256) << 7;
+        int32_t second = ((int32_t)src[2] + src[3] - 256) << 7;
+        *out++ = pcm_convert_pair((uint32_t)first, (uint32_t)second);
+        src += 4;
+    }
+}
+
+void pcm_convert_mono_s16_stereo(const uint8_t *src, int16_t *dst, int num_samples)
+{
+    uint32_t *out = (uint32_t *)dst;
+    const int16_t *in = (const int16_t *)src;
+    for (int i = 0; i < num_samples; i += 2)
+    {
+        int32_t first = ((int32_t)in[0] + in[1]) >> 1;
+        int32_t second = ((int32_t)in[2] + in[3]) >> 1;
+        *out++ = pcm_convert_pair((uint32_t)first, (uint32_t)second);
+        in += 4;
+    }
+}
+
+void pcm_convert_mono_s24_mono(const uint8_t *src, int16_t *dst, int num_samples)
+{
+    uint32_t *out = (uint32_t *)dst;
+    const uint8_t *end = src + num_samples * 3;
+    while (src < end)
+    {
+        *out++ = (src[1] | ((uint32_t)src[2] << 8)) | ((uint32_t)src[4] << 16) | ((uint32_t)src[5] << 24);
+        src += 6;
+    }
+}
+
+void pcm_convert_mono_s24_stereo(const uint8_t *src, int16_t *dst, int num_samples)
+{
+    uint32_t *out = (uint32_t *)dst;
+    const uint8_t *end = src + num_samples * 6;
+    while (src < end)
+    {
+        int32_t first = ((int32_t)(int16_t)(src[1] | (src[2] << 8)) + (int16_t)(src[4] | (src[5] << 8))) >> 1;
+        int32_t second = ((int32_t)(int16_t)(src[7] | (src[8] << 8)) + (int16_t)(src[10] | (src[11] << 8))) >> 1;
+        *out++ = pcm_convert_pair((uint32_t)first, (uint32_t)second);
+        src += 12;
+    }
+}
+
+pcm_convert_func_t pcm_convert_select(const wav_format_t *format, int output_channels)
+{
+    if (output_channels == 1)
+    {
+        switch (format->bits_per_sample)
+        {
+        case 8:
+            return format->num_channels == 1 ? pcm_convert_mono_u8_mono : pcm_convert_mono_u8_stereo;
+        case 16:
+            return format->num_channels == 1 ? NULL : pcm_convert_mono_s16_stereo;
+        case 24:
+            return format->num_channels == 1 ? pcm_convert_mono_s24_mono : pcm_convert_mono_s24_stereo;
+        default:
+            return NULL;
+        }
+    }
+    switch (format->bits_per_sample)
+    {
+    case 8:
+        return format->num_channels == 1 ? pcm_convert_u8_mono : pcm_convert_u8_stereo;
+    case 16:
+        return format->num_channels == 1 ? pcm_convert_s16_mono : NULL;
+    case 24:
+        return format->num_channels == 1 ? pcm_convert_s24_mono : pcm_convert_s24_stereo;
+    default:
+        return NULL;
+    }
+}
+
+// ---- 音量(ゲイン付きの変換) ----
+
+// level の上位16bitが Q15 のゲイン。ゲインは 1 以下なので int16 に収まる。
+static inline uint32_t pcm_gain_apply(int32_t sample, uint32_t level)
+{
+    return (uint32_t)((sample * (int32_t)(level >> 16)) >> 15);
+}
+
+void pcm_convert_gain_u8_mono(const uint8_t *src, int16_t *dst, int num_samples, uint32_t level, int32_t step)
+{
+    uint32_t *out = (uint32_t *)dst;
+    const uint8_t *end = src + num_samples;
+    while (src < end)
+    {
+        *out++ = pcm_convert_dup(pcm_gain_apply(((int32_t)*src++ - 128) << 8, level));
+        level += step;
+    }
+}
+
+void pcm_convert_gain_u8_stereo(const uint8_t *src, int16_t *dst, int num_samples, uint32_t level, int32_t step)
+{
+    uint32_t *out = (uint32_t *)dst;
+    const uint8_t *end = src + num_samples * 2;
+    while (src < end)
+    {
+        uint32_t left = pcm_gain_apply(((int32_t)src[0] - 128) << 8, level);
+        uint32_t right = pcm_gain_apply(((int32_t)src[1] - 128) << 8, level);
+        *out++ = (left & 0xffff) | (right << 16);
+        level += step;
+        src += 2;
+    }
+}
+
+void pcm_convert_gain_s16_mono(const uint8_t *src, int16_t *dst, int num_samples, uint32_t level, int32_t step)
+{
+    uint32_t *out = (uint32_t *)dst;
+    const int16_t *in = (const int16_t *)src;
+    for (int i = 0; i < num_samples; i++)
+    {
+        *out++ = pcm_convert_dup(pcm_gain_apply(in[i], level));
+        level += step;
+    }
+}
+
+// 16bitステレオはゲインを掛けるときだけ、リングから読んだものを書き写す。
+void pcm_convert_gain_s16_stereo(const uint8_t *src, int16_t *dst, int num_samples, uint32_t level, int32_t step)
+{
+    uint32_t *out = (uint32_t *)dst;
+    const int16_t *in = (const int16_t *)src;
+    for (int i = 0; i < num_samples; i++)
+    {
+        uint32_t left = pcm_gain_apply(in[0], level);
+        uint32_t right = pcm_gain_apply(in[1], level);
+        *out++ = (left & 0xffff) | (right << 16);
+        level += step;
+        in += 2;
+    }
+}
+
+void pcm_convert_gain_s24_mono(const uint8_t *src, int16_t *dst, int num_samples, uint32_t level, int32_t step)
+{
+    uint32_t *out = (uint32_t *)dst;
+    const uint8_t *end = src + num_samples * 3;
+    while (src < end)
+    {
+        *out++ = pcm_convert_dup(pcm_gain_apply((int16_t)(src[1] | (src[2] << 8)), level));
+        level += step;
+        src += 3;
+    }
+}
+
+void pcm_convert_gain_s24_stereo(const uint8_t *src, int16_t *dst, int num_samples, uint32_t level, int32_t step)
+{
+    uint32_t *out = (uint32_t *)dst;
+    const uint8_t *end = src + num_samples * 6;
+    while (src < end)
+    {
+        uint32_t left = pcm_gain_apply((int16_t)(src[1] | (src[2] << 8)), level);
+        uint32_t right = pcm_gain_apply((int16_t)(src[4] | (src[5] << 8)), level);
+        *out++ = (left & 0xffff) | (right << 16);
+        level += step;
+        src += 6;
+    }
+}
+
+// モノラル出力は2サンプルの組の中でも step ずつ変える。
+void pcm_convert_gain_mono_u8_mono(const uint8_t *src, int16_t *dst, int num_samples, uint32_t level, int32_t step)
+{
+    uint32_t *out = (uint32_t *)dst;
+    const uint8_t *end = src + num_samples;
+    while (src < end)
+    {
+        uint32_t first = pcm_gain_apply(((int32_t)src[0] - 128) << 8, level);
+        uint32_t second = pcm_gain_apply(((int32_t)src[1] - 128) << 8, level + step);
+        *out++ = pcm_convert_pair(first, second);
+        level += 2 * step;
+        src += 2;
+    }
+}
+
+void pcm_convert_gain_mono_u8_stereo(const uint8_t *src, int16_t *dst, int num_samples, uint32_t level, int32_t step)
+{
+    uint32_t *out = (uint32_t *)dst;
+    const uint8_t *end = src + num_samples * 2;
+    while (src < end)
+    {
+        uint32_t first = pcm_gain_apply(((int32_t)src[0] + src[1] - 256) << 7, level);
+        uint32_t second = pcm_gain_apply(((int32_t)src[2] + src[3] - 256) << 7, level + step);
+        *out++ = pcm_convert_pair(first, second);
+        level += 2 * step;
+        src += 4;
+    }
+}
+
+void pcm_convert_gain_mono_s16_mono(const uint8_t *src, int16_t *dst, int num_samples, uint32_t level, int32_t step)
+{
+    uint32_t *out = (uint32_t *)dst;
+    const int16_t *in = (const int16_t *)src;
+    for (int i = 0; i < num_samples; i += 2)
+    {
+        *out++ = pcm_convert_pair(pcm_gain_apply(in[0], level), pcm_gain_apply(in[1], level + step));
+        level += 2 * step;
+        in += 2;
+    }
+}
+
+void pcm_convert_gain_mono_s16_stereo(const uint8_t *src, int16_t *dst, int num_samples, uint32_t level, int32_t step)
+{
+    uint32_t *out = (uint32_t *)dst;
+    const int16_t *in = (const int16_t *)src;
+    for (int i = 0; i < num_samples; i += 2)
+    {
+        uint32_t first = pcm_gain_apply(((int32_t)in[0] + in[1]) >> 1, level);
+        uint32_t second = pcm_gain_apply(((int32_t)in[2] + in[3]) >> 1, level + step);
+        *out++ = pcm_convert_pair(first, second);
+        level += 2 * step;
+        in += 4;
+    }
+}
+
+void pcm_convert_gain_mono_s24_mono(const uint8_t *src, int16_t *dst, int num_samples, uint32_t level, int32_t step)
+{
+    uint32_t *out = (uint32_t *)dst;
+    const uint8_t *end = src + num_samples * 3;
+    while (src < end)
+    {
+        uint32_t first = pcm_gain_apply((int16_t)(src[1] | (src[2] << 8)), level);
+        uint32_t second = pcm_gain_apply((int16_t)(src[4] | (src[5] << 8)), level + step);
+        *out++ = pcm_convert_pair(first, second);
+        level += 2 * step;
+        src += 6;
+    }
+}
+
+void pcm_convert_gain_mono_s24_stereo(const uint8_t *src, int16_t *dst, int num_samples, uint32_t level, int32_t step)
+{
+    uint32_t *out = (uint32_t *)dst;
+    const uint8_t *end = src + num_samples * 6;
+    while (src < end)
+    {
+        int32_t first = ((int32_t)(int16_t)(src[1] | (src[2] << 8)) + (int16_t)(src[4] | (src[5] << 8))) >> 1;
+        int32_t second = ((int32_t)(int16_t)(src[7] | (src[8] << 8)) + (int16_t)(src[10] | (src[11] << 8))) >> 1;
+        *out++ = pcm_convert_pair(pcm_gain_apply(first, level), pcm_gain_apply(second, level + step));
+        level += 2 * step;
+        src += 12;
+    }
+}
+
+int32_t pcm_gain_step(uint32_t level, uint16_t gain, int num_samples)
+{
+    if (num_samples <= 0)
+        return 0;
+    return (int32_t)(((int64_t)PCM_GAIN_LEVEL(gain) - level) / num_samples);
+}
+
+uint16_t pcm_gain_from_volume(uint8_t volume)
+{
+    if (volume == 0)
+        return 0;
+    if (volume >= 127)
+        return PCM_GAIN_UNITY;
+    float db = -50.0f * (127 - volume) / 126;
+    return (uint16_t)(PCM_GAIN_UNITY * powf(10.0f, db / 20) + 0.5f);
+}
+
+pcm_convert_gain_func_t pcm_convert_select_gain(const wav_format_t *format, int output_channels)
+{
+    bool mono = format->num_channels == 1;
+    if (output_channels == 1)
+    {
+        switch (format->bits_per_sample)
+        {
+        case 8:
+            return mono ? pcm_convert_gain_mono_u8_mono : pcm_convert_gain_mono_u8_stereo;
+        case 16:
+            return mono ? pcm_convert_gain_mono_s16_mono : pcm_convert_gain_mono_s16_stereo;
+        case 24:
+            return mono ? pcm_convert_gain_mono_s24_mono : pcm_convert_gain_mono_s24_stereo;
+        default:
+            return NULL;
+        }
+    }
+    switch (format->bits_per_sample)
+    {
+    case 8:
+        return mono ? pcm_convert_gain_u8_mono : pcm_convert_gain_u8_stereo;
+    case 16:
+        return mono ? pcm_convert_gain_s16_mono : pcm_convert_gain_s16_stereo;
+    case 24:
+        return mono ? pcm_convert_gain_s24_mono : pcm_convert_gain_s24_stereo;
+    default:
+        return NULL;
+    }
+}
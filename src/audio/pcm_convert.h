@@ -0,0 +1,66 @@
+#ifndef AUDIO_PCM_CONVERT_H
+#define AUDIO_PCM_CONVERT_H
+
+#include <stdint.h>
+#include "wav_format.h"
+
+// WAVのデータをSBCエンコーダに渡す16bitステレオ(L,R の順にインターリーブ)に変換するカーネルです。
+// フォーマットごとに専用のループを用意し、produce_audio() は wav_source を開いたときに選んだものを呼びます。
+// 16bitステレオ(リトルエンディアン)はそのままエンコーダに渡せるので変換しません(pcm_convert_select が NULL を返す)。
+// dst は4バイト境界に置いて下さい。L と R を32bitで1回に書き込みます(RP2040 もホストもリトルエンディアン)。
+//
+// SBCのチャンネルモードが MONO のときは、エンコーダに16bitモノラルを渡します(pcm_convert_mono_*)。
+// ステレオのWAVは (L + R) / 2 に混ぜます。16bitモノラルはそのまま渡せるので変換しません。
+// モノラル出力のカーネルは2サンプルずつ32bitで書き込むので、num_samples は偶数にして下さい(SBCの1フレームは8の倍数)。
+//
+// 音量(pcm_convert_gain_*): 同じ変換のループの中で各サンプルに Q15 のゲインを掛けます。変換の後にもう1回バッファをなめません。
+// ゲインは level(Q15 のゲインを16bit左に送ったもの)から1サンプル(ステレオは L,R の組)ごとに step ずつ変え、
+// pcm_gain_step() で求めた step なら num_samples 後に目標のゲインに着きます(ブロックの中で直線に変わるので、音量を変えてもプチッといわない)。
+// 16bitでチャンネル数が同じ場合も、ゲインを掛けるときはコピーのカーネルを使います(NULL を返さない)。
+// ゲインは 1 以下なので飽和はしません。PCM_GAIN_UNITY ではゲインの無い変換と同じ値になります。
+
+typedef void (*pcm_convert_func_t)(const uint8_t *src, int16_t *dst, int num_samples);
+
+void pcm_convert_u8_mono(const uint8_t *src, int16_t *dst, int num_samples);
+void pcm_convert_u8_stereo(const uint8_t *src, int16_t *dst, int num_samples);
+void pcm_convert_s16_mono(const uint8_t *src, int16_t *dst, int num_samples);
+void pcm_convert_s24_mono(const uint8_t *src, int16_t *dst, int num_samples);
+void pcm_convert_s24_stereo(const uint8_t *src, int16_t *dst, int num_samples);
+
+void pcm_convert_mono_u8_mono(const uint8_t *src, int16_t *dst, int num_samples);
+void pcm_convert_mono_u8_stereo(const uint8_t *src, int16_t *dst, int num_samples);
+void pcm_convert_mono_s16_stereo(const uint8_t *src, int16_t *dst, int num_samples);
+void pcm_convert_mono_s24_mono(const uint8_t *src, int16_t *dst, int num_samples);
+void pcm_convert_mono_s24_stereo(const uint8_t *src, int16_t *dst, int num_samples);
+
+// output_channels(エンコーダのチャンネル数, 1 または 2)に合わせたカーネルを返します。
+// 変換が不要な場合(16bitでチャンネル数が同じ)は NULL を返します。
+pcm_convert_func_t pcm_convert_select(const wav_format_t *format, int output_channels);
+
+#define PCM_GAIN_UNITY 32768
+#define PCM_GAIN_LEVEL(gain) ((uint32_t)(gain) << 16)
+
+typedef void (*pcm_convert_gain_func_t)(const uint8_t *src, int16_t *dst, int num_samples, uint32_t level, int32_t step);
+
+void pcm_convert_gain_u8_mono(const uint8_t *src, int16_t *dst, int num_samples, uint32_t level, int32_t step);
+void pcm_convert_gain_u8_stereo(const uint8_t *src, int16_t *dst, int num_samples, uint32_t level, int32_t step);
+void pcm_convert_gain_s16_mono(const uint8_t *src, int16_t *dst, int num_samples, uint32_t level, int32_t step);
+void pcm_convert_gain_s16_stereo(const uint8_t *src, int16_t *dst, int num_samples, uint32_t level, int32_t step);
+void pcm_convert_gain_s24_mono(const uint8_t *src, int16_t *dst, int num_samples, uint32_t level, int32_t step);
+void pcm_convert_gain_s24_stereo(const uint8_t *src, int16_t *dst, int num_samples, uint32_t level, int32_t step);
+
+void pcm_convert_gain_mono_u8_mono(const uint8_t *src, int16_t *dst, int num_samples, uint32_t level, int32_t step);
+void pcm_convert_gain_mono_u8_stereo(const uint8_t *src, int16_t *dst, int num_samples, uint32_t level, int32_t step);
+void pcm_convert_gain_mono_s16_mono(const uint8_t *src, int16_t *dst, int num_samples, uint32_t level, int32_t step);
+void pcm_convert_gain_mono_s16_stereo(const uint8_t *src, int16_t *dst, int num_samples, uint32_t level, int32_t step);
+void pcm_convert_gain_mono_s24_mono(const uint8_t *src, int16_t *dst, int num_samples, uint32_t level, int32_t step);
+void pcm_convert_gain_mono_s24_stereo(const uint8_t *src, int16_t *dst, int num_samples, uint32_t level, int32_t step);
+
+// level から num_samples サンプルで目標のゲイン gain(Q15)に着く1サンプルあたりの変化量
+int32_t pcm_gain_step(uint32_t level, uint16_t gain, int num_samples);
+// AVRCP の絶対音量(0..127)を Q15 のゲインにします。127 が PCM_GAIN_UNITY(0dB)、1 が -50dB で、その間は dB で等間隔(約 0.4dB ずつ)、0 は無音です。
+uint16_t pcm_gain_from_volume(uint8_t volume);
+// output_channels に合わせたゲイン付きのカーネルを返します。対応していないフォーマットは NULL を返します。
+pcm_convert_gain_func_t pcm_convert_select_gain(const wav_format_t *format, int output_channels);
+
+#endif
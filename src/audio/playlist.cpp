@@ -0,0 +1,213 @@
+#include "playlist.h"
+
+#include <atomic>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "Arduino.h"
+#include "wav_format.h"
+#include "wav_source.h"
+
+static fs::FS *playlist_fs;
+static char playlist_dir[PLAYLIST_NAME_LENGTH];
+static playlist_track_t playlist_tracks[PLAYLIST_MAX_TRACKS];
+static int playlist_count;
+static bool playlist_repeat;
+
+// 最後に予約した曲(書き込み側)と、loop() から見た今の曲
+static int playlist_queued;
+static bool playlist_ended;
+static int playlist_playing;
+static uint32_t playlist_seen_changes;
+// playlist_jump() で指定された曲(-1 はなし)。書き込み側が次の曲を予約するときに受け取る。
+static std::atomic<int> playlist_jumped(-1);
+
+static bool playlist_is_track(const char *name)
+{
+    size_t length = strlen(name);
+    return length > 4 && (strcasecmp(name + length - 4, ".wav") == 0 || strcasecmp(name + length - 4, ".mp3") == 0);
+}
+
+static void playlist_path(char *path, size_t size, int index)
+{
+    snprintf(path, size, "%s/%.*s", playlist_dir, PLAYLIST_NAME_LENGTH - 1, playlist_tracks[index].name);
+}
+
+static int playlist_compare(const void *a, const void *b)
+{
+    return strcasecmp(((const playlist_track_t *)a)->name, ((const playlist_track_t *)b)->name);
+}
+
+int playlist_build(fs::FS &fs, const char *dir)
+{
+    playlist_fs = &fs;
+    // "/" は空にして、パスを "/name" にする。
+    snprintf(playlist_dir, sizeof(playlist_dir), "%s", strcmp(dir, "/") == 0 ? "" : dir);
+    playlist_count = 0;
+
+    Dir entries = fs.openDir(dir);
+    while (entries.next())
+    {
+        if (!entries.isFile() || !playlist_is_track(entries.fileName().c_str()))
+            continue;
+        if (playlist_count == PLAYLIST_MAX_TRACKS || strlen(entries.fileName().c_str()) >= PLAYLIST_NAME_LENGTH)
+        {
+            Serial.printf("playlist: %s skipped\n\r", entries.fileName().c_str());
+            continue;
+        }
+        snprintf(playlist_tracks[playlist_count].name, PLAYLIST_NAME_LENGTH, "%s", entries.fileName().c_str());
+        playlist_count++;
+    }
+    qsort(playlist_tracks, playlist_count, sizeof(playlist_track_t), playlist_compare);
+
+    // ヘッダを読んで長さを求める。読めないファイルと周波数が違うファイルは外す。
+    uint32_t sample_rate = 0;
+    int count = 0;
+    for (int i = 0; i < playlist_count; i++)
+    {
+        char path[2 * PLAYLIST_NAME_LENGTH];
+        playlist_path(path, sizeof(path), i);
+        File file = fs.open(path, "r");
+        if (!file)
+        {
+            Serial.printf("playlist: %s: open failed\n\r", path);
+            continue;
+        }
+        wav_format_t format;
+        wav_format_result_t result = wav_format_parse(file, &format);
+        file.close();
+        if (result != WAV_FORMAT_OK)
+        {
+            Serial.printf("playlist: %s: %s\n\r", path, wav_format_result_string(result));
+            continue;
+        }
+        if (sample_rate == 0)
+            sample_rate = format.sample_rate;
+        if (format.sample_rate != sample_rate)
+        {
+            Serial.printf("playlist: %s: %u Hz is not %u Hz\n\r", path, (unsigned)format.sample_rate, (unsigned)sample_rate);
+            continue;
+        }
+        playlist_track_t *track = &playlist_tracks[count++];
+        if (track != &playlist_tracks[i])
+            *track = playlist_tracks[i];
+        track->num_samples = wav_format_num_samples(&format);
+        track->length_ms = (uint32_t)((uint64_t)track->num_samples * 1000 / format.sample_rate);
+    }
+    playlist_count = count;
+    return playlist_count;
+}
+
+int playlist_size(void)
+{
+    return playlist_count;
+}
+
+const playlist_track_t *playlist_track(int index)
+{
+    return index >= 0 && index < playlist_count ? &playlist_tracks[index] : NULL;
+}
+
+void playlist_set_repeat(bool repeat)
+{
+    playlist_repeat = repeat;
+}
+
+// wav_source_service() から、今の曲の残りが少なくなったら呼ばれる。次に開ける曲を予約する。
+static void playlist_queue_next(void)
+{
+    int jumped = playlist_jumped.exchange(-1, std::memory_order_acquire);
+    if (jumped >= 0)
+    {
+        playlist_queued = jumped;
+        playlist_ended = false;
+    }
+    if (playlist_ended)
+        return;
+    for (int attempt = 0; attempt < playlist_count; attempt++)
+    {
+        int next = playlist_queued + 1;
+        if (next == playlist_count)
+        {
+            if (!playlist_repeat)
+                break;
+            next = 0;
+        }
+        playlist_queued = next;
+        char path[2 * PLAYLIST_NAME_LENGTH];
+        playlist_path(path, sizeof(path), next);
+        if (wav_source_queue(*playlist_fs, path, (uint32_t)next) == 0)
+            return;
+        Serial.printf("playlist: %s cannot be queued\n\r", path);
+    }
+    playlist_ended = true;
+}
+
+int playlist_start(int index)
+{
+    if (index < 0 || index >= playlist_count)
+        return -1;
+    char path[2 * PLAYLIST_NAME_LENGTH];
+    playlist_path(path, sizeof(path), index);
+    wav_source_set_queue_callback(NULL);
+    if (wav_source_open(*playlist_fs, path, false) != 0)
+        return -1;
+    playlist_queued = index;
+    playlist_playing = index;
+    playlist_ended = false;
+    playlist_seen_changes = 0;
+    playlist_jumped.store(-1, std::memory_order_relaxed);
+    wav_source_set_queue_callback(playlist_queue_next);
+    return 0;
+}
+
+int playlist_jump(int index)
+{
+    if (index < 0 || index >= playlist_count)
+        return -1;
+    char path[2 * PLAYLIST_NAME_LENGTH];
+    playlist_path(path, sizeof(path), index);
+    playlist_jumped.store(index, std::memory_order_release);
+    wav_source_request_track(*playlist_fs, path, (uint32_t)index);
+    return 0;
+}
+
+bool playlist_repeats(void)
+{
+    return playlist_repeat;
+}
+
+void playlist_stop(void)
+{
+    wav_source_set_queue_callback(NULL);
+    wav_source_close();
+}
+
+bool playlist_poll(int *index)
+{
+    wav_source_track_stats_t stats;
+    wav_source_get_track_stats(&stats);
+    if (stats.changes == playlist_seen_changes)
+        return false;
+    playlist_seen_changes = stats.changes;
+    playlist_playing = (int)stats.tag;
+    *index = playlist_playing;
+    return true;
+}
+
+int playlist_current(void)
+{
+    return playlist_playing;
+}
+
+void playlist_dump(void)
+{
+    wav_source_track_stats_t stats;
+    wav_source_get_track_stats(&stats);
+    Serial.printf("playlist: %d tracks, playing %d, %u changes, gap last %u samples (max %u)%s\n\r", playlist_count,
+                  playlist_playing + 1, (unsigned)stats.changes, (unsigned)stats.last_gap_samples,
+                  (unsigned)stats.max_gap_samples, playlist_repeat ? ", repeat" : "");
+    for (int i = 0; i < playlist_count; i++)
+        Serial.printf("  %c%2d %s %u ms\n\r", i == playlist_playing ? '>' : ' ', i + 1, playlist_tracks[i].name,
+                      (unsigned)playlist_tracks[i].length_ms);
+}
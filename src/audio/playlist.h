@@ -0,0 +1,51 @@
+#ifndef AUDIO_PLAYLIST_H
+#define AUDIO_PLAYLIST_H
+
+#include <stdint.h>
+#include <FS.h>
+
+// ディレクトリの WAV と MP3 のファイルを名前順に曲間なしで続けて再生するプレイリストです(sdcard_play.cpp)。
+//
+// playlist_build() で起動時に曲の一覧を作り、playlist_start() で最初の曲を wav_source で開きます。
+// 今の曲の残りが少なくなると、wav_source_service() の中(書き込み側のコンテキスト)で次の曲を開いて予約し、
+// 先読みリングに続けて読み込みます。曲が変わったことは playlist_poll() で loop() から受け取り、
+// AVRCP の TRACK_CHANGED と再生中の曲の情報を更新します。
+//
+// 一覧は固定の大きさの配列で、ヒープは使いません。サンプリング周波数が最初の曲と違うファイルは入れません
+// (SBC の設定とリサンプラーは接続時に決まるため)。チャンネル数とビット数は曲ごとに違っていても構いません。
+
+#define PLAYLIST_MAX_TRACKS 32
+#define PLAYLIST_NAME_LENGTH 48
+
+typedef struct
+{
+    char name[PLAYLIST_NAME_LENGTH]; // ディレクトリからのファイル名
+    uint32_t num_samples;            // 1チャンネルあたりのサンプル数
+    uint32_t length_ms;
+} playlist_track_t;
+
+// dir の *.wav と *.mp3 を名前順に並べます。入れた曲の数を返します。
+int playlist_build(fs::FS &fs, const char *dir);
+int playlist_size(void);
+const playlist_track_t *playlist_track(int index);
+
+// true にすると最後の曲の次に最初の曲に戻ります。false の場合は最後の曲の後は無音です。
+void playlist_set_repeat(bool repeat);
+bool playlist_repeats(void);
+
+// index の曲を開いて再生を始めます。読み出し側が止まっているときだけ呼べます。
+int playlist_start(int index);
+void playlist_stop(void);
+// 再生中に index の曲の先頭へ移ります(AVRCP の FORWARD / BACKWARD)。ストリーミングは止めず、
+// wav_source_request_track() で先読みリングを捨てて読み直します。続く曲はそこから順に予約します。
+// loop() や BTstack のコールバックから呼べます。
+int playlist_jump(int index);
+
+// 曲が変わっていれば true を返し、*index に今の曲の番号を入れます。loop() から呼びます。
+bool playlist_poll(int *index);
+// 今の曲の番号
+int playlist_current(void);
+
+void playlist_dump(void);
+
+#endif
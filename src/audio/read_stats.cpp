@@ -0,0 +1,56 @@
+#include "read_stats.h"
+
+#include <string.h>
+#include "Arduino.h"
+
+const uint32_t read_stats_limits_us[READ_STATS_BUCKETS - 1] = {100, 150, 200, 300, 400, 500, 750, 1000,
+                                                               1500, 2000, 3000, 5000, 10000, 20000, 50000};
+
+void read_stats_reset(read_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+}
+
+void read_stats_record(read_stats_t *stats, uint32_t bytes, uint32_t elapsed_us)
+{
+    int bucket = 0;
+    while (bucket < READ_STATS_BUCKETS - 1 && elapsed_us >= read_stats_limits_us[bucket])
+        bucket++;
+    stats->histogram[bucket]++;
+    stats->reads++;
+    stats->bytes += bytes;
+    stats->busy_us += elapsed_us;
+    if (elapsed_us > stats->max_us)
+        stats->max_us = elapsed_us;
+}
+
+double read_stats_mbps(const read_stats_t *stats)
+{
+    return stats->busy_us > 0 ? (double)stats->bytes / stats->busy_us : 0.0;
+}
+
+uint32_t read_stats_percentile_us(const read_stats_t *stats, double fraction)
+{
+    if (stats->reads == 0)
+        return 0;
+    // 小さい方から数えて fraction * reads 回目(切り上げ)の読み込みが入っているバケット
+    uint32_t rank = (uint32_t)(fraction * stats->reads + 0.999999);
+    if (rank == 0)
+        rank = 1;
+    uint32_t seen = 0;
+    for (int bucket = 0; bucket < READ_STATS_BUCKETS - 1; bucket++)
+    {
+        seen += stats->histogram[bucket];
+        if (seen >= rank)
+            return read_stats_limits_us[bucket] < stats->max_us ? read_stats_limits_us[bucket] : stats->max_us;
+    }
+    return stats->max_us;
+}
+
+void read_stats_dump(const char *name, const read_stats_t *stats)
+{
+    Serial.printf("%s: %u reads, %u KB, %.2f MB/s, p50 %u us, p90 %u us, p99 %u us, max %u us\n\r", name,
+                  (unsigned)stats->reads, (unsigned)(stats->bytes / 1024), read_stats_mbps(stats),
+                  (unsigned)read_stats_percentile_us(stats, 0.5), (unsigned)read_stats_percentile_us(stats, 0.9),
+                  (unsigned)read_stats_percentile_us(stats, 0.99), (unsigned)stats->max_us);
+}
@@ -0,0 +1,37 @@
+#ifndef AUDIO_READ_STATS_H
+#define AUDIO_READ_STATS_H
+
+#include <stdint.h>
+
+// ストレージからの読み込みの、1回ごとのかかった時間とバイト数の統計です。
+// file_prefetch の補充と sector_reader の読み込みで使います。
+// かかった時間は READ_STATS_BUCKETS 個のバケットの分布にし、パーセンタイルはそのバケットの上限で返します。
+// 読み込み中の時間の合計も持つので、読み込んでいる間の転送速度(MB/s)が分かります。
+// 書き込むのは読み込む側(1つのコンテキスト)だけです。
+
+#define READ_STATS_BUCKETS 16
+
+// 分布の各バケットの上限(us)。最後のバケットはそれ以上
+extern const uint32_t read_stats_limits_us[READ_STATS_BUCKETS - 1];
+
+typedef struct
+{
+    uint32_t reads;     // 読み込みの回数
+    uint64_t bytes;     // 読み込んだバイト数
+    uint64_t busy_us;   // 読み込みにかかった時間の合計
+    uint32_t max_us;    // 1回の最大
+    uint32_t histogram[READ_STATS_BUCKETS];
+} read_stats_t;
+
+void read_stats_reset(read_stats_t *stats);
+void read_stats_record(read_stats_t *stats, uint32_t bytes, uint32_t elapsed_us);
+
+// 読み込んでいる間の転送速度(MB/s, 1MB = 1000000 バイト)
+double read_stats_mbps(const read_stats_t *stats);
+// fraction(0.5 なら中央値)の読み込みがこの時間(us)以下で終わっている。最後のバケットに入る場合は最大値を返します。
+uint32_t read_stats_percentile_us(const read_stats_t *stats, double fraction);
+
+// name の行に回数、MB/s、p50/p90/p99/最大を表示します。
+void read_stats_dump(const char *name, const read_stats_t *stats);
+
+#endif
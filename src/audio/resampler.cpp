@@ -0,0 +1,146 @@
+#include "resampler.h"
+
+#include <math.h>
+#include <string.h>
+
+static uint32_t resampler_gcd(uint32_t a, uint32_t b)
+{
+    while (b != 0)
+    {
+        uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// 窓関数付きsincのローパスフィルタ(長さ up * RESAMPLER_TAPS)を作り、フェーズごとに分ける。
+// 遮断周波数は入力と出力の低い方のナイキスト周波数の 0.9 倍。
+static void resampler_make_coefficients(resampler_t *resampler)
+{
+    const int up = resampler->up;
+    const int length = up * RESAMPLER_TAPS;
+    const double center = (length - 1) / 2.0;
+    const double cutoff = 0.45 / (up > resampler->down ? up : resampler->down); // アップサンプル後のサンプルあたりの周期
+    for (int phase = 0; phase < up; phase++)
+    {
+        double taps[RESAMPLER_TAPS];
+        double sum = 0;
+        for (int j = 0; j < RESAMPLER_TAPS; j++)
+        {
+            int n = phase + j * up;
+            double x = n - center;
+            double sinc = x == 0 ? 1.0 : sin(2 * M_PI * cutoff * x) / (2 * M_PI * cutoff * x);
+            double window = 0.42 - 0.5 * cos(2 * M_PI * (n + 0.5) / length) + 0.08 * cos(4 * M_PI * (n + 0.5) / length);
+            taps[j] = sinc * window;
+            sum += taps[j];
+        }
+        // フェーズごとに直流のゲインを1に揃える(フェーズ間のゲインの差は up/down 周期のノイズになる)。
+        // taps[j] は入力 x[position - j] に掛かるので、古い順に並べ直す。
+        int16_t *coefficients = &resampler->coefficients[phase * RESAMPLER_TAPS];
+        for (int j = 0; j < RESAMPLER_TAPS; j++)
+        {
+            long value = lrint(taps[j] / sum * 32768.0);
+            coefficients[RESAMPLER_TAPS - 1 - j] = (int16_t)(value > 32767 ? 32767 : value);
+        }
+    }
+}
+
+int resampler_configure(resampler_t *resampler, uint32_t input_rate, uint32_t output_rate, int num_channels)
+{
+    resampler->num_channels = (uint8_t)num_channels;
+    if (input_rate == resampler->input_rate && output_rate == resampler->output_rate)
+    {
+        resampler_reset(resampler);
+        return 0;
+    }
+    resampler->input_rate = input_rate;
+    resampler->output_rate = output_rate;
+    uint32_t gcd = resampler_gcd(input_rate, output_rate);
+    uint32_t up = gcd ? output_rate / gcd : 1;
+    uint32_t down = gcd ? input_rate / gcd : 1;
+    int result = 0;
+    if (up > RESAMPLER_MAX_PHASES || down > 0xffff)
+    {
+        up = down = 1;
+        result = -1;
+    }
+    resampler->up = up;
+    resampler->down = down;
+    if (resampler_active(resampler))
+        resampler_make_coefficients(resampler);
+    resampler_reset(resampler);
+    return result;
+}
+
+void resampler_reset(resampler_t *resampler)
+{
+    memset(resampler->input, 0, sizeof(resampler->input));
+    resampler->phase = 0;
+    resampler->count = RESAMPLER_TAPS - 1;
+    resampler->position = RESAMPLER_TAPS - 1;
+}
+
+static inline int16_t resampler_saturate(int32_t value)
+{
+    if (value > 32767)
+        return 32767;
+    if (value < -32768)
+        return -32768;
+    return (int16_t)value;
+}
+
+int resampler_process(resampler_t *resampler, int16_t *pcm_buffer, int num_samples, resampler_source_t source)
+{
+    const uint16_t up = resampler->up;
+    const uint16_t down = resampler->down;
+    const int channels = resampler->num_channels;
+    uint16_t phase = resampler->phase;
+    uint16_t position = resampler->position;
+    for (int k = 0; k < num_samples; k++)
+    {
+        if (position >= resampler->count)
+        {
+            // 最後の RESAMPLER_TAPS - 1 サンプルを先頭に残して次のブロックを読み込む。
+            uint16_t keep_from = resampler->count - (RESAMPLER_TAPS - 1);
+            memmove(resampler->input, &resampler->input[keep_from * channels], (RESAMPLER_TAPS - 1) * channels * sizeof(int16_t));
+            if (source(&resampler->input[(RESAMPLER_TAPS - 1) * channels], RESAMPLER_INPUT_BLOCK) == -1)
+                return -1;
+            resampler->count = RESAMPLER_TAPS - 1 + RESAMPLER_INPUT_BLOCK;
+            position -= keep_from;
+        }
+
+        // Q15 の係数の絶対値の和は2未満なので、32bitで積和してもあふれない。
+        const int16_t *coefficients = &resampler->coefficients[phase * RESAMPLER_TAPS];
+        const int16_t *input = &resampler->input[(position - (RESAMPLER_TAPS - 1)) * channels];
+        if (channels == 1)
+        {
+            int32_t mono = 1 << 14;
+            for (int j = 0; j < RESAMPLER_TAPS; j++)
+                mono += coefficients[j] * input[j];
+            pcm_buffer[k] = resampler_saturate(mono >> 15);
+        }
+        else
+        {
+            int32_t left = 1 << 14;
+            int32_t right = 1 << 14;
+            for (int j = 0; j < RESAMPLER_TAPS; j++)
+            {
+                left += coefficients[j] * input[j * 2];
+                right += coefficients[j] * input[j * 2 + 1];
+            }
+            pcm_buffer[k * 2] = resampler_saturate(left >> 15);
+            pcm_buffer[k * 2 + 1] = resampler_saturate(right >> 15);
+        }
+
+        phase += down;
+        while (phase >= up)
+        {
+            phase -= up;
+            position++;
+        }
+    }
+    resampler->phase = phase;
+    resampler->position = position;
+    return 0;
+}
@@ -0,0 +1,54 @@
+#ifndef AUDIO_RESAMPLER_H
+#define AUDIO_RESAMPLER_H
+
+#include <stdint.h>
+
+// 16bit(ステレオまたはモノラル)の固定小数点ポリフェーズのサンプリングレート変換です。
+// produce_audio() と SBC エンコーダの間に入り、WAVのサンプリング周波数を
+// ネゴシエーションされた周波数(44.1kHz / 48kHz)に合わせます。
+//
+// 入力と出力の比を既約分数 up/down にし、up 個のフェーズそれぞれに RESAMPLER_TAPS タップの
+// フィルタ係数(Q15)を持ちます。出力1サンプルにつきチャンネルあたり RESAMPLER_TAPS 回の積和だけで済みます。
+// 44.1kHz -> 48kHz は up = 160, down = 147 です。
+
+#define RESAMPLER_TAPS 16
+#define RESAMPLER_MAX_PHASES 160
+// 1回に入力から読み込むサンプル数
+#define RESAMPLER_INPUT_BLOCK 128
+
+// 入力を読み込む関数。produce_audio() と同じ形で、num_channels チャンネルの16bitを num_samples 分書き込みます。
+typedef int (*resampler_source_t)(int16_t *pcm_buffer, int num_samples);
+
+typedef struct
+{
+    uint32_t input_rate;
+    uint32_t output_rate;
+    uint16_t up;       // フェーズ数
+    uint16_t down;     // 出力1サンプルごとに進む量
+    uint16_t phase;    // 現在のフェーズ(0..up-1)
+    uint16_t position; // 次の出力に使う最新の入力サンプルの位置
+    uint16_t count;    // input に入っているサンプル数
+    uint8_t num_channels;
+    // フェーズごとの係数。入力の古い順に並べてある。
+    int16_t coefficients[RESAMPLER_MAX_PHASES * RESAMPLER_TAPS];
+    // 直前の RESAMPLER_TAPS - 1 サンプルと、新しく読み込んだブロック
+    int16_t input[(RESAMPLER_TAPS - 1 + RESAMPLER_INPUT_BLOCK) * 2] __attribute__((aligned(4)));
+} resampler_t;
+
+// 入力と出力の周波数から係数を作ります。周波数が同じなら変換しません(resampler_active が false)。
+// num_channels は 1 または 2 です(エンコーダのチャンネル数)。
+// 比が RESAMPLER_MAX_PHASES に収まらない場合は -1 を返し、変換しません。
+// 係数の計算に浮動小数点を使うので、比が変わったときだけ計算し直します。
+int resampler_configure(resampler_t *resampler, uint32_t input_rate, uint32_t output_rate, int num_channels);
+// 履歴を消します。次の出力は無音から始まります。
+void resampler_reset(resampler_t *resampler);
+
+static inline bool resampler_active(const resampler_t *resampler)
+{
+    return resampler->up != resampler->down;
+}
+
+// source から必要なだけ読み込み、num_samples 分の16bit(num_channels チャンネル)を pcm_buffer に書き込みます。
+int resampler_process(resampler_t *resampler, int16_t *pcm_buffer, int num_samples, resampler_source_t source);
+
+#endif
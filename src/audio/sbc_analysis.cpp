@@ -0,0 +1,118 @@
+#include "sbc_analysis.h"
+
+#include <string.h>
+#include "Arduino.h"
+
+// プロトタイプフィルタ C[i + 16 * j](A2DP仕様 表12.24)の Q17。
+// Y[i] = sum_j C[i + 16 * j] * X[i + 16 * j] の順に並べてある。
+// const にせず .data に置き、フラッシュ(XIP)の読み出し待ちを避ける。
+static int16_t sbc_analysis_window[16][5] = {
+    {0, 742, 8913, -8913, -742},
+    {21, 1052, 10877, -6971, -458},
+    {45, 1371, 12789, -5122, -216},
+    {73, 1671, 14575, -3422, -23},
+    {108, 1921, 16157, -1919, 118},
+    {149, 2085, 17467, -644, 212},
+    {194, 2126, 18449, 383, 261},
+    {234, 2008, 19057, 1161, 276},
+    {264, 1696, 19262, 1696, 264},
+    {276, 1161, 19057, 2008, 234},
+    {261, 383, 18449, 2126, 194},
+    {212, -644, 17467, 2085, 149},
+    {118, -1919, 16157, 1921, 108},
+    {-23, -3422, 14575, 1671, 73},
+    {-216, -5122, 12789, 1371, 45},
+    {-458, -6971, 10877, 1052, 21},
+};
+
+// cos((k + 0.5) * (i - 4) * pi / 8) の Q13。
+// M[k][i] = M[k][8 - i]、M[k][i] = -M[k][24 - i]、M[k][12] = 0 を使って、入力を
+//   Y[4], Y[3] + Y[5], Y[2] + Y[6], Y[1] + Y[7], Y[0] + Y[8], Y[9] - Y[15], Y[10] - Y[14], Y[11] - Y[13]
+// の8つに畳み込んだ後の行列。
+static int16_t sbc_analysis_matrix[8][8] = {
+    {8192, 8035, 7568, 6811, 5793, 4551, 3135, 1598},
+    {8192, 6811, 3135, -1598, -5793, -8035, -7568, -4551},
+    {8192, 4551, -3135, -8035, -5793, 1598, 7568, 6811},
+    {8192, 1598, -7568, -4551, 5793, 6811, -3135, -8035},
+    {8192, -1598, -7568, 4551, 5793, -6811, -3135, 8035},
+    {8192, -4551, -3135, 8035, -5793, -1598, 7568, -6811},
+    {8192, -6811, 3135, 1598, -5793, 8035, -7568, 4551},
+    {8192, -8035, 7568, -6811, 5793, -4551, 3135, -1598},
+};
+
+void sbc_analysis_init(sbc_analysis_t *analysis)
+{
+    memset(analysis->history, 0, sizeof(analysis->history));
+    analysis->position = 72;
+}
+
+// x は古い順に並んだ直近80サンプル。X[n] = x[79 - n]。
+static void __not_in_flash_func(sbc_analysis_block)(const int16_t *x, int32_t *out)
+{
+    // 窓掛け。Y はサブバンドサンプルと同じ単位の Q2。
+    // 係数の絶対値の和から |Y| < 2^15 なので、畳み込みの加減算も int32 で足りる。
+    int32_t y[16];
+    const int16_t *window = &sbc_analysis_window[0][0];
+    for (int i = 0; i < 16; i++)
+    {
+        const int16_t *p = &x[79 - i];
+        int32_t acc = window[0] * p[0];
+        acc += window[1] * p[-16];
+        acc += window[2] * p[-32];
+        acc += window[3] * p[-48];
+        acc += window[4] * p[-64];
+        y[i] = (acc + (1 << 14)) >> 15;
+        window += 5;
+    }
+
+    int32_t u[8];
+    u[0] = y[4];
+    u[1] = y[3] + y[5];
+    u[2] = y[2] + y[6];
+    u[3] = y[1] + y[7];
+    u[4] = y[0] + y[8];
+    u[5] = y[9] - y[15];
+    u[6] = y[10] - y[14];
+    u[7] = y[11] - y[13];
+
+    // 行列演算。Q2 x Q13 = Q15 で、全振幅の入力でも |S| * 2^15 < 2^31。
+    const int16_t *matrix = &sbc_analysis_matrix[0][0];
+    for (int k = 0; k < 8; k++)
+    {
+        int32_t acc = matrix[0] * u[0];
+        acc += matrix[1] * u[1];
+        acc += matrix[2] * u[2];
+        acc += matrix[3] * u[3];
+        acc += matrix[4] * u[4];
+        acc += matrix[5] * u[5];
+        acc += matrix[6] * u[6];
+        acc += matrix[7] * u[7];
+        out[k] = acc;
+        matrix += 8;
+    }
+}
+
+void __not_in_flash_func(sbc_analysis_process)(sbc_analysis_t *analysis, const int16_t *pcm, int num_blocks, int num_channels, int32_t *sb_samples)
+{
+    for (int block = 0; block < num_blocks; block++)
+    {
+        if (analysis->position + SBC_ANALYSIS_SUBBANDS > SBC_ANALYSIS_HISTORY)
+        {
+            // 直近の72サンプルを先頭に戻す。
+            for (int ch = 0; ch < num_channels; ch++)
+                memmove(analysis->history[ch], &analysis->history[ch][analysis->position - 72], 72 * sizeof(int16_t));
+            analysis->position = 72;
+        }
+        uint16_t position = analysis->position;
+        for (int ch = 0; ch < num_channels; ch++)
+        {
+            int16_t *history = &analysis->history[ch][position];
+            for (int n = 0; n < SBC_ANALYSIS_SUBBANDS; n++)
+                history[n] = pcm[n * num_channels + ch];
+            sbc_analysis_block(history + SBC_ANALYSIS_SUBBANDS - 80, sb_samples);
+            sb_samples += SBC_ANALYSIS_SUBBANDS;
+        }
+        analysis->position = position + SBC_ANALYSIS_SUBBANDS;
+        pcm += SBC_ANALYSIS_SUBBANDS * num_channels;
+    }
+}
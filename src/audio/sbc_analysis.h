@@ -0,0 +1,76 @@
+#ifndef AUDIO_SBC_ANALYSIS_H
+#define AUDIO_SBC_ANALYSIS_H
+
+#include <stdint.h>
+
+// 8サブバンドの SBC 分析フィルタバンク(A2DP仕様 12.5.1)を M0+ 向けに固定小数点で実装したものです。
+//  - 窓掛け: 80タップのプロトタイプ(Q17, int16)を Y[i] の計算順に並べ、16bit x 16bit = 32bit の積和だけで行う
+//  - 行列演算: cos 行列の対称性で 16 入力を 8 に畳み込み、8 x 8 の積和(Q13)にする
+//  - 履歴: ブロックごとに 72 サンプルをずらさず、SBC_ANALYSIS_HISTORY がいっぱいになったときだけ先頭に戻す
+// 64bit の乗算は使いません。実機では処理と係数を RAM に置きます。
+//
+// 出力はサブバンドサンプルを 2^SBC_ANALYSIS_OUTPUT_Q 倍したものです。
+// 仕様の式を倍精度で計算したものとの差は最大 3 LSB(16bit PCM の単位)です。host の `program analysis` で確認します。
+
+#define SBC_ANALYSIS_SUBBANDS 8
+#define SBC_ANALYSIS_MAX_CHANNELS 2
+#define SBC_ANALYSIS_OUTPUT_Q 15
+// 1チャンネルの履歴。4フレーム(16ブロック)ごとに1回だけ先頭にコピーする。
+#define SBC_ANALYSIS_HISTORY (72 + SBC_ANALYSIS_SUBBANDS * 16 * 4)
+
+typedef struct
+{
+    int16_t history[SBC_ANALYSIS_MAX_CHANNELS][SBC_ANALYSIS_HISTORY];
+    uint16_t position; // 次のサンプルを書く位置
+} sbc_analysis_t;
+
+void sbc_analysis_init(sbc_analysis_t *analysis);
+
+// インターリーブされた16bit PCM(num_blocks * 8 サンプル x num_channels)を分析し、
+// sb_samples[block][channel][subband] の順に書き込みます。
+void sbc_analysis_process(sbc_analysis_t *analysis, const int16_t *pcm, int num_blocks, int num_channels, int32_t *sb_samples);
+
+// bluedroid の SbcAnalysisFilter8 との比較とベンチマークです(sbc_analysis_bluedroid.cpp)。--wrap しないビルドでも使えます。
+// bluedroid の s32SbBuffer は、仕様の式のサブバンドサンプル(16bit PCM の単位)の Q14 のはずです。
+// SBC_Encoder はスケールファクタを |s32SbBuffer| <= 0x8000 << scf で決め、sbc_packing は (s32SbBuffer >> 2) を
+// 2^(scf+1) << 12 と比べて量子化するので、2^(scf+1) が 2^(scf+15) に当たります。この実装の出力(Q15)を1ビット右に丸めます。
+// このスケールは実機の bluedroid ではまだ確かめていません。シリアルの `b` で sbc_analysis_bluedroid_check() の結果を見てから
+// SBC_ANALYSIS_FAST を有効にします。
+#define SBC_ANALYSIS_BLUEDROID_SHIFT (-1)
+// 許容誤差: 差の最大(16bit PCM の単位)と、bluedroid / この実装のスケール(最小二乗)の 1 からのずれ
+#define SBC_ANALYSIS_BLUEDROID_MAX_DIFFERENCE 4.0
+#define SBC_ANALYSIS_BLUEDROID_SCALE_TOLERANCE 0.01
+
+typedef struct
+{
+    double max_difference; // 差の最大(16bit PCM の単位)
+    double dot;            // bluedroid の出力とこの実装の出力の内積
+    double power;          // この実装の出力の2乗和
+    uint32_t frames;
+} sbc_analysis_diff_t;
+
+// 両方の実装の履歴を消します。
+void sbc_analysis_bluedroid_reset(void);
+// 同じ PCM を bluedroid の実装とこの実装で分析し、どちらも s32SbBuffer の単位で返します。
+void sbc_analysis_bluedroid_compare(const int16_t *pcm, int num_blocks, int num_channels, int32_t *bluedroid_out, int32_t *fast_out);
+// 1フレーム(16ブロック x num_channels)を両方の実装で分析し、差を diff に足します。
+void sbc_analysis_bluedroid_accumulate(const int16_t *pcm, int num_channels, sbc_analysis_diff_t *diff);
+// bluedroid / この実装のスケール(最小二乗)
+double sbc_analysis_diff_scale(const sbc_analysis_diff_t *diff);
+// 差とスケールが許容誤差に入っているか
+bool sbc_analysis_diff_ok(const sbc_analysis_diff_t *diff);
+// 実機で、ノイズ・矩形波・スイープを両方の実装で分析して差とスケールを表示し、全部許容誤差に入っていれば true を返します。
+// bluedroid の履歴を使うので、ストリーミングしていないときに呼びます。
+bool sbc_analysis_bluedroid_check(void);
+// 実機で1フレーム(16ブロック x 2チャンネル)の分析にかかる時間とサイクル数を両方の実装で測って表示します。
+// bluedroid の履歴を使うので、ストリーミングしていないときに呼びます。
+void sbc_analysis_benchmark(void);
+
+#ifdef SBC_ANALYSIS_FAST
+// bluedroid エンコーダの SbcAnalysisFilter8 をリンカの --wrap でこの実装に置き換えます(sbc_analysis_bluedroid.cpp)。
+// platformio.ini の build_flags で SBC_ANALYSIS_FAST と --wrap を一緒に指定します。
+// 置き換えても既定では bluedroid の実装を使い、sbc_analysis_set_fast(true) でこの実装にします。
+void sbc_analysis_set_fast(bool enable);
+#endif
+
+#endif
@@ -0,0 +1,214 @@
+#include "sbc_analysis.h"
+
+#include <math.h>
+#include <string.h>
+#include "Arduino.h"
+#include "sbc_encoder.h"
+
+#ifdef SBC_ANALYSIS_FAST
+// リンカの --wrap=SbcAnalysisFilter8 --wrap=SbcAnalysisInit で、bluedroid の SBC_Encoder からの呼び出しがここに来る。
+extern "C" void __real_SbcAnalysisFilter8(SBC_ENC_PARAMS *params);
+extern "C" void __real_SbcAnalysisInit(void);
+extern "C" void __wrap_SbcAnalysisFilter8(SBC_ENC_PARAMS *params);
+extern "C" void __wrap_SbcAnalysisInit(void);
+#define sbc_analysis_bluedroid_filter __real_SbcAnalysisFilter8
+#define sbc_analysis_bluedroid_init __real_SbcAnalysisInit
+#else
+// --wrap しないビルド(env:picow の既定)では、エンコーダはそのまま bluedroid の分析を使い、比べるときだけ直接呼ぶ。
+extern "C" void SbcAnalysisFilter8(SBC_ENC_PARAMS *params);
+extern "C" void SbcAnalysisInit(void);
+#define sbc_analysis_bluedroid_filter SbcAnalysisFilter8
+#define sbc_analysis_bluedroid_init SbcAnalysisInit
+#endif
+
+// エンコーダと同じコアだけが触る。
+static sbc_analysis_t fast_analysis;
+
+static void sbc_analysis_to_bluedroid(int32_t *sb_samples, int count)
+{
+#if SBC_ANALYSIS_BLUEDROID_SHIFT > 0
+    for (int i = 0; i < count; i++)
+        sb_samples[i] <<= SBC_ANALYSIS_BLUEDROID_SHIFT;
+#elif SBC_ANALYSIS_BLUEDROID_SHIFT < 0
+    const int32_t round = 1 << (-SBC_ANALYSIS_BLUEDROID_SHIFT - 1);
+    for (int i = 0; i < count; i++)
+        sb_samples[i] = (sb_samples[i] + round) >> -SBC_ANALYSIS_BLUEDROID_SHIFT;
+#else
+    (void)sb_samples;
+    (void)count;
+#endif
+}
+
+#ifdef SBC_ANALYSIS_FAST
+// SBC_Encoder の分析をこの実装にするか。出力のスケールを実機の bluedroid と比べて確かめるまでは false のままにする。
+static bool fast_enabled = false;
+
+extern "C" void __wrap_SbcAnalysisInit(void)
+{
+    __real_SbcAnalysisInit();
+    sbc_analysis_init(&fast_analysis);
+}
+
+extern "C" void __not_in_flash_func(__wrap_SbcAnalysisFilter8)(SBC_ENC_PARAMS *params)
+{
+    if (!fast_enabled)
+    {
+        __real_SbcAnalysisFilter8(params);
+        return;
+    }
+    int num_blocks = params->s16NumOfBlocks;
+    int num_channels = params->s16NumOfChannels;
+    sbc_analysis_process(&fast_analysis, params->ps16NextPcmBuffer, num_blocks, num_channels, params->s32SbBuffer);
+    sbc_analysis_to_bluedroid(params->s32SbBuffer, num_blocks * num_channels * SBC_ANALYSIS_SUBBANDS);
+    params->ps16NextPcmBuffer += num_blocks * num_channels * SBC_ANALYSIS_SUBBANDS;
+}
+
+void sbc_analysis_set_fast(bool enable)
+{
+    fast_enabled = enable;
+}
+#endif
+
+void sbc_analysis_bluedroid_reset(void)
+{
+    sbc_analysis_bluedroid_init();
+    sbc_analysis_init(&fast_analysis);
+}
+
+void sbc_analysis_bluedroid_compare(const int16_t *pcm, int num_blocks, int num_channels, int32_t *bluedroid_out, int32_t *fast_out)
+{
+    static SBC_ENC_PARAMS params;
+    int count = num_blocks * num_channels * SBC_ANALYSIS_SUBBANDS;
+    params.s16NumOfSubBands = SBC_ANALYSIS_SUBBANDS;
+    params.s16NumOfBlocks = num_blocks;
+    params.s16NumOfChannels = num_channels;
+    params.ps16NextPcmBuffer = (SINT16 *)pcm;
+    sbc_analysis_bluedroid_filter(&params);
+    memcpy(bluedroid_out, params.s32SbBuffer, count * sizeof(int32_t));
+    sbc_analysis_process(&fast_analysis, pcm, num_blocks, num_channels, fast_out);
+    sbc_analysis_to_bluedroid(fast_out, count);
+}
+
+void sbc_analysis_benchmark(void)
+{
+    static int16_t pcm[16 * SBC_ANALYSIS_SUBBANDS * 2];
+    static int32_t fast_out[16 * SBC_ANALYSIS_SUBBANDS * 2];
+    const int iterations = 200;
+    uint32_t seed = 1;
+    for (size_t i = 0; i < sizeof(pcm) / sizeof(pcm[0]); i++)
+    {
+        seed = seed * 1103515245u + 12345u;
+        pcm[i] = (int16_t)(seed >> 16);
+    }
+
+    static SBC_ENC_PARAMS params;
+    params.s16NumOfSubBands = SBC_ANALYSIS_SUBBANDS;
+    params.s16NumOfBlocks = 16;
+    params.s16NumOfChannels = 2;
+    uint32_t start = micros();
+    for (int i = 0; i < iterations; i++)
+    {
+        params.ps16NextPcmBuffer = pcm;
+        sbc_analysis_bluedroid_filter(&params);
+    }
+    uint32_t bluedroid_us = micros() - start;
+
+    start = micros();
+    for (int i = 0; i < iterations; i++)
+        sbc_analysis_process(&fast_analysis, pcm, 16, 2, fast_out);
+    uint32_t fast_us = micros() - start;
+
+#ifdef F_CPU
+    const double cycles_per_us = F_CPU / 1e6;
+#else
+    const double cycles_per_us = 0;
+#endif
+    Serial.printf("SBC analysis (16 blocks x 8 subbands x 2 ch): bluedroid %.1f us/frame (%.0f cycles), fast %.1f us/frame (%.0f cycles)\n\r",
+                  (double)bluedroid_us / iterations, cycles_per_us * bluedroid_us / iterations,
+                  (double)fast_us / iterations, cycles_per_us * fast_us / iterations);
+    sbc_analysis_bluedroid_reset();
+}
+
+void sbc_analysis_bluedroid_accumulate(const int16_t *pcm, int num_channels, sbc_analysis_diff_t *diff)
+{
+    static int32_t bluedroid_out[16 * SBC_ANALYSIS_SUBBANDS * SBC_ANALYSIS_MAX_CHANNELS];
+    static int32_t fast_out[16 * SBC_ANALYSIS_SUBBANDS * SBC_ANALYSIS_MAX_CHANNELS];
+    const int count = 16 * num_channels * SBC_ANALYSIS_SUBBANDS;
+    const double lsb = (double)(1 << SBC_ANALYSIS_OUTPUT_Q) * pow(2.0, SBC_ANALYSIS_BLUEDROID_SHIFT);
+    sbc_analysis_bluedroid_compare(pcm, 16, num_channels, bluedroid_out, fast_out);
+    for (int i = 0; i < count; i++)
+    {
+        double difference = fabs((double)bluedroid_out[i] - fast_out[i]) / lsb;
+        if (difference > diff->max_difference)
+            diff->max_difference = difference;
+        diff->dot += (double)bluedroid_out[i] * fast_out[i];
+        diff->power += (double)fast_out[i] * fast_out[i];
+    }
+    diff->frames++;
+}
+
+double sbc_analysis_diff_scale(const sbc_analysis_diff_t *diff)
+{
+    return diff->power > 0 ? diff->dot / diff->power : 1;
+}
+
+bool sbc_analysis_diff_ok(const sbc_analysis_diff_t *diff)
+{
+    return diff->max_difference <= SBC_ANALYSIS_BLUEDROID_MAX_DIFFERENCE &&
+           fabs(sbc_analysis_diff_scale(diff) - 1) <= SBC_ANALYSIS_BLUEDROID_SCALE_TOLERANCE;
+}
+
+bool sbc_analysis_bluedroid_check(void)
+{
+    static int16_t pcm[16 * SBC_ANALYSIS_SUBBANDS * 2];
+    static const char *const names[] = {"noise", "square", "sweep"};
+    const int num_frames = 200; // 48kHz で 0.5 秒
+    const int frame_samples = 16 * SBC_ANALYSIS_SUBBANDS;
+    bool ok = true;
+    for (int signal = 0; signal < 3; signal++)
+    {
+        sbc_analysis_diff_t diff;
+        memset(&diff, 0, sizeof(diff));
+        sbc_analysis_bluedroid_reset();
+        uint32_t seed = 1;
+        float phase = 0;
+        for (int frame = 0; frame < num_frames; frame++)
+        {
+            for (int i = 0; i < frame_samples; i++)
+            {
+                int n = frame * frame_samples + i;
+                int16_t left, right;
+                switch (signal)
+                {
+                case 0:
+                    seed = seed * 1103515245u + 12345u;
+                    left = (int16_t)(seed >> 16);
+                    seed = seed * 1103515245u + 12345u;
+                    right = (int16_t)(seed >> 16);
+                    break;
+                case 1:
+                    left = (n / 37) % 2 ? 32767 : -32768;
+                    right = (n / 5) % 2 ? 32767 : -32768;
+                    break;
+                default:
+                    // 20Hz から 20kHz までのスイープ
+                    phase += 2 * (float)M_PI * 20.0f * powf(1000.0f, (float)n / (num_frames * frame_samples)) / 48000;
+                    if (phase > 2 * (float)M_PI)
+                        phase -= 2 * (float)M_PI;
+                    left = (int16_t)(30000 * sinf(phase));
+                    right = (int16_t)(-20000 * sinf(phase));
+                    break;
+                }
+                pcm[i * 2] = left;
+                pcm[i * 2 + 1] = right;
+            }
+            sbc_analysis_bluedroid_accumulate(pcm, 2, &diff);
+        }
+        bool signal_ok = sbc_analysis_diff_ok(&diff);
+        Serial.printf("SBC analysis vs bluedroid, %-6s (%u frames): max difference %.3f LSB, bluedroid / fast scale %.4f -> %s\n\r",
+                      names[signal], (unsigned)diff.frames, diff.max_difference, sbc_analysis_diff_scale(&diff), signal_ok ? "OK" : "NG");
+        ok = ok && signal_ok;
+    }
+    sbc_analysis_bluedroid_reset();
+    return ok;
+}
@@ -0,0 +1,107 @@
+#include "sbc_fanout.h"
+
+#include <string.h>
+
+void sbc_fanout_init(sbc_fanout_t *fanout)
+{
+    fanout->head = 0;
+    memset(fanout->readers, 0, sizeof(fanout->readers));
+    fanout->frames = 0;
+    fanout->reads = 0;
+}
+
+int sbc_fanout_add_reader(sbc_fanout_t *fanout)
+{
+    for (int i = 0; i < SBC_FANOUT_MAX_READERS; i++)
+    {
+        sbc_fanout_reader_t *reader = &fanout->readers[i];
+        if (reader->active)
+            continue;
+        reader->active = 1;
+        reader->tail = fanout->head;
+        reader->lost = 0;
+        reader->lost_total = 0;
+        reader->max_level = 0;
+        return i;
+    }
+    return -1;
+}
+
+void sbc_fanout_remove_reader(sbc_fanout_t *fanout, int reader)
+{
+    fanout->readers[reader].active = 0;
+}
+
+int sbc_fanout_num_readers(const sbc_fanout_t *fanout)
+{
+    int count = 0;
+    for (const sbc_fanout_reader_t &reader : fanout->readers)
+        count += reader.active;
+    return count;
+}
+
+uint32_t sbc_fanout_level(const sbc_fanout_t *fanout, int reader)
+{
+    return fanout->head - fanout->readers[reader].tail;
+}
+
+void sbc_fanout_flush(sbc_fanout_t *fanout)
+{
+    for (sbc_fanout_reader_t &reader : fanout->readers)
+        reader.tail = fanout->head;
+}
+
+sbc_frame_slot_t *sbc_fanout_acquire(sbc_fanout_t *fanout)
+{
+    // このスロットを最後に読むのは、リング1周分遅れている読み出し側。
+    for (sbc_fanout_reader_t &reader : fanout->readers)
+    {
+        if (reader.active && fanout->head - reader.tail >= SBC_FANOUT_SLOTS)
+        {
+            reader.tail++;
+            reader.lost++;
+            reader.lost_total++;
+        }
+    }
+    return &fanout->slots[fanout->head & (SBC_FANOUT_SLOTS - 1)];
+}
+
+void sbc_fanout_push(sbc_fanout_t *fanout)
+{
+    fanout->head++;
+    fanout->frames++;
+    for (sbc_fanout_reader_t &reader : fanout->readers)
+    {
+        uint32_t level = fanout->head - reader.tail;
+        if (reader.active && level > reader.max_level)
+            reader.max_level = level;
+    }
+}
+
+const sbc_frame_slot_t *sbc_fanout_front(const sbc_fanout_t *fanout, int reader)
+{
+    uint32_t tail = fanout->readers[reader].tail;
+    if (tail == fanout->head)
+        return NULL;
+    return &fanout->slots[tail & (SBC_FANOUT_SLOTS - 1)];
+}
+
+void sbc_fanout_pop(sbc_fanout_t *fanout, int reader)
+{
+    fanout->readers[reader].tail++;
+    fanout->reads++;
+}
+
+uint32_t sbc_fanout_take_lost(sbc_fanout_t *fanout, int reader)
+{
+    uint32_t lost = fanout->readers[reader].lost;
+    fanout->readers[reader].lost = 0;
+    return lost;
+}
+
+void sbc_fanout_get_reader_stats(const sbc_fanout_t *fanout, int reader, sbc_fanout_reader_stats_t *stats)
+{
+    stats->lost = fanout->readers[reader].lost_total;
+    stats->level = sbc_fanout_level(fanout, reader);
+    stats->max_level = fanout->readers[reader].max_level;
+}
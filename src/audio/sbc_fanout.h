@@ -0,0 +1,70 @@
+#ifndef AUDIO_SBC_FANOUT_H
+#define AUDIO_SBC_FANOUT_H
+
+#include <stdint.h>
+#include "sbc_frame_queue.h"
+
+// 1回だけエンコードしたSBCフレームを、複数のシンク(A2DPの接続)に渡すためのリングです。
+// 書き込み側1つ・読み出し側 SBC_FANOUT_MAX_READERS 個で、読み出し側はそれぞれ自分の読み出し位置(tail)を持ちます。
+// フレームはコピーせずにリングに置いたまま、どのシンクもそのスロットを指して読み、全部の読み出し側が読み終える
+// (一番遅い tail が通り過ぎる)までスロットを再利用しません。
+//
+// 書き込みも読み出しもコア0(BTstack のコンテキスト)だけで行うので、排他はしません。
+// デュアルコアモードでは、コア1が sbc_frame_queue に積んだフレームをコア0がこのリングに移します。
+//
+// 一番遅い読み出し側がリング1周分遅れたまま書き込むと、その読み出し側の一番古いフレームを上書きし、
+// 読めなかったフレームとして数えます(sbc_fanout_take_lost())。
+
+#define SBC_FANOUT_MAX_READERS 2
+#define SBC_FANOUT_SLOTS 64 // 2のべき乗。48kHz(128サンプル/フレーム)で約170ms
+
+typedef struct
+{
+    uint8_t active;
+    uint32_t tail;       // 次に読むフレームの番号
+    uint32_t lost;       // 上書きされて読めなかった、まだ読み出し側に渡していないフレーム数
+    uint32_t lost_total; // その合計
+    uint32_t max_level;  // 読んでいないフレーム数の最大
+} sbc_fanout_reader_t;
+
+typedef struct
+{
+    uint32_t lost;      // 上書きされて読めなかったフレーム数の合計
+    uint32_t level;     // 今読んでいないフレーム数
+    uint32_t max_level; // その最大
+} sbc_fanout_reader_stats_t;
+
+typedef struct
+{
+    sbc_frame_slot_t slots[SBC_FANOUT_SLOTS];
+    uint32_t head; // 次に書くフレームの番号
+    sbc_fanout_reader_t readers[SBC_FANOUT_MAX_READERS];
+    uint32_t frames; // 書いたフレーム数
+    uint32_t reads;  // 全部の読み出し側が読んだフレーム数の合計
+} sbc_fanout_t;
+
+void sbc_fanout_init(sbc_fanout_t *fanout);
+
+// 読み出し側を加え、その番号を返します(空きが無ければ -1)。次に書くフレームから読みます。
+int sbc_fanout_add_reader(sbc_fanout_t *fanout);
+void sbc_fanout_remove_reader(sbc_fanout_t *fanout, int reader);
+int sbc_fanout_num_readers(const sbc_fanout_t *fanout);
+// 読み出し側がまだ読んでいないフレーム数
+uint32_t sbc_fanout_level(const sbc_fanout_t *fanout, int reader);
+// 全部の読み出し側の読み出し位置を書き込み位置に合わせます(エンコーダの設定が変わったとき)。
+void sbc_fanout_flush(sbc_fanout_t *fanout);
+
+// 書き込み側: 次に書くスロットを返します。一番遅い読み出し側がまだ読んでいなければ、そのフレームを読めなかったことにします。
+// data を書いてから sbc_fanout_push() します。
+sbc_frame_slot_t *sbc_fanout_acquire(sbc_fanout_t *fanout);
+void sbc_fanout_push(sbc_fanout_t *fanout);
+
+// 読み出し側: 次に読むスロットを返します(全部読んでいれば NULL)。使い終わったら sbc_fanout_pop() します。
+const sbc_frame_slot_t *sbc_fanout_front(const sbc_fanout_t *fanout, int reader);
+void sbc_fanout_pop(sbc_fanout_t *fanout, int reader);
+// 前回から上書きされて読めなかったフレーム数を返してクリアします。
+uint32_t sbc_fanout_take_lost(sbc_fanout_t *fanout, int reader);
+
+void sbc_fanout_get_reader_stats(const sbc_fanout_t *fanout, int reader, sbc_fanout_reader_stats_t *stats);
+
+#endif
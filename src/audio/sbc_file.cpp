@@ -0,0 +1,95 @@
+#include "sbc_file.h"
+
+#include <string.h>
+
+static void sbc_file_put16(uint8_t *p, uint16_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void sbc_file_put32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static uint16_t sbc_file_get16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t sbc_file_get32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+void sbc_file_header_encode(const sbc_file_header_t *header, uint8_t *buffer)
+{
+    memset(buffer, 0, SBC_FILE_HEADER_SIZE);
+    memcpy(buffer, SBC_FILE_MAGIC, 4);
+    sbc_file_put16(buffer + 4, SBC_FILE_VERSION);
+    sbc_file_put16(buffer + 6, SBC_FILE_HEADER_SIZE);
+    sbc_file_put32(buffer + 8, header->sampling_frequency);
+    buffer[12] = header->channel_mode;
+    buffer[13] = header->allocation_method;
+    buffer[14] = header->block_length;
+    buffer[15] = header->subbands;
+    buffer[16] = header->bitpool;
+    sbc_file_put16(buffer + 18, header->frame_length);
+    sbc_file_put16(buffer + 20, header->samples_per_frame);
+    sbc_file_put32(buffer + 24, header->num_frames);
+    sbc_file_put32(buffer + 28, header->data_offset);
+    sbc_file_put32(buffer + 32, header->index_offset);
+    sbc_file_put32(buffer + 36, header->index_count);
+}
+
+int sbc_file_header_decode(const uint8_t *buffer, sbc_file_header_t *header)
+{
+    if (memcmp(buffer, SBC_FILE_MAGIC, 4) != 0 || sbc_file_get16(buffer + 4) != SBC_FILE_VERSION)
+        return -1;
+    header->sampling_frequency = sbc_file_get32(buffer + 8);
+    header->channel_mode = buffer[12];
+    header->allocation_method = buffer[13];
+    header->block_length = buffer[14];
+    header->subbands = buffer[15];
+    header->bitpool = buffer[16];
+    header->frame_length = sbc_file_get16(buffer + 18);
+    header->samples_per_frame = sbc_file_get16(buffer + 20);
+    header->num_frames = sbc_file_get32(buffer + 24);
+    header->data_offset = sbc_file_get32(buffer + 28);
+    header->index_offset = sbc_file_get32(buffer + 32);
+    header->index_count = sbc_file_get32(buffer + 36);
+    header->data_size = header->index_offset - header->data_offset;
+    if (header->data_offset < SBC_FILE_HEADER_SIZE || header->index_offset < header->data_offset)
+        return -1;
+    return 0;
+}
+
+bool sbc_file_matches(const sbc_file_header_t *header, const media_codec_configuration_sbc_t *configuration)
+{
+    return header->sampling_frequency == (uint32_t)configuration->sampling_frequency &&
+           header->channel_mode == configuration->channel_mode &&
+           header->allocation_method == configuration->allocation_method &&
+           header->block_length == configuration->block_length &&
+           header->subbands == configuration->subbands &&
+           header->bitpool >= configuration->min_bitpool_value &&
+           header->bitpool <= configuration->max_bitpool_value;
+}
+
+uint16_t sbc_file_frame_length(const uint8_t *frame)
+{
+    static const int sampling_frequencies[] = {16000, 32000, 44100, 48000};
+    if (frame[0] != 0x9c)
+        return 0;
+    media_codec_configuration_sbc_t configuration;
+    configuration.sampling_frequency = sampling_frequencies[frame[1] >> 6];
+    configuration.block_length = ((frame[1] >> 4) & 3) * 4 + 4;
+    configuration.channel_mode = (btstack_sbc_channel_mode_t)((frame[1] >> 2) & 3);
+    configuration.allocation_method = (btstack_sbc_allocation_method_t)((frame[1] >> 1) & 1);
+    configuration.subbands = (frame[1] & 1) ? 8 : 4;
+    configuration.num_channels = configuration.channel_mode == SBC_CHANNEL_MODE_MONO ? 1 : 2;
+    return audio_sbc_frame_length(&configuration, frame[2]);
+}
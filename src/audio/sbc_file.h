@@ -0,0 +1,47 @@
+#ifndef AUDIO_SBC_FILE_H
+#define AUDIO_SBC_FILE_H
+
+#include <stdint.h>
+#include "audio_pipeline.h"
+
+// エンコード済みSBCのコンテナ(.sbc)の形式です。ホストの transcode コマンドで WAV から作ります。
+//
+//   ヘッダ(SBC_FILE_HEADER_SIZE バイト、リトルエンディアン)
+//   SBCフレーム(A2DP の SBC フレームをそのまま並べたもの)
+//   インデックス(SBC_FILE_INDEX_INTERVAL フレームごとのフレームの先頭のファイル内の位置、uint32_t)
+//
+// フレームはそれぞれのヘッダから長さがわかるので、インデックスの間は順にたどります。
+
+#define SBC_FILE_MAGIC "PSBC"
+#define SBC_FILE_VERSION 1
+#define SBC_FILE_HEADER_SIZE 40
+#define SBC_FILE_INDEX_INTERVAL 32
+
+typedef struct
+{
+    uint32_t sampling_frequency;
+    uint8_t channel_mode;      // btstack_sbc_channel_mode_t
+    uint8_t allocation_method; // btstack_sbc_allocation_method_t
+    uint8_t block_length;
+    uint8_t subbands;
+    uint8_t bitpool;
+    uint16_t frame_length;      // 1フレームのバイト数
+    uint16_t samples_per_frame; // block_length * subbands
+    uint32_t num_frames;
+    uint32_t data_offset;  // 最初のフレームの位置
+    uint32_t data_size;    // フレームの合計バイト数
+    uint32_t index_offset; // インデックスの位置
+    uint32_t index_count;  // インデックスの数
+} sbc_file_header_t;
+
+void sbc_file_header_encode(const sbc_file_header_t *header, uint8_t *buffer);
+// 形式が違う場合は -1 を返します。
+int sbc_file_header_decode(const uint8_t *buffer, sbc_file_header_t *header);
+
+// ネゴシエーションされた設定でそのまま送れるか(同じ周波数・モードで、ビットプールが範囲内か)
+bool sbc_file_matches(const sbc_file_header_t *header, const media_codec_configuration_sbc_t *configuration);
+
+// SBCフレームのヘッダ(先頭3バイト)からフレームのバイト数を求めます。同期ワードが違う場合は 0 を返します。
+uint16_t sbc_file_frame_length(const uint8_t *frame);
+
+#endif
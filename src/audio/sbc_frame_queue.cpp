@@ -0,0 +1,44 @@
+#include "sbc_frame_queue.h"
+
+void sbc_frame_queue_init(sbc_frame_queue_t *queue)
+{
+    queue->head.store(0, std::memory_order_relaxed);
+    queue->tail.store(0, std::memory_order_relaxed);
+    queue->underruns = 0;
+    queue->max_level = 0;
+}
+
+sbc_frame_slot_t *sbc_frame_queue_acquire(sbc_frame_queue_t *queue)
+{
+    uint32_t head = queue->head.load(std::memory_order_relaxed);
+    if (head - queue->tail.load(std::memory_order_acquire) >= SBC_FRAME_QUEUE_SLOTS)
+        return NULL;
+    return &queue->slots[head & (SBC_FRAME_QUEUE_SLOTS - 1)];
+}
+
+void sbc_frame_queue_push(sbc_frame_queue_t *queue)
+{
+    // スロットを書いてから head を進める(release)。
+    uint32_t head = queue->head.load(std::memory_order_relaxed) + 1;
+    queue->head.store(head, std::memory_order_release);
+    uint32_t level = head - queue->tail.load(std::memory_order_relaxed);
+    if (level > queue->max_level)
+        queue->max_level = level;
+}
+
+const sbc_frame_slot_t *sbc_frame_queue_front(sbc_frame_queue_t *queue)
+{
+    uint32_t tail = queue->tail.load(std::memory_order_relaxed);
+    if (queue->head.load(std::memory_order_acquire) == tail)
+    {
+        queue->underruns++;
+        return NULL;
+    }
+    return &queue->slots[tail & (SBC_FRAME_QUEUE_SLOTS - 1)];
+}
+
+void sbc_frame_queue_pop(sbc_frame_queue_t *queue)
+{
+    // スロットを読み終えてから tail を進める(release)。書き込み側はその後でスロットを再利用する。
+    queue->tail.store(queue->tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
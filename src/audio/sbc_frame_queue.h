@@ -0,0 +1,48 @@
+#ifndef AUDIO_SBC_FRAME_QUEUE_H
+#define AUDIO_SBC_FRAME_QUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+// エンコード済みのSBCフレームを渡すための、書き込み側1つ・読み出し側1つ(SPSC)のロックフリーキューです。
+// デュアルコアモードでは、コア1がエンコードしたフレームを積み、コア0がRTPパケットに詰めるときに取り出します。
+// スロットは固定長で、1スロットに1フレームを入れます。
+
+#define SBC_FRAME_QUEUE_SLOTS 32 // 2のべき乗
+#define SBC_FRAME_MAX_SIZE 256   // 8サブバンド/16ブロックでビットプール53のデュアルチャンネルでも224バイト
+
+typedef struct
+{
+    uint16_t length;
+    uint16_t generation; // エンコーダ設定の世代。設定が変わる前のフレームを読み出し側で捨てるために使う
+    uint8_t landing;     // 新しい位置(曲の先頭・シーク先)の最初のフレーム。1: 曲の切り替わり、2: 要求したシーク・曲の指定
+    uint32_t landing_ms; // そのときの曲の中の位置(ms)
+    uint8_t data[SBC_FRAME_MAX_SIZE];
+} sbc_frame_slot_t;
+
+typedef struct
+{
+    sbc_frame_slot_t slots[SBC_FRAME_QUEUE_SLOTS];
+    std::atomic<uint32_t> head; // 書き込み側だけが更新
+    std::atomic<uint32_t> tail; // 読み出し側だけが更新
+    uint32_t underruns;         // 読み出し側が空のキューを見た回数
+    uint32_t max_level;         // 書き込み側から見た最大の深さ
+} sbc_frame_queue_t;
+
+void sbc_frame_queue_init(sbc_frame_queue_t *queue);
+
+static inline uint32_t sbc_frame_queue_level(const sbc_frame_queue_t *queue)
+{
+    return queue->head.load(std::memory_order_acquire) - queue->tail.load(std::memory_order_acquire);
+}
+
+// 書き込み側: 空きスロットを返します(満杯なら NULL)。data を書いてから sbc_frame_queue_push() します。
+sbc_frame_slot_t *sbc_frame_queue_acquire(sbc_frame_queue_t *queue);
+void sbc_frame_queue_push(sbc_frame_queue_t *queue);
+
+// 読み出し側: 先頭のスロットを返します(空なら NULL)。使い終わったら sbc_frame_queue_pop() します。
+const sbc_frame_slot_t *sbc_frame_queue_front(sbc_frame_queue_t *queue);
+void sbc_frame_queue_pop(sbc_frame_queue_t *queue);
+
+#endif
@@ -0,0 +1,209 @@
+#include "sbc_source.h"
+
+#include "Arduino.h"
+
+static const uint32_t SBC_PREFETCH_SIZE = FILE_PREFETCH_BLOCK_SIZE * SBC_PREFETCH_NUM_BLOCKS;
+
+static File sbc_file;
+static sbc_file_header_t sbc_header;
+static bool sbc_open;
+static bool sbc_loop;
+static uint32_t sbc_position;
+// 末尾で閉じた後にシークするときに開き直す。
+static fs::FS *sbc_fs;
+static char sbc_path[64];
+
+// シークの要求。要求する側が sbc_request_frame を書いてから sbc_request_sequence を進める。
+static std::atomic<uint32_t> sbc_request_frame;
+static std::atomic<uint32_t> sbc_request_sequence;
+static uint32_t sbc_request_done;
+// シーク先。書き込み側がリングに読み込む前に書き、読み出し側が最初のフレームを読んだら sbc_position にする。
+static uint32_t sbc_seek_target;
+static uint32_t sbc_flushes_seen;
+static std::atomic<uint32_t> sbc_landings;
+static uint32_t sbc_landing_frame;
+
+static uint8_t sbc_prefetch_buffer[SBC_PREFETCH_SIZE] __attribute__((aligned(4)));
+static file_prefetch_t sbc_prefetch;
+
+int sbc_source_open(fs::FS &fs, const char *path, bool loop)
+{
+    sbc_open = false;
+    sbc_file = fs.open(path, "r");
+    if (!sbc_file)
+        return -1;
+    uint8_t buffer[SBC_FILE_HEADER_SIZE];
+    if (sbc_file.read(buffer, sizeof(buffer)) != sizeof(buffer) || sbc_file_header_decode(buffer, &sbc_header) != 0)
+    {
+        Serial.printf("%s: not an SBC file\n\r", path);
+        sbc_file.close();
+        return -1;
+    }
+    Serial.printf("%s: %u Hz, mode %u, %u blocks, %u subbands, bitpool %u, %u frames\n\r", path,
+                  (unsigned)sbc_header.sampling_frequency, sbc_header.channel_mode, sbc_header.block_length,
+                  sbc_header.subbands, sbc_header.bitpool, (unsigned)sbc_header.num_frames);
+    sbc_loop = loop;
+    sbc_open = true;
+    sbc_fs = &fs;
+    snprintf(sbc_path, sizeof(sbc_path), "%s", path);
+    sbc_request_done = sbc_request_sequence.load(std::memory_order_relaxed);
+    sbc_landings.store(0, std::memory_order_relaxed);
+    file_prefetch_init(&sbc_prefetch, sbc_prefetch_buffer, SBC_PREFETCH_SIZE);
+    sbc_flushes_seen = file_prefetch_flushes(&sbc_prefetch);
+    return sbc_source_seek_frame(0);
+}
+
+void sbc_source_close(void)
+{
+    file_prefetch_stop(&sbc_prefetch);
+    sbc_open = false;
+}
+
+bool sbc_source_is_open(void)
+{
+    return sbc_open;
+}
+
+const sbc_file_header_t *sbc_source_header(void)
+{
+    return &sbc_header;
+}
+
+static int sbc_source_frame_offset(uint32_t frame, uint32_t *offset);
+
+// 要求されたフレームから読み込む。リングは file_prefetch_flush() で空にしてある。
+static void sbc_source_jump(uint32_t frame)
+{
+    if (frame >= sbc_header.num_frames)
+        frame = sbc_header.num_frames - 1;
+    if (!sbc_file)
+        sbc_file = sbc_fs->open(sbc_path, "r");
+    uint32_t offset;
+    if (!sbc_file || sbc_source_frame_offset(frame, &offset) != 0)
+    {
+        Serial.printf("%s: cannot seek to frame %u\n\r", sbc_path, (unsigned)frame);
+        return;
+    }
+    sbc_seek_target = frame;
+    file_prefetch_jump(&sbc_prefetch, sbc_file, sbc_header.data_offset, sbc_header.data_size, offset, false);
+}
+
+void sbc_source_service(void)
+{
+    uint32_t sequence = sbc_request_sequence.load(std::memory_order_acquire);
+    if (sequence != sbc_request_done && sbc_header.num_frames > 0)
+    {
+        // 読み出し側が古いフレームを捨てるまでは補充しない。
+        if (!file_prefetch_flush(&sbc_prefetch))
+            return;
+        sbc_request_done = sequence;
+        sbc_source_jump(sbc_request_frame.load(std::memory_order_relaxed));
+    }
+    file_prefetch_service(&sbc_prefetch);
+}
+
+void sbc_source_request_seek(uint32_t frame)
+{
+    sbc_request_frame.store(frame, std::memory_order_relaxed);
+    sbc_request_sequence.fetch_add(1, std::memory_order_release);
+}
+
+bool sbc_source_seeking(void)
+{
+    return file_prefetch_flushes(&sbc_prefetch) != sbc_flushes_seen;
+}
+
+uint32_t sbc_source_landings(uint32_t *frame)
+{
+    uint32_t landings = sbc_landings.load(std::memory_order_acquire);
+    *frame = sbc_landing_frame;
+    return landings;
+}
+
+int sbc_source_read_frame(uint8_t *dst, int max_length)
+{
+    // ヘッダを見て、1フレーム全部がリングにあるときだけ取り出す。
+    uint8_t frame_header[3];
+    uint32_t level = file_prefetch_available(&sbc_prefetch);
+    // シークしてから新しい位置のフレームが届くまでは、アンダーランに数えない。
+    bool seeking = sbc_source_seeking();
+    if (level < sizeof(frame_header) || audio_ring_peek(&sbc_prefetch.ring, frame_header, sizeof(frame_header)) != sizeof(frame_header))
+    {
+        if (!seeking)
+            file_prefetch_count_underrun(&sbc_prefetch, sbc_header.frame_length);
+        return 0;
+    }
+    uint16_t length = sbc_file_frame_length(frame_header);
+    if (length == 0 || length > max_length)
+        return 0;
+    if (level < length)
+    {
+        if (!seeking)
+            file_prefetch_count_underrun(&sbc_prefetch, length - level);
+        return 0;
+    }
+    file_prefetch_read(&sbc_prefetch, dst, length);
+    if (seeking)
+    {
+        // シーク先の最初のフレーム
+        sbc_flushes_seen = file_prefetch_flushes(&sbc_prefetch);
+        sbc_position = sbc_seek_target;
+        sbc_landing_frame = sbc_seek_target;
+        sbc_landings.store(sbc_landings.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+    if (++sbc_position == sbc_header.num_frames)
+        sbc_position = 0;
+    return length;
+}
+
+void sbc_source_skip_frames(uint32_t num_frames)
+{
+    if (sbc_header.num_frames == 0)
+        return;
+    file_prefetch_discard(&sbc_prefetch, num_frames * sbc_header.frame_length);
+    sbc_position = (sbc_position + num_frames) % sbc_header.num_frames;
+}
+
+// インデックスから直前のフレームの位置を読み、残りはフレームのヘッダをたどる(SBC_FILE_INDEX_INTERVAL フレーム未満)。
+static int sbc_source_frame_offset(uint32_t frame, uint32_t *offset_out)
+{
+    uint32_t entry = frame / SBC_FILE_INDEX_INTERVAL;
+    uint8_t buffer[4];
+    if (entry >= sbc_header.index_count || !sbc_file.seek(sbc_header.index_offset + entry * 4, SeekSet) ||
+        sbc_file.read(buffer, 4) != 4)
+        return -1;
+    uint32_t offset = (uint32_t)buffer[0] | ((uint32_t)buffer[1] << 8) | ((uint32_t)buffer[2] << 16) | ((uint32_t)buffer[3] << 24);
+    for (uint32_t i = entry * SBC_FILE_INDEX_INTERVAL; i < frame; i++)
+    {
+        uint8_t frame_header[3];
+        if (!sbc_file.seek(offset, SeekSet) || sbc_file.read(frame_header, 3) != 3)
+            return -1;
+        uint16_t length = sbc_file_frame_length(frame_header);
+        if (length == 0)
+            return -1;
+        offset += length;
+    }
+    *offset_out = offset;
+    return 0;
+}
+
+int sbc_source_seek_frame(uint32_t frame)
+{
+    uint32_t offset;
+    if (!sbc_open || frame >= sbc_header.num_frames || sbc_source_frame_offset(frame, &offset) != 0)
+        return -1;
+    file_prefetch_start(&sbc_prefetch, sbc_file, sbc_header.data_offset, sbc_header.data_size, offset, sbc_loop);
+    sbc_position = frame;
+    sbc_flushes_seen = file_prefetch_flushes(&sbc_prefetch);
+    return 0;
+}
+
+uint32_t sbc_source_position(void)
+{
+    return sbc_position;
+}
+
+void sbc_source_get_stats(sbc_source_stats_t *stats)
+{
+    file_prefetch_get_stats(&sbc_prefetch, stats);
+}
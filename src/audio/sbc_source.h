@@ -0,0 +1,50 @@
+#ifndef AUDIO_SBC_SOURCE_H
+#define AUDIO_SBC_SOURCE_H
+
+#include <stdint.h>
+#include <FS.h>
+#include "file_prefetch.h"
+#include "sbc_file.h"
+
+// エンコード済みのSBCファイル(.sbc, sbc_file.h)からフレームを読み出すソースです。
+// ネゴシエーションされた設定がファイルと一致する場合、audio_pipeline はエンコードせずに
+// このソースのフレームをそのまま sbc_storage にコピーします。
+// 読み込みは wav_source と同じく先読みリング(file_prefetch)で行い、sbc_source_service() を loop() から呼びます。
+
+#define SBC_PREFETCH_NUM_BLOCKS 4
+
+typedef file_prefetch_stats_t sbc_source_stats_t;
+
+// ファイルをオープンしてヘッダを読み、最初のフレームからリングを満たします。
+// loop が true の場合、最後のフレームの後は最初のフレームに戻ります。
+int sbc_source_open(fs::FS &fs, const char *path, bool loop);
+void sbc_source_close(void);
+bool sbc_source_is_open(void);
+const sbc_file_header_t *sbc_source_header(void);
+
+void sbc_source_service(void);
+
+// 次のフレームを dst にコピーしてバイト数を返します。リングに1フレーム分なければ 0 を返します。
+int sbc_source_read_frame(uint8_t *dst, int max_length);
+
+// num_frames フレームを読まずに捨てます。sbc_source_read_frame() を呼ぶ側から呼びます。
+// ファイルのフレームはすべて同じビットプール(同じ長さ)です。
+void sbc_source_skip_frames(uint32_t num_frames);
+
+// インデックスを使って frame 番目のフレームから読み直します。
+// 読み出し側(ストリーミング)が止まっているときに呼びます。
+int sbc_source_seek_frame(uint32_t frame);
+// ストリーミング中に frame 番目のフレームから再生するように要求します。次の sbc_source_service() が
+// 先読みリングを捨てさせて(file_prefetch_flush)、インデックスから求めた位置にシークします。
+// loop() や BTstack のコールバックから呼べます。
+void sbc_source_request_seek(uint32_t frame);
+// シーク先の最初のフレームを読んだ回数を返し、そのフレームの番号を返します。読み出し側から呼びます。
+uint32_t sbc_source_landings(uint32_t *frame);
+// シークで古いフレームを捨ててから、シーク先の最初のフレームを読むまでの間は true。読み出し側から呼びます。
+bool sbc_source_seeking(void);
+// 次に読むフレームの番号
+uint32_t sbc_source_position(void);
+
+void sbc_source_get_stats(sbc_source_stats_t *stats);
+
+#endif
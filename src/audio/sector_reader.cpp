@@ -0,0 +1,94 @@
+#include "sector_reader.h"
+
+#include <string.h>
+#include "Arduino.h"
+
+void sector_reader_init(sector_reader_t *reader, block_device_t *device, uint32_t first_sector, uint32_t size, uint32_t max_sectors)
+{
+    reader->device = device;
+    reader->first_sector = first_sector;
+    reader->size = size;
+    reader->position = 0;
+    reader->max_sectors = max_sectors == 0 || max_sectors > device->max_sectors ? device->max_sectors : max_sectors;
+    reader->busy = false;
+    read_stats_reset(&reader->stats);
+}
+
+void sector_reader_seek(sector_reader_t *reader, uint32_t offset)
+{
+    reader->position = offset < reader->size ? offset : reader->size;
+}
+
+int sector_reader_start(sector_reader_t *reader, uint8_t *dst, uint32_t length)
+{
+    if (reader->busy)
+        return -1;
+    uint32_t remaining = sector_reader_remaining(reader);
+    if (length > remaining)
+        length = remaining;
+    if (length == 0)
+        return 0;
+    uint32_t sector = reader->first_sector + reader->position / BLOCK_DEVICE_SECTOR_SIZE;
+    uint32_t offset = reader->position % BLOCK_DEVICE_SECTOR_SIZE;
+    bool ok;
+    if (offset == 0 && length >= BLOCK_DEVICE_SECTOR_SIZE && ((uintptr_t)dst & 3) == 0)
+    {
+        // セクタ境界から始まるので、読み込み先に直接まとめて読む。
+        uint32_t count = length / BLOCK_DEVICE_SECTOR_SIZE;
+        if (count > reader->max_sectors)
+            count = reader->max_sectors;
+        length = count * BLOCK_DEVICE_SECTOR_SIZE;
+        reader->dst = NULL;
+        ok = reader->device->start_read(reader->device, sector, dst, count);
+    }
+    else
+    {
+        // セクタの途中、または1セクタに満たない分は、セクタバッファに読んでからコピーする。
+        if (length > BLOCK_DEVICE_SECTOR_SIZE - offset)
+            length = BLOCK_DEVICE_SECTOR_SIZE - offset;
+        reader->dst = dst;
+        reader->copy_offset = offset;
+        ok = reader->device->start_read(reader->device, sector, reader->sector, 1);
+    }
+    if (!ok)
+        return -1;
+    reader->length = length;
+    reader->start_us = micros();
+    reader->busy = true;
+    return (int)length;
+}
+
+int sector_reader_poll(sector_reader_t *reader)
+{
+    if (!reader->busy)
+        return 0;
+    int result = reader->device->poll(reader->device);
+    if (result == 0)
+        return 0;
+    reader->busy = false;
+    if (result < 0)
+        return -1;
+    if (reader->dst)
+        memcpy(reader->dst, reader->sector + reader->copy_offset, reader->length);
+    reader->position += reader->length;
+    read_stats_record(&reader->stats, reader->length, micros() - reader->start_us);
+    return (int)reader->length;
+}
+
+int sector_reader_read(sector_reader_t *reader, uint8_t *dst, uint32_t length)
+{
+    uint32_t done = 0;
+    while (done < length)
+    {
+        int started = sector_reader_start(reader, dst + done, length - done);
+        if (started <= 0)
+            return started < 0 ? -1 : (int)done;
+        int result;
+        while ((result = sector_reader_poll(reader)) == 0)
+            ;
+        if (result < 0)
+            return -1;
+        done += result;
+    }
+    return (int)done;
+}
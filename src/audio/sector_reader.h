@@ -0,0 +1,55 @@
+#ifndef AUDIO_SECTOR_READER_H
+#define AUDIO_SECTOR_READER_H
+
+#include <stdint.h>
+#include "block_device.h"
+#include "read_stats.h"
+
+// ブロックデバイス上の連続したセクタに置かれたデータ(断片化していないファイルなど)を先頭から順に読むリーダーです。
+// 読み込みはセクタ境界にそろえ、読み込み先が4バイト境界にあれば、まとめて読めるだけのセクタ(最大 max_sectors)を
+// 1回のマルチブロック読み込み(SD の CMD18)で読み込み先に直接読み込みます。
+// セクタの途中から始まる・途中で終わる分だけは、内部のセクタバッファに読んでからコピーします。
+//
+// sector_reader_start() で読み込みを始めて sector_reader_poll() で終わるのを待つので、
+// 待っている間に他のことができます。sector_reader_read() は終わるまで待ちます。
+// 1回の読み込みにかかった時間(start から poll が終わりを返すまで)は read_stats に記録します。
+
+typedef struct
+{
+    block_device_t *device;
+    uint32_t first_sector; // データの先頭のセクタ
+    uint32_t size;         // データのバイト数
+    uint32_t position;     // 次に読むバイトの位置
+    uint32_t max_sectors;  // 1回に読むセクタ数の最大
+
+    // 読み込み中の要求
+    bool busy;
+    uint8_t *dst;          // 内部のセクタバッファを使う場合のコピー先
+    uint32_t length;       // 読み込み中の要求で進むバイト数
+    uint32_t copy_offset;  // セクタバッファのコピー元の位置
+    uint32_t start_us;
+
+    uint8_t sector[BLOCK_DEVICE_SECTOR_SIZE] __attribute__((aligned(4)));
+    read_stats_t stats;
+} sector_reader_t;
+
+// device の first_sector から size バイトを読むようにします。max_sectors が 0 ならデバイスの最大にします。
+void sector_reader_init(sector_reader_t *reader, block_device_t *device, uint32_t first_sector, uint32_t size, uint32_t max_sectors);
+// 次に読む位置を offset にします。読み込み中は呼べません。
+void sector_reader_seek(sector_reader_t *reader, uint32_t offset);
+
+// 最大 length バイトを dst に読み込み始め、この読み込みで進むバイト数を返します(末尾なら 0、始められなければ -1)。
+// length より少ないことがあるので、残りは次の読み込みで読みます。
+int sector_reader_start(sector_reader_t *reader, uint8_t *dst, uint32_t length);
+// 読み込みが終わっていれば読んだバイト数、まだなら 0、失敗したら -1 を返します。
+int sector_reader_poll(sector_reader_t *reader);
+// length バイト(末尾までならその分)を、必要なだけ読み込みを繰り返して読み、終わるまで待ちます。
+// 読んだバイト数(失敗したら -1)を返します。
+int sector_reader_read(sector_reader_t *reader, uint8_t *dst, uint32_t length);
+
+static inline uint32_t sector_reader_remaining(const sector_reader_t *reader)
+{
+    return reader->size - reader->position;
+}
+
+#endif
@@ -0,0 +1,75 @@
+#include "sink_latency.h"
+
+#include <string.h>
+
+void sink_latency_init(sink_latency_t *latency)
+{
+    memset(latency, 0, sizeof(*latency));
+}
+
+void sink_latency_reset_in_flight(sink_latency_t *latency)
+{
+    latency->first = 0;
+    latency->count = 0;
+    latency->in_flight_samples = 0;
+}
+
+void sink_latency_delay_report(sink_latency_t *latency, uint16_t delay_100us, uint32_t now_ms)
+{
+    sink_delay_stats_t *delay = &latency->delay;
+    if (delay->reports == 0)
+    {
+        delay->min_delay_100us = delay_100us;
+        delay->max_delay_100us = delay_100us;
+    }
+    else
+    {
+        if (delay_100us != delay->delay_100us)
+            delay->changes++;
+        if (delay_100us < delay->min_delay_100us)
+            delay->min_delay_100us = delay_100us;
+        if (delay_100us > delay->max_delay_100us)
+            delay->max_delay_100us = delay_100us;
+    }
+    delay->reports++;
+    delay->delay_100us = delay_100us;
+    delay->last_report_ms = now_ms;
+}
+
+uint32_t sink_latency_delay_us(const sink_latency_t *latency)
+{
+    return (uint32_t)latency->delay.delay_100us * 100;
+}
+
+static void sink_latency_pop(sink_latency_t *latency)
+{
+    latency->in_flight_samples -= latency->packet_samples[latency->first];
+    latency->first = (latency->first + 1) % SINK_LATENCY_MAX_IN_FLIGHT;
+    latency->count--;
+}
+
+void sink_latency_sent(sink_latency_t *latency, uint32_t num_samples, uint8_t acl_packets)
+{
+    if (latency->count == SINK_LATENCY_MAX_IN_FLIGHT)
+        sink_latency_pop(latency);
+    int index = (latency->first + latency->count) % SINK_LATENCY_MAX_IN_FLIGHT;
+    latency->packet_samples[index] = (uint16_t)num_samples;
+    latency->packet_acl_left[index] = acl_packets > 0 ? acl_packets : 1;
+    latency->count++;
+    latency->in_flight_samples += num_samples;
+    if (latency->count > latency->max_in_flight_packets)
+        latency->max_in_flight_packets = latency->count;
+}
+
+void sink_latency_completed(sink_latency_t *latency, uint16_t num_packets)
+{
+    while (num_packets > 0 && latency->count > 0)
+    {
+        uint8_t *acl_left = &latency->packet_acl_left[latency->first];
+        uint16_t done = num_packets < *acl_left ? num_packets : *acl_left;
+        *acl_left -= done;
+        num_packets -= done;
+        if (*acl_left == 0)
+            sink_latency_pop(latency);
+    }
+}
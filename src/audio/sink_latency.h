@@ -0,0 +1,60 @@
+#ifndef AUDIO_SINK_LATENCY_H
+#define AUDIO_SINK_LATENCY_H
+
+#include <stdint.h>
+
+// スピーカー(シンク)で音が鳴るまでの遅れのうち、送った後の分を数えます。
+//  - スピーカーが AVDTP の delay report で知らせてくる遅延(100us 単位)。ストリームの設定のときと、
+//    再生中に変わったときに届くので、最後の値と、それまでの最小・最大・変わった回数を持ちます。
+//  - BTstack に渡したがコントローラから送信完了(HCI Number Of Completed Packets)が来ていないパケットの音声。
+//    BTstack はメディアパケットをコントローラの ACL の長さ(hci_max_acl_data_packet_length())で分けて送り、
+//    送信完了は ACL パケットごとに来ます。メディアパケットごとのサンプル数と ACL パケット数を送った順に並べ、
+//    完了の数だけ古い方の ACL パケットを減らし、全部送り終えたメディアパケットを外します。
+//    同じ接続ハンドルの AVDTP シグナリングや AVRCP のパケットの完了は区別できません。並びにメディアパケットが
+//    あるときに届くと、まだ送っていないメディアの ACL パケットを送り終えたことにするので、送信完了を待つ音声を
+//    そのパケットの分だけ少なく(スピーカーで鳴っている位置を先に)見積もります。このずれは並びが空になる
+//    (リンクが追いついている)まで残ります。並びが空のときに来た完了は捨てます。
+//
+// BTstack には依存しないので、ホストビルドでも同じコードを使います。
+
+// 完了を待つメディアパケットの数の上限。超えたら一番古いパケットは送り終えたことにします。
+#define SINK_LATENCY_MAX_IN_FLIGHT 16
+
+typedef struct
+{
+    uint32_t reports;         // 受け取った delay report の数
+    uint32_t changes;         // 前と違う遅延が報告された回数
+    uint16_t delay_100us;     // 最後に報告された遅延
+    uint16_t min_delay_100us;
+    uint16_t max_delay_100us;
+    uint32_t last_report_ms;  // 最後に報告された時刻
+} sink_delay_stats_t;
+
+typedef struct
+{
+    sink_delay_stats_t delay;
+    uint16_t packet_samples[SINK_LATENCY_MAX_IN_FLIGHT]; // 完了を待つメディアパケットのサンプル数(送った順のリング)
+    uint8_t packet_acl_left[SINK_LATENCY_MAX_IN_FLIGHT]; // そのうち送信完了が来ていない ACL パケットの数
+    uint8_t first;
+    uint8_t count;
+    uint32_t in_flight_samples;     // その合計
+    uint32_t max_in_flight_packets;
+} sink_latency_t;
+
+// 遅延の報告も完了を待つパケットも無い状態にします(新しい接続)。
+void sink_latency_init(sink_latency_t *latency);
+// 完了を待つパケットだけを空にします(ストリーミングの開始・停止)。
+void sink_latency_reset_in_flight(sink_latency_t *latency);
+
+// AVDTP の delay report を受け取ったときに呼びます。
+void sink_latency_delay_report(sink_latency_t *latency, uint16_t delay_100us, uint32_t now_ms);
+// 最後に報告された遅延(us)。報告が無ければ 0。
+uint32_t sink_latency_delay_us(const sink_latency_t *latency);
+
+// num_samples のサンプルが入ったメディアパケットを BTstack に渡したときに呼びます(フラグメントは最後以外 0 サンプル)。
+// acl_packets はそのパケットを送る ACL パケットの数です。
+void sink_latency_sent(sink_latency_t *latency, uint32_t num_samples, uint8_t acl_packets);
+// コントローラが num_packets 個の ACL パケットを送り終えたときに呼びます。
+void sink_latency_completed(sink_latency_t *latency, uint16_t num_packets);
+
+#endif
@@ -0,0 +1,59 @@
+#include "stack_watermark.h"
+
+#include "Arduino.h"
+
+static uint32_t *stack_watermark_bottom;
+static uint32_t *stack_watermark_top;
+
+#ifdef ARDUINO_ARCH_RP2040
+#include "hardware/sync.h"
+
+extern uint32_t __StackOneTop;
+extern uint32_t __StackTop;
+
+void stack_watermark_paint(void)
+{
+    // 割り込みもこのスタックを使うので、塗っている間は止める。自分のフレームの分は残す。
+    uint32_t status = save_and_disable_interrupts();
+    uint32_t *sp = (uint32_t *)__builtin_frame_address(0) - 16;
+    stack_watermark_bottom = &__StackOneTop;
+    stack_watermark_top = &__StackTop;
+    for (uint32_t *p = stack_watermark_bottom; p < sp; p++)
+        *p = STACK_WATERMARK_PATTERN;
+    restore_interrupts(status);
+}
+#else
+// 呼び出し元より下の領域を塗る。戻った後の領域はその後の呼び出しが使う。
+static void __attribute__((noinline)) stack_watermark_paint_below(void)
+{
+    volatile uint32_t area[STACK_WATERMARK_HOST_SIZE / 4];
+    for (uint32_t i = 0; i < STACK_WATERMARK_HOST_SIZE / 4; i++)
+        area[i] = STACK_WATERMARK_PATTERN;
+    uintptr_t bottom = (uintptr_t)&area[0];
+    stack_watermark_bottom = (uint32_t *)bottom;
+    stack_watermark_top = (uint32_t *)(bottom + STACK_WATERMARK_HOST_SIZE);
+}
+
+void stack_watermark_paint(void)
+{
+    stack_watermark_paint_below();
+}
+#endif
+
+void stack_watermark_get(stack_watermark_stats_t *stats)
+{
+    stats->size = (uint32_t)((stack_watermark_top - stack_watermark_bottom) * sizeof(uint32_t));
+    const volatile uint32_t *p = stack_watermark_bottom;
+    while (p < stack_watermark_top && *p == STACK_WATERMARK_PATTERN)
+        p++;
+    stats->max_used = (uint32_t)((stack_watermark_top - p) * sizeof(uint32_t));
+    stats->overflow = stack_watermark_bottom != NULL && stats->max_used == stats->size;
+}
+
+void stack_watermark_dump(void)
+{
+    stack_watermark_stats_t stats;
+    stack_watermark_get(&stats);
+    Serial.printf("core 0 stack: max used %u of %u bytes%s\n\r", (unsigned)stats.max_used, (unsigned)stats.size,
+                  stats.overflow ? " (OVERFLOW)" : "");
+}
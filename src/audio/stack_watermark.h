@@ -0,0 +1,31 @@
+#ifndef AUDIO_STACK_WATERMARK_H
+#define AUDIO_STACK_WATERMARK_H
+
+#include <stdint.h>
+
+// コア0のスタック(BTstack のコンテキスト)の最大使用量を調べます。
+// タイマーコールバックも BTstack のパケットハンドラも loop() と同じコア0のメインスタックで動くので、それらを合わせた最大値です。
+//
+// setup() の最初で stack_watermark_paint() を呼び、今のスタックポインタより下の使われていない領域を模様で埋めます。
+// stack_watermark_get() は、模様が書き換えられた一番深い位置から最大使用量を求めます。
+// arduino-pico ではコア0のスタックは SCRATCH_Y(__StackOneTop .. __StackTop)にあり、その下はコア1のスタックです。
+// 一番下まで書き換えられていたら、コア1のスタックまであふれた可能性があります。
+//
+// ホストビルドでは、呼び出したスレッドの今のスタックポインタから STACK_WATERMARK_HOST_SIZE バイト下までを塗り、
+// 塗った位置から下の使用量を返します(x86 のスタックなので大きさは実機と同じではありません)。
+
+#define STACK_WATERMARK_PATTERN 0xa5a5a5a5u
+#define STACK_WATERMARK_HOST_SIZE (64 * 1024)
+
+typedef struct
+{
+    uint32_t size;     // 塗った位置の上端から下端まで(実機ではスタック全体)
+    uint32_t max_used; // 最大使用量
+    bool overflow;     // 一番下まで書き換えられていた
+} stack_watermark_stats_t;
+
+void stack_watermark_paint(void);
+void stack_watermark_get(stack_watermark_stats_t *stats);
+void stack_watermark_dump(void);
+
+#endif
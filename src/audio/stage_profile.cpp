@@ -0,0 +1,139 @@
+#include "stage_profile.h"
+
+#include <string.h>
+
+static stage_profile_stage_stats_t stage_profile_stages[STAGE_PROFILE_NUM_STAGES];
+static bool stage_profile_enabled = true;
+static uint8_t stage_profile_record_buffer[STAGE_PROFILE_RECORD_SIZE];
+
+static const char *const stage_profile_names[STAGE_PROFILE_NUM_STAGES] = {
+    "refill", "read", "convert", "encode", "send wait", "send",
+};
+
+// サイクル数のビット長からバケットを決める。M0+ には CLZ 命令がないが、呼ばれるのは段ごとに1回だけ。
+static inline int stage_profile_bucket(uint32_t cycles)
+{
+    int bits = 32 - __builtin_clz(cycles | 1);
+    int bucket = bits - STAGE_PROFILE_FIRST_BUCKET_BITS;
+    if (bucket < 0)
+        return 0;
+    if (bucket > STAGE_PROFILE_BUCKETS - 1)
+        return STAGE_PROFILE_BUCKETS - 1;
+    return bucket;
+}
+
+void __not_in_flash_func(stage_profile_record_cycles)(stage_profile_stage_t stage, uint32_t start, uint32_t cycles)
+{
+    if (!stage_profile_enabled)
+        return;
+    stage_profile_stage_stats_t *stats = &stage_profile_stages[stage];
+    stats->count++;
+    stats->total_cycles += cycles;
+    if (cycles > stats->max_cycles)
+        stats->max_cycles = cycles;
+    stats->histogram[stage_profile_bucket(cycles)]++;
+    stage_profile_event_t *event = &stats->ring[stats->ring_next];
+    event->start = start;
+    event->cycles = cycles;
+    stats->ring_next = (stats->ring_next + 1) % STAGE_PROFILE_RING_ENTRIES;
+}
+
+void __not_in_flash_func(stage_profile_record)(stage_profile_stage_t stage, uint32_t start)
+{
+    stage_profile_record_cycles(stage, start, stage_profile_now() - start);
+}
+
+void stage_profile_set_enabled(bool enable)
+{
+    stage_profile_enabled = enable;
+}
+
+void stage_profile_reset(void)
+{
+    memset(stage_profile_stages, 0, sizeof(stage_profile_stages));
+}
+
+const stage_profile_stage_stats_t *stage_profile_get(stage_profile_stage_t stage)
+{
+    return &stage_profile_stages[stage];
+}
+
+const char *stage_profile_stage_name(stage_profile_stage_t stage)
+{
+    return stage_profile_names[stage];
+}
+
+static uint8_t *stage_profile_put_u16(uint8_t *p, uint16_t value)
+{
+    p[0] = value & 0xff;
+    p[1] = value >> 8;
+    return p + 2;
+}
+
+static uint8_t *stage_profile_put_u32(uint8_t *p, uint32_t value)
+{
+    p = stage_profile_put_u16(p, value & 0xffff);
+    return stage_profile_put_u16(p, value >> 16);
+}
+
+size_t stage_profile_serialize(uint8_t *buffer, size_t size)
+{
+    // 書いている間に記録が進んでも長さが変わらないように、回数を先に読んでおく。
+    uint32_t counts[STAGE_PROFILE_NUM_STAGES];
+    size_t length = STAGE_PROFILE_HEADER_SIZE + 2;
+    for (int i = 0; i < STAGE_PROFILE_NUM_STAGES; i++)
+    {
+        counts[i] = stage_profile_stages[i].count;
+        uint32_t ring_count = counts[i] < STAGE_PROFILE_RING_ENTRIES ? counts[i] : STAGE_PROFILE_RING_ENTRIES;
+        length += STAGE_PROFILE_STAGE_SIZE - 8 * (STAGE_PROFILE_RING_ENTRIES - ring_count);
+    }
+    if (length > size)
+        return 0;
+
+    uint8_t *p = buffer;
+    memcpy(p, "SPRF", 4);
+    p += 4;
+    *p++ = STAGE_PROFILE_VERSION;
+    *p++ = STAGE_PROFILE_NUM_STAGES;
+    *p++ = STAGE_PROFILE_BUCKETS;
+    *p++ = STAGE_PROFILE_RING_ENTRIES;
+    p = stage_profile_put_u32(p, STAGE_PROFILE_CLOCK_HZ);
+    p = stage_profile_put_u16(p, length);
+    p = stage_profile_put_u16(p, 0);
+    for (int i = 0; i < STAGE_PROFILE_NUM_STAGES; i++)
+    {
+        const stage_profile_stage_stats_t *stats = &stage_profile_stages[i];
+        uint32_t count = counts[i];
+        uint32_t ring_count = count < STAGE_PROFILE_RING_ENTRIES ? count : STAGE_PROFILE_RING_ENTRIES;
+        uint8_t next = stats->ring_next;
+        p = stage_profile_put_u32(p, count);
+        p = stage_profile_put_u32(p, stats->max_cycles);
+        p = stage_profile_put_u32(p, (uint32_t)stats->total_cycles);
+        p = stage_profile_put_u32(p, (uint32_t)(stats->total_cycles >> 32));
+        for (int b = 0; b < STAGE_PROFILE_BUCKETS; b++)
+            p = stage_profile_put_u32(p, stats->histogram[b]);
+        p = stage_profile_put_u32(p, ring_count);
+        for (uint32_t n = 0; n < ring_count; n++)
+        {
+            const stage_profile_event_t *event = &stats->ring[(next + STAGE_PROFILE_RING_ENTRIES - ring_count + n) % STAGE_PROFILE_RING_ENTRIES];
+            p = stage_profile_put_u32(p, event->start);
+            p = stage_profile_put_u32(p, event->cycles);
+        }
+    }
+
+    // Fletcher-16
+    uint16_t sum1 = 0, sum2 = 0;
+    for (const uint8_t *q = buffer; q < p; q++)
+    {
+        sum1 = (sum1 + *q) % 255;
+        sum2 = (sum2 + sum1) % 255;
+    }
+    p = stage_profile_put_u16(p, (uint16_t)((sum2 << 8) | sum1));
+    return p - buffer;
+}
+
+void stage_profile_dump(void)
+{
+    size_t length = stage_profile_serialize(stage_profile_record_buffer, sizeof(stage_profile_record_buffer));
+    Serial.write(stage_profile_record_buffer, length);
+}
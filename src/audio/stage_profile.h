@@ -0,0 +1,91 @@
+#ifndef AUDIO_STAGE_PROFILE_H
+#define AUDIO_STAGE_PROFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "Arduino.h"
+
+// オーディオのホットパスの段ごとの処理時間を、常時・低コストで記録するプロファイラです。
+// 時刻はサイクルカウンタ(rp2040.getCycleCount(), SysTick)で取り、段ごとに
+//  - 2のべき乗のバケットの分布(固定 STAGE_PROFILE_BUCKETS 個)、回数、合計、最大
+//  - 直近 STAGE_PROFILE_RING_ENTRIES 回の開始時刻と処理時間のリング
+// を static な領域に持ちます。malloc も Serial.printf も使いません。
+//
+// 各段に書き込むのは1つのコンテキストだけです(デュアルコアモードでは READ/CONVERT/ENCODE はコア1、SEND はコア0)。
+// stage_profile_dump() は記録中でもそのまま読むので、まれに1回分だけ途中の値が混じることがあります。
+//
+// ホストビルドでは host/shim の rp2040.getCycleCount() が壁時計の ns を返すので、同じコードがそのまま動きます
+// (レコードの clock_hz が 1000000000 になる)。
+//
+// stage_profile_dump() は次のバイナリレコードを USB シリアルに書き出します(リトルエンディアン)。
+//   ヘッダ   : "SPRF", version(u8), stages(u8), buckets(u8), ring_entries(u8), clock_hz(u32), length(u16, 全体のバイト数), reserved(u16)
+//   段ごと   : count(u32), max(u32), total(u64), histogram(u32 x buckets), ring_count(u32), ring(start u32, cycles u32 x ring_count, 古い順)
+//   トレーラ : Fletcher-16(u16, ヘッダからトレーラの手前まで)
+// ヒストグラムのバケット i (0 < i < buckets - 1) は 2^(STAGE_PROFILE_FIRST_BUCKET_BITS + i - 1) 以上 2^(STAGE_PROFILE_FIRST_BUCKET_BITS + i) 未満の
+// サイクル数、バケット 0 はそれ未満、最後のバケットはそれ以上です。
+
+typedef enum
+{
+    STAGE_PROFILE_REFILL = 0, // ファイルから先読みリングへの読み込み(file_prefetch, loop())
+    STAGE_PROFILE_READ,       // 先読みリングからの取り出し(wav_source_read / sbc_source_read_frame)
+    STAGE_PROFILE_CONVERT,    // 16bit PCM への変換とサンプリングレート変換(produce_audio と resampler)
+    STAGE_PROFILE_ENCODE,     // SBC_Encoder()
+    STAGE_PROFILE_SEND_WAIT,  // CAN_SEND_NOW を要求してから来るまで
+    STAGE_PROFILE_SEND,       // a2dp_source_stream_send_media_payload_rtp()
+    STAGE_PROFILE_NUM_STAGES,
+} stage_profile_stage_t;
+
+#define STAGE_PROFILE_BUCKETS 16
+#define STAGE_PROFILE_FIRST_BUCKET_BITS 8
+#define STAGE_PROFILE_RING_ENTRIES 16
+#define STAGE_PROFILE_VERSION 1
+#define STAGE_PROFILE_HEADER_SIZE 16
+#define STAGE_PROFILE_STAGE_SIZE (4 + 4 + 8 + 4 * STAGE_PROFILE_BUCKETS + 4 + 8 * STAGE_PROFILE_RING_ENTRIES)
+// レコードの最大のバイト数(リングがいっぱいのとき)
+#define STAGE_PROFILE_RECORD_SIZE (STAGE_PROFILE_HEADER_SIZE + STAGE_PROFILE_STAGE_SIZE * STAGE_PROFILE_NUM_STAGES + 2)
+
+#ifdef F_CPU
+#define STAGE_PROFILE_CLOCK_HZ F_CPU
+#else
+#define STAGE_PROFILE_CLOCK_HZ 1000000000u
+#endif
+
+typedef struct
+{
+    uint32_t start;
+    uint32_t cycles;
+} stage_profile_event_t;
+
+typedef struct
+{
+    uint32_t count;
+    uint32_t max_cycles;
+    uint64_t total_cycles;
+    uint32_t histogram[STAGE_PROFILE_BUCKETS];
+    stage_profile_event_t ring[STAGE_PROFILE_RING_ENTRIES];
+    uint8_t ring_next; // 次に書くリングの位置
+} stage_profile_stage_stats_t;
+
+// 段の開始時刻。stage_profile_record() に渡します。
+static inline uint32_t stage_profile_now(void)
+{
+    return rp2040.getCycleCount();
+}
+
+// start から今までを stage の1回分として記録します。
+void stage_profile_record(stage_profile_stage_t stage, uint32_t start);
+// start から cycles サイクルかかった1回分を記録します(測り終えた時刻と記録する時刻が違うとき)。
+void stage_profile_record_cycles(stage_profile_stage_t stage, uint32_t start, uint32_t cycles);
+
+// false にすると記録しません(オーバーヘッドの比較用)。デフォルトは true。
+void stage_profile_set_enabled(bool enable);
+void stage_profile_reset(void);
+const stage_profile_stage_stats_t *stage_profile_get(stage_profile_stage_t stage);
+const char *stage_profile_stage_name(stage_profile_stage_t stage);
+
+// レコードを buffer に書き、バイト数を返します。size が足りなければ 0 を返します。
+size_t stage_profile_serialize(uint8_t *buffer, size_t size);
+// レコードを Serial.write() で書き出します。シリアルのコマンド 'p' で呼びます。
+void stage_profile_dump(void);
+
+#endif
@@ -0,0 +1,161 @@
+#include "wav_format.h"
+
+#include <string.h>
+#include "ima_adpcm.h"
+#include "mp3_frame.h"
+
+static uint16_t wav_format_le16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t wav_format_le32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static wav_format_result_t wav_format_parse_fmt(File &file, uint32_t chunk_size, wav_format_t *format)
+{
+    // WAVEFORMATEXTENSIBLE でも先頭の40バイトまでしか使わない。
+    uint8_t fmt[40];
+    uint32_t length = chunk_size < sizeof(fmt) ? chunk_size : sizeof(fmt);
+    if (length < 16 || file.read(fmt, length) != length)
+        return WAV_FORMAT_ERROR_NO_FMT;
+
+    format->format_tag = wav_format_le16(fmt + 0);
+    format->num_channels = wav_format_le16(fmt + 2);
+    format->sample_rate = wav_format_le32(fmt + 4);
+    format->byte_rate = wav_format_le32(fmt + 8);
+    format->block_align = wav_format_le16(fmt + 12);
+    format->bits_per_sample = wav_format_le16(fmt + 14);
+    if (format->format_tag == WAV_FORMAT_EXTENSIBLE)
+    {
+        // cbSize(2) wValidBitsPerSample(2) dwChannelMask(4) SubFormat(16): GUID の先頭2バイトがフォーマット
+        if (length < 26 || wav_format_le16(fmt + 16) < 22)
+            return WAV_FORMAT_ERROR_UNSUPPORTED;
+        format->format_tag = wav_format_le16(fmt + 24);
+    }
+    else if (format->format_tag == WAV_FORMAT_IMA_ADPCM && length >= 20 && wav_format_le16(fmt + 16) >= 2)
+    {
+        // cbSize(2) wSamplesPerBlock(2)
+        format->samples_per_block = wav_format_le16(fmt + 18);
+    }
+    return WAV_FORMAT_OK;
+}
+
+// RIFF でないファイルを MP3 として解析する。
+static wav_format_result_t wav_format_parse_mp3(File &file, wav_format_t *format)
+{
+    mp3_frame_stream_t stream;
+    if (!mp3_frame_parse_file(file, &stream))
+        return WAV_FORMAT_ERROR_NOT_RIFF;
+    format->format_tag = WAV_FORMAT_MPEG_LAYER3;
+    format->num_channels = stream.header.num_channels;
+    format->sample_rate = stream.header.sample_rate;
+    format->block_align = stream.header.frame_bytes;
+    format->samples_per_block = stream.header.samples;
+    format->data_offset = stream.data_offset;
+    format->data_size = stream.data_size;
+    // VBR は Xing/Info フレームのフレーム数から平均のビットレートを出す。無ければ最初のフレームのビットレート(CBR)。
+    if (stream.num_frames > 0)
+        format->byte_rate = (uint32_t)((uint64_t)stream.data_size * stream.header.sample_rate / stream.header.samples / stream.num_frames);
+    else
+        format->byte_rate = stream.header.bitrate / 8;
+    file.seek(format->data_offset, SeekSet);
+    return format->byte_rate > 0 ? WAV_FORMAT_OK : WAV_FORMAT_ERROR_UNSUPPORTED;
+}
+
+wav_format_result_t wav_format_parse(File &file, wav_format_t *format)
+{
+    uint8_t header[12];
+    memset(format, 0, sizeof(*format));
+    file.seek(0, SeekSet);
+    if (file.read(header, 12) != 12 || memcmp(header, "RIFF", 4) != 0 || memcmp(header + 8, "WAVE", 4) != 0)
+        return wav_format_parse_mp3(file, format);
+
+    uint32_t file_size = file.size();
+    uint32_t position = 12;
+    bool have_fmt = false;
+    bool have_data = false;
+    while (position <= file_size && file_size - position >= 8 && !(have_fmt && have_data))
+    {
+        uint8_t chunk[8];
+        file.seek(position, SeekSet);
+        if (file.read(chunk, 8) != 8)
+            break;
+        uint32_t chunk_size = wav_format_le32(chunk + 4);
+        uint32_t body = position + 8;
+        // data 以外でファイル末尾を越えるチャンクは壊れているので、そこでたどるのをやめる。
+        // body + chunk_size が 32bit で回り込んで前に戻り、同じチャンクを読み続けることもない。
+        bool is_data = memcmp(chunk, "data", 4) == 0;
+        if (!is_data && chunk_size > file_size - body)
+            break;
+
+        if (memcmp(chunk, "fmt ", 4) == 0)
+        {
+            wav_format_result_t result = wav_format_parse_fmt(file, chunk_size, format);
+            if (result != WAV_FORMAT_OK)
+                return result;
+            have_fmt = true;
+        }
+        else if (is_data)
+        {
+            format->data_offset = body;
+            // 書きかけのファイル(サイズ 0 や 0xFFFFFFFF)や途中で切れたファイルはファイル末尾までとする。
+            if (chunk_size == 0 || chunk_size > file_size - body)
+                chunk_size = file_size - body;
+            format->data_size = chunk_size;
+            have_data = true;
+        }
+        // LIST などはそのまま読み飛ばす。チャンクは2バイト境界にパディングされる。
+        position = body + chunk_size + (chunk_size & 1);
+    }
+    if (!have_fmt)
+        return WAV_FORMAT_ERROR_NO_FMT;
+    if (!have_data)
+        return WAV_FORMAT_ERROR_NO_DATA;
+
+    if (format->num_channels < 1 || format->num_channels > 2)
+        return WAV_FORMAT_ERROR_UNSUPPORTED;
+    if (format->format_tag == WAV_FORMAT_IMA_ADPCM)
+    {
+        // wSamplesPerBlock が無い、またはブロックの大きさと合わないものは読まない。
+        uint32_t samples = ima_adpcm_samples_per_block(format->block_align, format->num_channels);
+        if (format->bits_per_sample != 4 || samples == 0 || format->block_align > WAV_FORMAT_MAX_ADPCM_BLOCK_ALIGN ||
+            (format->samples_per_block != 0 && format->samples_per_block != samples))
+            return WAV_FORMAT_ERROR_UNSUPPORTED;
+        format->samples_per_block = (uint16_t)samples;
+    }
+    else
+    {
+        if (format->format_tag != WAV_FORMAT_PCM ||
+            (format->bits_per_sample != 8 && format->bits_per_sample != 16 && format->bits_per_sample != 24) ||
+            format->block_align != format->num_channels * format->bits_per_sample / 8)
+            return WAV_FORMAT_ERROR_UNSUPPORTED;
+        format->samples_per_block = 1;
+    }
+
+    // 最後のサンプル(ADPCM はブロック)が途中で切れていたら切り捨てる。
+    format->data_size -= format->data_size % format->block_align;
+    file.seek(format->data_offset, SeekSet);
+    return WAV_FORMAT_OK;
+}
+
+const char *wav_format_result_string(wav_format_result_t result)
+{
+    switch (result)
+    {
+    case WAV_FORMAT_OK:
+        return "ok";
+    case WAV_FORMAT_ERROR_NOT_RIFF:
+        return "not a RIFF/WAVE or MP3 file";
+    case WAV_FORMAT_ERROR_NO_FMT:
+        return "no fmt chunk";
+    case WAV_FORMAT_ERROR_NO_DATA:
+        return "no data chunk";
+    case WAV_FORMAT_ERROR_UNSUPPORTED:
+        return "unsupported format";
+    default:
+        return "unknown error";
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef AUDIO_WAV_FORMAT_H
+#define AUDIO_WAV_FORMAT_H
+
+#include <stdint.h>
+#include <FS.h>
+
+// RIFF/WAVE ヘッダの解析です。チャンクを順にたどって fmt と data を探します。
+// LIST などのその他のチャンクは読み飛ばし、奇数サイズのチャンクのパディングも扱います。
+// ファイル末尾を越えるチャンク(サイズが壊れている)があればそこでたどるのをやめます。data だけはファイル末尾までとします。
+// WAVE_FORMAT_EXTENSIBLE の場合は SubFormat の GUID から実際のフォーマットを取り出します。
+// IMA-ADPCM(4bit, 16bit に対して 1/4)も読めます。block_align は ADPCM の1ブロックのバイト数です。
+// RIFF でないファイルは MP3(mp3_frame)として解析し、フォーマットタグを WAV_FORMAT_MPEG_LAYER3 にします。
+// MP3 はフレームの大きさが一定でないので、data_size は最初のフレームから最後のフレームの終わりまでで、
+// サンプル数とバイト位置は byte_rate(平均のビットレート)で換算します。
+
+#define WAV_FORMAT_PCM 0x0001
+#define WAV_FORMAT_IMA_ADPCM 0x0011
+#define WAV_FORMAT_MPEG_LAYER3 0x0055
+#define WAV_FORMAT_EXTENSIBLE 0xFFFE
+// IMA-ADPCM の1ブロックの最大。wav_source は1ブロックずつデコードするので、デコードしたブロックのバッファの大きさが決まる
+// (モノラル 2041 サンプル、ステレオ 1017 サンプル。ffmpeg の既定の 1024 バイト)。
+#define WAV_FORMAT_MAX_ADPCM_BLOCK_ALIGN 1024
+
+typedef struct
+{
+    uint16_t format_tag;        // WAV_FORMAT_PCM など(EXTENSIBLE の場合は SubFormat のもの)
+    uint16_t num_channels;
+    uint32_t sample_rate;
+    uint16_t bits_per_sample;   // コンテナのビット数(8/16/24、IMA-ADPCM は 4、MP3 は 0)
+    uint16_t block_align;       // 1ブロックのバイト数。PCM は1サンプル(全チャンネル)、MP3 は最初のフレーム
+    uint16_t samples_per_block; // 1ブロックのサンプル数。PCM は 1、MP3 は1フレーム
+    uint32_t byte_rate;         // 1秒あたりのバイト数(fmt の nAvgBytesPerSec)。MP3 は平均のビットレート / 8
+    uint32_t data_offset;       // data チャンクの中身の先頭
+    uint32_t data_size;         // data チャンクの中身のバイト数
+} wav_format_t;
+
+typedef enum
+{
+    WAV_FORMAT_OK = 0,
+    WAV_FORMAT_ERROR_NOT_RIFF = -1,
+    WAV_FORMAT_ERROR_NO_FMT = -2,
+    WAV_FORMAT_ERROR_NO_DATA = -3,
+    WAV_FORMAT_ERROR_UNSUPPORTED = -4,
+} wav_format_result_t;
+
+// file の先頭からヘッダを解析します。成功すると file は data チャンクの先頭を指します。
+wav_format_result_t wav_format_parse(File &file, wav_format_t *format);
+const char *wav_format_result_string(wav_format_result_t result);
+
+// data チャンクのサンプル数(1チャンネル分)
+static inline uint32_t wav_format_num_samples(const wav_format_t *format)
+{
+    if (format->format_tag == WAV_FORMAT_MPEG_LAYER3)
+        return format->byte_rate > 0 ? (uint32_t)((uint64_t)format->data_size * format->sample_rate / format->byte_rate) : 0;
+    return format->block_align > 0 ? format->data_size / format->block_align * format->samples_per_block : 0;
+}
+
+#endif
@@ -0,0 +1,577 @@
+#include "wav_source.h"
+
+#include <string.h>
+#include "Arduino.h"
+#include "file_prefetch.h"
+#include "ima_adpcm.h"
+#include "mp3_decoder.h"
+#include "mp3_frame.h"
+
+static const uint32_t WAV_PREFETCH_SIZE = FILE_PREFETCH_BLOCK_SIZE * WAV_PREFETCH_NUM_BLOCKS;
+
+static wav_format_t wav_format;
+// 読み出しで返すフォーマット(wav_source_format())。PCM は wav_format と同じで、IMA-ADPCM と MP3 はデコードした 16bit PCM
+static wav_format_t wav_output;
+// 無音のバイト値。unsigned 8-bit は 0x80、それ以外は 0
+static uint8_t wav_silence;
+
+// IMA-ADPCM と MP3 のデコード。読み出し側がリングから1ブロック(MP3 は1フレーム)ずつ取り出してデコードし、そこから返す。
+// ADPCM のブロック(最大 1024 バイト、モノラル 2041 サンプル)と MP3 のフレーム(最大 1441 バイト、1152 サンプル x 2)の大きい方
+#define WAV_SOURCE_BLOCK_BYTES (MP3_FRAME_MAX_BYTES > WAV_FORMAT_MAX_ADPCM_BLOCK_ALIGN ? MP3_FRAME_MAX_BYTES : WAV_FORMAT_MAX_ADPCM_BLOCK_ALIGN)
+#define WAV_SOURCE_DECODED_SAMPLES (MP3_DECODER_MAX_SAMPLES > (WAV_FORMAT_MAX_ADPCM_BLOCK_ALIGN - 4) * 2 + 1 ? MP3_DECODER_MAX_SAMPLES : (WAV_FORMAT_MAX_ADPCM_BLOCK_ALIGN - 4) * 2 + 1)
+static uint8_t wav_block[WAV_SOURCE_BLOCK_BYTES] __attribute__((aligned(4)));
+static int16_t wav_decoded_pcm[WAV_SOURCE_DECODED_SAMPLES] __attribute__((aligned(4)));
+static uint32_t wav_decoded;          // デコードしたブロックのサンプル数
+static uint32_t wav_decoded_position; // 次に返すサンプル
+static uint32_t wav_decode_skip;      // 次にデコードするブロックから捨てるサンプル数(ブロックの途中へのシーク)
+static uint32_t wav_decode_flushes;   // 最後に見た file_prefetch_flushes()。変わったらデコードしたブロックを捨てる
+// MP3 のフレームは大きさがヘッダで決まるので、ヘッダから順に wav_block に集める。
+static uint32_t wav_mp3_length; // wav_block に集めたバイト数
+static mp3_frame_header_t wav_mp3_header;
+static uint32_t wav_mp3_resync_bytes; // 同期を取り直すために捨てたバイト数
+
+// 予約した次の曲。書き込み側が予約し、読み出し側が境目をまたいだら wav_format にする。
+static wav_format_t wav_next_format;
+static uint32_t wav_next_tag;
+static uint32_t wav_next_start;   // 次の曲の最初に読むサンプルの番号
+static bool wav_next_requested;   // シークや曲の指定(wav_source_request_*)による切り替え
+static void (*wav_queue_callback)(void);
+
+// 今の曲と次の曲のパス。読み出し側が境目をまたいだら wav_path_slot を入れ替え、書き込み側はもう一方に書く。
+static fs::FS *wav_fs;
+static char wav_paths[2][WAV_SOURCE_PATH_LENGTH];
+static uint8_t wav_path_slot;
+// シーク・曲の指定で置いた境目を、読み出し側がまだまたいでいない。続けて要求されたとき、
+// リングを捨てると境目も消えるので、「今の曲」はまだ始まっていない要求先の曲になる。
+static std::atomic<bool> wav_jump_pending;
+
+// シークと曲の指定の要求。要求する側が wav_request_sequence を奇数にしてから書き、偶数に戻す。
+typedef struct
+{
+    fs::FS *fs;
+    char path[WAV_SOURCE_PATH_LENGTH]; // 空なら今の曲
+    uint32_t tag;
+    uint32_t sample;
+} wav_request_t;
+static wav_request_t wav_request;
+static std::atomic<uint32_t> wav_request_sequence;
+static uint32_t wav_request_done; // 書き込み側が最後に処理した wav_request_sequence
+
+// 新しい位置(曲の先頭・シーク先)の最初のサンプルを読んだ回数と、その位置。読み出し側が更新する。
+static std::atomic<uint32_t> wav_landings;
+static uint32_t wav_landing_sample;
+static bool wav_landing_requested;
+// 境目をまたいでから最初のサンプルを読むまでの間。位置は書き込み側が次の予約で書き換える前に写しておく。
+static bool wav_landing_pending;
+static uint32_t wav_pending_sample;
+static bool wav_pending_requested;
+// 最後に見た file_prefetch_flushes()。変わったらシーク先の最初のデータまで無音をアンダーランに数えない。
+static uint32_t wav_flushes_seen;
+
+// 曲の切り替わり。wav_track_changes は最後に書き、loop() などから tag と一緒に読めるようにする。
+static std::atomic<uint32_t> wav_track_changes;
+static std::atomic<uint32_t> wav_track_tag;
+static std::atomic<uint32_t> wav_gaps;
+static uint32_t wav_last_gap_samples;
+static uint32_t wav_max_gap_samples;
+// 最後に実データを返してから続けて返した無音のサンプル数と、次の曲の最初のサンプルを待っているか
+static uint32_t wav_silence_run;
+static bool wav_gap_pending;
+
+// 先読みリング。ファイルから直接この領域に読み込む。
+static uint8_t wav_prefetch_buffer[WAV_PREFETCH_SIZE] __attribute__((aligned(4)));
+static file_prefetch_t wav_prefetch;
+
+// 読み出し側でデコードするフォーマットか
+static inline bool wav_source_is_coded(const wav_format_t *format)
+{
+    return format->format_tag == WAV_FORMAT_IMA_ADPCM || format->format_tag == WAV_FORMAT_MPEG_LAYER3;
+}
+
+// 読み出しで返すフォーマット。IMA-ADPCM と MP3 は 16bit PCM にデコードして返す。
+static void wav_source_output_format(const wav_format_t *format, wav_format_t *output)
+{
+    *output = *format;
+    if (wav_source_is_coded(format))
+    {
+        output->format_tag = WAV_FORMAT_PCM;
+        output->bits_per_sample = 16;
+        output->block_align = 2 * format->num_channels;
+        output->samples_per_block = 1;
+        output->byte_rate = format->sample_rate * output->block_align;
+        output->data_size = wav_format_num_samples(format) * output->block_align;
+    }
+}
+
+// ファイルの中で sample 番目のサンプルを含む(ADPCM はブロックの先頭の)バイト位置。
+// MP3 は平均のビットレートで換算した位置で、読み出し側がそこから次のフレームのヘッダを探す。
+static uint32_t wav_source_sample_offset(const wav_format_t *format, uint32_t sample)
+{
+    if (format->format_tag == WAV_FORMAT_MPEG_LAYER3)
+        return format->data_offset + (uint32_t)((uint64_t)sample * format->byte_rate / format->sample_rate);
+    return format->data_offset + sample / format->samples_per_block * format->block_align;
+}
+
+// 新しい位置の最初のサンプルから読むように、デコードしたブロックを捨てる。
+static void wav_source_reset_decoder(uint32_t start)
+{
+    wav_decoded = 0;
+    wav_decoded_position = 0;
+    wav_mp3_length = 0;
+    wav_decode_skip = wav_format.format_tag == WAV_FORMAT_IMA_ADPCM ? start % wav_format.samples_per_block : 0;
+}
+
+// 要求された曲を開き、sample の位置から読み込む。リングは file_prefetch_flush() で空にしてある。
+static void wav_source_jump(const wav_request_t *request)
+{
+    bool same_track = request->path[0] == '\0';
+    bool pending = wav_jump_pending.load(std::memory_order_acquire);
+    fs::FS *fs = same_track ? wav_fs : request->fs;
+    const char *path = same_track ? wav_paths[pending ? wav_path_slot ^ 1 : wav_path_slot] : request->path;
+    File file = fs->open(path, "r");
+    wav_format_result_t result = file ? wav_format_parse(file, &wav_next_format) : WAV_FORMAT_ERROR_NO_DATA;
+    if (result != WAV_FORMAT_OK || wav_next_format.sample_rate != wav_format.sample_rate ||
+        (wav_next_format.format_tag == WAV_FORMAT_MPEG_LAYER3 && !mp3_decoder_begin()))
+    {
+        // 新しい位置が無いので、次の要求までは無音になる。
+        Serial.printf("%s: cannot seek\n\r", path);
+        if (file)
+            file.close();
+        return;
+    }
+    uint32_t num_samples = wav_format_num_samples(&wav_next_format);
+    uint32_t sample = request->sample < num_samples ? request->sample : num_samples;
+    if (path != wav_paths[wav_path_slot ^ 1])
+        snprintf(wav_paths[wav_path_slot ^ 1], WAV_SOURCE_PATH_LENGTH, "%s", path);
+    if (!same_track)
+        wav_next_tag = request->tag;
+    else if (!pending)
+        wav_next_tag = wav_track_tag.load(std::memory_order_relaxed);
+    wav_fs = fs;
+    wav_jump_pending.store(true, std::memory_order_relaxed);
+    wav_next_start = sample;
+    wav_next_requested = true;
+    // data チャンクの先頭からサンプル番号 x block_align の位置にシークするだけで、ファイルをたどらない。
+    // ADPCM はサンプルを含むブロックの先頭にシークし、読み出し側がブロックの中の手前の分を捨てる。
+    // MP3 はビットレートで換算した位置にシークし、読み出し側が次のフレームのヘッダから読む。
+    file_prefetch_jump(&wav_prefetch, file, wav_next_format.data_offset, wav_next_format.data_size,
+                       wav_source_sample_offset(&wav_next_format, sample), true);
+}
+
+// 要求があれば処理する。読み出し側がリングを捨てるのを待っている間は true を返す。
+static bool wav_source_service_request(void)
+{
+    uint32_t sequence = wav_request_sequence.load(std::memory_order_acquire);
+    if (sequence == wav_request_done || (sequence & 1))
+        return false;
+    wav_request_t request = wav_request;
+    // コピー中に次の要求が書かれていたら、次の呼び出しでやり直す。
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (wav_request_sequence.load(std::memory_order_relaxed) != sequence)
+        return true;
+    if (!file_prefetch_flush(&wav_prefetch))
+        return true;
+    wav_request_done = sequence;
+    wav_source_jump(&request);
+    return false;
+}
+
+static void wav_source_request(fs::FS *fs, const char *path, uint32_t tag, uint32_t sample)
+{
+    uint32_t sequence = wav_request_sequence.load(std::memory_order_relaxed);
+    wav_request_sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    wav_request.fs = fs;
+    snprintf(wav_request.path, sizeof(wav_request.path), "%s", path);
+    wav_request.tag = tag;
+    wav_request.sample = sample;
+    wav_request_sequence.store(sequence + 2, std::memory_order_release);
+}
+
+void wav_source_request_seek(uint32_t sample)
+{
+    wav_source_request(NULL, "", 0, sample);
+}
+
+void wav_source_request_track(fs::FS &fs, const char *path, uint32_t tag)
+{
+    wav_source_request(&fs, path, tag, 0);
+}
+
+uint32_t wav_source_landings(uint32_t *sample, bool *requested)
+{
+    uint32_t landings = wav_landings.load(std::memory_order_acquire);
+    *sample = wav_landing_sample;
+    *requested = wav_landing_requested;
+    return landings;
+}
+
+void wav_source_service(void)
+{
+    if (wav_source_service_request())
+        return;
+    // 短い曲は読み出し側が境目をまたぐ前に末尾まで読み込んで閉じてしまうので、閉じた後(残り 0)も予約させる。
+    if (wav_queue_callback != NULL && file_prefetch_can_queue(&wav_prefetch) &&
+        file_prefetch_remaining(&wav_prefetch) <= WAV_SOURCE_QUEUE_AHEAD)
+        wav_queue_callback();
+    file_prefetch_service(&wav_prefetch);
+}
+
+void wav_source_set_queue_callback(void (*callback)(void))
+{
+    wav_queue_callback = callback;
+}
+
+int wav_source_queue(fs::FS &fs, const char *path, uint32_t tag)
+{
+    if (!file_prefetch_can_queue(&wav_prefetch))
+        return -1;
+    File file = fs.open(path, "r");
+    if (!file)
+        return -1;
+    wav_format_result_t result = wav_format_parse(file, &wav_next_format);
+    if (result != WAV_FORMAT_OK || wav_next_format.sample_rate != wav_format.sample_rate ||
+        (wav_next_format.format_tag == WAV_FORMAT_MPEG_LAYER3 && !mp3_decoder_begin()))
+    {
+        file.close();
+        return -1;
+    }
+    // サンプルの途中で次の曲にならないように、data チャンクを block_align の倍数にそろえる。
+    // MP3 はフレームの大きさが変わるので、最後のフレームの終わりまでのまま(途中で切れたフレームは読み出し側で捨てる)。
+    uint32_t data_size = wav_next_format.data_size;
+    if (wav_next_format.format_tag != WAV_FORMAT_MPEG_LAYER3)
+        data_size -= data_size % wav_next_format.block_align;
+    snprintf(wav_paths[wav_path_slot ^ 1], WAV_SOURCE_PATH_LENGTH, "%s", path);
+    wav_next_tag = tag;
+    wav_next_start = 0;
+    wav_next_requested = false;
+    file_prefetch_queue(&wav_prefetch, file, wav_next_format.data_offset, data_size);
+    return 0;
+}
+
+// 境目をまたいで次の曲に進む。フォーマットが同じなら true(同じ読み出しの中で続けて読める)。
+static bool wav_source_next_track(void)
+{
+    wav_format_t output;
+    wav_source_output_format(&wav_next_format, &output);
+    bool same = output.bits_per_sample == wav_output.bits_per_sample && output.num_channels == wav_output.num_channels;
+    wav_format = wav_next_format;
+    wav_output = output;
+    wav_silence = wav_output.bits_per_sample == 8 ? 0x80 : 0x00;
+    wav_source_reset_decoder(wav_next_start);
+    wav_path_slot ^= 1;
+    if (wav_next_requested)
+        wav_jump_pending.store(false, std::memory_order_release);
+    // シーク先の無音は曲間に数えない。同じ曲の中のシークは曲の切り替わりにもしない。
+    wav_gap_pending = !wav_next_requested;
+    wav_landing_pending = true;
+    wav_pending_sample = wav_next_start;
+    wav_pending_requested = wav_next_requested;
+    bool changed = !wav_next_requested || wav_next_tag != wav_track_tag.load(std::memory_order_relaxed);
+    wav_track_tag.store(wav_next_tag, std::memory_order_relaxed);
+    if (changed)
+        wav_track_changes.store(wav_track_changes.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    return same;
+}
+
+int wav_source_open(fs::FS &fs, const char *path, bool loop)
+{
+    // audioファイルをオープンする。
+    File file = fs.open(path, "r");
+    if (!file)
+    {
+        Serial.println("file open failed");
+        return -1;
+    }
+    // ヘッダのチャンクをたどってフォーマットと data チャンクの位置を得る。
+    wav_format_result_t result = wav_format_parse(file, &wav_format);
+    if (result != WAV_FORMAT_OK)
+    {
+        Serial.printf("%s: %s\n\r", path, wav_format_result_string(result));
+        file.close();
+        return -1;
+    }
+    if (wav_format.format_tag == WAV_FORMAT_MPEG_LAYER3 && !mp3_decoder_begin())
+    {
+        Serial.printf("%s: MP3 decoder: out of memory\n\r", path);
+        file.close();
+        return -1;
+    }
+    if (wav_format.format_tag == WAV_FORMAT_MPEG_LAYER3)
+        Serial.printf("%s: %u Hz, MP3 %u kbps, %u ch, %u bytes\n\r", path, (unsigned)wav_format.sample_rate,
+                      (unsigned)(wav_format.byte_rate * 8 / 1000), wav_format.num_channels, (unsigned)wav_format.data_size);
+    else
+        Serial.printf("%s: %u Hz, %u bit%s, %u ch, %u bytes\n\r", path, (unsigned)wav_format.sample_rate,
+                      wav_format.bits_per_sample, wav_format.format_tag == WAV_FORMAT_IMA_ADPCM ? " IMA-ADPCM" : "",
+                      wav_format.num_channels, (unsigned)wav_format.data_size);
+    wav_source_output_format(&wav_format, &wav_output);
+    wav_silence = wav_output.bits_per_sample == 8 ? 0x80 : 0x00;
+    wav_source_reset_decoder(0);
+    wav_fs = &fs;
+    wav_path_slot = 0;
+    wav_jump_pending.store(false, std::memory_order_relaxed);
+    snprintf(wav_paths[0], WAV_SOURCE_PATH_LENGTH, "%s", path);
+
+    file_prefetch_init(&wav_prefetch, wav_prefetch_buffer, WAV_PREFETCH_SIZE);
+    file_prefetch_start(&wav_prefetch, file, wav_format.data_offset, wav_format.data_size, wav_format.data_offset, loop);
+    wav_track_changes.store(0, std::memory_order_relaxed);
+    wav_track_tag.store(0, std::memory_order_relaxed);
+    wav_gaps.store(0, std::memory_order_relaxed);
+    wav_last_gap_samples = 0;
+    wav_max_gap_samples = 0;
+    wav_silence_run = 0;
+    wav_gap_pending = false;
+    wav_request_done = wav_request_sequence.load(std::memory_order_relaxed) & ~1u;
+    wav_landings.store(0, std::memory_order_relaxed);
+    wav_landing_pending = false;
+    wav_flushes_seen = file_prefetch_flushes(&wav_prefetch);
+    wav_decode_flushes = wav_flushes_seen;
+    wav_mp3_resync_bytes = 0;
+    return 0;
+}
+
+void wav_source_close(void)
+{
+    file_prefetch_stop(&wav_prefetch);
+}
+
+const wav_format_t *wav_source_format(void)
+{
+    return &wav_output;
+}
+
+// MP3 のフレームを1つ wav_block に集める。level バイトで足りなければ、集めた分を残して false を返す。
+// ヘッダが今のストリームのものでなければ1バイトずらして同期を取り直す(シークの後、壊れたフレーム)。
+static bool wav_source_gather_mp3(uint32_t *level)
+{
+    while (wav_mp3_length < MP3_FRAME_HEADER_SIZE)
+    {
+        uint32_t length = MP3_FRAME_HEADER_SIZE - wav_mp3_length;
+        if (length > *level)
+            length = *level;
+        length = file_prefetch_read(&wav_prefetch, wav_block + wav_mp3_length, length);
+        wav_mp3_length += length;
+        *level -= length;
+        if (wav_mp3_length < MP3_FRAME_HEADER_SIZE)
+            return false;
+        if (!mp3_frame_parse_header(wav_block, &wav_mp3_header) || wav_mp3_header.sample_rate != wav_format.sample_rate ||
+            wav_mp3_header.num_channels != wav_format.num_channels || wav_mp3_header.samples != wav_format.samples_per_block)
+        {
+            memmove(wav_block, wav_block + 1, MP3_FRAME_HEADER_SIZE - 1);
+            wav_mp3_length = MP3_FRAME_HEADER_SIZE - 1;
+            wav_mp3_resync_bytes++;
+        }
+    }
+    uint32_t length = wav_mp3_header.frame_bytes - wav_mp3_length;
+    if (length > *level)
+        length = *level;
+    length = file_prefetch_read(&wav_prefetch, wav_block + wav_mp3_length, length);
+    wav_mp3_length += length;
+    *level -= length;
+    return wav_mp3_length == wav_mp3_header.frame_bytes;
+}
+
+// リングから次のブロック(MP3 はフレーム)を取り出してデコードする。level バイトで足りなければ false を返す。
+static bool wav_source_decode_next(uint32_t *level)
+{
+    if (wav_format.format_tag == WAV_FORMAT_MPEG_LAYER3)
+    {
+        if (!wav_source_gather_mp3(level))
+            return false;
+        // デコードできなかったフレーム(シークの後のビットリザーバが無いものなど)は 0 サンプルで、次のフレームに進む。
+        wav_decoded = mp3_decoder_decode(wav_block, wav_mp3_length, wav_decoded_pcm);
+        wav_mp3_length = 0;
+    }
+    else
+    {
+        uint32_t block_align = wav_format.block_align;
+        if (*level < block_align)
+            return false;
+        file_prefetch_read(&wav_prefetch, wav_block, block_align);
+        *level -= block_align;
+        wav_decoded = ima_adpcm_decode_block(wav_block, block_align, wav_format.num_channels, wav_decoded_pcm);
+    }
+    wav_decoded_position = wav_decode_skip < wav_decoded ? wav_decode_skip : wav_decoded;
+    wav_decode_skip -= wav_decoded_position;
+    return true;
+}
+
+// 最大 length バイト(16bit PCM の block_align の倍数)を、IMA-ADPCM のブロック・MP3 のフレームをデコードして dst に書く。
+// level はリングから境目までに取り出せるバイト数。ブロックが丸ごと届いていなければそこまでにする。
+static uint32_t wav_source_read_decoded(uint8_t *dst, uint32_t length, uint32_t level)
+{
+    uint32_t flushes = file_prefetch_flushes(&wav_prefetch);
+    if (flushes != wav_decode_flushes)
+    {
+        // シークでリングを捨てたので、デコードしてあるシーク前のサンプルと集めかけのフレームも捨てる。
+        wav_decode_flushes = flushes;
+        wav_decoded_position = wav_decoded;
+        wav_mp3_length = 0;
+    }
+    uint32_t sample_bytes = wav_output.block_align;
+    uint32_t done = 0;
+    while (done < length)
+    {
+        if (wav_decoded_position == wav_decoded)
+        {
+            if (!wav_source_decode_next(&level))
+                break;
+            continue;
+        }
+        uint32_t chunk = (wav_decoded - wav_decoded_position) * sample_bytes;
+        if (chunk > length - done)
+            chunk = length - done;
+        memcpy(dst + done, (const uint8_t *)wav_decoded_pcm + wav_decoded_position * sample_bytes, chunk);
+        wav_decoded_position += chunk / sample_bytes;
+        done += chunk;
+    }
+    return done;
+}
+
+int wav_source_read(uint8_t *wav_data, int data_size)
+{
+    uint32_t length = 0;
+    bool format_changed = false;
+    // 無音は読み出しを始めたときのフォーマットで埋める(data_size はその block_align の倍数)。
+    uint32_t block_align = wav_output.block_align;
+    uint8_t silence = wav_silence;
+    while (length < (uint32_t)data_size)
+    {
+        // シークの要求があれば、ここでリングの古いデータを捨てる。
+        uint32_t level = file_prefetch_available(&wav_prefetch);
+        uint32_t until = file_prefetch_until_boundary(&wav_prefetch);
+        // ADPCM・MP3 は今の曲の最後のブロックのデコードした分を返し終わるまで境目を越えない。
+        if (until == 0 && wav_decoded_position == wav_decoded)
+        {
+            // 次の曲(シーク先)の先頭。フォーマットが違えばこの読み出しの残りは前のフォーマットの無音にする。
+            // 書き込み側が次の予約をする前に、パスとフォーマットを入れ替えておく。
+            bool same = wav_source_next_track();
+            file_prefetch_cross_boundary(&wav_prefetch);
+            if (!same)
+            {
+                format_changed = true;
+                break;
+            }
+            continue;
+        }
+        // サンプルの途中で切れないように、block_align の倍数だけ取り出す。境目はまたがない。
+        if (level > until)
+            level = until;
+        uint32_t chunk = (uint32_t)data_size - length;
+        if (wav_source_is_coded(&wav_format))
+        {
+            chunk = wav_source_read_decoded(wav_data + length, chunk, level);
+        }
+        else
+        {
+            if (chunk > level)
+                chunk = level - level % wav_format.block_align;
+            chunk = file_prefetch_read(&wav_prefetch, wav_data + length, chunk);
+        }
+        if (chunk == 0)
+            break;
+        length += chunk;
+        if (wav_gap_pending)
+        {
+            // 次の曲の最初のサンプル。前の曲の最後のサンプルからの無音の長さを曲間として残す。
+            wav_gap_pending = false;
+            wav_last_gap_samples = wav_silence_run;
+            if (wav_silence_run > wav_max_gap_samples)
+                wav_max_gap_samples = wav_silence_run;
+            wav_gaps.store(wav_gaps.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+        if (wav_landing_pending)
+        {
+            // 新しい位置の最初のサンプル。audio_pipeline がこのサンプルを含むフレームのRTPタイムスタンプを再生位置にする。
+            wav_landing_pending = false;
+            wav_landing_sample = wav_pending_sample;
+            wav_landing_requested = wav_pending_requested;
+            wav_landings.store(wav_landings.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+            wav_flushes_seen = file_prefetch_flushes(&wav_prefetch);
+        }
+        wav_silence_run = 0;
+    }
+    if (length < (uint32_t)data_size)
+    {
+        // 補充が間に合わなかった、ファイル末尾、またはフォーマットの切り替え。
+        memset(wav_data + length, silence, data_size - length);
+        wav_silence_run += (data_size - length) / block_align;
+        // シークしてから新しい位置のデータが届くまでの無音もアンダーランに数えない。
+        bool seeking = wav_flushes_seen != file_prefetch_flushes(&wav_prefetch);
+        if (!format_changed && !seeking)
+            file_prefetch_count_underrun(&wav_prefetch, data_size - length);
+    }
+    return 0;
+}
+
+void wav_source_skip(uint32_t num_samples)
+{
+    if (!wav_source_is_coded(&wav_format))
+    {
+        file_prefetch_discard(&wav_prefetch, num_samples * wav_format.block_align);
+        return;
+    }
+    // デコードしてある分を先に捨て、残りはブロック単位でリングから捨てて、半端は次のブロックから捨てる。
+    uint32_t buffered = wav_decoded - wav_decoded_position;
+    if (num_samples <= buffered)
+    {
+        wav_decoded_position += num_samples;
+        return;
+    }
+    wav_decoded_position = wav_decoded;
+    num_samples += wav_decode_skip - buffered;
+    uint32_t blocks = num_samples / wav_format.samples_per_block;
+    wav_decode_skip = num_samples % wav_format.samples_per_block;
+    if (wav_format.format_tag == WAV_FORMAT_MPEG_LAYER3)
+    {
+        // MP3 は平均のビットレートでフレーム数分のバイトを捨て、集めかけのフレームも捨てて次のヘッダから読む。
+        wav_mp3_length = 0;
+        file_prefetch_discard(&wav_prefetch, (uint32_t)((uint64_t)blocks * wav_format.samples_per_block * wav_format.byte_rate /
+                                                        wav_format.sample_rate));
+        return;
+    }
+    file_prefetch_discard(&wav_prefetch, blocks * wav_format.block_align);
+}
+
+void wav_source_get_track_stats(wav_source_track_stats_t *stats)
+{
+    stats->changes = wav_track_changes.load(std::memory_order_acquire);
+    stats->tag = wav_track_tag.load(std::memory_order_relaxed);
+    stats->gaps = wav_gaps.load(std::memory_order_acquire);
+    stats->last_gap_samples = wav_last_gap_samples;
+    stats->max_gap_samples = wav_max_gap_samples;
+}
+
+uint32_t wav_source_resync_bytes(void)
+{
+    return wav_mp3_resync_bytes;
+}
+
+void wav_source_get_stats(wav_source_stats_t *stats)
+{
+    file_prefetch_get_stats(&wav_prefetch, stats);
+}
+
+void wav_source_reset_stats(void)
+{
+    file_prefetch_reset_stats(&wav_prefetch);
+}
+
+void wav_source_dump_stats(void)
+{
+    wav_source_stats_t stats;
+    wav_source_get_stats(&stats);
+    Serial.printf("WAV prefetch: level %u/%u (min %u), refills %u, worst refill %u us, underrun %u bytes\n\r",
+                  (unsigned)stats.level, (unsigned)stats.capacity, (unsigned)stats.min_level,
+                  (unsigned)stats.refills, (unsigned)stats.worst_refill_us, (unsigned)stats.underrun_bytes);
+    read_stats_dump("WAV reads", &stats.reads);
+    if (wav_format.format_tag == WAV_FORMAT_MPEG_LAYER3)
+        Serial.printf("MP3: %u frames, %u decode errors, %u bytes skipped to resync, decoder heap %u bytes\n\r",
+                      (unsigned)mp3_decoder_frames(), (unsigned)mp3_decoder_errors(), (unsigned)wav_mp3_resync_bytes,
+                      (unsigned)mp3_decoder_heap_bytes());
+    wav_source_track_stats_t track;
+    wav_source_get_track_stats(&track);
+    if (track.changes > 0)
+        Serial.printf("WAV tracks: %u changes, gap last %u samples (max %u)\n\r", (unsigned)track.changes,
+                      (unsigned)track.last_gap_samples, (unsigned)track.max_gap_samples);
+}
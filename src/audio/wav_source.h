@@ -0,0 +1,98 @@
+#ifndef AUDIO_WAV_SOURCE_H
+#define AUDIO_WAV_SOURCE_H
+
+#include <stdint.h>
+#include <FS.h>
+#include "file_prefetch.h"
+#include "wav_format.h"
+
+// WAVファイルからPCMデータを読み出すソースです。
+// LittleFS(main.cpp)とSDFS(sdcard_play.cpp)のどちらの fs::FS でも使えます。
+// ホストビルドでは host/shim のファイルベースの FS がそのまま使われます。
+//
+// ファイルの読み込みは先読みリング(file_prefetch, WAV_PREFETCH_NUM_BLOCKS ブロック)で行います。
+// wav_source_service() を loop() から呼んでリングを補充し、
+// オーディオのタイマーコールバックからは wav_source_read() でリングから取り出すだけにします。
+//
+// 曲間の無い連続再生(playlist): wav_source_set_queue_callback() で登録した関数が、今のファイルの残りが
+// WAV_SOURCE_QUEUE_AHEAD バイトを切ったら wav_source_service() の中から呼ばれ、wav_source_queue() で
+// 次のファイルを予約します。次のファイルは今のファイルの末尾に続けて先読みリングに読み込むので、
+// 同じフォーマットの曲はサンプル単位で途切れずにつながります。フォーマット(ビット数・チャンネル数)が
+// 違う曲は、境目を含む読み出しの残りを無音にして次の読み出しから切り替えます。
+// サンプリング周波数はエンコーダの設定で決まるので、同じ周波数の曲だけを予約します。
+//
+// IMA-ADPCM の WAV は、読み出し側がリングから1ブロックずつ取り出してデコード(ima_adpcm)し、16bit PCM として返します。
+// wav_source_format() は読み出しで返すフォーマット(16bit PCM)なので、audio_pipeline は PCM の WAV と同じに扱えます。
+// ファイルからの読み込みは 16bit の 1/4 です。ブロックの途中へのシークは、ブロックの先頭から読んで手前の分を捨てます。
+//
+// MP3 のファイル(RIFF でないもの)も同じように、読み出し側がリングから1フレームずつ集めて mp3_decoder でデコードします。
+// ファイルからの読み込みは 16bit ステレオの PCM の 1/10 程度(128kbps なら 16KB/s)です。フレームの大きさはヘッダで決まるので
+// 読み出し側がヘッダから順にフレームを集め、シーク先(平均のビットレートで換算した位置)では次のヘッダを探して同期を取ります。
+// 1フレーム(1152 サンプル)のデコードがタイマーコールバックの1回の読み出しに入るので、ビットレートとサンプリング周波数ごとの
+// デコードの時間は mp3_decoder_benchmark() で確かめます。
+//
+// シーク: wav_source_request_seek() / wav_source_request_track() は要求を置くだけで、次の wav_source_service() が
+// 先読みリングを捨てさせて(file_prefetch_flush)、data チャンクの先頭 + サンプル番号 x block_align にシークします。
+// ファイルはたどらず、ストリーミングもエンコーダも止めません。新しい位置の最初のサンプルを読んだことは
+// wav_source_landings() で分かり、audio_pipeline はそのフレームのRTPタイムスタンプを再生位置の基準にします。
+
+#define WAV_PREFETCH_NUM_BLOCKS 8
+// 次の曲を予約する、今のファイルの残りのバイト数(SDのオープンとヘッダの読み込みに余裕を持たせる)
+#define WAV_SOURCE_QUEUE_AHEAD (4 * FILE_PREFETCH_BLOCK_SIZE * WAV_PREFETCH_NUM_BLOCKS)
+// 覚えておくパスの長さ(プレイリストのディレクトリ + ファイル名)
+#define WAV_SOURCE_PATH_LENGTH 100
+
+typedef file_prefetch_stats_t wav_source_stats_t;
+
+// 曲の切り替わりの統計。読み出し側が更新します。
+typedef struct
+{
+    uint32_t changes;          // 次の曲に進んだ回数
+    uint32_t tag;              // 今読み出している曲の wav_source_queue() の tag
+    uint32_t gaps;             // 曲間を測った回数。次の曲の最初のサンプルを読んだときに数えるので、changes より遅れることがある
+    uint32_t last_gap_samples; // 直前の切り替わりで、前の曲の最後のサンプルと次の曲の最初のサンプルの間に入れた無音のサンプル数
+    uint32_t max_gap_samples;
+} wav_source_track_stats_t;
+
+// ファイルをオープンしてヘッダを解析し、data チャンクの先頭にシークしてリングを満たします。
+// loop が true の場合、data チャンクの末尾に達したら先頭に戻って繰り返し再生します。
+// false の場合は末尾以降は無音を返します。
+int wav_source_open(fs::FS &fs, const char *path, bool loop);
+void wav_source_close(void);
+// wav_source_read() で返すデータのフォーマット。IMA-ADPCM はデコードした 16bit PCM のフォーマットを返します。
+const wav_format_t *wav_source_format(void);
+
+// 次の曲を予約する関数を登録します。NULL で解除します。書き込み側(wav_source_service() を呼ぶ側)から呼ばれます。
+void wav_source_set_queue_callback(void (*callback)(void));
+// path を今のファイルの次に再生するように予約します。tag は切り替わったときに wav_source_get_track_stats() で返す値です。
+// ヘッダが読めない、またはサンプリング周波数が今のファイルと違う場合は -1 を返します。
+// wav_source_set_queue_callback() で登録した関数の中から呼びます。
+int wav_source_queue(fs::FS &fs, const char *path, uint32_t tag);
+
+// リングがローウォーターマークを下回っていれば、ハイウォーターマークまでファイルから補充します。
+// タイマーコールバックの外(loop() など)から呼びます。
+void wav_source_service(void);
+
+// data_size バイト(block_align の倍数)分のデータを wav_data に読み込みます。リングから取り出すだけでファイルには触りません。
+int wav_source_read(uint8_t *wav_data, int data_size);
+
+// num_samples サンプル分のデータを読まずに捨てます。wav_source_read() を呼ぶ側から呼びます。
+void wav_source_skip(uint32_t num_samples);
+
+void wav_source_get_stats(wav_source_stats_t *stats);
+void wav_source_reset_stats(void);
+void wav_source_dump_stats(void);
+void wav_source_get_track_stats(wav_source_track_stats_t *stats);
+// MP3 のフレームの同期を取り直すために捨てたバイト数(シーク先のフレームの途中、フレームの間のゴミ)
+uint32_t wav_source_resync_bytes(void);
+
+// 今の曲の sample 番目のサンプルから再生するように要求します。曲の長さを超える場合は曲の末尾にします。
+// loop() や BTstack のコールバックから呼べます。続けて呼んだ場合は最後の要求だけを処理します。
+void wav_source_request_seek(uint32_t sample);
+// path の曲の先頭から再生するように要求します(プレイリストの前後の曲)。tag は wav_source_queue() と同じです。
+void wav_source_request_track(fs::FS &fs, const char *path, uint32_t tag);
+// 新しい位置(曲の先頭・シーク先)の最初のサンプルを読んだ回数を返し、その位置の曲の中のサンプル番号と、
+// 要求したシーク・曲の指定によるものかを返します。読み出し側から呼びます。
+uint32_t wav_source_landings(uint32_t *sample, bool *requested);
+
+#endif
@@ -0,0 +1,233 @@
+#include "sd_block_device.h"
+
+#include "Arduino.h"
+#include <SPI.h>
+#include "hardware/dma.h"
+#include "hardware/spi.h"
+#include "audio/sector_reader.h"
+
+// データトークン(0xFE)を待つ時間の上限(SD の仕様では読み込みは最大 100ms)
+static const uint32_t SD_TOKEN_TIMEOUT_US = 100000;
+// CMD12 の後にカードがビジーでなくなるのを待つ時間の上限
+static const uint32_t SD_BUSY_TIMEOUT_US = 250000;
+
+typedef enum
+{
+    SD_STATE_IDLE = 0,
+    SD_STATE_TOKEN, // データトークンを待っている
+    SD_STATE_DATA,  // DMA で1ブロックを読み込んでいる
+} sd_state_t;
+
+static block_device_t sd_device;
+static uint8_t sd_cs_pin;
+static SPISettings sd_spi_settings;
+static bool sd_block_addressing;
+static int sd_dma_tx = -1;
+static int sd_dma_rx = -1;
+static const uint8_t sd_fill = 0xFF;
+
+static sd_state_t sd_state;
+static uint8_t *sd_dst;
+static uint32_t sd_remaining; // まだ読んでいないブロック数
+static uint32_t sd_token_start;
+
+static uint8_t sd_transfer(uint8_t value)
+{
+    uint8_t result;
+    spi_write_read_blocking(spi0, &value, &result, 1);
+    return result;
+}
+
+static uint8_t sd_command(uint8_t command, uint32_t argument)
+{
+    uint8_t frame[6] = {(uint8_t)(0x40 | command), (uint8_t)(argument >> 24), (uint8_t)(argument >> 16),
+                        (uint8_t)(argument >> 8), (uint8_t)argument, 0x01};
+    sd_transfer(0xFF);
+    spi_write_blocking(spi0, frame, sizeof(frame));
+    // CMD12 の直後の1バイトは読み捨てる(スタッフバイト)
+    if (command == 12)
+        sd_transfer(0xFF);
+    for (int i = 0; i < 10; i++)
+    {
+        uint8_t response = sd_transfer(0xFF);
+        if ((response & 0x80) == 0)
+            return response;
+    }
+    return 0xFF;
+}
+
+static void sd_select(void)
+{
+    SPI.beginTransaction(sd_spi_settings);
+    digitalWrite(sd_cs_pin, LOW);
+}
+
+static void sd_deselect(void)
+{
+    digitalWrite(sd_cs_pin, HIGH);
+    // CS を上げた後に8クロック送って、カードに MISO を放させる。
+    sd_transfer(0xFF);
+    SPI.endTransaction();
+}
+
+// 1ブロック(512 バイト)を DMA で sd_dst に読み込み始める。
+static void sd_start_dma(void)
+{
+    dma_channel_config rx = dma_channel_get_default_config(sd_dma_rx);
+    channel_config_set_transfer_data_size(&rx, DMA_SIZE_8);
+    channel_config_set_read_increment(&rx, false);
+    channel_config_set_write_increment(&rx, true);
+    channel_config_set_dreq(&rx, spi_get_dreq(spi0, false));
+    dma_channel_configure(sd_dma_rx, &rx, sd_dst, &spi_get_hw(spi0)->dr, BLOCK_DEVICE_SECTOR_SIZE, false);
+
+    dma_channel_config tx = dma_channel_get_default_config(sd_dma_tx);
+    channel_config_set_transfer_data_size(&tx, DMA_SIZE_8);
+    channel_config_set_read_increment(&tx, false);
+    channel_config_set_write_increment(&tx, false);
+    channel_config_set_dreq(&tx, spi_get_dreq(spi0, true));
+    dma_channel_configure(sd_dma_tx, &tx, &spi_get_hw(spi0)->dr, &sd_fill, BLOCK_DEVICE_SECTOR_SIZE, false);
+
+    dma_start_channel_mask((1u << sd_dma_rx) | (1u << sd_dma_tx));
+}
+
+// CMD12 で読み込みを止め、カードがビジーでなくなるまで待つ。
+static bool sd_stop(void)
+{
+    sd_command(12, 0);
+    uint32_t start = micros();
+    bool ok = false;
+    while (micros() - start < SD_BUSY_TIMEOUT_US)
+    {
+        if (sd_transfer(0xFF) == 0xFF)
+        {
+            ok = true;
+            break;
+        }
+    }
+    sd_deselect();
+    sd_state = SD_STATE_IDLE;
+    return ok;
+}
+
+static bool sd_start_read(block_device_t *device, uint32_t sector, uint8_t *dst, uint32_t count)
+{
+    (void)device;
+    if (sd_state != SD_STATE_IDLE || count == 0 || count > SD_BLOCK_DEVICE_MAX_SECTORS)
+        return false;
+    sd_select();
+    if (sd_command(18, sd_block_addressing ? sector : sector * BLOCK_DEVICE_SECTOR_SIZE) != 0)
+    {
+        sd_deselect();
+        return false;
+    }
+    sd_dst = dst;
+    sd_remaining = count;
+    sd_token_start = micros();
+    sd_state = SD_STATE_TOKEN;
+    return true;
+}
+
+static int sd_poll(block_device_t *device)
+{
+    (void)device;
+    for (;;)
+    {
+        switch (sd_state)
+        {
+        case SD_STATE_TOKEN:
+        {
+            uint8_t token = sd_transfer(0xFF);
+            if (token == 0xFF)
+            {
+                if (micros() - sd_token_start < SD_TOKEN_TIMEOUT_US)
+                    return 0;
+                sd_stop();
+                return -1;
+            }
+            if (token != 0xFE)
+            {
+                // データエラートークン
+                sd_stop();
+                return -1;
+            }
+            sd_start_dma();
+            sd_state = SD_STATE_DATA;
+            break;
+        }
+        case SD_STATE_DATA:
+            if (dma_channel_is_busy(sd_dma_rx))
+                return 0;
+            // CRC は見ない
+            sd_transfer(0xFF);
+            sd_transfer(0xFF);
+            sd_dst += BLOCK_DEVICE_SECTOR_SIZE;
+            if (--sd_remaining > 0)
+            {
+                sd_token_start = micros();
+                sd_state = SD_STATE_TOKEN;
+                break;
+            }
+            return sd_stop() ? 1 : -1;
+        default:
+            return -1;
+        }
+    }
+}
+
+block_device_t *sd_block_device_begin(uint8_t cs_pin, uint32_t clock_hz)
+{
+    sd_cs_pin = cs_pin;
+    sd_spi_settings = SPISettings(clock_hz, MSBFIRST, SPI_MODE0);
+    sd_state = SD_STATE_IDLE;
+
+    // CMD58(READ_OCR)の CCS ビットで、アドレスがブロック単位かバイト単位かを決める。
+    sd_select();
+    uint8_t response = sd_command(58, 0);
+    uint8_t ocr[4];
+    for (int i = 0; i < 4; i++)
+        ocr[i] = sd_transfer(0xFF);
+    sd_deselect();
+    if (response != 0)
+        return NULL;
+    sd_block_addressing = (ocr[0] & 0x40) != 0;
+
+    if (sd_dma_rx < 0)
+    {
+        sd_dma_rx = dma_claim_unused_channel(true);
+        sd_dma_tx = dma_claim_unused_channel(true);
+    }
+    sd_device.start_read = sd_start_read;
+    sd_device.poll = sd_poll;
+    sd_device.max_sectors = SD_BLOCK_DEVICE_MAX_SECTORS;
+    sd_device.context = NULL;
+    Serial.printf("SD block device: SPI %u Hz, %s addressing\n\r", (unsigned)spi_get_baudrate(spi0),
+                  sd_block_addressing ? "block" : "byte");
+    return &sd_device;
+}
+
+void sd_block_device_benchmark(uint32_t first_sector, uint32_t size)
+{
+    static uint8_t buffer[SD_BLOCK_DEVICE_MAX_SECTORS * BLOCK_DEVICE_SECTOR_SIZE] __attribute__((aligned(4)));
+    static sector_reader_t reader;
+    if (sd_device.start_read == NULL)
+    {
+        Serial.printf("SD block device is not started\n\r");
+        return;
+    }
+    static const uint32_t max_sectors[] = {1, 8, SD_BLOCK_DEVICE_MAX_SECTORS};
+    for (uint32_t sectors : max_sectors)
+    {
+        sector_reader_init(&reader, &sd_device, first_sector, size, sectors);
+        uint32_t start = micros();
+        int length;
+        while ((length = sector_reader_read(&reader, buffer, sizeof(buffer))) > 0)
+            ;
+        uint32_t elapsed = micros() - start;
+        char name[40];
+        snprintf(name, sizeof(name), "SD CMD18 x%u", (unsigned)sectors);
+        read_stats_dump(name, &reader.stats);
+        Serial.printf("  sustained %.2f MB/s (%u bytes in %u us)%s\n\r",
+                      elapsed > 0 ? (double)reader.position / elapsed : 0.0, (unsigned)reader.position,
+                      (unsigned)elapsed, length < 0 ? ", read error" : "");
+    }
+}
@@ -0,0 +1,26 @@
+#ifndef SD_BLOCK_DEVICE_H
+#define SD_BLOCK_DEVICE_H
+
+#include <stdint.h>
+#include "audio/block_device.h"
+
+// SPI モードの SD カードを block_device として読みます(実機専用)。
+// SDFS.begin() で初期化したカードを、同じ SPI(spi0)と CS ピンでそのまま使います。
+// 読み込みは CMD18(READ_MULTIPLE_BLOCK)で、各ブロックのデータは DMA で読み込み先に直接転送します。
+// 送信側の DMA チャンネルが 0xFF を送り続けるので、転送中は CPU を使いません。
+//
+// SDFS と SPI を取り合わないように、SDFS の読み込みと同じコンテキストから使います
+// (デュアルコアモードで再生中はコア1が SDFS で読むので、ベンチマークはストリーミングしていないときに使います)。
+
+// CMD18 1回で読むセクタ数の最大
+#define SD_BLOCK_DEVICE_MAX_SECTORS 64
+
+// SPI のクロックを clock_hz にして、カードがブロック単位のアドレス(SDHC/SDXC)かを調べ、DMA チャンネルを確保します。
+// 失敗したら NULL を返します。
+block_device_t *sd_block_device_begin(uint8_t cs_pin, uint32_t clock_hz);
+
+// first_sector から size バイトを、1セクタずつの読み込みと最大セクタ数の読み込みで読み、
+// 転送速度とかかった時間のパーセンタイルを表示します。
+void sd_block_device_benchmark(uint32_t first_sector, uint32_t size);
+
+#endif
@@ -42,97 +42,184 @@
 #include <SPI.h>
 #include <SDFS.h>
 
-#include "sbc_encoder.h"
-#include "sbc_enc_func_declare.h"
-#include "sbc_types.h"
-#include "sbc_dct.h"
 #include "a2dp_source.h"
-#include "btstack_sbc_encoder_bluedroid.c"
-
-#define NUM_CHANNELS 2
-#define AUDIO_TIMEOUT_MS 10
-#define SBC_STORAGE_SIZE 1030
+#include "sd_block_device.h"
+#include "audio/audio_pipeline.h"
+#include "audio/connect_planner.h"
+#include "audio/inquiry_ranker.h"
+#include "audio/mp3_decoder.h"
+#include "audio/playlist.h"
+#include "audio/sbc_analysis.h"
+#include "audio/sbc_source.h"
+#include "audio/stack_watermark.h"
+#include "audio/stage_profile.h"
+#include "audio/wav_source.h"
 
 // device_addr_stringはご自身の環境に合わせて修正して下さい。
+// 起動するとまずこのアドレスと、ペアリングしたことのあるスピーカー(フラッシュのリンクキー)にインクワイアリをせずに直接接続します。
+// "" にするとペアリングしたスピーカーだけに直接接続します。
 // Daiso BT earphone
 // static const char *device_addr_string = "41:42:2B:84:12:8D";
 // ダイソー Bluetooth スピーカー LBS
 static const char *device_addr_string = "FD:94:0B:D6:4D:34";
 
-// 音楽ファイル名。ご自身の環境に合わせて修正して下さい。
-// Unsigned 8-bit 48000Hz の WAV ファイルを配置して下さい。
-static const char *WAV_FILE_NAME = "hotmilk.wav";
+// 音楽ファイルのディレクトリ。ご自身の環境に合わせて修正して下さい。
+// WAV ファイル(PCM unsigned 8-bit / 16-bit / 24-bit または IMA-ADPCM、モノラルまたはステレオ)か MP3 ファイルを配置して下さい。
+// ファイル名の順に曲間なしで続けて再生します(playlist)。最初の曲と周波数が違うファイルは飛ばします。
+// 44100Hz / 48000Hz 以外や、スピーカーが対応していない周波数の場合はレート変換して送ります。
+static const char *PLAYLIST_DIR = "/";
+// true にすると最後の曲の後に最初の曲に戻ります。false の場合は最後の曲の後は無音を送ります。
+static const bool PLAYLIST_REPEAT = false;
+// エンコード済みのSBCファイル(ホストの transcode コマンドで作ります)。無くても構いません。
+// ネゴシエーションされた設定と一致すればエンコードせずに送り(曲は進みません)、一致しなければプレイリストのWAVをエンコードします。
+static const char *SBC_FILE_NAME = "hotmilk.sbc";
+
+// SD カードの SPI クロック。SPI モードの SD の上限(デフォルトスピード)は 25MHz です。
+// 配線が長くて読み込みエラーになる場合は下げて下さい。
+static const uint32_t SD_SPI_CLOCK_HZ = 25000000;
+// 'm' のデコードのベンチマークでデコードするフレーム数
+static const uint32_t MP3_BENCHMARK_FRAMES = 400;
+// 'r' の読み込みベンチマークで読むカードの範囲(先頭のセクタとバイト数)
+static const uint32_t SD_BENCHMARK_FIRST_SECTOR = 0;
+static const uint32_t SD_BENCHMARK_SIZE = 1024 * 1024;
+
+// オーディオパイプラインの動作モード。
+// AUDIO_PIPELINE_DUAL_CORE にすると、読み込み・変換・SBCエンコードをコア1で行い、コア0は送信だけを行います。
+static const audio_pipeline_mode_t AUDIO_PIPELINE_MODE = AUDIO_PIPELINE_SINGLE_CORE;
+
+// シリアルの '+' / '-' で変える音量の幅(絶対音量 0..127)
+static const uint8_t VOLUME_STEP = 8;
+
+// 直接の接続がこの回数ページタイムアウトしたら、インクワイアリで探します(ほかの理由の失敗は数えません)。
+static const uint8_t MAX_PAGE_TIMEOUTS = 3;
+// 1回のページングの時間(0.625ms 単位)。0x1000 で 2.56 秒(BTstack のデフォルトは 5.12 秒)。
+static const uint16_t PAGE_TIMEOUT_SLOTS = 0x1000;
 
 static bd_addr_t device_addr;
 
 static bool scan_active;
-
-// wavファイルの定義
-static File wav_file;
-static File sd_file;
-static size_t wav_length;
-static size_t sd_data_length;
-// wavデータはファイルの先頭に４４バイトのヘッダがある。
-static const char WAV_START_POINT = 44;
-static const int WAV_DATA_BUFFER_SIZE = 1024*2;
-static uint8_t wav_data_buffer[WAV_DATA_BUFFER_SIZE];
-static int wav_data_buffer_index = 0;
-
-// static int current_sample_rate = 44100;
-static int current_sample_rate = 48000;
+// 知っているスピーカーへの直接の接続と、インクワイアリへの切り替え
+static connect_planner_t connect_planner;
+// インクワイアリで見つけたデバイスの順位付け
+static inquiry_ranker_t inquiry_ranker;
+// インクワイアリで、Class of Device にかかわらず一番先に試すスピーカー(アドレスか、EIR の名前の先頭)。
+// 見つかったらインクワイアリの終わりを待たずに接続します。
+static const char *const SPEAKER_ALLOWLIST[] = {"FD:94:0B:D6:4D:34", "41:42:2B:84:12:8D"};
 
 static btstack_packet_callback_registration_t hci_event_callback_registration;
 
-static uint8_t media_sbc_codec_configuration[4];
+// 同じ音を送るスピーカーの数。スピーカーごとにストリームエンドポイントと a2dp_media_sending_context_t を使う。
+// btstack_config.h の MAX_NR_AVDTP_CONNECTIONS / MAX_NR_AVDTP_STREAM_ENDPOINTS もこの数にする。
+static const int MAX_SINKS = SBC_FANOUT_MAX_READERS;
 
-static const int A2DP_SOURCE_DEMO_INQUIRY_DURATION_1280MS = 12;
+static uint8_t media_sbc_codec_configuration[MAX_SINKS][4];
+
+// インクワイアリの長さ(1.28 秒単位)。この間に見つかったデバイスから接続先を選ぶ。
+static const int A2DP_SOURCE_DEMO_INQUIRY_DURATION_1280MS = 3;
 
 // A2DPメディア送信に関連する情報を追跡するための構造体変数を宣言しています。この変数は、音楽の送信に関連するさまざまな状態や情報を保持するために使用されます。
 // A2DP接続のID、ローカルおよびリモートのストリームエンドポイントID、ストリームの状態、音量など、メディア送信に関する情報を追跡するために使用されます。
 // この構造体変数は、A2DPパケットハンドラ関数内でイベントに応じた処理を行う際に参照され、音楽の送信状態を適切に管理するために使用されます。
-typedef struct
-{
-    uint16_t a2dp_cid;     // A2DP接続のID
-    uint8_t local_seid;    // ローカルのストリームエンドポイントID
-    uint8_t remote_seid;   // リモートのストリームエンドポイントID
-    uint8_t stream_opened; // ストリームが開いているかどうかのフラグ
-    uint16_t avrcp_cid;
-
-    uint32_t time_audio_data_sent; // ms
-    uint32_t acc_num_missed_samples;
-    uint32_t samples_ready;
-    btstack_timer_source_t audio_timer;
-    uint8_t streaming;
-    int max_media_payload_size;
-    uint32_t rtp_timestamp;
-
-    uint8_t sbc_storage[SBC_STORAGE_SIZE];
-    uint16_t sbc_storage_count;
-    uint8_t sbc_ready_to_send;
-
-    uint8_t volume; // 音量
-} a2dp_media_sending_context_t;
-static a2dp_media_sending_context_t media_tracker;
+// スピーカーごとに1つ使い、a2dp_cid が 0 のものは空いています。
+static a2dp_media_sending_context_t media_trackers[MAX_SINKS];
+
+// 2台目のスピーカーへの接続をもう試したか。1台目が切断されたら戻す。
+static bool next_sink_tried;
 
 // SBCメディア送信に関連する情報を追跡するための構造体変数を宣言しています。
 // この構造体変数は、サンプリング周波数、チャンネルモード、ブロック長、サブバンド数、ビットプール値など、SBCコーデックのさまざまなパラメータを保持します。これらのパラメータは、音声データの圧縮や品質に影響を与えます。
-typedef struct
-{
-    int reconfigure;                                   // 再設定が必要かどうかのフラグ
-    int num_channels;                                  // チャンネル数（モノラルまたはステレオ）
-    int sampling_frequency;                            // サンプリング周波数（Hz）
-    int block_length;                                  // ブロック長
-    int subbands;                                      // サブバンド数
-    int min_bitpool_value;                             // 最小ビットプール値
-    int max_bitpool_value;                             // 最大ビットプール値
-    btstack_sbc_channel_mode_t channel_mode;           // チャンネルモード（モノ、デュアル、ステレオ、ジョイントステレオ）
-    btstack_sbc_allocation_method_t allocation_method; // 割り当て方法（SNRまたはLOUDNESS）
-} media_codec_configuration_sbc_t;
 static media_codec_configuration_sbc_t sbc_configuration;
+// sbc_configuration を受け取ったスピーカー(エンコーダの設定を決めたスピーカー)。
+static a2dp_media_sending_context_t *sbc_configuration_tracker;
+// スピーカーごとに受け取った設定。media_trackers と同じ順番です。
+static media_codec_configuration_sbc_t sink_configurations[MAX_SINKS];
+
+// a2dp_cid のスピーカーのコンテキスト。無ければ NULL。
+static a2dp_media_sending_context_t *a2dp_source_demo_tracker(uint16_t a2dp_cid)
+{
+    for (a2dp_media_sending_context_t &tracker : media_trackers)
+    {
+        if (a2dp_cid != 0 && tracker.a2dp_cid == a2dp_cid)
+            return &tracker;
+    }
+    return NULL;
+}
+
+// avrcp_cid のスピーカーのコンテキスト。無ければ NULL。
+static a2dp_media_sending_context_t *a2dp_source_demo_avrcp_tracker(uint16_t avrcp_cid)
+{
+    for (a2dp_media_sending_context_t &tracker : media_trackers)
+    {
+        if (avrcp_cid != 0 && tracker.avrcp_cid == avrcp_cid)
+            return &tracker;
+    }
+    return NULL;
+}
+
+// address に接続している(または接続しようとしている)スピーカーのコンテキスト。無ければ NULL。
+static a2dp_media_sending_context_t *a2dp_source_demo_address_tracker(const bd_addr_t address)
+{
+    for (a2dp_media_sending_context_t &tracker : media_trackers)
+    {
+        if ((tracker.a2dp_cid != 0 || tracker.avrcp_cid != 0) && bd_addr_cmp(tracker.remote_address, address) == 0)
+            return &tracker;
+    }
+    return NULL;
+}
+
+// 空いているコンテキスト。無ければ NULL。
+static a2dp_media_sending_context_t *a2dp_source_demo_free_tracker(void)
+{
+    for (a2dp_media_sending_context_t &tracker : media_trackers)
+    {
+        if (tracker.a2dp_cid == 0 && tracker.avrcp_cid == 0)
+            return &tracker;
+    }
+    return NULL;
+}
+
+// tracker のほかに接続している(または接続しようとしている)スピーカーのコンテキスト。無ければ NULL。
+static a2dp_media_sending_context_t *a2dp_source_demo_other_tracker(const a2dp_media_sending_context_t *tracker)
+{
+    for (a2dp_media_sending_context_t &other : media_trackers)
+    {
+        if (&other != tracker && other.a2dp_cid != 0)
+            return &other;
+    }
+    return NULL;
+}
 
-// SBC（Subband Coding）エンコーダの内部状態を保持するための構造体変数です。
-// この構造体変数は、エンコーダの内部状態、作業バッファ、およびエンコーディングプロセスに必要なパラメータを保持します。これには、サンプリング周波数、チャンネルモード、ブロック長、サブバンド数、ビットプール値など、SBCエンコーディングの設定が含まれます。
-static btstack_sbc_encoder_state_t sbc_encoder_state;
+// configuration のスピーカーに、sbc_configuration でエンコードしたフレームをそのまま送れるようにする。
+// 周波数・チャンネルモード・ブロック長・サブバンド数・割り当て方式が同じで、ビットプールの範囲が重なっていれば、
+// エンコーダのビットプールを両方のスピーカーの範囲の共通部分に狭めて true を返す。
+static bool a2dp_source_demo_share_encoder(const media_codec_configuration_sbc_t *configuration)
+{
+    if (configuration->sampling_frequency != sbc_configuration.sampling_frequency || configuration->channel_mode != sbc_configuration.channel_mode ||
+        configuration->block_length != sbc_configuration.block_length || configuration->subbands != sbc_configuration.subbands ||
+        configuration->allocation_method != sbc_configuration.allocation_method)
+        return false;
+    return audio_pipeline_set_bitpool_range(btstack_max(configuration->min_bitpool_value, sbc_configuration.min_bitpool_value),
+                                            btstack_min(configuration->max_bitpool_value, sbc_configuration.max_bitpool_value));
+}
+
+// tracker のスピーカーが切断されたら、ビットプールの範囲を残ったスピーカーの範囲に戻す。
+// エンコーダの設定を決めたスピーカーが切断されたら、残ったスピーカーの設定を引き継ぐ(周波数などは同じ)。
+static void a2dp_source_demo_release_encoder(const a2dp_media_sending_context_t *tracker)
+{
+    a2dp_media_sending_context_t *other = a2dp_source_demo_other_tracker(tracker);
+    if (other == NULL || other->remote_seid == 0)
+    {
+        if (tracker == sbc_configuration_tracker)
+            sbc_configuration_tracker = NULL;
+        return;
+    }
+    if (tracker == sbc_configuration_tracker)
+    {
+        sbc_configuration = sink_configurations[other - media_trackers];
+        sbc_configuration_tracker = other;
+    }
+    audio_pipeline_set_bitpool_range(sbc_configuration.min_bitpool_value, sbc_configuration.max_bitpool_value);
+}
 
 // AVRCP (Audio/Video Remote Control Profile) に関連する再生状態情報を保持するための構造体変数です。
 // 再生コマンドを受け取った際には play_info.play_status を再生中に設定し、一時停止コマンドを受け取った際には一時停止中に設定するなどの処理が行われます。また、曲の再生位置の更新や曲の長さの設定も、この構造体を通じて行われます。
@@ -144,17 +231,124 @@ typedef struct
     uint32_t song_position_ms;      // 曲の現在位置（ミリ秒単位）0xFFFFFFFF if not supported
 } avrcp_play_status_info_t;
 static avrcp_play_status_info_t play_info;
+// 再生中(または移ると要求した)プレイリストの曲の番号。FORWARD を続けて押したときに、移る前でも次の曲に進めるように持つ。
+static int avrcp_track_index;
+
+// FAST_FORWARD / REWIND で動かす時間(ms)
+#define AVRCP_SEEK_STEP_MS 10000
+// BACKWARD を押したとき、曲の先頭からこれより後なら曲の先頭に戻り、前なら前の曲に移る(ms)
+#define AVRCP_RESTART_MS 3000
 
 static avrcp_track_t track = {{0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01}, 1, "Sample Song", "music.wav", "A2DP Source Demo", "monotone", 12345};
 
+static uint16_t avrcp_total_tracks(void)
+{
+    return playlist_size() > 0 ? (uint16_t)playlist_size() : 1;
+}
+
+// 再生中の曲の情報(track と play_info)をプレイリストの index の曲にする。
+static void avrcp_set_track(int index)
+{
+    const playlist_track_t *entry = playlist_track(index);
+    if (entry == NULL)
+        return;
+    uint16_t track_nr = (uint16_t)(index + 1);
+    memset(track.track_id, 0, sizeof(track.track_id));
+    track.track_id[6] = (uint8_t)(track_nr >> 8);
+    track.track_id[7] = (uint8_t)track_nr;
+    track.track_nr = track_nr;
+    track.title = (char *)entry->name;
+    track.song_length_ms = entry->length_ms;
+    memcpy(play_info.track_id, track.track_id, sizeof(play_info.track_id));
+    play_info.song_length_ms = entry->length_ms;
+    play_info.song_position_ms = 0;
+    avrcp_track_index = index;
+}
+
+// index の曲の先頭に移る。移った曲は playlist_poll() で受け取る。
+static void avrcp_jump_track(a2dp_media_sending_context_t *tracker, int index)
+{
+    if (playlist_jump(index) != 0)
+        return;
+    avrcp_track_index = index;
+    audio_pipeline_seek_requested(tracker);
+}
+
+// FORWARD: 次の曲。最後の曲ではリピートのときだけ最初の曲に戻る。
+static void avrcp_next_track(a2dp_media_sending_context_t *tracker)
+{
+    int next = avrcp_track_index + 1;
+    if (next >= playlist_size())
+    {
+        if (!playlist_repeats())
+            return;
+        next = 0;
+    }
+    avrcp_jump_track(tracker, next);
+}
+
+// BACKWARD: 曲の途中なら曲の先頭、先頭の近くなら前の曲。エンコード済みファイルはプレイリストが無いので先頭に戻るだけ。
+static void avrcp_previous_track(a2dp_media_sending_context_t *tracker)
+{
+    if (audio_pipeline_is_pre_encoded() || audio_pipeline_playback_position_ms(tracker) > AVRCP_RESTART_MS)
+    {
+        audio_pipeline_seek(tracker, 0);
+        return;
+    }
+    int previous = avrcp_track_index - 1;
+    if (previous < 0)
+        previous = playlist_repeats() ? playlist_size() - 1 : 0;
+    avrcp_jump_track(tracker, previous);
+}
+
+// FAST_FORWARD / REWIND: 今の位置から delta_ms 動かす。曲の先頭より前は先頭、曲の末尾より後は次の曲にする。
+static void avrcp_seek_by(a2dp_media_sending_context_t *tracker, int32_t delta_ms)
+{
+    int64_t target = (int64_t)audio_pipeline_playback_position_ms(tracker) + delta_ms;
+    if (target < 0)
+        target = 0;
+    if (!audio_pipeline_is_pre_encoded() && target >= play_info.song_length_ms)
+    {
+        avrcp_next_track(tracker);
+        return;
+    }
+    audio_pipeline_seek(tracker, (uint32_t)target);
+}
+
+// 絶対音量を扱わないスピーカー(AVRCP が無い・VOLUME_CHANGED を通知しない・SetAbsoluteVolume を断った)が
+// つながっているか。どのスピーカーにも同じフレームを送るので、そのときだけ共有の音量を PCM に掛ける。
+static bool a2dp_source_demo_needs_volume_gain(void)
+{
+    for (const a2dp_media_sending_context_t &tracker : media_trackers)
+    {
+        if (tracker.a2dp_cid != 0 && !(tracker.avrcp_cid != 0 && tracker.absolute_volume))
+            return true;
+    }
+    return false;
+}
+
+// 共有の音量をスピーカーに渡す。PCM に掛けないときは、絶対音量を扱うスピーカーに AVRCP で送る。
+// PCM に掛けるときは、絶対音量を扱うスピーカーを 127 にして二重に下げない。
+static void a2dp_source_demo_apply_volume(void)
+{
+    bool gain = a2dp_source_demo_needs_volume_gain();
+    audio_pipeline_set_volume_gain(gain);
+    uint8_t volume = gain ? 127 : audio_pipeline_get_volume();
+    for (a2dp_media_sending_context_t &tracker : media_trackers)
+    {
+        if (tracker.avrcp_cid == 0 || !tracker.absolute_volume || tracker.sink_volume == volume)
+            continue;
+        tracker.sink_volume = volume;
+        avrcp_controller_set_absolute_volume(tracker.avrcp_cid, volume);
+    }
+}
+
 // A2DP (Advanced Audio Distribution Profile) で使用されるSBC (Subband Coding) コーデックの機能を定義しています。この配列は、リモートデバイスに対して、このデバイスがサポートしているSBCコーデックのパラメータを通知するために使用されます。
 // この配列は、A2DPのSDPレコードや、AVDTP (Audio/Video Distribution Transport Protocol) のコーデック設定コマンドで使用され、リモートデバイスに対して、このデバイスがサポートしているSBCコーデックの機能を通知するために使用されます。
-// Unsigned 8-bit 48000Hz の WAV ファイルを再生する場合の設定です。
+// 44100Hz と 48000Hz の両方を通知し、WAVと同じ周波数を優先します(a2dp_source_and_avrcp_services_init)。
+// チャンネルモードは MONO / JOINT_STEREO / STEREO を通知し、ファイルに合った一番安いモードを優先します。
 static uint8_t media_sbc_codec_capabilities[] = {
-    // (AVDTP_SBC_44100 << 4) | AVDTP_SBC_STEREO,
-    // (AVDTP_SBC_44100 << 4) | AVDTP_SBC_MONO,
-    // (AVDTP_SBC_48000 << 4) | AVDTP_SBC_MONO,
-    (AVDTP_SBC_48000 << 4) | AVDTP_SBC_STEREO,
+    ((AVDTP_SBC_44100 | AVDTP_SBC_48000) << 4) | AVDTP_SBC_MONO | AVDTP_SBC_JOINT_STEREO | AVDTP_SBC_STEREO,
     // 0xFF, //(AVDTP_SBC_BLOCK_LENGTH_16 << 4) | (AVDTP_SBC_SUBBANDS_8 << 2) | AVDTP_SBC_ALLOCATION_METHOD_LOUDNESS,
     (AVDTP_SBC_BLOCK_LENGTH_16 << 4) | (AVDTP_SBC_SUBBANDS_8 << 2) | AVDTP_SBC_ALLOCATION_METHOD_SNR,
     2, // 最小ビットプール値
@@ -168,63 +362,104 @@ static uint8_t device_id_sdp_service_buffer[100];
 
 //*********ここから関数の宣言*********
 
-static int fs_setup(void);
 static int sd_setup(void);
 static int btstack_main(void);
 
-//SDカードから音楽データをdata_size分読み込む
-static int read_sd_data(uint8_t *wav_data, int data_size)
+// Bluetoothデバイスのスキャン（検出）を開始するためのシンプルな関数です。
+// この関数は、Bluetoothデバイスの検出プロセスを開始する際に使用され、周囲のデバイスを検出して接続可能なデバイスのリストを取得するために役立ちます。スキャンが完了すると、検出されたデバイスに関する情報がイベントとして報告され、適切な処理が行われます。
+static void a2dp_source_demo_start_scanning(void)
+{
+    Serial.printf("Start scanning...\n\r");
+    // Bluetoothデバイスのスキャンを開始します。
+    // A2DP_SOURCE_DEMO_INQUIRY_DURATION_1280MS は、スキャンの持続時間を 1280ミリ秒（約1.28秒）単位で指定する定数です。
+    // 前のスキャンで集めたデバイスは捨てます。
+    inquiry_ranker_reset(&inquiry_ranker);
+    gap_inquiry_start(A2DP_SOURCE_DEMO_INQUIRY_DURATION_1280MS);
+    // スキャンがアクティブな状態になったことを示すフラグを true に設定します。
+    scan_active = true;
+}
+
+// インクワイアリで集めたデバイスのうち、まだ試していない一番点数の高いものに接続します。無ければ false を返します。
+static bool a2dp_source_demo_connect_ranked(void)
 {
-    if (wav_data_buffer_index >= WAV_DATA_BUFFER_SIZE)
+    a2dp_media_sending_context_t *tracker = a2dp_source_demo_free_tracker();
+    if (tracker == NULL)
+        return false;
+    bd_addr_t address;
+    const inquiry_ranker_device_t *device;
+    while (inquiry_ranker_next(&inquiry_ranker, address, &device))
     {
-        sd_file.read(wav_data_buffer, WAV_DATA_BUFFER_SIZE);
-        wav_data_buffer_index = 0;
-        if (sd_file.position() >= sd_data_length)
+        Serial.printf("Bluetooth speaker detected, trying to connect to %s (COD %06" PRIx32 ", rssi %d dBm, score %d)...\n\r",
+                      bd_addr_to_str(address), device->class_of_device, device->rssi, device->score);
+        if (a2dp_source_establish_stream(address, &tracker->a2dp_cid) == ERROR_CODE_SUCCESS)
         {
-            sd_file.close();
-            // if (fs_setup() == -1)
-            //     return -1;
-            for (int i = 0; i < WAV_DATA_BUFFER_SIZE; i++)
-            {
-                wav_data_buffer[i] = 0;
-            }
+            memcpy(tracker->remote_address, address, sizeof(bd_addr_t));
+            return true;
         }
     }
-    memcpy(wav_data, wav_data_buffer + wav_data_buffer_index, data_size);
-    wav_data_buffer_index += data_size;
-    return 0;
+    return false;
 }
 
+// connect_planner が決めたとおりに、スピーカーに直接接続するか、インクワイアリで見つけた次の候補に接続するかスキャンを始めます。
+static void a2dp_source_demo_connect(connect_planner_action_t action, const bd_addr_t address)
+{
+    if (action == CONNECT_PLANNER_INQUIRY)
+    {
+        if (!a2dp_source_demo_connect_ranked())
+            a2dp_source_demo_start_scanning();
+        return;
+    }
+    a2dp_media_sending_context_t *tracker = a2dp_source_demo_free_tracker();
+    if (tracker == NULL)
+        return;
+    Serial.printf("Connecting to known speaker %s...\n\r", bd_addr_to_str(address));
+    uint8_t status = a2dp_source_establish_stream((uint8_t *)address, &tracker->a2dp_cid);
+    if (status != ERROR_CODE_SUCCESS)
+    {
+        Serial.printf("A2DP Source: Could not connect, status 0x%02x\n\r", status);
+        bd_addr_t next;
+        a2dp_source_demo_connect(connect_planner_failed(&connect_planner, status, next), next);
+        return;
+    }
+    memcpy(tracker->remote_address, address, sizeof(bd_addr_t));
+}
 
-// wav_fileからdata_size分のデータを読み込む
-static int read_wav_data(uint8_t *wav_data, int data_size)
+// 1台目のスピーカーで再生が始まったら、直接接続の候補のうちまだ接続していないスピーカーにも接続して同じ音を送る。
+// 試すのは1台目の接続ごとに1回だけ。つながらなくても1台目はそのまま続ける。
+static void a2dp_source_demo_connect_next_sink(void)
 {
-    if (wav_data_buffer_index >= WAV_DATA_BUFFER_SIZE)
+    a2dp_media_sending_context_t *tracker = a2dp_source_demo_free_tracker();
+    if (tracker == NULL || next_sink_tried)
+        return;
+    next_sink_tried = true;
+    for (int i = 0; i < connect_planner.num_candidates; i++)
     {
-        wav_file.read(wav_data_buffer, WAV_DATA_BUFFER_SIZE);
-        wav_data_buffer_index = 0;
-        if (wav_file.position() >= wav_length)
+        const uint8_t *address = connect_planner.candidates[i];
+        if (a2dp_source_demo_address_tracker(address) != NULL)
+            continue;
+        Serial.printf("Connecting to another speaker %s...\n\r", bd_addr_to_str(address));
+        if (a2dp_source_establish_stream((uint8_t *)address, &tracker->a2dp_cid) == ERROR_CODE_SUCCESS)
         {
-            wav_file.close();
-            if (fs_setup() == -1)
-                return -1;
+            memcpy(tracker->remote_address, address, sizeof(bd_addr_t));
+            return;
         }
     }
-    memcpy(wav_data, wav_data_buffer + wav_data_buffer_index, data_size);
-    wav_data_buffer_index += data_size;
-    return 0;
 }
 
-// Bluetoothデバイスのスキャン（検出）を開始するためのシンプルな関数です。
-// この関数は、Bluetoothデバイスの検出プロセスを開始する際に使用され、周囲のデバイスを検出して接続可能なデバイスのリストを取得するために役立ちます。スキャンが完了すると、検出されたデバイスに関する情報がイベントとして報告され、適切な処理が行われます。
-static void a2dp_source_demo_start_scanning(void)
+// 設定したアドレスと、リンクキーを持っているスピーカーを直接接続の候補にする。
+static void a2dp_source_demo_add_known_speakers(void)
 {
-    Serial.printf("Start scanning...\n\r");
-    // Bluetoothデバイスのスキャンを開始します。
-    // A2DP_SOURCE_DEMO_INQUIRY_DURATION_1280MS は、スキャンの持続時間を指定する定数で、1280ミリ秒（約1.28秒）を意味します。
-    gap_inquiry_start(A2DP_SOURCE_DEMO_INQUIRY_DURATION_1280MS);
-    // スキャンがアクティブな状態になったことを示すフラグを true に設定します。
-    scan_active = true;
+    connect_planner_init(&connect_planner, MAX_PAGE_TIMEOUTS);
+    connect_planner_add_candidate(&connect_planner, device_addr);
+    btstack_link_key_iterator_t iterator;
+    if (!gap_link_key_iterator_init(&iterator))
+        return;
+    bd_addr_t address;
+    link_key_t link_key;
+    link_key_type_t type;
+    while (gap_link_key_iterator_get_next(&iterator, address, link_key, &type))
+        connect_planner_add_candidate(&connect_planner, address);
+    gap_link_key_iterator_done(&iterator);
 }
 
 // HCI (Host Controller Interface) イベントを処理するためのパケットハンドラです。主な機能は、Bluetoothデバイスの検出、接続の確立、PINコード要求の処理などを行うことです。
@@ -248,9 +483,13 @@ static void hci_packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *p
     case BTSTACK_EVENT_STATE:
         // BTSTACKの状態変更イベント (BTSTACK_EVENT_STATE):
         // BTstackの状態が変更されたことを示します。状態が HCI_STATE_WORKING になった場合、Bluetoothデバイスのスキャンを開始します。
+        // 知っているスピーカーがあれば、インクワイアリをせずに直接接続します。
         if (btstack_event_state_get_state(packet) != HCI_STATE_WORKING)
             return;
-        a2dp_source_demo_start_scanning();
+        gap_set_page_timeout(PAGE_TIMEOUT_SLOTS);
+        inquiry_ranker_init(&inquiry_ranker, SPEAKER_ALLOWLIST, sizeof(SPEAKER_ALLOWLIST) / sizeof(SPEAKER_ALLOWLIST[0]));
+        a2dp_source_demo_add_known_speakers();
+        a2dp_source_demo_connect(connect_planner_start(&connect_planner, 0, address), address);
         break;
     case HCI_EVENT_PIN_CODE_REQUEST:
         // PINコード要求イベント (HCI_EVENT_PIN_CODE_REQUEST):
@@ -261,38 +500,76 @@ static void hci_packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *p
         break;
     case GAP_EVENT_INQUIRY_RESULT:
         // インクワイアリ結果イベント (GAP_EVENT_INQUIRY_RESULT):
-        // Bluetoothデバイスが検出されたことを示します。デバイスのアドレス、クラスオブデバイス (CoD)、RSSI、デバイス名などの情報を表示します。検出されたデバイスがBluetoothスピーカーである場合（CoDが一致する場合）、そのデバイスに接続を試みます。
-        gap_event_inquiry_result_get_bd_addr(packet, address);
-        // print info
-        Serial.printf("Device found: %s ", bd_addr_to_str(address));
-        cod = gap_event_inquiry_result_get_class_of_device(packet);
-        Serial.printf("with COD: %06" PRIx32, cod);
-        if (gap_event_inquiry_result_get_rssi_available(packet))
+        // Bluetoothデバイスが検出されたことを示します。デバイスのアドレス、クラスオブデバイス (CoD)、RSSI、デバイス名などの情報を表示します。
+        // すぐには接続せず、inquiry_ranker で音を出す機器(CoD)と許可リストに絞り、RSSI と名前で点数を付けておきます。
+        // 許可リストのスピーカーが見つかったら、インクワイアリを止めて接続します。
         {
-            Serial.printf(", rssi %d dBm", (int8_t)gap_event_inquiry_result_get_rssi(packet));
+            gap_event_inquiry_result_get_bd_addr(packet, address);
+            // print info
+            Serial.printf("Device found: %s ", bd_addr_to_str(address));
+            cod = gap_event_inquiry_result_get_class_of_device(packet);
+            Serial.printf("with COD: %06" PRIx32, cod);
+            int rssi = INQUIRY_RANKER_UNKNOWN_RSSI;
+            if (gap_event_inquiry_result_get_rssi_available(packet))
+            {
+                rssi = (int8_t)gap_event_inquiry_result_get_rssi(packet);
+                Serial.printf(", rssi %d dBm", rssi);
+            }
+            char name_buffer[240];
+            int name_len = 0;
+            if (gap_event_inquiry_result_get_name_available(packet))
+            {
+                name_len = gap_event_inquiry_result_get_name_len(packet);
+                memcpy(name_buffer, gap_event_inquiry_result_get_name(packet), name_len);
+                name_buffer[name_len] = 0;
+                Serial.printf(", name '%s'", name_buffer);
+            }
+            int score = inquiry_ranker_add(&inquiry_ranker, address, cod, rssi, name_len > 0 ? name_buffer : NULL, name_len);
+            if (score < 0)
+                Serial.printf(", not an audio sink");
+            else
+                Serial.printf(", score %d", score);
+            Serial.println();
+            if (scan_active && inquiry_ranker_has_allowlisted(&inquiry_ranker))
+            {
+                scan_active = false;
+                gap_inquiry_stop();
+                a2dp_source_demo_connect_ranked();
+            }
         }
-        if (gap_event_inquiry_result_get_name_available(packet))
+        break;
+    case HCI_EVENT_NUMBER_OF_COMPLETED_PACKETS:
+        // 送信完了イベント (HCI_EVENT_NUMBER_OF_COMPLETED_PACKETS):
+        // コントローラが送り終えたACLパケットの数を、接続ごとに数えます。スピーカーの接続の分は、送信完了を待つ音声から引きます。
+        // 同じ接続のシグナリングや AVRCP のパケットの分も区別できずに引くので、少なく見積もることがあります(sink_latency.h)。
         {
-            char name_buffer[240];
-            int name_len = gap_event_inquiry_result_get_name_len(packet);
-            memcpy(name_buffer, gap_event_inquiry_result_get_name(packet), name_len);
-            name_buffer[name_len] = 0;
-            Serial.printf(", name '%s'", name_buffer);
+            uint8_t num_handles = packet[2];
+            for (int i = 0; i < num_handles; i++)
+            {
+                int offset = 3 + i * 4;
+                if (offset + 4 > size)
+                    break;
+                hci_con_handle_t handle = little_endian_read_16(packet, offset) & 0x0fff;
+                uint16_t num_packets = little_endian_read_16(packet, offset + 2);
+                for (a2dp_media_sending_context_t &tracker : media_trackers)
+                {
+                    if (tracker.a2dp_cid != 0 && tracker.con_handle == handle)
+                        audio_pipeline_packets_completed(&tracker, num_packets);
+                }
+            }
         }
-        Serial.println();
-        memcpy(device_addr, address, 6);
-        Serial.printf("Bluetooth speaker detected, trying to connect to %s...\n\r", bd_addr_to_str(device_addr));
-        scan_active = false;
-        gap_inquiry_stop();
-        a2dp_source_establish_stream(device_addr, &media_tracker.a2dp_cid);
         break;
     case GAP_EVENT_INQUIRY_COMPLETE:
         // インクワイアリ完了イベント (GAP_EVENT_INQUIRY_COMPLETE):
-        // Bluetoothデバイスのスキャンが完了したことを示します。スキャンがアクティブな状態であれば、再びスキャンを開始します。
+        // Bluetoothデバイスのスキャンが完了したことを示します。スキャンがアクティブな状態であれば、集めた中で一番点数の高いスピーカーに接続し、
+        // 無ければ再びスキャンを開始します。
         if (scan_active)
         {
+            scan_active = false;
+            if (a2dp_source_demo_connect_ranked())
+                break;
             Serial.printf("No Bluetooth speakers found, scanning again...\n\r");
-            gap_inquiry_start(A2DP_SOURCE_DEMO_INQUIRY_DURATION_1280MS);
+            a2dp_source_demo_start_scanning();
         }
         break;
     default:
@@ -316,7 +593,9 @@ static void avrcp_controller_packet_handler(uint8_t packet_type, uint16_t channe
         return;
     // AVRCP接続のチェック:
     // AVRCP接続が確立されているかどうかを確認します。接続が確立されていない場合は、処理を終了します。
-    if (!media_tracker.avrcp_cid)
+    // AVRCP のサブイベントはどれも avrcp_cid から始まるので、それでどのスピーカーからの通知かを探します。
+    a2dp_media_sending_context_t *tracker = a2dp_source_demo_avrcp_tracker(little_endian_read_16(packet, 3));
+    if (tracker == NULL)
         return;
 
     switch (packet[2])
@@ -324,7 +603,29 @@ static void avrcp_controller_packet_handler(uint8_t packet_type, uint16_t channe
     case AVRCP_SUBEVENT_NOTIFICATION_VOLUME_CHANGED:
         // 音量変更の通知 (AVRCP_SUBEVENT_NOTIFICATION_VOLUME_CHANGED):
         // リモートデバイスからの音量変更の通知を処理します。絶対音量の値を取得し、パーセンテージとして表示します。
-        Serial.printf("AVRCP Controller: Notification Absolute Volume %d %%\n\r", avrcp_subevent_notification_volume_changed_get_absolute_volume(packet) * 100 / 127);
+        // 通知するスピーカーは絶対音量を扱い、自分で音量を変えるので PCM には掛けません。
+        // 共有の音量は、どのスピーカーからでも最後に通知された値にし、絶対音量を扱うほかのスピーカーにも同じ値を送ります。
+        // ほかのスピーカーのために PCM に掛けているときは、こちらが 127 にしているので共有の音量は変えません。
+        {
+            uint8_t volume = avrcp_subevent_notification_volume_changed_get_absolute_volume(packet);
+            Serial.printf("AVRCP Controller: Notification Absolute Volume %d %%\n\r", volume * 100 / 127);
+            tracker->absolute_volume = 1;
+            tracker->sink_volume = volume;
+            if (!a2dp_source_demo_needs_volume_gain())
+                audio_pipeline_set_volume(volume);
+            a2dp_source_demo_apply_volume();
+        }
+        break;
+    case AVRCP_SUBEVENT_SET_ABSOLUTE_VOLUME_RESPONSE:
+        // SetAbsoluteVolume の応答。断ったスピーカーは絶対音量を扱わないものとして、共有の音量を PCM に掛けます。
+        {
+            uint8_t command_type = avrcp_subevent_set_absolute_volume_response_get_command_type(packet);
+            if (command_type != AVRCP_CTYPE_RESPONSE_REJECTED && command_type != AVRCP_CTYPE_RESPONSE_NOT_IMPLEMENTED)
+                break;
+            Serial.printf("AVRCP Controller: Set Absolute Volume rejected, avrcp_cid 0x%02x\n\r", tracker->avrcp_cid);
+            tracker->absolute_volume = 0;
+            a2dp_source_demo_apply_volume();
+        }
         break;
     case AVRCP_SUBEVENT_NOTIFICATION_EVENT_BATT_STATUS_CHANGED:
         // バッテリーステータスの通知 (AVRCP_SUBEVENT_NOTIFICATION_EVENT_BATT_STATUS_CHANGED):
@@ -338,6 +639,13 @@ static void avrcp_controller_packet_handler(uint8_t packet_type, uint16_t channe
         Serial.printf("AVRCP Controller: Notification %s - %s\n\r",
                       avrcp_event2str(avrcp_subevent_notification_state_get_event_id(packet)),
                       avrcp_subevent_notification_state_get_enabled(packet) != 0 ? "enabled" : "disabled");
+        // VOLUME_CHANGED の通知を登録できなかったスピーカーは絶対音量を扱わない。
+        if (avrcp_subevent_notification_state_get_event_id(packet) == AVRCP_NOTIFICATION_EVENT_VOLUME_CHANGED &&
+            avrcp_subevent_notification_state_get_enabled(packet) == 0)
+        {
+            tracker->absolute_volume = 0;
+            a2dp_source_demo_apply_volume();
+        }
         break;
     default:
         break;
@@ -357,6 +665,10 @@ static void avrcp_target_packet_handler(uint8_t packet_type, uint16_t channel, u
     // イベントタイプのチェック:パケットがAVRCPメタイベントであることを確認します。そうでない場合は、処理を終了します。
     if (hci_event_packet_get_type(packet) != HCI_EVENT_AVRCP_META)
         return;
+    // 問い合わせや操作が来たスピーカー(avrcp_cid はどのサブイベントでも先頭)
+    a2dp_media_sending_context_t *tracker = a2dp_source_demo_avrcp_tracker(little_endian_read_16(packet, 3));
+    if (tracker == NULL)
+        return;
 
     bool button_pressed;
     char const *button_state;
@@ -368,7 +680,9 @@ static void avrcp_target_packet_handler(uint8_t packet_type, uint16_t channel, u
     case AVRCP_SUBEVENT_PLAY_STATUS_QUERY:
         // 再生状態の問い合わせ (AVRCP_SUBEVENT_PLAY_STATUS_QUERY):
         // リモートデバイスが現在の再生状態（再生中、一時停止中、停止中など）を問い合わせるイベントです。avrcp_target_play_status 関数を使用して、現在の再生状態をリモートデバイスに返答します。
-        status = avrcp_target_play_status(media_tracker.avrcp_cid, play_info.song_length_ms, play_info.song_position_ms, play_info.status);
+        // 再生位置は送ったRTPタイムスタンプから、送信完了を待つ音声とスピーカーの遅延の分を戻して求める。
+        play_info.song_position_ms = audio_pipeline_playback_position_ms(tracker);
+        status = avrcp_target_play_status(tracker->avrcp_cid, play_info.song_length_ms, play_info.song_position_ms, play_info.status);
         break;
     case AVRCP_SUBEVENT_OPERATION:
         // 操作コマンドの処理 (AVRCP_SUBEVENT_OPERATION):
@@ -387,13 +701,25 @@ static void avrcp_target_packet_handler(uint8_t packet_type, uint16_t channel, u
         switch (operation_id)
         {
         case AVRCP_OPERATION_ID_PLAY:
-            status = a2dp_source_start_stream(media_tracker.a2dp_cid, media_tracker.local_seid);
+            status = a2dp_source_start_stream(tracker->a2dp_cid, tracker->local_seid);
             break;
         case AVRCP_OPERATION_ID_PAUSE:
-            status = a2dp_source_pause_stream(media_tracker.a2dp_cid, media_tracker.local_seid);
+            status = a2dp_source_pause_stream(tracker->a2dp_cid, tracker->local_seid);
             break;
         case AVRCP_OPERATION_ID_STOP:
-            status = a2dp_source_disconnect(media_tracker.a2dp_cid);
+            status = a2dp_source_disconnect(tracker->a2dp_cid);
+            break;
+        case AVRCP_OPERATION_ID_FAST_FORWARD:
+            avrcp_seek_by(tracker, AVRCP_SEEK_STEP_MS);
+            break;
+        case AVRCP_OPERATION_ID_REWIND:
+            avrcp_seek_by(tracker, -AVRCP_SEEK_STEP_MS);
+            break;
+        case AVRCP_OPERATION_ID_FORWARD:
+            avrcp_next_track(tracker);
+            break;
+        case AVRCP_OPERATION_ID_BACKWARD:
+            avrcp_previous_track(tracker);
             break;
         default:
             break;
@@ -420,6 +746,7 @@ static void avrcp_packet_handler(uint8_t packet_type, uint16_t channel, uint8_t
     bd_addr_t event_addr;
     uint16_t local_cid;
     uint8_t status = ERROR_CODE_SUCCESS;
+    a2dp_media_sending_context_t *tracker;
 
     // 1.パケットタイプのチェック:最初に、受信したパケットがHCIイベントパケットであることを確認します。そうでない場合は、処理を終了します。
     if (packet_type != HCI_EVENT_PACKET)
@@ -440,26 +767,44 @@ static void avrcp_packet_handler(uint8_t packet_type, uint16_t channel, uint8_t
             Serial.printf("AVRCP: Connection failed, local cid 0x%02x, status 0x%02x\n\r", local_cid, status);
             return;
         }
-        media_tracker.avrcp_cid = local_cid;
         avrcp_subevent_connection_established_get_bd_addr(packet, event_addr);
+        // A2DP で接続しているスピーカーのコンテキストを使う。AVRCP が先につながったときは空いているコンテキストを取っておく。
+        tracker = a2dp_source_demo_address_tracker(event_addr);
+        if (tracker == NULL)
+            tracker = a2dp_source_demo_free_tracker();
+        if (tracker == NULL)
+        {
+            Serial.printf("AVRCP: No room for %s, avrcp_cid 0x%02x\n\r", bd_addr_to_str(event_addr), local_cid);
+            return;
+        }
+        tracker->avrcp_cid = local_cid;
+        // VOLUME_CHANGED の通知が来るまでは、絶対音量を扱わないものとする。
+        tracker->absolute_volume = 0;
+        memcpy(tracker->remote_address, event_addr, sizeof(bd_addr_t));
 
-        Serial.printf("AVRCP: Channel to %s successfully opened, avrcp_cid 0x%02x\n\r", bd_addr_to_str(event_addr), media_tracker.avrcp_cid);
+        Serial.printf("AVRCP: Channel to %s successfully opened, avrcp_cid 0x%02x\n\r", bd_addr_to_str(event_addr), tracker->avrcp_cid);
 
-        avrcp_target_support_event(media_tracker.avrcp_cid, AVRCP_NOTIFICATION_EVENT_PLAYBACK_STATUS_CHANGED);
-        avrcp_target_support_event(media_tracker.avrcp_cid, AVRCP_NOTIFICATION_EVENT_TRACK_CHANGED);
-        avrcp_target_support_event(media_tracker.avrcp_cid, AVRCP_NOTIFICATION_EVENT_NOW_PLAYING_CONTENT_CHANGED);
-        avrcp_target_set_now_playing_info(media_tracker.avrcp_cid, NULL, sizeof(track) / sizeof(avrcp_track_t));
+        avrcp_target_support_event(tracker->avrcp_cid, AVRCP_NOTIFICATION_EVENT_PLAYBACK_STATUS_CHANGED);
+        avrcp_target_support_event(tracker->avrcp_cid, AVRCP_NOTIFICATION_EVENT_TRACK_CHANGED);
+        avrcp_target_support_event(tracker->avrcp_cid, AVRCP_NOTIFICATION_EVENT_NOW_PLAYING_CONTENT_CHANGED);
+        avrcp_target_set_now_playing_info(tracker->avrcp_cid, NULL, avrcp_total_tracks());
 
         Serial.printf("Enable Volume Change notification\n\r");
-        avrcp_controller_enable_notification(media_tracker.avrcp_cid, AVRCP_NOTIFICATION_EVENT_VOLUME_CHANGED);
+        avrcp_controller_enable_notification(tracker->avrcp_cid, AVRCP_NOTIFICATION_EVENT_VOLUME_CHANGED);
         Serial.printf("Enable Battery Status Change notification\n\r");
-        avrcp_controller_enable_notification(media_tracker.avrcp_cid, AVRCP_NOTIFICATION_EVENT_BATT_STATUS_CHANGED);
+        avrcp_controller_enable_notification(tracker->avrcp_cid, AVRCP_NOTIFICATION_EVENT_BATT_STATUS_CHANGED);
         return;
 
     case AVRCP_SUBEVENT_CONNECTION_RELEASED:
         // 5.AVRCP接続解放イベント (AVRCP_SUBEVENT_CONNECTION_RELEASED):AVRCP接続が解放されたことを示します。このイベントでは、AVRCP接続IDをクリアし、接続が切断されたことをログに記録します。
         Serial.printf("AVRCP Target: Disconnected, avrcp_cid 0x%02x\n\r", avrcp_subevent_connection_released_get_avrcp_cid(packet));
-        media_tracker.avrcp_cid = 0;
+        tracker = a2dp_source_demo_avrcp_tracker(avrcp_subevent_connection_released_get_avrcp_cid(packet));
+        if (tracker != NULL)
+        {
+            tracker->avrcp_cid = 0;
+            tracker->absolute_volume = 0;
+            a2dp_source_demo_apply_volume();
+        }
         return;
     default:
         break;
@@ -472,167 +817,6 @@ static void avrcp_packet_handler(uint8_t packet_type, uint16_t channel, uint8_t
     }
 }
 
-// WAVファイルからdata_size分のデータを読み込む処理を実装
-// ここでは、ファイル操作関数を使用してデータを読み込む
-static int produce_audio(int16_t *pcm_buffer, int data_size)
-{
-    uint8_t wav_data[data_size];
-    if (read_sd_data(wav_data, data_size) == -1)
-        return -1;
-    for (int count = 0; count < data_size; count++)
-    {
-        // 正規化:
-        // 8ビットのオーディオデータが符号なし整数（例えば、0から255の範囲）である場合、16ビットに拡張する際にデータを正規化する必要があります。これは、8ビットの範囲を16ビットの範囲に合わせるために行われます。
-        int16_t scaled_sample = static_cast<int16_t>(wav_data[count] - 0x80) * 256;
-
-        // 左チャンネルと右チャンネルに同じ値を設定
-        pcm_buffer[count * 2] = scaled_sample;
-        pcm_buffer[count * 2 + 1] = scaled_sample;
-    }
-    return 0;
-}
-
-// オーディオデータをSBC (Subband Coding) 形式にエンコードし、エンコードされたデータを送信用のバッファに格納するための関数です。具体的には、以下の処理を行っています。
-//  1.SBCエンコーディングの実行:関数は、PCM (Pulse Code Modulation) 形式のオーディオデータをSBC形式にエンコードします。エンコードは、btstack_sbc_encoder_process_data 関数を使用して行われます。
-//  2.オーディオバッファの充填:エンコードされたSBCデータは、context->sbc_storage というバッファに格納されます。このバッファは、Bluetooth経由でリモートデバイスに送信されるためのデータを保持します。
-//  3.サンプルの消費:エンコードに使用されたオーディオサンプルの数だけ、context->samples_ready からサンプル数が減算されます。これにより、どれだけのオーディオデータがエンコードされて送信の準備ができているかを追跡します。
-//  4.バッファの管理:関数は、エンコードされたデータが最大ペイロードサイズを超えないように、バッファの容量を管理します。バッファがいっぱいになると、送信の準備が整ったとみなされます。
-static int a2dp_demo_fill_sbc_audio_buffer(a2dp_media_sending_context_t *context)
-{
-    // perform sbc encoding
-    int total_num_bytes_read = 0;
-    unsigned int num_audio_samples_per_sbc_buffer = btstack_sbc_encoder_num_audio_frames();
-    while (context->samples_ready >= num_audio_samples_per_sbc_buffer && (context->max_media_payload_size - context->sbc_storage_count) >= btstack_sbc_encoder_sbc_buffer_length())
-    {
-
-        int16_t pcm_frame[256 * NUM_CHANNELS];
-        if (produce_audio(pcm_frame, num_audio_samples_per_sbc_buffer) == -1)
-            return 0;
-        // ここでエンコードされる。
-        btstack_sbc_encoder_process_data(pcm_frame);
-
-        uint16_t sbc_frame_size = btstack_sbc_encoder_sbc_buffer_length();
-        uint8_t *sbc_frame = btstack_sbc_encoder_sbc_buffer();
-
-        total_num_bytes_read += num_audio_samples_per_sbc_buffer;
-        // first byte in sbc storage contains sbc media header
-        memcpy(&context->sbc_storage[1 + context->sbc_storage_count], sbc_frame, sbc_frame_size);
-        context->sbc_storage_count += sbc_frame_size;
-        context->samples_ready -= num_audio_samples_per_sbc_buffer;
-    }
-    return total_num_bytes_read;
-}
-
-// A2DPを使用して音声データを定期的に送信するためのタイムアウトハンドラです。
-// 関数の役割は、一定の間隔でオーディオデータをエンコードし、送信の準備が整ったら送信リクエストを行うことです。
-// この関数は、定期的に呼び出されることで、オーディオデータのエンコードと送信を一定の間隔で行い、安定したオーディオストリーミングを実現します。
-static void a2dp_demo_audio_timeout_handler(btstack_timer_source_t *timer)
-{
-    a2dp_media_sending_context_t *context = (a2dp_media_sending_context_t *)btstack_run_loop_get_timer_context(timer);
-    // タイマーの設定。次回のタイムアウトイベントが発生するまでの時間を設定します。AUDIO_TIMEOUT_MS は、タイムアウトの間隔をミリ秒単位で指定します。
-    btstack_run_loop_set_timer(&context->audio_timer, AUDIO_TIMEOUT_MS);
-    // タイマーの追加。設定したタイマーを実行ループに追加し、タイムアウトイベントの監視を開始します。
-    btstack_run_loop_add_timer(&context->audio_timer);
-    // 前回オーディオデータが送信されてからの経過時間を計算し、その期間に対応するサンプル数を計算します。これにより、オーディオの再生速度を一定に保つことができます。
-    uint32_t now = btstack_run_loop_get_time_ms();
-
-    uint32_t update_period_ms = AUDIO_TIMEOUT_MS;
-    if (context->time_audio_data_sent > 0)
-    {
-        update_period_ms = now - context->time_audio_data_sent;
-    }
-
-    uint32_t num_samples = (update_period_ms * current_sample_rate) / 1000;
-    context->acc_num_missed_samples += (update_period_ms * current_sample_rate) % 1000;
-
-    while (context->acc_num_missed_samples >= 1000)
-    {
-        num_samples++;
-        context->acc_num_missed_samples -= 1000;
-    }
-    context->time_audio_data_sent = now;
-    context->samples_ready += num_samples;
-
-    if (context->sbc_ready_to_send)
-        return;
-
-    // オーディオバッファの充填。
-    // オーディオバッファをSBCエンコードされたオーディオデータで充填します。これにより、Bluetooth経由で送信するためのデータが準備されます。
-    // この中で、SBC にエンコードしている。
-    a2dp_demo_fill_sbc_audio_buffer(context);
-
-    // 送信の準備。
-    // 送信するデータが十分に溜まったら（バッファが最大ペイロードサイズを超えたら）、送信リクエストを行います。これにより、リモートデバイスにオーディオデータが送信されます。
-    if ((context->sbc_storage_count + btstack_sbc_encoder_sbc_buffer_length()) > context->max_media_payload_size)
-    {
-        // schedule sending
-        context->sbc_ready_to_send = 1;
-        a2dp_source_stream_endpoint_request_can_send_now(context->a2dp_cid, context->local_seid);
-    }
-}
-
-static void a2dp_demo_timer_start(a2dp_media_sending_context_t *context)
-{
-    context->max_media_payload_size = btstack_min(a2dp_max_media_payload_size(context->a2dp_cid, context->local_seid), SBC_STORAGE_SIZE);
-    context->sbc_storage_count = 0;
-    context->sbc_ready_to_send = 0;
-    context->streaming = 1;
-    btstack_run_loop_remove_timer(&context->audio_timer);
-    btstack_run_loop_set_timer_handler(&context->audio_timer, a2dp_demo_audio_timeout_handler);
-    btstack_run_loop_set_timer_context(&context->audio_timer, context);
-    btstack_run_loop_set_timer(&context->audio_timer, AUDIO_TIMEOUT_MS);
-    btstack_run_loop_add_timer(&context->audio_timer);
-}
-
-static void a2dp_demo_timer_stop(a2dp_media_sending_context_t *context)
-{
-    context->time_audio_data_sent = 0;
-    context->acc_num_missed_samples = 0;
-    context->samples_ready = 0;
-    context->streaming = 1;
-    context->sbc_storage_count = 0;
-    context->sbc_ready_to_send = 0;
-    btstack_run_loop_remove_timer(&context->audio_timer);
-}
-
-// この関数は、A2DP (Advanced Audio Distribution Profile) を使用してSBC (Subband Coding) エンコードされたオーディオデータをBluetooth経由で送信するためのものです。
-// この関数は、定期的に呼び出され、エンコード済みのオーディオデータをBluetooth経由でリモートデバイスに送信する役割を果たします。
-static void a2dp_demo_send_media_packet(void)
-{
-    // フレームサイズの計算
-    // SBCエンコーダによって生成される各SBCフレームのバイト数を計算します。この値は、エンコーディングプロセスにおいて一定です。
-    int num_bytes_in_frame = btstack_sbc_encoder_sbc_buffer_length();
-    // ストレージ内のバイト数の計算
-    // 現在ストレージに保持されているエンコード済みオーディオデータのバイト数を計算します。
-    int bytes_in_storage = media_tracker.sbc_storage_count;
-    // SBCフレーム数の計算
-    // ストレージに保持されているエンコード済みオーディオデータから生成できるSBCフレームの数を計算します。
-    uint8_t num_sbc_frames = bytes_in_storage / num_bytes_in_frame;
-    // Prepend SBC Header
-    // SBCヘッダの追加
-    // SBCフレームの数を最初のバイトに格納して、SBCヘッダを追加します。これは、受信側がどのくらいのフレーム数を受け取るべきかを知るために必要です。
-    media_tracker.sbc_storage[0] = num_sbc_frames; // (fragmentation << 7) | (starting_packet << 6) | (last_packet << 5) | num_frames;
-    // オーディオデータの送信
-    // エンコード済みのオーディオデータ（SBCフレーム）をBluetooth経由で送信します。この関数は、A2DPのストリームエンドポイントID、RTPタイムスタンプ、およびエンコード済みデータを含むSBCストレージを引数として取ります。
-    a2dp_source_stream_send_media_payload_rtp(
-        media_tracker.a2dp_cid,
-        media_tracker.local_seid,
-        0,
-        media_tracker.rtp_timestamp,
-        media_tracker.sbc_storage,
-        bytes_in_storage + 1);
-
-    // update rtp_timestamp
-    unsigned int num_audio_samples_per_sbc_buffer = btstack_sbc_encoder_num_audio_frames();
-    // 次回のオーディオパケットを送信する際に使用するRTPタイムスタンプを更新します。RTPタイムスタンプは、オーディオデータの同期を保つために重要です。
-    media_tracker.rtp_timestamp += num_sbc_frames * num_audio_samples_per_sbc_buffer;
-
-    // ストレージと送信フラグのリセット
-    // オーディオデータが送信された後にストレージと送信フラグをリセットします。これにより、次のオーディオデータのエンコードと送信の準備が整います。
-    media_tracker.sbc_storage_count = 0;
-    media_tracker.sbc_ready_to_send = 0;
-}
-
 static void dump_sbc_configuration(media_codec_configuration_sbc_t *configuration)
 {
     Serial.printf("Received media codec configuration:\n\r");
@@ -654,6 +838,7 @@ static void a2dp_source_packet_handler(uint8_t packet_type, uint16_t channel, ui
     uint8_t local_seid;
     bd_addr_t address;
     uint16_t cid;
+    a2dp_media_sending_context_t *tracker;
 
     avdtp_channel_mode_t channel_mode;
     uint8_t allocation_method;
@@ -679,16 +864,45 @@ static void a2dp_source_packet_handler(uint8_t packet_type, uint16_t channel, ui
         cid = a2dp_subevent_signaling_connection_established_get_a2dp_cid(packet);
         status = a2dp_subevent_signaling_connection_established_get_status(packet);
 
+        tracker = a2dp_source_demo_tracker(cid);
         if (status != ERROR_CODE_SUCCESS)
         {
-            Serial.printf("A2DP Source: Connection failed, status 0x%02x, cid 0x%02x, a2dp_cid 0x%02x \n\r", status, cid, media_tracker.a2dp_cid);
-            media_tracker.a2dp_cid = 0;
+            Serial.printf("A2DP Source: Connection failed, status 0x%02x, cid 0x%02x\n\r", status, cid);
+            if (tracker != NULL)
+                tracker->a2dp_cid = 0;
+            // ほかのスピーカーに送っていれば、2台目につながらなかっただけ。
+            if (a2dp_source_demo_other_tracker(tracker) != NULL)
+                break;
+            // 次の候補を直接ページングするか、ページタイムアウトが MAX_PAGE_TIMEOUTS 回になるか、どの候補にも断られたらスキャンする。
+            a2dp_source_demo_connect(connect_planner_failed(&connect_planner, status, address), address);
+            break;
+        }
+        // スピーカーから接続してきたときは、AVRCP で取っておいたか空いているコンテキストを使う。
+        if (tracker == NULL)
+            tracker = a2dp_source_demo_address_tracker(address);
+        if (tracker == NULL)
+            tracker = a2dp_source_demo_free_tracker();
+        if (tracker == NULL)
+        {
+            Serial.printf("A2DP Source: No room for %s, a2dp cid 0x%02x\n\r", bd_addr_to_str(address), cid);
+            a2dp_source_disconnect(cid);
             break;
         }
-        media_tracker.a2dp_cid = cid;
-        media_tracker.volume = 10;
+        tracker->a2dp_cid = cid;
+        memcpy(tracker->remote_address, address, sizeof(bd_addr_t));
+        // 送信完了イベントはこの接続ハンドルで来る。前のスピーカーの delay report は使わない。
+        tracker->con_handle = a2dp_subevent_signaling_connection_established_get_con_handle(packet);
+        audio_pipeline_reset_latency(tracker);
+        // 再接続の候補の順番は1台目のスピーカーで決める。
+        if (a2dp_source_demo_other_tracker(tracker) == NULL)
+        {
+            connect_planner_connected(&connect_planner, address);
+            inquiry_ranker_connected(&inquiry_ranker);
+        }
+        // 絶対音量の通知が来るまでは、共有の音量を PCM に掛ける。
+        a2dp_source_demo_apply_volume();
 
-        Serial.printf("A2DP Source: Connected to address %s, a2dp cid 0x%02x, local seid 0x%02x.\n\r", bd_addr_to_str(address), media_tracker.a2dp_cid, media_tracker.local_seid);
+        Serial.printf("A2DP Source: Connected to address %s, a2dp cid 0x%02x.\n\r", bd_addr_to_str(address), tracker->a2dp_cid);
         break;
 
     case A2DP_SUBEVENT_SIGNALING_MEDIA_CODEC_SBC_CONFIGURATION:
@@ -696,55 +910,78 @@ static void a2dp_source_packet_handler(uint8_t packet_type, uint16_t channel, ui
         // このイベントは、音楽を送信するためのコーデック（圧縮方式）の設定が完了したことを示します。ここで、サンプリング周波数やビットレートなどのパラメータが設定されます。
         {
             cid = avdtp_subevent_signaling_media_codec_sbc_configuration_get_avdtp_cid(packet);
-            if (cid != media_tracker.a2dp_cid)
+            tracker = a2dp_source_demo_tracker(cid);
+            if (tracker == NULL)
                 return;
 
-            media_tracker.remote_seid = a2dp_subevent_signaling_media_codec_sbc_configuration_get_remote_seid(packet);
+            tracker->local_seid = a2dp_subevent_signaling_media_codec_sbc_configuration_get_local_seid(packet);
+            tracker->remote_seid = a2dp_subevent_signaling_media_codec_sbc_configuration_get_remote_seid(packet);
 
-            sbc_configuration.reconfigure = a2dp_subevent_signaling_media_codec_sbc_configuration_get_reconfigure(packet);
-            sbc_configuration.num_channels = a2dp_subevent_signaling_media_codec_sbc_configuration_get_num_channels(packet);
-            sbc_configuration.sampling_frequency = a2dp_subevent_signaling_media_codec_sbc_configuration_get_sampling_frequency(packet);
-            sbc_configuration.block_length = a2dp_subevent_signaling_media_codec_sbc_configuration_get_block_length(packet);
-            sbc_configuration.subbands = a2dp_subevent_signaling_media_codec_sbc_configuration_get_subbands(packet);
-            sbc_configuration.min_bitpool_value = a2dp_subevent_signaling_media_codec_sbc_configuration_get_min_bitpool_value(packet);
-            sbc_configuration.max_bitpool_value = a2dp_subevent_signaling_media_codec_sbc_configuration_get_max_bitpool_value(packet);
+            // エンコーダは全部のスピーカーで1つなので、設定はこのスピーカーの分として受け取ってから比べる。
+            media_codec_configuration_sbc_t configuration;
+
+            configuration.reconfigure = a2dp_subevent_signaling_media_codec_sbc_configuration_get_reconfigure(packet);
+            configuration.num_channels = a2dp_subevent_signaling_media_codec_sbc_configuration_get_num_channels(packet);
+            configuration.sampling_frequency = a2dp_subevent_signaling_media_codec_sbc_configuration_get_sampling_frequency(packet);
+            configuration.block_length = a2dp_subevent_signaling_media_codec_sbc_configuration_get_block_length(packet);
+            configuration.subbands = a2dp_subevent_signaling_media_codec_sbc_configuration_get_subbands(packet);
+            configuration.min_bitpool_value = a2dp_subevent_signaling_media_codec_sbc_configuration_get_min_bitpool_value(packet);
+            configuration.max_bitpool_value = a2dp_subevent_signaling_media_codec_sbc_configuration_get_max_bitpool_value(packet);
 
             channel_mode = (avdtp_channel_mode_t)a2dp_subevent_signaling_media_codec_sbc_configuration_get_channel_mode(packet);
             allocation_method = a2dp_subevent_signaling_media_codec_sbc_configuration_get_allocation_method(packet);
 
             Serial.printf("A2DP Source: Received SBC codec configuration, sampling frequency %u, a2dp_cid 0x%02x, local seid 0x%02x, remote seid 0x%02x.\n\r",
-                          sbc_configuration.sampling_frequency, cid,
+                          configuration.sampling_frequency, cid,
                           a2dp_subevent_signaling_media_codec_sbc_configuration_get_local_seid(packet),
                           a2dp_subevent_signaling_media_codec_sbc_configuration_get_remote_seid(packet));
 
             // Adapt Bluetooth spec definition to SBC Encoder expected input
-            sbc_configuration.allocation_method = (btstack_sbc_allocation_method_t)(allocation_method - 1);
+            configuration.allocation_method = (btstack_sbc_allocation_method_t)(allocation_method - 1);
             switch (channel_mode)
             {
             case AVDTP_CHANNEL_MODE_JOINT_STEREO:
-                sbc_configuration.channel_mode = SBC_CHANNEL_MODE_JOINT_STEREO;
+                configuration.channel_mode = SBC_CHANNEL_MODE_JOINT_STEREO;
                 break;
             case AVDTP_CHANNEL_MODE_STEREO:
-                sbc_configuration.channel_mode = SBC_CHANNEL_MODE_STEREO;
+                configuration.channel_mode = SBC_CHANNEL_MODE_STEREO;
                 break;
             case AVDTP_CHANNEL_MODE_DUAL_CHANNEL:
-                sbc_configuration.channel_mode = SBC_CHANNEL_MODE_DUAL_CHANNEL;
+                configuration.channel_mode = SBC_CHANNEL_MODE_DUAL_CHANNEL;
                 break;
             case AVDTP_CHANNEL_MODE_MONO:
-                sbc_configuration.channel_mode = SBC_CHANNEL_MODE_MONO;
+                configuration.channel_mode = SBC_CHANNEL_MODE_MONO;
                 break;
             default:
                 btstack_assert(false);
                 break;
             }
-            dump_sbc_configuration(&sbc_configuration);
-
-            btstack_sbc_encoder_init(&sbc_encoder_state,
-                                     SBC_MODE_STANDARD,
-                                     sbc_configuration.block_length, sbc_configuration.subbands,
-                                     sbc_configuration.allocation_method, sbc_configuration.sampling_frequency,
-                                     sbc_configuration.max_bitpool_value,
-                                     sbc_configuration.channel_mode);
+            dump_sbc_configuration(&configuration);
+
+            sink_configurations[tracker - media_trackers] = configuration;
+            // ほかのスピーカーの設定でエンコードしているときは、エンコーダを作り直さずに同じフレームを送る。
+            // 周波数・チャンネルモード・ブロック長・サブバンド数・割り当て方式のどれかが違うか、ビットプールの範囲が
+            // 重ならなければ、同じフレームは送れないので切断する。
+            a2dp_media_sending_context_t *other = a2dp_source_demo_other_tracker(tracker);
+            bool shared = other != NULL && other->remote_seid != 0;
+            if (shared && other == sbc_configuration_tracker)
+            {
+                if (!a2dp_source_demo_share_encoder(&configuration))
+                {
+                    Serial.printf("A2DP Source: SBC configuration of a2dp_cid 0x%02x differs from the other speaker, disconnecting\n\r", cid);
+                    a2dp_source_disconnect(cid);
+                }
+                break;
+            }
+            // エンコーダの設定を決めたスピーカー(の再設定)ではエンコーダを初期化し直し、ほかのスピーカーをもう一度合わせる。
+            sbc_configuration = configuration;
+            sbc_configuration_tracker = tracker;
+            audio_pipeline_init_encoder(&sbc_configuration);
+            if (shared && !a2dp_source_demo_share_encoder(&sink_configurations[other - media_trackers]))
+            {
+                Serial.printf("A2DP Source: SBC configuration of a2dp_cid 0x%02x differs from the other speaker, disconnecting\n\r", other->a2dp_cid);
+                a2dp_source_disconnect(other->a2dp_cid);
+            }
             break;
         }
 
@@ -762,8 +999,11 @@ static void a2dp_source_packet_handler(uint8_t packet_type, uint16_t channel, ui
 
         Serial.printf("A2DP Source: Stream established a2dp_cid 0x%02x, local_seid 0x%02x, remote_seid 0x%02x\n\r", cid, local_seid, a2dp_subevent_stream_established_get_remote_seid(packet));
 
-        media_tracker.stream_opened = 1;
-        status = a2dp_source_start_stream(media_tracker.a2dp_cid, media_tracker.local_seid);
+        tracker = a2dp_source_demo_tracker(cid);
+        if (tracker == NULL)
+            break;
+        tracker->stream_opened = 1;
+        status = a2dp_source_start_stream(cid, local_seid);
         break;
 
     case A2DP_SUBEVENT_STREAM_RECONFIGURED:
@@ -778,7 +1018,7 @@ static void a2dp_source_packet_handler(uint8_t packet_type, uint16_t channel, ui
         }
 
         Serial.printf("A2DP Source: Stream reconfigured a2dp_cid 0x%02x, local_seid 0x%02x\n\r", cid, local_seid);
-        status = a2dp_source_start_stream(media_tracker.a2dp_cid, media_tracker.local_seid);
+        status = a2dp_source_start_stream(cid, local_seid);
         break;
 
     case A2DP_SUBEVENT_STREAM_STARTED:
@@ -786,21 +1026,31 @@ static void a2dp_source_packet_handler(uint8_t packet_type, uint16_t channel, ui
         // 音楽の再生が開始されたことを示します。このイベントが発生すると、音楽を送信する準備が整ったことが示されます。
         local_seid = a2dp_subevent_stream_started_get_local_seid(packet);
         cid = a2dp_subevent_stream_started_get_a2dp_cid(packet);
+        tracker = a2dp_source_demo_tracker(cid);
+        if (tracker == NULL)
+            break;
 
         play_info.status = AVRCP_PLAYBACK_STATUS_PLAYING;
-        if (media_tracker.avrcp_cid)
+        if (tracker->avrcp_cid)
         {
-            avrcp_target_set_now_playing_info(media_tracker.avrcp_cid, &track, sizeof(track) / sizeof(avrcp_track_t));
-            avrcp_target_set_playback_status(media_tracker.avrcp_cid, AVRCP_PLAYBACK_STATUS_PLAYING);
+            avrcp_target_set_now_playing_info(tracker->avrcp_cid, &track, avrcp_total_tracks());
+            avrcp_target_set_playback_status(tracker->avrcp_cid, AVRCP_PLAYBACK_STATUS_PLAYING);
         }
-        a2dp_demo_timer_start(&media_tracker);
+        a2dp_demo_timer_start(tracker);
         Serial.printf("A2DP Source: Stream started, a2dp_cid 0x%02x, local_seid 0x%02x\n\r", cid, local_seid);
+        a2dp_source_demo_connect_next_sink();
         break;
 
     case A2DP_SUBEVENT_STREAMING_CAN_SEND_MEDIA_PACKET_NOW:
         local_seid = a2dp_subevent_streaming_can_send_media_packet_now_get_local_seid(packet);
-        cid = a2dp_subevent_signaling_media_codec_sbc_configuration_get_a2dp_cid(packet);
-        a2dp_demo_send_media_packet();
+        cid = a2dp_subevent_streaming_can_send_media_packet_now_get_a2dp_cid(packet);
+        tracker = a2dp_source_demo_tracker(cid);
+        if (tracker == NULL)
+            break;
+        a2dp_demo_send_media_packet(tracker);
+        // 起動(切断)から最初のパケットまでの時間を表示する
+        if (tracker->media_packets > 0)
+            connect_planner_first_packet(&connect_planner, millis());
         break;
 
     case A2DP_SUBEVENT_STREAM_SUSPENDED:
@@ -808,15 +1058,18 @@ static void a2dp_source_packet_handler(uint8_t packet_type, uint16_t channel, ui
         // 音楽の再生が一時停止されたことを示します。
         local_seid = a2dp_subevent_stream_suspended_get_local_seid(packet);
         cid = a2dp_subevent_stream_suspended_get_a2dp_cid(packet);
+        tracker = a2dp_source_demo_tracker(cid);
+        if (tracker == NULL)
+            break;
 
         play_info.status = AVRCP_PLAYBACK_STATUS_PAUSED;
-        if (media_tracker.avrcp_cid)
+        if (tracker->avrcp_cid)
         {
-            avrcp_target_set_playback_status(media_tracker.avrcp_cid, AVRCP_PLAYBACK_STATUS_PAUSED);
+            avrcp_target_set_playback_status(tracker->avrcp_cid, AVRCP_PLAYBACK_STATUS_PAUSED);
         }
         Serial.printf("A2DP Source: Stream paused, a2dp_cid 0x%02x, local_seid 0x%02x\n\r", cid, local_seid);
 
-        a2dp_demo_timer_stop(&media_tracker);
+        a2dp_demo_timer_stop(tracker);
         break;
 
     case A2DP_SUBEVENT_STREAM_RELEASED:
@@ -828,26 +1081,48 @@ static void a2dp_source_packet_handler(uint8_t packet_type, uint16_t channel, ui
 
         Serial.printf("A2DP Source: Stream released, a2dp_cid 0x%02x, local_seid 0x%02x\n\r", cid, local_seid);
 
-        if (cid == media_tracker.a2dp_cid)
+        tracker = a2dp_source_demo_tracker(cid);
+        if (tracker == NULL)
+            break;
+        tracker->stream_opened = 0;
+        Serial.printf("A2DP Source: Stream released.\n\r");
+        if (tracker->avrcp_cid)
         {
-            media_tracker.stream_opened = 0;
-            Serial.printf("A2DP Source: Stream released.\n\r");
+            avrcp_target_set_now_playing_info(tracker->avrcp_cid, NULL, avrcp_total_tracks());
+            avrcp_target_set_playback_status(tracker->avrcp_cid, AVRCP_PLAYBACK_STATUS_STOPPED);
         }
-        if (media_tracker.avrcp_cid)
+        a2dp_demo_timer_stop(tracker);
+        break;
+    case A2DP_SUBEVENT_SIGNALING_DELAY_REPORT:
+        // スピーカーが受け取ってから鳴らすまでの遅延(100us単位)。再生中にも変わることがある。
+        cid = a2dp_subevent_signaling_delay_report_get_a2dp_cid(packet);
+        tracker = a2dp_source_demo_tracker(cid);
+        if (tracker == NULL)
+            break;
         {
-            avrcp_target_set_now_playing_info(media_tracker.avrcp_cid, NULL, sizeof(track) / sizeof(avrcp_track_t));
-            avrcp_target_set_playback_status(media_tracker.avrcp_cid, AVRCP_PLAYBACK_STATUS_STOPPED);
+            uint16_t delay_100us = a2dp_subevent_signaling_delay_report_get_delay_100us(packet);
+            audio_pipeline_set_sink_delay(tracker, delay_100us);
+            Serial.printf("A2DP Source: Delay report %u.%u ms, a2dp_cid 0x%02x\n\r", delay_100us / 10, delay_100us % 10, cid);
         }
-        a2dp_demo_timer_stop(&media_tracker);
         break;
     case A2DP_SUBEVENT_SIGNALING_CONNECTION_RELEASED:
         cid = a2dp_subevent_signaling_connection_released_get_a2dp_cid(packet);
-        if (cid == media_tracker.a2dp_cid)
-        {
-            media_tracker.avrcp_cid = 0;
-            media_tracker.a2dp_cid = 0;
-            Serial.printf("A2DP Source: Signaling released.\n\r\n\r");
-        }
+        tracker = a2dp_source_demo_tracker(cid);
+        if (tracker == NULL)
+            break;
+        a2dp_demo_timer_stop(tracker);
+        tracker->avrcp_cid = 0;
+        tracker->absolute_volume = 0;
+        tracker->a2dp_cid = 0;
+        tracker->remote_seid = 0;
+        a2dp_source_demo_release_encoder(tracker);
+        a2dp_source_demo_apply_volume();
+        Serial.printf("A2DP Source: Signaling released.\n\r\n\r");
+        // ほかのスピーカーにはそのまま送り続ける。全部切断されたら、最後に接続していたスピーカーから直接接続し直す。
+        if (a2dp_source_demo_other_tracker(tracker) != NULL)
+            break;
+        next_sink_tried = false;
+        a2dp_source_demo_connect(connect_planner_disconnected(&connect_planner, millis(), address), address);
         break;
     default:
         break;
@@ -904,16 +1179,24 @@ static int a2dp_source_and_avrcp_services_init(void)
     // ストリームエンドポイントの作成
     // a2dp_source_create_stream_endpoint(...);
     // ストリームエンドポイントを作成します。これは、音楽の送受信に使用されるチャネルのようなものです。
-    avdtp_stream_endpoint_t *local_stream_endpoint = a2dp_source_create_stream_endpoint(AVDTP_AUDIO, AVDTP_CODEC_SBC, media_sbc_codec_capabilities, sizeof(media_sbc_codec_capabilities), media_sbc_codec_configuration, sizeof(media_sbc_codec_configuration));
-    if (!local_stream_endpoint)
+    // スピーカーごとに1つ作ります。どのエンドポイントを使ったかは SBC_CONFIGURATION の local seid で分かります。
+    for (int i = 0; i < MAX_SINKS; i++)
     {
-        Serial.printf("A2DP Source: not enough memory to create local stream endpoint\n\r");
-        return 1;
-    }
+        avdtp_stream_endpoint_t *local_stream_endpoint = a2dp_source_create_stream_endpoint(AVDTP_AUDIO, AVDTP_CODEC_SBC, media_sbc_codec_capabilities, sizeof(media_sbc_codec_capabilities), media_sbc_codec_configuration[i], sizeof(media_sbc_codec_configuration[i]));
+        if (!local_stream_endpoint)
+        {
+            Serial.printf("A2DP Source: not enough memory to create local stream endpoint\n\r");
+            return 1;
+        }
 
-    // Store stream enpoint's SEP ID, as it is used by A2DP API to indentify the stream endpoint
-    media_tracker.local_seid = avdtp_local_seid(local_stream_endpoint);
-    avdtp_source_register_delay_reporting_category(media_tracker.local_seid);
+        // Store stream enpoint's SEP ID, as it is used by A2DP API to indentify the stream endpoint
+        uint8_t local_seid = avdtp_local_seid(local_stream_endpoint);
+        // スピーカーが両方に対応していれば、ファイルと同じ周波数を選んでレート変換や再エンコードを避ける。
+        avdtp_set_preferred_sampling_frequency(local_stream_endpoint, sbc_source_is_open() ? sbc_source_header()->sampling_frequency : wav_source_format()->sample_rate);
+        // モノラルのWAVなら MONO にして、分析とビットを1チャンネル分にする。
+        avdtp_set_preferred_channel_mode(local_stream_endpoint, audio_pipeline_preferred_channel_mode());
+        avdtp_source_register_delay_reporting_category(local_seid);
+    }
 
     // Initialize AVRCP Service
     // AVRCPサービス初期化
@@ -1001,57 +1284,24 @@ static int btstack_main(void)
 
 static int sd_setup()
 {
-    Dir dir = SDFS.openDir("/");
-    while (dir.next()) {
-    Serial.print(dir.fileName());
-    if(dir.fileSize()) {
-        File f = dir.openFile("r");
-        Serial.println(f.size());
-    }
-}
-    
-    // audioファイルをオープンする。
-    sd_file = SDFS.open(WAV_FILE_NAME, "r");
-    if (!sd_file)
-    {
-        Serial.println("file open failed");
+    // ディレクトリの WAV ファイルを名前順に並べ、最初の曲を開く。次の曲は再生中に先読みする。
+    playlist_build(SDFS, PLAYLIST_DIR);
+    playlist_set_repeat(PLAYLIST_REPEAT);
+    playlist_dump();
+    int sbc_result = sbc_source_open(SDFS, SBC_FILE_NAME, false);
+    if (playlist_start(0) == -1 && sbc_result == -1)
         return -1;
-    }
-    sd_data_length = sd_file.size();
-    // 先頭44バイトはヘッダなので読み飛ばす。
-    sd_file.seek(WAV_START_POINT, SeekSet);
-    // wave_bufferの初期化
-    for (int i = 0; i < WAV_DATA_BUFFER_SIZE; i++)
-    {
-        wav_data_buffer[i] = 0;
-    }
+    avrcp_set_track(0);
     return 0;
 }
 
 
-static int fs_setup()
-{
-    // audioファイルをオープンする。
-    wav_file = LittleFS.open(WAV_FILE_NAME, "r");
-    if (!wav_file)
-    {
-        Serial.println("file open failed");
-        return -1;
-    }
-    wav_length = wav_file.size();
-    // 先頭44バイトはヘッダなので読み飛ばす。
-    wav_file.seek(WAV_START_POINT, SeekSet);
-    // wave_bufferの初期化
-    for (int i = 0; i < WAV_DATA_BUFFER_SIZE; i++)
-    {
-        wav_data_buffer[i] = 0;
-    }
-    return 0;
-}
-
 void setup()
 {
+    // BTstack のコンテキストのスタックの最大使用量を s で表示するため、使う前に塗っておく。
+    stack_watermark_paint();
     Serial.begin(115200);
+    audio_pipeline_set_mode(AUDIO_PIPELINE_MODE);
     delay(1500);
     Serial.println("start");
     Serial.printf("MISO: %d\r\n", MISO);
@@ -1063,10 +1313,13 @@ void setup()
     // }
     SDFSConfig c2;
     c2.setCSPin(SS);
+    c2.setSPISpeed(SD_SPI_CLOCK_HZ);
     SDFS.setConfig(c2);
     if(!SDFS.begin()){
         Serial.println("SDFSの初期化に失敗しました。");
     };
+    if (sd_block_device_begin(SS, SD_SPI_CLOCK_HZ) == NULL)
+        Serial.println("SDカードのOCRを読めませんでした。");
     if (sd_setup() == -1) {
         Serial.println("sd_setup failed");
         return;
@@ -1083,4 +1336,90 @@ void setup()
 
 void loop()
 {
-}
\ No newline at end of file
+    // シングルコアモードでは、ここでWAVデータの先読みリングを補充する。
+    audio_pipeline_loop();
+    // 曲が変わったら、再生中の曲の情報を更新して AVRCP の TRACK_CHANGED を通知する。
+    int index;
+    if (playlist_poll(&index))
+    {
+        avrcp_set_track(index);
+        Serial.printf("track %d: %s\n\r", index + 1, track.title);
+        for (const a2dp_media_sending_context_t &tracker : media_trackers)
+        {
+            if (tracker.avrcp_cid && play_info.status == AVRCP_PLAYBACK_STATUS_PLAYING)
+                avrcp_target_set_now_playing_info(tracker.avrcp_cid, &track, avrcp_total_tracks());
+        }
+    }
+    // シリアルのコマンド
+    //   's': プレイリストと曲間、先読み・ビットプール制御、スピーカーごとのタイマーのジッタ・溜まったサンプル・delay report とレイテンシ、2台に送るリング、接続までの時間の統計を表示する
+    //   'p': 段ごとの処理時間の記録(stage_profile)をバイナリで書き出す
+    //   '+' / '-': 共有の音量を VOLUME_STEP だけ上げる / 下げる(絶対音量を扱うスピーカーには AVRCP で送り、扱わないスピーカーがいれば PCM に掛ける)
+    //   'b': SBC分析フィルタバンクのベンチマークと、bluedroid の分析との差・スケールの確認(ストリーミングしていないときに使う)
+    //   'r': SDカードの読み込みのベンチマーク(CMD18 と DMA。転送速度と1回の読み込み時間のパーセンタイル。ストリーミングしていないときに使う)
+    //   'm': 今の曲が MP3 ならデコードのベンチマーク(1フレームのサイクル数、実時間に対する割合。ストリーミングしていないときに使う)
+    if (Serial.available())
+    {
+        int c = Serial.read();
+        switch (c)
+        {
+        case 's':
+            connect_planner_dump_stats(&connect_planner);
+            inquiry_ranker_dump_stats(&inquiry_ranker);
+            playlist_dump();
+            wav_source_dump_stats();
+            audio_pipeline_dump_bitpool_stats();
+            for (const a2dp_media_sending_context_t &tracker : media_trackers)
+            {
+                if (tracker.a2dp_cid == 0)
+                    continue;
+                Serial.printf("speaker %s, a2dp_cid 0x%02x:\n\r", bd_addr_to_str(tracker.remote_address), tracker.a2dp_cid);
+                audio_pipeline_dump_clock_stats(&tracker);
+                audio_pipeline_dump_backlog_stats(&tracker);
+                audio_pipeline_dump_payload_stats(&tracker);
+                audio_pipeline_dump_seek_stats(&tracker);
+                audio_pipeline_dump_latency_stats(&tracker);
+            }
+            audio_pipeline_dump_fanout_stats();
+            audio_pipeline_dump_memory();
+            break;
+        case 'p':
+            stage_profile_dump();
+            break;
+        case '+':
+        case '-':
+        {
+            // 音量はどのスピーカーにも同じフレームを送るので1つ。
+            int volume = audio_pipeline_get_volume() + (c == '+' ? VOLUME_STEP : -VOLUME_STEP);
+            audio_pipeline_set_volume(volume < 0 ? 0 : volume > 127 ? 127 : volume);
+            a2dp_source_demo_apply_volume();
+            Serial.printf("volume %d / 127 (%s)\n\r", audio_pipeline_get_volume(),
+                          a2dp_source_demo_needs_volume_gain() ? "PCM gain" : "absolute volume");
+            break;
+        }
+        case 'r':
+            sd_block_device_benchmark(SD_BENCHMARK_FIRST_SECTOR, SD_BENCHMARK_SIZE);
+            break;
+        case 'm':
+            if (playlist_current() >= 0 && playlist_current() < playlist_size())
+            {
+                char path[WAV_SOURCE_PATH_LENGTH];
+                snprintf(path, sizeof(path), "%s/%s", strcmp(PLAYLIST_DIR, "/") == 0 ? "" : PLAYLIST_DIR,
+                         playlist_track(playlist_current())->name);
+                mp3_decoder_benchmark(SDFS, path, MP3_BENCHMARK_FRAMES);
+            }
+            break;
+        case 'b':
+            sbc_analysis_benchmark();
+            sbc_analysis_bluedroid_check();
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+// コア1。デュアルコアモードでは読み込み・変換・SBCエンコードをここで行う。
+void loop1()
+{
+    audio_pipeline_loop1();
+}